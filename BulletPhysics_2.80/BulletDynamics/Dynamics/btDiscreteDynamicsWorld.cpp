@@ -991,6 +991,8 @@ void	btDiscreteDynamicsWorld::startProfiling(btScalar timeStep)
 	(void)timeStep;
 
 #ifndef BT_NO_PROFILE
+	//Only the thread stepping the world records samples
+	CProfileManager::Claim_Profiled_Thread();
 	CProfileManager::Reset();
 #endif //BT_NO_PROFILE
 
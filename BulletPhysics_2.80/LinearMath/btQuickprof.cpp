@@ -52,6 +52,26 @@ static btClock gProfileClock;
 #include <sys/time.h>
 #endif //_WIN32
 
+#if !defined(_WIN32) && !defined(__CELLOS_LV2__)
+//The profile tree is not thread safe; only the thread stepping the world
+//(the latest one to call Claim_Profiled_Thread, which the world does at the
+//start of each step) records samples. Samples taken on any other thread,
+//such as a parallel solver's worker threads, and all samples taken before
+//a thread is claimed are ignored. The claim is written by the stepping
+//thread before it hands any work of the step to other threads, and read
+//by them only within that work
+#define BT_PROFILE_STEPPING_THREAD_ONLY
+#include <pthread.h>
+
+static pthread_t gProfileThread;
+static bool gProfileThreadSet = false;
+
+static inline bool btIsProfiledThread()
+{
+	return gProfileThreadSet && pthread_equal(pthread_self(), gProfileThread);
+}
+#endif //!_WIN32 && !__CELLOS_LV2__
+
 #define mymin(a,b) (a > b ? a : b)
 
 struct btClockData
@@ -443,6 +463,10 @@ unsigned long int			CProfileManager::ResetTime = 0;
  *=============================================================================================*/
 void	CProfileManager::Start_Profile( const char * name )
 {
+#ifdef BT_PROFILE_STEPPING_THREAD_ONLY
+	if (!btIsProfiledThread())
+		return;
+#endif //BT_PROFILE_STEPPING_THREAD_ONLY
 	if (name != CurrentNode->Get_Name()) {
 		CurrentNode = CurrentNode->Get_Sub_Node( name );
 	} 
@@ -456,6 +480,10 @@ void	CProfileManager::Start_Profile( const char * name )
  *=============================================================================================*/
 void	CProfileManager::Stop_Profile( void )
 {
+#ifdef BT_PROFILE_STEPPING_THREAD_ONLY
+	if (!btIsProfiledThread())
+		return;
+#endif //BT_PROFILE_STEPPING_THREAD_ONLY
 	// Return will indicate whether we should back up to our parent (we may
 	// be profiling a recursive function)
 	if (CurrentNode->Return()) {
@@ -488,6 +516,29 @@ void CProfileManager::Increment_Frame_Counter( void )
 }
 
 
+/***********************************************************************************************
+ * CProfileManager::Claim_Profiled_Thread -- Record the samples of the calling thread only     *
+ *=============================================================================================*/
+void CProfileManager::Claim_Profiled_Thread( void )
+{
+#ifdef BT_PROFILE_STEPPING_THREAD_ONLY
+	gProfileThread = pthread_self();
+	gProfileThreadSet = true;
+#endif //BT_PROFILE_STEPPING_THREAD_ONLY
+}
+
+
+/***********************************************************************************************
+ * CProfileManager::Release_Profiled_Thread -- Record no samples until a thread is claimed     *
+ *=============================================================================================*/
+void CProfileManager::Release_Profiled_Thread( void )
+{
+#ifdef BT_PROFILE_STEPPING_THREAD_ONLY
+	gProfileThreadSet = false;
+#endif //BT_PROFILE_STEPPING_THREAD_ONLY
+}
+
+
 /***********************************************************************************************
  * CProfileManager::Get_Time_Since_Reset -- returns the elapsed time since last reset         *
  *=============================================================================================*/
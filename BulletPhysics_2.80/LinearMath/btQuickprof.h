@@ -150,6 +150,8 @@ public:
 
 	static	void						Reset( void );
 	static	void						Increment_Frame_Counter( void );
+	static	void						Claim_Profiled_Thread( void );
+	static	void						Release_Profiled_Thread( void );
 	static	int						Get_Frame_Count_Since_Reset( void )		{ return FrameCounter; }
 	static	float						Get_Time_Since_Reset( void );
 
@@ -30,6 +30,13 @@ include(../jsoncpp/jsoncpp.pri)
 
 #QMAKE_CXXFLAGS += -Werror -Wall
 
+# Compile in the NEON code paths for the ARMv7 devices; they are only taken
+# when the CPU reports a NEON unit at runtime. Without auto-vectorization
+# (not enabled at -O2) the compiler only emits NEON for the intrinsics
+android|blackberry-armv7le-*|contains(MEEGO_EDITION,harmattan) {
+     QMAKE_CXXFLAGS += -mfpu=neon
+}
+
 blackberry-* {
      DEFINES += __BLACKBERRY__
      DEFINES += __BUILD_DEVICE__
@@ -84,11 +91,28 @@ SOURCES += src/main.cpp src/mainwindow.cpp \
     ../src/PhysicsStageStatics.cpp \
     ../src/PhysicsStage.cpp \
     ../src/Pillar.cpp \
+    ../src/GLExtensions.cpp \
+    ../src/InstanceBuffer.cpp \
+    ../src/MatrixKernels.cpp \
+    ../src/ChunkedTerrain.cpp \
+    ../src/GLStateCache.cpp \
+    ../src/DrawQueue.cpp \
+    ../src/PhysicsStateBuffer.cpp \
+    ../src/ParallelCollisionDispatcher.cpp \
+    ../src/PooledCollisionDispatcher.cpp \
+    ../src/PhysicsSnapshot.cpp \
+    ../src/TunedDbvtBroadphase.cpp \
+    ../src/ContinuousDynamicsWorld.cpp \
+    ../src/ParallelDynamicsWorld.cpp \
+    ../src/SimdConstraintSolver.cpp \
+    ../src/PhysicsAllocator.cpp \
     ../../../CommonGL/src/ObjectMotionState.cpp \
     ../../../CommonGL/src/TimeSample.cpp \
-    ../src/ObjectInstance.cpp \
+    ../src/SceneInstanceStore.cpp \
     ../../../CommonGL/src/Rect.cpp \
     ../src/Vehicle.cpp \
+    ../src/RaycastVehicle.cpp \
+    ../src/SceneQueryBatch.cpp \
     ../../../CommonGL/src/RotationAnimation.cpp \
     ../../../CommonGL/src/SimpleTimer.cpp \
     ../../../CommonGL/src/BSplineAnimation.cpp \
@@ -129,10 +153,27 @@ HEADERS += include/mainwindow.h \
     ../include/PhysicsStageStatics.h \
     ../include/PhysicsStage.h \
     ../include/Pillar.h \
+    ../include/GLExtensions.h \
+    ../include/InstanceBuffer.h \
+    ../include/MatrixKernels.h \
+    ../include/ChunkedTerrain.h \
+    ../include/GLStateCache.h \
+    ../include/DrawQueue.h \
+    ../include/PhysicsStateBuffer.h \
+    ../include/ParallelCollisionDispatcher.h \
+    ../include/PooledCollisionDispatcher.h \
+    ../include/PhysicsSnapshot.h \
+    ../include/TunedDbvtBroadphase.h \
+    ../include/ContinuousDynamicsWorld.h \
+    ../include/ParallelDynamicsWorld.h \
+    ../include/SimdConstraintSolver.h \
+    ../include/PhysicsAllocator.h \
     ../../../CommonGL/include/ObjectMotionState.h \
     ../../../CommonGL/include/TimeSample.h \
-    ../include/ObjectInstance.h \
+    ../include/SceneInstanceStore.h \
     ../include/Vehicle.h \
+    ../include/RaycastVehicle.h \
+    ../include/SceneQueryBatch.h \
     ../../../CommonGL/include/RotationAnimation.h \
     ../../../CommonGL/include/SimpleTimer.h \
     ../../../CommonGL/include/BSplineAnimation.h \
@@ -215,6 +256,14 @@ OTHER_FILES += \
     ../shaders/XBlur.fsh \
     ../shaders/MappedLight.vsh \
     ../shaders/MappedLight.fsh \
+    ../shaders/PhysicsStageDefaultInstanced.vsh \
+    ../shaders/PhysicsStageDefaultInstanced.fsh \
+    ../shaders/ShadowMapInstanced.vsh \
+    ../shaders/ShadowMapInstanced.fsh \
+    ../shaders/ChesspieceInstanced.vsh \
+    ../shaders/ChesspieceInstanced.fsh \
+    ../shaders/ChesspieceReflectionInstanced.vsh \
+    ../shaders/ChesspieceReflectionInstanced.fsh \
     android/src/org/kde/necessitas/origo/QtActivity.java \
     android/src/org/kde/necessitas/origo/QtApplication.java \
     android/src/org/kde/necessitas/ministro/IMinistro.aidl \
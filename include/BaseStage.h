@@ -2,6 +2,8 @@
 #define BASESTAGE_H
 
 #include <string>
+#include <vector>
+#include <utility>
 
 #include "OpenGLAPI.h"
 #include "TimeSample.h"
@@ -16,9 +18,44 @@ class ScalarAnimation;
 static const float DefaultStageNearClip = 0.5;
 static const float DefaultStageFarClip = 250.0;
 
+/** Physics throughput at one level of a physics stress test. */
+struct PhysicsStressPoint
+{
+    PhysicsStressPoint() : m_numBodies(0), m_stepsPerSecond(0.0),
+        m_contactsPerSecond(0.0) {}
+
+    // Number of dynamic bodies in the world
+    int m_numBodies;
+
+    // Simulation steps and contact points per second of step time
+    float m_stepsPerSecond;
+    float m_contactsPerSecond;
+};
+
 /** Stage performance data. */
 struct StageData
 {
+    StageData()
+        : m_fps(0.0),
+          m_score(0),
+          m_cpuScore(0),
+          m_fillRateScore(0),
+          m_numImages(0),
+          m_loadTime(0.0),
+          m_unlightedFillRate(0.0),
+          m_vertexLightedFillRate(0.0),
+          m_pixelLightedFillRate(0.0),
+          m_mappedLightedFillRate(0.0),
+          m_physicsTime(0.0),
+          m_renderTime(0.0),
+          m_broadphasePairs(0.0),
+          m_broadphaseStepTime(0.0),
+          m_queryRaysPerSecond(0.0),
+          m_querySweepsPerSecond(0.0),
+          m_queryTime(0.0)
+    {
+    }
+
     float m_fps;
     int m_score;
     int m_cpuScore;
@@ -35,6 +72,31 @@ struct StageData
     float m_mappedLightedFillRate;
 
     std::string m_missingFeatures;
+
+    // Time per frame spent in the physics simulation and in the rest of
+    // the frame, in milliseconds; only set by stages that simulate physics
+    float m_physicsTime;
+    float m_renderTime;
+
+    // The physics time per frame broken down by simulation phase, as
+    // (phase name, milliseconds) pairs
+    std::vector<std::pair<std::string, float> > m_physicsPhaseTimes;
+
+    // Name of the physics broadphase, and its overlapping pairs and time
+    // per simulation step, in milliseconds
+    std::string m_broadphase;
+    float m_broadphasePairs;
+    float m_broadphaseStepTime;
+
+    // Scene queries cast per second of query time, and the query time per
+    // frame in milliseconds; only set by stages that run scene queries
+    float m_queryRaysPerSecond;
+    float m_querySweepsPerSecond;
+    float m_queryTime;
+
+    // Physics throughput at each level of a stress test, smallest first;
+    // only set by stages run as a physics stress test
+    std::vector<PhysicsStressPoint> m_physicsStress;
 };
 
 // Default values for infopopup timings (in seconds)
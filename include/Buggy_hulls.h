@@ -0,0 +1,131 @@
+//
+// Exported by hull2c from the Buggy_*_data.h files; do not edit
+//
+
+#ifndef __BUGGY_HULLS_H__
+#define __BUGGY_HULLS_H__
+
+// Collision margin the hulls are shrunk by
+static const float Buggy_hullMargin = 0.04;
+
+// Convex hull vertices { x, y, z } of each mesh
+static const int Buggy_bodyHullNumVertices = 37;
+static const float Buggy_bodyHullVertices[] = {
+    -1.27872658, -0.53838861, -1.63627803,
+    -0.295824468, -0.710062742, -1.36102331,
+    -1.16878986, -0.412073731, 2.18555641,
+    1.27640533, -0.464072615, 1.96026194,
+    0.87377727, 0.491284877, 1.94925952,
+    0.537671387, -0.287613481, 2.63269448,
+    -0.589114249, -0.462579787, -2.5014832,
+    0.54259932, -0.462696135, -2.50177646,
+    1.09302044, -0.709623933, 1.94040561,
+    0.243902683, 0.594636679, 2.50059986,
+    -0.601393044, -0.2923446, 2.62762284,
+    -0.0264453068, 0.710062623, 0.863005102,
+    -0.924012542, 0.491704941, 1.88433123,
+    -0.303452253, 0.64843303, 2.43794179,
+    1.12495971, -0.44807303, -1.91207731,
+    -0.479264766, 0.10891068, -2.61001301,
+    0.437057912, 0.108901948, -2.61030149,
+    -1.16215253, 0.0253979992, 1.89293587,
+    -1.16581738, -0.195403621, -1.92899966,
+    1.09494376, -0.561107576, 2.17962646,
+    0.580579758, 0.0387684591, -2.56947064,
+    1.12495971, -0.17318669, -1.92067289,
+    -0.606156886, 0.0447512642, -2.58867192,
+    -1.16581738, -0.476005673, -1.89174402,
+    -0.36914432, 0.54524678, 2.5035069,
+    0.246407554, 0.64843303, 2.43794179,
+    0.511161447, 0.0292540677, -2.63509798,
+    0.601328313, -0.406074911, -2.52099276,
+    -0.482211918, -0.0977354199, -2.63509798,
+    -0.924530149, 0.4906919, 1.95149446,
+    -0.552644253, 0.0292540677, -2.63509798,
+    -0.61797756, -0.345187813, 2.56534815,
+    -0.476073414, 0.0735798702, -2.63509798,
+    1.28163505, -0.451041073, 1.79149067,
+    -0.585033417, -0.436029255, -2.52104092,
+    0.874368906, 0.491850376, 1.87589884,
+    -1.16552389, -0.406324774, 2.19643545,
+};
+
+static const int Buggy_front_wheelHullNumVertices = 32;
+static const float Buggy_front_wheelHullVertices[] = {
+    0.119381443, -0.127251402, -0.475098491,
+    0.119401611, -0.402786553, -0.282206714,
+    -0.122805811, -0.282718569, -0.402644604,
+    -0.00619066274, 0.0443877466, -0.50912565,
+    0.119377807, -0.042737525, 0.48995316,
+    0.119401611, 0.282206953, 0.402786165,
+    -0.00619066274, -0.0443877466, 0.50912565,
+    0.119406201, -0.489885092, 0.0429769605,
+    -0.00620485377, -0.509128213, 0.0443879217,
+    -0.122784421, 0.0424203537, -0.490239173,
+    -0.122774489, -0.403411865, -0.281777948,
+    -0.12280333, -0.490097433, 0.0434897318,
+    -0.122778036, 0.127843454, 0.475192815,
+    -0.122799002, 0.403257757, 0.281926721,
+    -0.122784421, -0.0424203537, 0.490239173,
+    0.119385883, 0.402885735, 0.28211081,
+    0.119406201, 0.489885092, -0.0429769605,
+    0.119390473, 0.347766131, -0.347765833,
+    0.119387776, 0.207960725, -0.445682436,
+    -0.122785501, 0.347631693, -0.348274112,
+    -0.122795433, 0.445693374, -0.208381072,
+    0.119387776, 0.445682824, -0.207960516,
+    0.119387776, -0.207960725, 0.445682436,
+    -0.122785501, -0.347631693, 0.348274112,
+    0.119390458, -0.347766131, 0.347765833,
+    0.119387776, -0.445682824, 0.207960516,
+    -0.122760162, -0.207703948, 0.446049929,
+    -0.122760162, 0.207703948, -0.446049929,
+    -0.122795433, -0.445693374, 0.208381072,
+    -0.12280333, 0.490097433, -0.0434897318,
+    0.119377807, 0.042737525, -0.48995316,
+    -0.00620485377, 0.509128213, -0.0443879217,
+};
+
+static const int Buggy_rear_wheelHullNumVertices = 38;
+static const float Buggy_rear_wheelHullVertices[] = {
+    -0.29057166, 0.139567107, 0.519147396,
+    -0.29063639, 0.440634489, 0.307858855,
+    -0.367445886, 0.405489504, -0.0360336676,
+    -0.0132767446, -0.0491295531, 0.559442163,
+    0.283654541, 0.308182806, 0.440146327,
+    0.283588678, -0.535306633, 0.047025051,
+    -0.0132799512, -0.559442461, 0.0491295792,
+    0.283654511, -0.440146327, -0.308182806,
+    0.283588678, -0.047025051, 0.535306633,
+    0.3605313, -0.405177623, 0.035654556,
+    0.283588678, 0.047025051, -0.535306633,
+    0.3605313, 0.405177623, -0.035654556,
+    -0.367445886, 0.0352245346, -0.405493617,
+    -0.290638864, -0.308835566, -0.439876437,
+    -0.367445886, -0.405489504, 0.0360336676,
+    0.283584833, -0.139210135, -0.519055307,
+    -0.0132767446, 0.0491295531, -0.559442163,
+    0.283593446, 0.440351397, 0.30798468,
+    0.283588678, 0.535306633, -0.047025051,
+    -0.290632159, -0.440648526, -0.307845294,
+    -0.290625066, -0.535409272, 0.0475430898,
+    -0.290625066, 0.535409272, -0.0475430898,
+    -0.290569782, 0.486887395, -0.227738753,
+    -0.290614218, -0.226459786, 0.487423182,
+    -0.290567994, -0.379914224, 0.380328417,
+    -0.290625811, 0.0464798883, -0.535512328,
+    -0.290614218, 0.226459786, -0.487423182,
+    0.3605313, -0.0356545523, 0.405177623,
+    0.283590704, -0.379950881, 0.379950881,
+    -0.290612519, 0.379742712, -0.380443513,
+    0.283590734, 0.379950911, -0.379950911,
+    0.283587873, 0.487101763, -0.226957932,
+    0.283581346, -0.226933196, 0.487119704,
+    0.283581346, 0.226933196, -0.487119704,
+    0.283581346, -0.487119675, 0.226933211,
+    -0.290569782, -0.486887395, 0.227738753,
+    -0.290625811, -0.0464798883, 0.535512328,
+    -0.0132799512, 0.559442461, -0.0491295792,
+};
+
+#endif
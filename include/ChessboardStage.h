@@ -11,6 +11,22 @@ class Chessboard;
 class Chesspiece;
 class Skybox;
 class BaseAnimation;
+class InstanceBuffer;
+
+/**
+ * A group of piece instances sharing the same geometry, texture and fade;
+ * drawn with a single instanced draw call.
+ */
+struct PieceBatch
+{
+    Chesspiece* m_object;
+    GLuint m_texture;
+    float m_fade;
+
+    // Range of the batch's transforms in the instance buffer
+    int m_firstInstance;
+    int m_numInstances;
+};
 
 /**
  * Multi-texturing stage, displaying a chessboard.
@@ -51,6 +67,12 @@ private:
     void RenderBoard(float* vMatrix, float* vpMatrix);
     void RenderPieces(float* vMatrix, float* vpMatrix);
     void RenderReflectedPieces(float* vpMatrix);
+    void UpdatePieceInstances();
+    void RenderPieceBatches(GLint textureLoc, GLint modelMatrixLoc);
+    void RenderPiecesInstanced(float* vMatrix, float* vpMatrix);
+    void RenderReflectedPiecesInstanced(float* vpMatrix);
+    bool SetupInstancing();
+    void TeardownInstancing();
     void RenderSkybox(float* viewMatrix);
     bool SwitchRenderTexture(GLuint texture);
     void RenderXBlur();
@@ -74,6 +96,11 @@ protected: // Data
     // Object instances
     std::vector<ChesspieceInstance*> m_pieces;
 
+    // Per-instance piece transforms grouped into batches; the buffer is
+    // NULL if instancing is not in use
+    InstanceBuffer* m_pieceInstances;
+    std::vector<PieceBatch> m_pieceBatches;
+
     // List of active animations
     std::list<BaseAnimation*> m_animations;
 
@@ -106,6 +133,8 @@ protected: // Data
     GLuint m_xBlurProgram;
     GLuint m_yBlurProgram;
     GLuint m_combineProgram;
+    GLuint m_chesspieceInstancedProgram;
+    GLuint m_chesspieceReflInstancedProgram;
 
     // GLSL unifroms
     GLint m_chessboardMvpLoc;
@@ -132,6 +161,19 @@ protected: // Data
     GLint m_yBlurSampleHeightLoc;
     GLint m_combineUnblurredTextureLoc;
     GLint m_combineBlurredTextureLoc;
+    GLint m_chesspieceInstancedVpLoc;
+    GLint m_chesspieceInstancedVLoc;
+    GLint m_chesspieceInstancedTextureLoc;
+    GLint m_chesspieceInstancedEyeposLoc;
+    GLint m_chesspieceInstancedEnvmapLoc;
+    GLint m_chesspieceInstancedDofParamsLoc;
+    GLint m_chesspieceReflInstancedVpLoc;
+    GLint m_chesspieceReflInstancedTextureLoc;
+    GLint m_chesspieceReflInstancedEyeposLoc;
+
+    // GLSL per-instance model matrix attributes
+    GLint m_chesspieceInstancedModelMatrixLoc;
+    GLint m_chesspieceReflInstancedModelMatrixLoc;
 };
 
 #endif // CHESSBOARDSTAGE_H
@@ -28,7 +28,11 @@ public:
 public:
     void Render();
 
+    /** Renders numInstances pieces; requires instancing support. */
+    void RenderInstanced(int numInstances);
+
 private:
+    void BindBuffers();
     bool Setup(Chesspiece::Type type);
     Chesspiece();
 
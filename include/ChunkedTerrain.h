@@ -0,0 +1,75 @@
+#ifndef CHUNKEDTERRAIN_H
+#define CHUNKEDTERRAIN_H
+
+#include <vector>
+
+#include "OpenGLAPI.h"
+
+// Number of detail levels per terrain chunk; level 0 is the original mesh
+static const int TerrainNumLodLevels = 3;
+
+/**
+ * Terrain mesh split into a grid of spatial chunks, each with a set of
+ * decreasing detail levels. Only the chunks within the view frustum are
+ * drawn, with the detail level selected by their distance to the eye.
+ *
+ * The detail levels are generated when the terrain is created by
+ * clustering the vertices of each chunk into a grid of cells. The vertices
+ * on the chunk borders are never moved so adjacent chunks always meet
+ * regardless of their detail levels.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class ChunkedTerrain
+{
+public: // Construction and destruction
+    /**
+     * Creates the terrain from the given triangle mesh. The data is copied
+     * into OpenGL buffers and not referenced afterwards.
+     */
+    static ChunkedTerrain* Create(const VertexAttribs* vertices,
+                                  int numVertices, const GLushort* indices,
+                                  int numIndices);
+    ~ChunkedTerrain();
+
+public: // Public API
+    /**
+     * Binds the VBOs and draws the visible chunks.
+     *
+     * @param frustumPlanes view frustum, see ExtractFrustumPlanes()
+     * @param eyePosition float[3]; world space
+     * @return number of indices drawn
+     */
+    int Render(const float* frustumPlanes, const float* eyePosition);
+
+private:
+    ChunkedTerrain();
+    bool Setup(const VertexAttribs* vertices, int numVertices,
+               const GLushort* indices, int numIndices);
+    void BuildLod(const VertexAttribs* vertices,
+                  const std::vector<GLushort>& chunkIndices,
+                  const std::vector<bool>& locked, float cellSize,
+                  std::vector<GLushort>& lodIndices);
+
+private: // Types
+    struct TerrainChunk
+    {
+        // Bounding box
+        float m_min[3];
+        float m_max[3];
+
+        // Ranges within the index buffer for each detail level
+        int m_lodOffset[TerrainNumLodLevels];
+        int m_lodCount[TerrainNumLodLevels];
+    };
+
+private: // Data
+    std::vector<TerrainChunk> m_chunks;
+
+    // Vertex/index buffers
+    GLuint m_vertexBuffer;
+    GLuint m_indexBuffer;
+};
+
+#endif // CHUNKEDTERRAIN_H
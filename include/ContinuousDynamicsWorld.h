@@ -0,0 +1,47 @@
+#ifndef CONTINUOUSDYNAMICSWORLD_H
+#define CONTINUOUSDYNAMICSWORLD_H
+
+#include <btBulletDynamicsCommon.h>
+
+/**
+ * btDiscreteDynamicsWorld whose continuous collision detection covers the
+ * bodies of any shape.
+ *
+ * A body with a CCD motion threshold that moves further than it in a
+ * step has its motion swept with a sphere of its CCD swept sphere radius,
+ * and the motion is cut short at the first object the sphere hits.
+ * btDiscreteDynamicsWorld only does this for bodies of a convex shape,
+ * although the sweep does not depend on the shape; here compound bodies,
+ * such as the vehicle, are swept too. The motions cut short are counted.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class ContinuousDynamicsWorld : public btDiscreteDynamicsWorld
+{
+public: // Construction and destruction
+    ContinuousDynamicsWorld(btDispatcher* dispatcher,
+                            btBroadphaseInterface* broadphase,
+                            btConstraintSolver* constraintSolver,
+                            btCollisionConfiguration* collisionConfiguration);
+    virtual ~ContinuousDynamicsWorld();
+
+public: // Public API
+    /** Returns the number of body motions cut short by the sweeps. */
+    int NumClampedMotions() const { return m_numClampedMotions; }
+
+    /** Resets the count of motions cut short. */
+    void ResetClampedMotions() { m_numClampedMotions = 0; }
+
+protected: // From btDiscreteDynamicsWorld
+    virtual void integrateTransforms(btScalar timeStep);
+
+private:
+    bool ClampMotion(btRigidBody* body, btScalar timeStep,
+                     const btTransform& predictedTransform);
+
+private: // Data
+    int m_numClampedMotions;
+};
+
+#endif // CONTINUOUSDYNAMICSWORLD_H
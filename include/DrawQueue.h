@@ -0,0 +1,70 @@
+#ifndef DRAWQUEUE_H
+#define DRAWQUEUE_H
+
+#include <vector>
+
+#include "OpenGLAPI.h"
+
+/**
+ * A single queued draw. The sort key is (pass, program, texture, mesh,
+ * depth); mesh and data are freeform ids interpreted by the owner of the
+ * queue.
+ */
+struct DrawItem
+{
+    // Render pass; all items of a lower pass are drawn first
+    int m_pass;
+
+    // Program and (primary) texture the item is drawn with
+    GLuint m_program;
+    GLuint m_texture;
+
+    // Vertex data the item is drawn from
+    int m_mesh;
+
+    // Sort depth within items sharing the same state; smaller first. Use
+    // the view depth for front to back order, its negation for back to
+    // front.
+    float m_depth;
+
+    // Freeform item data, eg. the index of an instance
+    int m_data;
+};
+
+/**
+ * Collects the draws of a frame and submits them sorted by their render
+ * state so that the state changes between consecutive items are as few
+ * as possible, and by depth within the same state.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class DrawQueue
+{
+public:
+    /** Called for each item on Submit(), in sorted order. */
+    typedef void (*DrawCallback)(void* userData, const DrawItem& item);
+
+public: // Construction and destruction
+    DrawQueue(DrawCallback callback, void* userData);
+    ~DrawQueue();
+
+public: // Public API
+    void Add(int pass, GLuint program, GLuint texture, int mesh, float depth,
+             int data = 0);
+
+    /** Sorts the queued items and draws them, emptying the queue. */
+    void Submit();
+
+    /** Removes all the queued items without drawing them. */
+    void Clear() { m_items.clear(); }
+
+    int Count() const { return m_items.size(); }
+
+private: // Data
+    DrawCallback m_callback;
+    void* m_userData;
+    std::vector<DrawItem> m_items;
+};
+
+#endif // DRAWQUEUE_H
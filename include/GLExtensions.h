@@ -0,0 +1,68 @@
+#ifndef GLEXTENSIONS_H
+#define GLEXTENSIONS_H
+
+#include "OpenGLAPI.h"
+
+/**
+ * Runtime detection of and entry points to the optional OpenGL (ES)
+ * features used by the stages. The first query probes the current
+ * GL context, so these must only be called once a context is current.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+
+/**
+ * Returns true if instanced drawing (glDrawElementsInstanced and
+ * glVertexAttribDivisor) is available, either through OpenGL ES 3.0 or
+ * one of the EXT / ANGLE / NV / ARB instanced arrays extensions.
+ */
+bool InstancingSupported();
+
+/**
+ * Checks whether the given extension is listed in GL_EXTENSIONS.
+ */
+bool GLExtensionPresent(const char* extensionName);
+
+/**
+ * Draws primcount instances of the indexed geometry. Only valid when
+ * InstancingSupported() returns true.
+ */
+void DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type,
+                           const GLvoid* indices, GLsizei primcount);
+
+/**
+ * Sets the per-instance divisor for the vertex attribute at index. Only
+ * valid when InstancingSupported() returns true.
+ */
+void VertexAttribDivisor(GLuint index, GLuint divisor);
+
+/**
+ * Returns true if occlusion queries are available, either through OpenGL
+ * ES 3.0, GL_EXT_occlusion_query_boolean or GL_ARB_occlusion_query.
+ */
+bool OcclusionQueriesSupported();
+
+/**
+ * Creates / deletes occlusion query objects. Only valid when
+ * OcclusionQueriesSupported() returns true.
+ */
+void GenQueries(GLsizei n, GLuint* ids);
+void DeleteQueries(GLsizei n, const GLuint* ids);
+
+/**
+ * Starts / ends an occlusion query; any samples passing the depth test
+ * between the calls make the query result true.
+ */
+void BeginOcclusionQuery(GLuint id);
+void EndOcclusionQuery();
+
+/**
+ * Reads the result of a finished occlusion query without waiting for the
+ * GPU. Returns false if the result is not available yet.
+ *
+ * @param anySamplesPassed set to the query result if available
+ */
+bool GetOcclusionQueryResult(GLuint id, bool* anySamplesPassed);
+
+#endif // GLEXTENSIONS_H
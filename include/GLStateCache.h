@@ -0,0 +1,85 @@
+#ifndef GLSTATECACHE_H
+#define GLSTATECACHE_H
+
+#include "OpenGLAPI.h"
+
+// Number of texture units tracked by GLStateCache
+static const int StateCacheTextureUnits = 8;
+
+// Number of texture targets (GL_TEXTURE_2D and GL_TEXTURE_CUBE_MAP) tracked
+// for each texture unit by GLStateCache
+static const int StateCacheTextureTargets = 2;
+
+// Number of capabilities (glEnable / glDisable) tracked by GLStateCache
+static const int StateCacheCapabilities = 4;
+
+/**
+ * Shadow copy of the GL state switched by the scene render loops: the
+ * current program, the texture bindings, a few capabilities (face
+ * culling, blending, depth testing and polygon offset) and the depth
+ * write mask. Calls that would not change the state are dropped.
+ *
+ * Counts the state changes sent to GL and the redundant ones filtered
+ * out, so the driver overhead of a frame can be measured.
+ *
+ * The cache assumes it sees every change to the state it tracks; call
+ * Invalidate() after code that changes it directly.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class GLStateCache
+{
+public: // Construction and destruction
+    GLStateCache();
+    ~GLStateCache();
+
+public: // Public API
+    /** Forgets the tracked state; the next change of each is always sent. */
+    void Invalidate();
+
+    void UseProgram(GLuint program);
+
+    /**
+     * Binds a texture to the given target of the given texture unit.
+     * Switches the active texture unit only if needed; the active unit is
+     * left undefined. Targets other than GL_TEXTURE_2D and
+     * GL_TEXTURE_CUBE_MAP are passed through as is.
+     */
+    void BindTexture(int unit, GLenum target, GLuint texture);
+
+    /**
+     * glEnable() / glDisable(). Capabilities other than GL_CULL_FACE,
+     * GL_BLEND, GL_DEPTH_TEST and GL_POLYGON_OFFSET_FILL are passed
+     * through as is.
+     */
+    void SetEnabled(GLenum capability, bool enabled);
+
+    void SetDepthMask(bool enabled);
+
+    /** Resets the state change counters. */
+    void ResetCounters();
+
+    /** Returns the number of state changes sent to GL. */
+    int NumStateChanges() const { return m_numStateChanges; }
+
+    /** Returns the number of redundant state changes dropped. */
+    int NumRedundantChanges() const { return m_numRedundantChanges; }
+
+private:
+    bool Update(int& current, int value);
+
+private: // Data
+    // The tracked state; -1 is unknown
+    int m_program;
+    int m_activeUnit;
+    int m_textures[StateCacheTextureUnits][StateCacheTextureTargets];
+    int m_capabilities[StateCacheCapabilities];
+    int m_depthMask;
+
+    // Counters
+    int m_numStateChanges;
+    int m_numRedundantChanges;
+};
+
+#endif // GLSTATECACHE_H
@@ -0,0 +1,56 @@
+#ifndef INSTANCEBUFFER_H
+#define INSTANCEBUFFER_H
+
+#include "OpenGLAPI.h"
+
+/**
+ * A streamed vertex buffer of per-instance 4x4 model matrices for
+ * instanced drawing. The matrices are written into a client-side staging
+ * area, uploaded once per frame and then bound to a mat4 vertex attribute
+ * (which occupies 4 consecutive attribute slots) with divisor 1.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class InstanceBuffer
+{
+public: // Construction and destruction
+    static InstanceBuffer* Create(int maxInstances);
+    ~InstanceBuffer();
+
+public: // Public API
+    /** Returns the staging storage for the matrix of the given instance. */
+    float* InstanceMatrix(int index) { return &m_instanceData[index * 16]; }
+
+    /**
+     * Uploads the first numInstances matrices from the staging area into
+     * the buffer, orphaning its previous storage.
+     */
+    void Upload(int numInstances);
+
+    /**
+     * Binds the instance matrices starting from firstInstance into the
+     * given mat4 attribute location.
+     */
+    void Bind(GLint attribLocation, int firstInstance);
+
+    /**
+     * Disables the mat4 attribute and resets its divisors so that other
+     * programs may use those attribute slots normally.
+     */
+    void Unbind(GLint attribLocation);
+
+    /** Returns the number of instances this buffer was created for. */
+    int MaxInstances() const { return m_maxInstances; }
+
+private:
+    InstanceBuffer(int maxInstances);
+    bool Setup();
+
+private: // Data
+    int m_maxInstances;
+    float* m_instanceData;
+    GLuint m_buffer;
+};
+
+#endif // INSTANCEBUFFER_H
@@ -34,6 +34,7 @@ const char* const JsonApiPassword = "a4b54eee8800697954b9ccdb685ffa9f";
 
 // Forward declarations
 class BaseStage;
+class PhysicsStage;
 class TextRenderer;
 class Torus;
 class RotationAnimation;
@@ -89,6 +90,7 @@ public: // From WidgetTouchListener
 
 private:
     void SetupDeviceInfo();
+    void ConfigurePhysicsStage(PhysicsStage& stage);
     bool SetupNextStage();
 //    void SetupRects();
     void DrawImage(const CommonGL::Rect& rect, GLuint texture);
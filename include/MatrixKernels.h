@@ -0,0 +1,113 @@
+#ifndef MATRIXKERNELS_H
+#define MATRIXKERNELS_H
+
+/**
+ * SIMD (SSE / NEON) accelerated versions of the hot 4x4 matrix operations
+ * with batched variants for transforming many objects by the same matrix,
+ * plus batched frustum culling of object bounding spheres.
+ * Matrices use the same layout as MatrixOperations.h (row vectors,
+ * translation at MatrixTranslationOffset), so for any kernel the result
+ * of MatrixMultiplyKernel(a, b, out) equals MatrixMultiply(a, b, out).
+ *
+ * The implementation is selected at runtime by InitMatrixKernels(); until
+ * then (or when no SIMD unit is present) the scalar reference is used.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+
+/** Available kernel implementations. */
+enum MatrixKernelType
+{
+    MatrixKernelScalar,
+    MatrixKernelSSE,
+    MatrixKernelNEON
+};
+
+/**
+ * Probes the CPU and selects the fastest available implementation.
+ */
+void InitMatrixKernels();
+
+/**
+ * Forces the given implementation, eg. for comparing the kernels.
+ * Returns false (and leaves the selection unchanged) if the implementation
+ * is not supported on this CPU / build.
+ */
+bool SetMatrixKernel(MatrixKernelType type);
+
+/**
+ * Returns whether the CPU has a NEON unit the NEON code paths of this
+ * build can run on; always false on builds without them.
+ */
+bool NEONPresent();
+
+/** Returns the currently selected implementation. */
+MatrixKernelType ActiveMatrixKernel();
+
+/** Returns a printable name of the currently selected implementation. */
+const char* MatrixKernelName();
+
+/**
+ * out = a * b. out may alias either input.
+ */
+void MatrixMultiplyKernel(const float* a, const float* b, float* out);
+
+/**
+ * Multiplies count tightly packed matrices by the same matrix m:
+ * out[i] = matrices[i] * m. out must not alias the inputs.
+ */
+void MatrixMultiplyBatch(const float* matrices, const float* m, float* out,
+                         int count);
+
+/**
+ * As MatrixMultiplyBatch() but gathers the matrices through an array of
+ * pointers; for transforms that are stored within their owner objects.
+ */
+void MatrixMultiplyBatchIndirect(const float* const* matrices,
+                                 const float* m, float* out, int count);
+
+/**
+ * Transforms the point v into the object space of the rigid (rotation +
+ * translation only) transform m without computing the full inverse.
+ * Equals Transformv3(inverse(m), v, out).
+ */
+void InverseTransformPointRigid(const float* m, const float* v, float* out);
+
+/** Number of floats in a set of frustum planes; 6 planes of (a, b, c, d). */
+static const int FrustumPlanesSize = 24;
+
+/**
+ * Extracts the normalized clip planes of the frustum of the given
+ * view-projection matrix, in world space. A point p is inside a plane
+ * when a*p.x + b*p.y + c*p.z + d >= 0.
+ *
+ * @param planes must point to a float[FrustumPlanesSize]
+ */
+void ExtractFrustumPlanes(const float* vpMatrix, float* planes);
+
+/**
+ * Returns true if the sphere at center (float[3]) with the given radius
+ * intersects the frustum described by planes.
+ */
+bool SphereInFrustum(const float* planes, const float* center, float radius);
+
+/**
+ * Returns true if the axis aligned box from min to max (float[3] each)
+ * intersects the frustum described by planes.
+ */
+bool AabbInFrustum(const float* planes, const float* min, const float* max);
+
+/**
+ * Frustum culls count tightly packed object transforms, each with a
+ * bounding sphere of the given radius around its translation (ie. the
+ * object is centered at its origin). The indices of the visible objects
+ * are written into visible in ascending order.
+ *
+ * @param visible must have room for count indices
+ * @return number of visible objects
+ */
+int FrustumCullSpheres(const float* planes, const float* transforms,
+                       int count, float radius, int* visible);
+
+#endif // MATRIXKERNELS_H
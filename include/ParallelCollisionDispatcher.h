@@ -0,0 +1,130 @@
+#ifndef PARALLELCOLLISIONDISPATCHER_H
+#define PARALLELCOLLISIONDISPATCHER_H
+
+#include <pthread.h>
+#include <vector>
+
+#include <btBulletCollisionCommon.h>
+#include "PooledCollisionDispatcher.h"
+
+// Forward declarations
+struct CollisionContext;
+class btPoolAllocator;
+
+// Maximum number of narrowphase threads
+static const int MaxCollisionThreads = 8;
+
+/**
+ * Collision dispatcher that processes the overlapping pairs of a physics
+ * step (the narrowphase) on a pool of worker threads.
+ *
+ * Bullet's collision algorithms are not thread safe as such: the convex
+ * algorithms share the simplex solver of the collision configuration they
+ * were created with, and new contact manifolds are appended to a shared
+ * list. Therefore each thread slot gets a context of its own, with its own
+ * collision configuration (simplex solver and manifold pool) and collision
+ * algorithm pool. The first context's pools are as large as those of the
+ * given configuration; the others are sized for an even share of the
+ * pairs, with some headroom. The algorithm of a pair is created with one
+ * context and the pair is always processed by the thread serving that
+ * context.
+ * Manifolds created or released while the threads run are merged into the
+ * manifold list afterwards, in pair order, so the result does not depend
+ * on the number of threads.
+ *
+ * Pairs with compound or triangle mesh shapes are always processed by the
+ * first context; their algorithms temporarily change the shape of the
+ * collision object they process.
+ *
+ * Only discrete collision detection is run in parallel, and the near
+ * callback is not used; continuous dispatches fall back to the serial
+ * btCollisionDispatcher.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class ParallelCollisionDispatcher : public PooledCollisionDispatcher
+{
+public: // Construction and destruction
+    /**
+     * Creates a dispatcher with the given number of threads, including
+     * the calling one. Returns NULL on failure.
+     */
+    static ParallelCollisionDispatcher* Create(
+            btCollisionConfiguration* collisionConfiguration, int numThreads);
+    virtual ~ParallelCollisionDispatcher();
+
+public: // Public API
+    int NumThreads() const { return m_numThreads; }
+
+    /**
+     * Sets the number of threads used, 1 .. NumThreads(), to measure the
+     * scaling. With cycle set, each dispatch uses one more thread than the
+     * previous one, wrapping around to 1.
+     */
+    void SetActiveThreads(int numThreads, bool cycle);
+
+    /**
+     * Returns the average time of a dispatch with the given number of
+     * threads, in seconds, or a negative value if there has been none.
+     */
+    double AverageDispatchTime(int numThreads) const;
+
+public: // From btCollisionDispatcher
+    virtual btPersistentManifold* getNewManifold(void* b0, void* b1);
+    virtual void releaseManifold(btPersistentManifold* manifold);
+    virtual btCollisionAlgorithm* findAlgorithm(
+            btCollisionObject* body0, btCollisionObject* body1,
+            btPersistentManifold* sharedManifold = 0);
+    virtual void* allocateCollisionAlgorithm(int size);
+    virtual void freeCollisionAlgorithm(void* ptr);
+    virtual void dispatchAllCollisionPairs(btOverlappingPairCache* pairCache,
+                                           const btDispatcherInfo& dispatchInfo,
+                                           btDispatcher* dispatcher);
+
+private:
+    ParallelCollisionDispatcher(btCollisionConfiguration* collisionConfiguration,
+                                int numThreads);
+    bool Setup();
+    CollisionContext* CurrentContext() const;
+    void AssignPairs(btBroadphasePairArray& pairs);
+    void ProcessContexts(int thread, int numThreads);
+    void MergeManifolds();
+    void DestroyManifold(btPersistentManifold* manifold);
+    void WorkerThreadLoop(int thread);
+    static void* WorkerThreadMethod(void* data);
+
+private: // Data
+    int m_numThreads;
+    int m_activeThreads;
+    bool m_cycleThreads;
+
+    // One context per thread slot; the first uses the collision
+    // configuration given to the constructor
+    CollisionContext* m_contexts[MaxCollisionThreads];
+
+    // The context of the calling thread
+    pthread_key_t m_contextKey;
+    bool m_contextKeyCreated;
+
+    // The dispatch in progress
+    btBroadphasePairArray* m_pairs;
+    const btDispatcherInfo* m_dispatchInfo;
+    bool m_dispatching;
+
+    // Worker threads; the calling thread serves as the first one
+    std::vector<pthread_t> m_threads;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_startCondition;
+    pthread_cond_t m_doneCondition;
+    int m_generation;
+    int m_dispatchThreads;
+    int m_numBusyThreads;
+    bool m_threadsAlive;
+
+    // Dispatch times per number of threads
+    double m_totalDispatchTime[MaxCollisionThreads + 1];
+    int m_numDispatches[MaxCollisionThreads + 1];
+};
+
+#endif // PARALLELCOLLISIONDISPATCHER_H
@@ -0,0 +1,122 @@
+#ifndef PARALLELDYNAMICSWORLD_H
+#define PARALLELDYNAMICSWORLD_H
+
+#include <pthread.h>
+#include <vector>
+
+#include <btBulletDynamicsCommon.h>
+
+#include "ContinuousDynamicsWorld.h"
+
+// Forward declarations
+struct SolverIsland;
+class IslandCollector;
+
+// Maximum number of constraint solver threads
+static const int MaxSolverThreads = 8;
+
+/**
+ * Dynamics world that solves the simulation islands of a physics step
+ * on a pool of worker threads.
+ *
+ * btDiscreteDynamicsWorld hands the islands to its constraint solver one
+ * after another. Islands do not share any dynamic bodies, contact
+ * manifolds or constraints, so they can be solved independently; this
+ * world first collects the awake islands, batches small consecutive ones
+ * together and then divides the batches between the threads. Each thread
+ * has a constraint solver of its own, so no solver body or constraint
+ * pools are shared.
+ *
+ * The batches are assigned to the threads in a fixed order by their
+ * size, and the sequential impulse solver gives an island the same
+ * result whichever batch or thread it is solved in, so the results are
+ * repeatable.
+ *
+ * The continuous collision detection of ContinuousDynamicsWorld is
+ * inherited as is.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class ParallelDynamicsWorld : public ContinuousDynamicsWorld
+{
+public: // Construction and destruction
+    /**
+     * Creates a world with the given number of solver threads, including
+     * the calling one. constraintSolvers holds a separate solver for each
+     * thread, the calling thread's first; the solvers are not owned by
+     * the world. Returns NULL on failure.
+     */
+    static ParallelDynamicsWorld* Create(
+            btDispatcher* dispatcher, btBroadphaseInterface* broadphase,
+            btConstraintSolver* const* constraintSolvers,
+            btCollisionConfiguration* collisionConfiguration, int numThreads);
+    virtual ~ParallelDynamicsWorld();
+
+public: // Public API
+    int NumThreads() const { return m_numThreads; }
+
+    /**
+     * Returns the average time spent solving the constraints of a step,
+     * in seconds, or a negative value if there has been no step.
+     */
+    double AverageSolveTime() const;
+
+    /**
+     * Returns the average number of islands solved per step.
+     */
+    double AverageIslandsPerStep() const;
+
+protected: // From btDiscreteDynamicsWorld
+    virtual void solveConstraints(btContactSolverInfo& solverInfo);
+
+private:
+    ParallelDynamicsWorld(btDispatcher* dispatcher,
+                          btBroadphaseInterface* broadphase,
+                          btConstraintSolver* const* constraintSolvers,
+                          btCollisionConfiguration* collisionConfiguration,
+                          int numThreads);
+    bool Setup();
+    void SortConstraints();
+    void BatchIslands(int batchSize);
+    void AssignBatches(int numThreads);
+    void SolveBatches(int thread);
+    void WorkerThreadLoop(int thread);
+    static void* WorkerThreadMethod(void* data);
+
+private: // Data
+    int m_numThreads;
+
+    // Solver of each thread, as given to Create()
+    btConstraintSolver* m_solvers[MaxSolverThreads];
+
+    // The islands of the step in progress and the batches they are
+    // solved in
+    IslandCollector* m_islandCollector;
+    std::vector<SolverIsland> m_islands;
+    std::vector<SolverIsland> m_batches;
+    std::vector<btCollisionObject*> m_islandBodies;
+    std::vector<btPersistentManifold*> m_islandManifolds;
+    std::vector<btTypedConstraint*> m_islandConstraints;
+    btContactSolverInfo* m_solverInfo;
+
+    // Indices of the batches each thread solves
+    std::vector<int> m_threadBatches[MaxSolverThreads];
+
+    // Worker threads; the calling thread serves as the first one
+    std::vector<pthread_t> m_threads;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_startCondition;
+    pthread_cond_t m_doneCondition;
+    int m_generation;
+    int m_solveThreads;
+    int m_numBusyThreads;
+    bool m_threadsAlive;
+
+    // Solver statistics
+    double m_totalSolveTime;
+    int m_totalIslands;
+    int m_numSolves;
+};
+
+#endif // PARALLELDYNAMICSWORLD_H
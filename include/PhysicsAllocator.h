@@ -0,0 +1,122 @@
+#ifndef PHYSICSALLOCATOR_H
+#define PHYSICSALLOCATOR_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <vector>
+
+// Number of block size classes of PhysicsAllocator
+static const int NumAllocatorSizeClasses = 8;
+
+/**
+ * Allocation counters of PhysicsAllocator.
+ */
+struct PhysicsAllocatorStats
+{
+    PhysicsAllocatorStats() : m_numAllocations(0), m_numFrees(0),
+        m_allocatedBytes(0), m_numHeapAllocations(0), m_heapBytes(0),
+        m_numLiveBlocks(0) {}
+
+    // Allocations and frees made through the allocator, and the total
+    // number of bytes requested by the allocations
+    int m_numAllocations;
+    int m_numFrees;
+    size_t m_allocatedBytes;
+
+    // Allocations the allocator has made from the heap: arena chunks and
+    // the blocks too large for the size classes
+    int m_numHeapAllocations;
+    size_t m_heapBytes;
+
+    // Blocks currently allocated
+    int m_numLiveBlocks;
+};
+
+/**
+ * Stage-scoped memory allocator for Bullet and the physics objects of a
+ * stage.
+ *
+ * Small blocks come from size class pools carved out of large arena
+ * chunks; freed blocks go back to the free list of their class and are
+ * reused, so once the pools have warmed up no heap allocations are made.
+ * Blocks larger than the biggest class are allocated from the heap one by
+ * one. All of the memory is released at once when the allocator is
+ * destroyed, which must only happen after everything allocated from it
+ * is no longer used.
+ *
+ * Install() routes all of Bullet's allocations through the allocator; it
+ * must be installed before the first Bullet object of the stage is
+ * created and uninstalled after the last one is destroyed. The allocator
+ * is thread safe.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class PhysicsAllocator
+{
+public: // Construction and destruction
+    /**
+     * Creates an allocator that reserves its arena in chunks of the given
+     * size. Returns NULL on failure.
+     */
+    static PhysicsAllocator* Create(size_t chunkSize);
+    ~PhysicsAllocator();
+
+public: // Public API
+    /**
+     * Allocates a block of the given size and alignment, which must be a
+     * power of two. Returns NULL on failure.
+     */
+    void* Allocate(size_t size, int alignment = 16);
+
+    /** Frees a block allocated with Allocate(); NULL is ignored. */
+    void Free(void* ptr);
+
+    /**
+     * Destroys an object placement-constructed into a block allocated with
+     * Allocate() and frees the block; NULL is ignored.
+     */
+    template <class T> void Delete(T* object)
+    {
+        if ( object != NULL )
+        {
+            object->~T();
+            Free(object);
+        }
+    }
+
+    /** Routes Bullet's allocations through this allocator. */
+    void Install();
+
+    /** Restores Bullet's default allocation functions if installed. */
+    void Uninstall();
+
+    /** Returns a copy of the allocation counters. */
+    PhysicsAllocatorStats Stats();
+
+private:
+    PhysicsAllocator(size_t chunkSize);
+    bool Setup();
+    bool AllocateChunk();
+    void* AllocateHeapBlock(size_t size, int alignment);
+    static void* BulletAlloc(size_t size);
+    static void* BulletAlignedAlloc(size_t size, int alignment);
+    static void BulletFree(void* ptr);
+
+private: // Data
+    size_t m_chunkSize;
+
+    // Arena chunks as returned by the heap, and the unused part of the
+    // latest chunk
+    std::vector<char*> m_chunks;
+    char* m_chunkPos;
+    char* m_chunkEnd;
+
+    // Free blocks of each size class, linked through their first word
+    void* m_freeLists[NumAllocatorSizeClasses];
+
+    PhysicsAllocatorStats m_stats;
+    pthread_mutex_t m_mutex;
+};
+
+#endif // PHYSICSALLOCATOR_H
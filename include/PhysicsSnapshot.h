@@ -0,0 +1,99 @@
+#ifndef PHYSICSSNAPSHOT_H
+#define PHYSICSSNAPSHOT_H
+
+#include <vector>
+
+#include <btBulletDynamicsCommon.h>
+
+/**
+ * Snapshot of the state of a dynamics world, serialized with Bullet's
+ * btDefaultSerializer into a memory buffer.
+ *
+ * The buffer is a regular .bullet file of the whole world. Restore()
+ * writes the body states back into the world the snapshot was taken of,
+ * in place: it does not create any objects, so the shapes, bodies and
+ * motion states set up for the world are kept. The broadphase pairs and
+ * cached contacts are dropped and rebuilt from scratch. Bullet does not
+ * serialize the contacts, so only a snapshot taken before the first step
+ * replays bit-exactly; from a later one the simulation starts without the
+ * cached contact impulses and drifts slightly from the original run.
+ *
+ * Restoring requires the same bodies to be in the world, in the same
+ * order, as when the snapshot was taken. Snapshots created from a buffer
+ * cannot be restored, but they can be compared with the snapshots of this
+ * build to check that two builds simulate alike.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class PhysicsSnapshot
+{
+public: // Construction and destruction
+    /**
+     * Takes a snapshot of the given world. Must not be called while the
+     * world is being stepped. Returns NULL on failure.
+     */
+    static PhysicsSnapshot* Create(btDynamicsWorld* world);
+
+    /**
+     * Creates a snapshot from a buffer written by Data() of a build with
+     * the same Bullet version, precision and pointer size. Returns NULL
+     * if the buffer is not valid.
+     */
+    static PhysicsSnapshot* CreateFromBuffer(const unsigned char* data,
+                                             int size);
+    ~PhysicsSnapshot();
+
+public: // Public API
+    /**
+     * Restores the body states of the snapshot into the world it was taken
+     * of. Must not be called while the world is being stepped. Returns
+     * false, leaving the world untouched, if the bodies of the world do not
+     * match the snapshot.
+     */
+    bool Restore(btDynamicsWorld* world) const;
+
+    /** Returns the number of rigid bodies in the snapshot. */
+    int NumBodies() const { return m_bodies.size(); }
+
+    /**
+     * Returns a checksum of the positions, orientations and velocities of
+     * the bodies; it only matches for bit-exact equal states.
+     */
+    unsigned int Checksum() const;
+
+    /**
+     * Returns the largest distance between the positions of the same body
+     * in this and the other snapshot, or -1.0 if the snapshots do not have
+     * the same number of bodies.
+     */
+    float MaxDistance(const PhysicsSnapshot& other) const;
+
+    /** Returns the serialized world. */
+    const unsigned char* Data() const { return &m_buffer[0]; }
+
+    /** Returns the size of the serialized world in bytes. */
+    int Size() const { return m_buffer.size(); }
+
+private:
+    PhysicsSnapshot(bool restorable);
+    bool Setup(const unsigned char* data, int size);
+    static void GetBodies(btDynamicsWorld* world,
+                          std::vector<btRigidBody*>& bodies);
+    void RestoreBody(const btRigidBodyData& data, btRigidBody* body) const;
+
+private: // Data
+    std::vector<unsigned char> m_buffer;
+
+    // Offsets of the rigid body chunks in the buffer
+    std::vector<int> m_bodies;
+
+    // The bodies the chunks were serialized from; the serializer replaces
+    // the object addresses in the chunks with unique ids
+    std::vector<btRigidBody*> m_liveBodies;
+
+    // Whether the snapshot was taken of a world of this process
+    bool m_restorable;
+};
+
+#endif // PHYSICSSNAPSHOT_H
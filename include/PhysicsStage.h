@@ -1,21 +1,36 @@
 #ifndef PILLARSTAGE_H
 #define PILLARSTAGE_H
 
+#include <pthread.h>
 #include <list>
 #include <vector>
 
 #include <btBulletDynamicsCommon.h>
 #include "BaseStage.h"
+#include "SceneInstanceStore.h"
+#include "DrawQueue.h"
+#include "GLStateCache.h"
+#include "PhysicsStateBuffer.h"
+#include "SimdConstraintSolver.h"
+#include "PhysicsAllocator.h"
+#include "TunedDbvtBroadphase.h"
+#include "SceneQueryBatch.h"
 
 // Forward declarations
 class PhysicsStageStatics;
 class Pillar;
+class InstanceBuffer;
 class Skybox;
 class BaseAnimation;
-class RotationAnimation;
-class ObjectInstance;
 class Vehicle;
 class SimpleTimer;
+class PooledCollisionDispatcher;
+class ParallelCollisionDispatcher;
+class ContinuousDynamicsWorld;
+class ParallelDynamicsWorld;
+class PhysicsSnapshot;
+class BatchedVehicleRaycaster;
+class RaycastVehicle;
 
 /**
  * Describes a lens flare image; a series of these will make up for the
@@ -37,6 +52,203 @@ struct LensFlare
     float m_sizeScaler;
 };
 
+/**
+ * Objects that survived frustum culling against one view (the camera or
+ * a shadow cascade). The vectors hold indices into the corresponding
+ * object lists.
+ */
+struct VisibleObjects
+{
+    VisibleObjects() : m_vehicle(false), m_numCulled(0),
+        m_firstPillarInstance(0) {}
+
+    std::vector<int> m_pillars;
+    std::vector<int> m_wallCorners;
+    std::vector<int> m_wallSegments;
+    std::vector<int> m_trees;
+    bool m_vehicle;
+
+    // Number of objects culled away
+    int m_numCulled;
+
+    // Index of the first of m_pillars in the pillar instance buffer
+    int m_firstPillarInstance;
+};
+
+// Maximum number of shadow map cascades
+static const int MaxShadowCascades = 4;
+
+/**
+ * Shadow map quality tiers; these select the number of cascades and the
+ * resolution of each cascade.
+ */
+enum ShadowQuality
+{
+    ShadowQualityLow,
+    ShadowQualityMedium,
+    ShadowQualityHigh,
+
+    // Pick the tier by the capabilities of the device
+    ShadowQualityAuto
+};
+
+/**
+ * One split of the camera frustum, shadowed by its own orthographic light
+ * projection rendered into a tile of the shadow map.
+ */
+struct ShadowCascade
+{
+    ShadowCascade() : m_far(0.0), m_viewportX(0), m_viewportY(0),
+        m_totalDraws(0)
+    {
+        for ( int i = 0; i < 3; i++ )
+        {
+            m_scale[i] = 0.0;
+            m_offset[i] = 0.0;
+        }
+    }
+
+    // Light view * the cascade's projection
+    float m_vpMatrix[16];
+
+    // Maps light view space coordinates into the cascade's tile in the
+    // shadow map (xy) and its depth range (z): coord * scale + offset
+    float m_scale[3];
+    float m_offset[3];
+
+    // View depth at the far end of the cascade
+    float m_far;
+
+    // Location of the cascade's tile in the shadow map
+    int m_viewportX;
+    int m_viewportY;
+
+    // Shadow casters within the cascade for this frame
+    VisibleObjects m_visible;
+
+    // Number of depth map draw calls over the whole stage
+    int m_totalDraws;
+};
+
+/**
+ * Locations of the shadow cascade uniforms in a program that receives
+ * shadows.
+ */
+struct CascadeUniformLocs
+{
+    CascadeUniformLocs() : m_farLoc(-1), m_scalesLoc(-1), m_offsetsLoc(-1) {}
+
+    GLint m_farLoc;
+    GLint m_scalesLoc;
+    GLint m_offsetsLoc;
+};
+
+/**
+ * Uniforms of the default program derived from an object's transform.
+ * Cached per object and recalculated only when the transform changes.
+ */
+struct ObjectUniforms
+{
+    ObjectUniforms() : m_valid(false) {}
+
+    // Sun position in object space
+    float m_lightPosition[3];
+
+    // Model matrix * light view matrix
+    float m_shadowMatrix[16];
+
+    bool m_valid;
+};
+
+/**
+ * Physics throughput measured over one level of the stress mode.
+ */
+struct StressLevelResult
+{
+    StressLevelResult() : m_numBodies(0), m_numSteps(0), m_numContacts(0.0),
+        m_numPairs(0.0), m_stepTime(0.0), m_broadphaseTime(0.0),
+        m_numPoolOverflows(0) {}
+
+    // Number of dynamic bodies in the world
+    int m_numBodies;
+
+    // Number of simulation steps taken and contact points in them
+    int m_numSteps;
+    double m_numContacts;
+
+    // Overlapping broadphase pairs summed over the steps
+    double m_numPairs;
+
+    // Time spent stepping the world, in seconds, and the part of it spent
+    // in the broadphase, in milliseconds
+    double m_stepTime;
+    double m_broadphaseTime;
+
+    // Manifolds and collision algorithms that did not fit in their pools
+    int m_numPoolOverflows;
+};
+
+/**
+ * Awake pillars and frame time averaged over an interval of the stage.
+ */
+struct ActivitySample
+{
+    ActivitySample() : m_time(0.0), m_activeBodies(0.0), m_frameTime(0.0) {}
+
+    // Start of the interval, in seconds since the first frame
+    float m_time;
+
+    // Awake pillars per frame
+    float m_activeBodies;
+
+    // Time per frame, in milliseconds
+    float m_frameTime;
+};
+
+/**
+ * Phases of a physics step in the profile breakdown of the stage; each
+ * groups some of the BT_PROFILE zones of btDiscreteDynamicsWorld.
+ */
+enum PhysicsPhase
+{
+    // Updating the AABBs and finding the overlapping pairs
+    PhysicsPhaseBroadphase = 0,
+
+    // Generating the contacts of the overlapping pairs
+    PhysicsPhaseNarrowphase,
+
+    // Building the simulation islands and solving the constraints
+    PhysicsPhaseSolver,
+
+    // Predicting and integrating the motion of the bodies
+    PhysicsPhaseIntegrate,
+
+    // Casting the wheel rays of the raycast vehicle and applying its
+    // suspension and tire forces
+    PhysicsPhaseVehicle,
+
+    // The rest of the step
+    PhysicsPhaseOther,
+
+    NumPhysicsPhases
+};
+
+/**
+ * Broadphases the physics world can be set up with.
+ */
+enum PhysicsBroadphase
+{
+    // Bullet's btDbvtBroadphase as it is
+    PhysicsBroadphaseDbvt,
+
+    // TunedDbvtBroadphase; the static bodies are kept in the fixed tree
+    // and their AABBs are not updated
+    PhysicsBroadphaseStaticDbvt,
+
+    // btAxisSweep3 over the bounds of the static bodies
+    PhysicsBroadphaseAxisSweep
+};
+
 /**
  * Physics engine stage with realtime shadows.
  *
@@ -52,6 +264,163 @@ public: // Construction and destruction
                  GLint simpleColorMvpLoc, GLint simpleColorColorLoc);
     ~PhysicsStage();
 
+public: // Public API
+    /**
+     * Sets the shadow map quality tier. Must be called before the stage
+     * is set up; defaults to ShadowQualityAuto.
+     */
+    void SetShadowQuality(ShadowQuality quality) { m_shadowQuality = quality; }
+
+    /**
+     * Runs the physics simulation on its own thread at a fixed rate
+     * instead of stepping it on the render thread before each frame. The
+     * renderer draws the bodies interpolated between the two latest
+     * physics states. Must be called before the stage is set up; defaults
+     * to false.
+     */
+    void SetThreadedPhysics(bool threaded) { m_threadedPhysics = threaded; }
+
+    /**
+     * Processes the colliding pairs of each physics step on the given
+     * number of threads; 0 (the default) uses Bullet's own serial
+     * dispatcher. With measureScaling set, the steps cycle through 1 ..
+     * numThreads threads and the average narrowphase time of each thread
+     * count is logged. Must be called before the stage is set up.
+     */
+    void SetCollisionThreads(int numThreads, bool measureScaling = false)
+    {
+        m_collisionThreads = numThreads;
+        m_measureCollisionScaling = measureScaling;
+    }
+
+    /**
+     * Solves the simulation islands of each physics step on the given
+     * number of threads; 0 (the default) uses Bullet's own serial
+     * btDiscreteDynamicsWorld. The average constraint solving time is
+     * logged with the score. Must be called before the stage is set up.
+     */
+    void SetSolverThreads(int numThreads) { m_solverThreads = numThreads; }
+
+    /**
+     * Selects the constraint row kernels of the solvers; by default the
+     * best ones available are used. With benchmark set, the row kernel
+     * micro-benchmark is run and logged when the stage is set up. Must be
+     * called before the stage is set up.
+     */
+    void SetRowKernels(RowKernels kernels, bool benchmark = false)
+    {
+        m_rowKernels = kernels;
+        m_benchmarkRowKernels = benchmark;
+    }
+
+    /**
+     * Selects the broadphase of the physics world; the tuning only
+     * applies to PhysicsBroadphaseStaticDbvt. The overlapping pairs and
+     * the broadphase time per step are logged with the score, and for
+     * each level of the stress mode, for choosing the broadphase per
+     * device. Must be called before the stage is set up; defaults to
+     * PhysicsBroadphaseDbvt.
+     */
+    void SetBroadphase(PhysicsBroadphase broadphase,
+                       const DbvtBroadphaseTuning& tuning =
+                               DbvtBroadphaseTuning())
+    {
+        m_broadphaseType = broadphase;
+        m_broadphaseTuning = tuning;
+    }
+
+    /**
+     * Runs the stage as a physics stress test: instead of the fixed 5 x 10
+     * pillar grid, the stage goes through numLevels equally long levels of
+     * growing size, the last one having maxRows x maxColumns pillars plus
+     * maxExtraBodies pillars piled on the walkway. The grid is packed
+     * tighter as it grows and spreads out of the walkway once it no longer
+     * fits. The simulation steps and contact points per second of each
+     * level are logged and reported with the score. numLevels 0 (the
+     * default) disables the mode. Must be called before the stage is set
+     * up.
+     */
+    void SetStressMode(int maxRows, int maxColumns, int maxExtraBodies,
+                       int numLevels)
+    {
+        m_stressRows = maxRows;
+        m_stressColumns = maxColumns;
+        m_stressExtraBodies = maxExtraBodies;
+        m_numStressLevels = numLevels;
+    }
+
+    /**
+     * Checks that the physics replays deterministically when the stage is
+     * set up: the world is stepped numSteps fixed steps from its initial
+     * state, restored from a snapshot and stepped again, and the two end
+     * states are compared. The checksum of the end state is logged for
+     * comparing builds. 0 (the default) disables the check. Must be called
+     * before the stage is set up.
+     */
+    void SetReplayCheck(int numSteps) { m_replayCheckSteps = numSteps; }
+
+    /**
+     * Steps the physics world stepsPerSecond fixed steps per simulated
+     * second; the default is 60. With enabled set, the motions of the
+     * vehicle and the pillars are swept in the steps in which they move
+     * further than about half their size, and cut short where they would
+     * pass through another object; this keeps the fast bodies from
+     * tunnelling at a lower step rate. The step rate, the step time and
+     * the motions cut short are logged with the score. Must be called
+     * before the stage is set up; CCD is disabled by default.
+     */
+    void SetContinuousCollision(bool enabled, int stepsPerSecond = 60)
+    {
+        m_continuousCollision = enabled;
+        m_physicsStepsPerSecond = stepsPerSecond;
+    }
+
+    /**
+     * Counts the steps in which the center of the vehicle or a pillar
+     * passes through another object, by casting a ray along its motion
+     * after each step. The incidents are logged with the score; the time
+     * of the check is left out of the physics times. Must be called before
+     * the stage is set up; defaults to false.
+     */
+    void SetTunnellingCheck(bool check) { m_checkTunnelling = check; }
+
+    /**
+     * Runs a scene query workload alongside the stage: every frame,
+     * raysPerFrame rays and sweepsPerFrame sphere sweeps are cast from the
+     * camera across its view, as one batch each on numThreads threads
+     * including the rendering one. The queries per second of query time
+     * are logged and reported with the score. 0 rays and sweeps (the
+     * default) disable the workload. Must be called before the stage is
+     * set up.
+     */
+    void SetQueryBenchmark(int raysPerFrame, int sweepsPerFrame,
+                           int numThreads = 1)
+    {
+        m_queryRaysPerFrame = raysPerFrame;
+        m_querySweepsPerFrame = sweepsPerFrame;
+        m_queryThreads = numThreads;
+    }
+
+    /**
+     * Keeps the state of the bodies as they were created, at setup or at
+     * the start of each stress level, for RestartPhysics(). Outside of the
+     * stress mode the world is also kept when the stage is torn down, and
+     * the next set-up restarts it instead of rebuilding it; the world and
+     * its snapshot, which covers every body including the terrain, stay
+     * in memory in between. Must be called before the stage is set up;
+     * defaults to false.
+     */
+    void SetRestartable(bool restartable) { m_restartable = restartable; }
+
+    /**
+     * Puts the bodies back into the state they were created in, at setup
+     * or at the start of the current stress level, without rebuilding the
+     * world. The animations and timers of the stage are not affected.
+     * Returns false if the stage was not made restartable or the state
+     * could not be restored.
+     */
+    bool RestartPhysics();
+
 protected: // From BaseStage
     bool SetupImpl();
     void RenderImpl(const TimeSample& time);
@@ -61,31 +430,75 @@ protected: // From BaseStage
 
 private:
     void Animate(const TimeSample& time);
-    void UpdateDefaultUniforms(const float* objectTransform);
-    void PrepareRenderWall();
-    void RenderPillarsDepthMap(float* vpMatrix);
-    void RenderTreeTrunksDepthMap(float* vpMatrix);
-    void RenderTreeLeavesDepthMap(float* vpMatrix);
+    void UpdateDefaultUniforms(ObjectUniforms& uniforms,
+                               const float* objectTransform);
+    const float* MultiplyBatchTransforms(const float* matrix);
+    const float* MultiplyVisibleTransforms(const SceneInstanceStore& instances,
+                                           const std::vector<int>& visible,
+                                           const float* matrix);
+    void CullInstances(const float* planes, const float* transforms,
+                       int count, float radius, std::vector<int>& visible);
+    void CullObjects(const float* vpMatrix, VisibleObjects& visible);
+    void RenderPillarsDepthMap(float* vpMatrix,
+                               const VisibleObjects& visible);
+    void RenderTreeTrunksDepthMap(float* vpMatrix,
+                                  const std::vector<int>& visible);
+    void RenderTreeLeavesDepthMap(float* vpMatrix,
+                                  const std::vector<int>& visible);
     void RenderDepthMap();
+    void UpdateShadowCascades();
+    void UpdateCascadeUniforms(const CascadeUniformLocs& locs);
+    void GetCascadeUniformLocations(GLuint program, CascadeUniformLocs& locs);
     void RenderSkybox(float* viewMatrix);
-    void PrepareRenderPillars();
-    void RenderPillars(float* vpMatrix, GLint mvpLoc);
+    void RenderPillars(float* vpMatrix, GLint mvpLoc,
+                       const std::vector<int>& visible);
+    void RenderPillarsInstanced(float* vpMatrix);
+    void UpdatePillarInstances();
     void RenderTerrain(float* vMatrix, float* vpMatrix);
     void RenderWalkway(float* vpMatrix);
-    void RenderTrees(float* vpMatrix);
-    void RenderWallCorners(float* vpMatrix, GLint mvpLoc);
-    void RenderWallSegments(float* vpMatrix, GLint mvpLoc);
+    void GatherVisibleTransforms(const SceneInstanceStore& instances,
+                                 const std::vector<int>& visible);
+    void GatherObjectUniforms(std::vector<ObjectUniforms>& uniforms,
+                              int numObjects, const std::vector<int>& visible);
+    void QueueObjects(int pass, GLuint texture, int mesh, int firstTransform,
+                      int numTransforms, bool backToFront);
+    void QueueCameraPass(float* vpMatrix);
+    static void DrawQueueCallback(void* userData, const DrawItem& item);
+    void RenderDrawItem(const DrawItem& item);
+    void RenderWallCorners(float* vpMatrix, GLint mvpLoc,
+                           const std::vector<int>& visible);
+    void RenderWallSegments(float* vpMatrix, GLint mvpLoc,
+                            const std::vector<int>& visible);
     void SetupWheelRender(const float* wheelTransform,
                           const float* objectTransform,
                           const float* vpMatrix, GLint mvpLoc);
     void UpdateVehicleUniforms(const float* objectTransform);
     void RenderVehicle(float* vpMatrix, GLint mvpLoc);
     void DetectSunVisibility(float* vpMatrix);
+    void UpdateSunVisibility();
+    void ReadSunQueries();
+    void IssueSunQueries();
+    bool SetupSunQueries();
+    void TeardownSunQueries();
     void RenderLensFlares();
     void StepPhysics();
+    void StepWorld(btScalar timeStep, int maxSubSteps,
+                   btScalar fixedTimeStep);
     void CopyPhysicsTransforms();
+    void InterpolatePhysicsTransforms();
+    void UpdatePillarTransform(int index, const float* transform);
+    void SampleActivity(int numActiveBodies);
+    void LogActivitySamples();
+    void WritePhysicsState(PhysicsState& state);
+    bool StartPhysicsThread();
+    void StopPhysicsThread();
+    void PhysicsThreadLoop();
+    static void* PhysicsThreadMethod(void* data);
     static void BulletTickCallback(btDynamicsWorld* world, btScalar timeStep);
+    bool SetupPhysics();
+    void TeardownPhysics();
     void SetupPhysicsEngine();
+    btBroadphaseInterface* CreateBroadphase();
     void SetupLensFlares();
     static void TimerCallback(SimpleTimer* timer, int timerId);
     void AddTransAnim(float initialX, float initialY, float initialZ,
@@ -97,13 +510,42 @@ private:
                       float destinationZ,
                       float initialDelay, float duration, float* location);
     void SetupAnimations();
+    ShadowQuality SelectShadowQuality();
     bool SetupShadowMapping();
+    int MaxPillars() const;
+    bool SetupInstancing();
+    void TeardownInstancing();
     void CreatePillars();
+    void CreatePillarGrid(int numRows, int numColumns, float spacing);
+    void CreatePillarPile(int numPillars);
+    void GetStressLevelSize(int level, int& numRows, int& numColumns,
+                            int& numExtraBodies) const;
+    void CreateStressLevel(int level);
+    void FinishStressLevel();
+    void NextStressLevel();
+    void UpdateStressResults();
+    void TakeInitialSnapshot();
+    bool RestorePhysics(const PhysicsSnapshot& snapshot);
+    void CheckReplay();
+    void ResetPhysicsProfile();
+    double CollectPhysicsProfile();
+    void UpdatePhysicsProfileResults();
+    void UpdateBroadphaseResults();
+    void UpdateContinuousCollisionResults();
+    void CheckTunnelling(btDynamicsWorld* world);
+    void SetupSceneQueries();
+    void AimQueries(int numQueries, float length);
+    void RunSceneQueries();
+    void UpdateSceneQueryResults();
+    void CountStepAllocations(const PhysicsAllocatorStats& before);
+    void LogStepAllocations();
+    void CountPoolOverflows(int before, double stepTime);
+    void LogPoolOverflows();
     void CreateVehicle();
-    void AddNewPillar(float x, float y, float z);
-    void AddBodies(std::list<ObjectInstance*>& objects);
+    void AddNewPillar(float x, float y, float z, bool lying = false);
+    void AddBodies(SceneInstanceStore& objects);
     void DestroyBodies(std::vector<btRigidBody*>& bodies);
-    void DestroyObjects(std::list<ObjectInstance*>& objects);
+    void DestroyObjects(SceneInstanceStore& objects);
 
 private: // Data
     // Shader programs
@@ -113,6 +555,8 @@ private: // Data
     GLuint m_shadowMapProgram;
     GLuint m_shadowMapTransparentProgram;
     GLuint m_vehicleProgram;
+    GLuint m_defaultInstancedProgram;
+    GLuint m_shadowMapInstancedProgram;
 
     // Textures
     GLuint m_pillarTexture;
@@ -153,13 +597,74 @@ private: // Data
     GLint m_vehicleShadowMatrixLoc;
     GLint m_vehicleShininessLoc;
     GLint m_vehicleSpecularColorLoc;
+    GLint m_defaultInstancedVpLoc;
+    GLint m_defaultInstancedTextureLoc;
+    GLint m_defaultInstancedLightPosLoc;
+    GLint m_defaultInstancedShadowTextureLoc;
+    GLint m_defaultInstancedShadowMatrixLoc;
+    GLint m_shadowMapInstancedVpLoc;
+    CascadeUniformLocs m_defaultCascadeLocs;
+    CascadeUniformLocs m_terrainCascadeLocs;
+    CascadeUniformLocs m_vehicleCascadeLocs;
+    CascadeUniformLocs m_defaultInstancedCascadeLocs;
+
+    // Attribute locations for the per-instance model matrices
+    GLint m_defaultInstancedModelMatrixLoc;
+    GLint m_shadowMapInstancedModelMatrixLoc;
 
     // Shadow mapping
     GLuint m_shadowMapTexture;
     GLuint m_shadowMapFBO;
     GLuint m_shadowMapDepthRenderBuffer;
     bool m_shadowMapping;
-    float m_lightMatrix[16];
+    ShadowQuality m_shadowQuality;
+    int m_shadowMapWidth;
+    int m_shadowMapHeight;
+    float m_lightViewMatrix[16]; // World -> light view space
+
+    // Shadow cascades, nearest first
+    ShadowCascade m_cascades[MaxShadowCascades];
+    int m_numCascades;
+    int m_cascadeSize; // Cascade tile size (m_cascadeSize * m_cascadeSize)
+
+    // Scratch space for the batched matrix calculations; the transforms
+    // are gathered into m_batchTransforms and the results are written
+    // into m_batchMatrices
+    std::vector<const float*> m_batchTransforms;
+    std::vector<float> m_batchMatrices;
+
+    // Cached uniforms of the objects drawn with the default program; the
+    // camera pass gathers the visible ones into m_batchUniforms alongside
+    // m_batchTransforms
+    std::vector<ObjectUniforms> m_pillarUniforms;
+    std::vector<ObjectUniforms> m_wallCornerUniforms;
+    std::vector<ObjectUniforms> m_wallSegmentUniforms;
+    std::vector<ObjectUniforms> m_treeUniforms;
+    ObjectUniforms m_walkwayUniforms;
+    std::vector<ObjectUniforms*> m_batchUniforms;
+
+    // Frustum culling results for this frame
+    VisibleObjects m_cameraVisible;
+    std::vector<int> m_cullScratch;
+
+    // Culling statistics over the whole stage
+    int m_totalCameraCulled;
+    int m_totalLightCulled; // Summed over the cascades
+    int m_totalTerrainIndices;
+
+    // The camera pass is queued and drawn sorted by render state; the
+    // state changes go through the cache
+    GLStateCache m_stateCache;
+    DrawQueue m_drawQueue;
+    int m_lastDrawMesh;
+    float m_cameraViewMatrix[16];
+    float m_cameraVpMatrix[16];
+
+    // Draw queue / state change statistics over the whole stage
+    int m_totalDrawItems;
+    int m_totalStateChanges;
+    int m_totalRedundantStateChanges;
+    int m_totalObjectUniformUpdates;
 
     // List of active animations
     std::list<BaseAnimation*> m_animations;
@@ -171,20 +676,36 @@ private: // Data
     // Lens flares
     int m_lensFlareMaxSize;
     std::list<LensFlare> m_lensFlares;
-    bool m_sunVisible;
+    bool m_sunOnScreen;
     int m_sunScreenX;
     int m_sunScreenY;
     TimeSample* m_lastSunVisibilityTestTime;
 
+    // Sun visibility for the lens flares; 0.0 (hidden) .. 1.0 (fully
+    // visible). Fades towards the target measured by the queries.
+    float m_sunVisibility;
+    float m_sunVisibilityTarget;
+
+    // Occlusion query sets for the sun visibility, used as a ring buffer;
+    // empty if queries are not supported, in which case the visibility is
+    // probed with glReadPixels()
+    std::vector<GLuint> m_sunQueries;
+    GLuint m_sunSampleVertexBuffer;
+    int m_oldestSunQuerySet;
+    int m_numPendingSunQuerySets;
+
     // Objects
     PhysicsStageStatics* m_statics;
     Pillar* m_pillar;
+
+    // Per-instance pillar transforms; NULL if instancing is not in use
+    InstanceBuffer* m_pillarInstances;
     Skybox* m_skybox;
     Vehicle* m_vehicle;
 
-    // Vehicle wheel rotation
-    RotationAnimation* m_wheelRotationAnimation;
-    float m_wheelRotation;
+    // Vehicle wheel rotations for this frame, in radians
+    float m_frontWheelRotation;
+    float m_rearWheelRotation;
 
     // Object physics shapes
     btCollisionShape* m_pillarShape;
@@ -192,21 +713,150 @@ private: // Data
 
     // Object instances / physics rigid bodies
     std::vector<btRigidBody*> m_pillarBodies;
-    std::list<ObjectInstance*> m_terrains;
-    std::list<ObjectInstance*> m_wallSegments;
-    std::list<ObjectInstance*> m_wallCorners;
-    std::list<ObjectInstance*> m_trees;
+    std::vector<float> m_pillarTransforms; // Packed copy, updated per frame
+    SceneInstanceStore m_terrains;
+    SceneInstanceStore m_wallSegments;
+    SceneInstanceStore m_wallCorners;
+    SceneInstanceStore m_trees;
     btRigidBody* m_vehicleBody;
 
-    // Physics engine objects
+    // The raycast vehicle riding on m_vehicleBody, and the raycaster
+    // casting the rays of its wheels
+    BatchedVehicleRaycaster* m_vehicleRaycaster;
+    RaycastVehicle* m_raycastVehicle;
+
+    // Physics engine objects. All of Bullet's allocations, and the motion
+    // states of the dynamic bodies, come from the stage's own allocator
+    PhysicsAllocator* m_allocator;
     btBroadphaseInterface* m_broadphase;
+    TunedDbvtBroadphase* m_tunedBroadphase; // NULL if not in use
+    PhysicsBroadphase m_broadphaseType;
+    DbvtBroadphaseTuning m_broadphaseTuning;
     btDefaultCollisionConfiguration* m_collisionConfiguration;
-    btCollisionDispatcher* m_dispatcher;
-    btSequentialImpulseConstraintSolver* m_solver;
-    btDiscreteDynamicsWorld* m_dynamicsWorld;
+    PooledCollisionDispatcher* m_dispatcher;
+    ParallelCollisionDispatcher* m_parallelDispatcher; // NULL if not in use
+    int m_collisionThreads;
+    bool m_measureCollisionScaling;
+    std::vector<SimdConstraintSolver*> m_solvers; // One per solver thread
+    RowKernels m_rowKernels;
+    bool m_benchmarkRowKernels;
+    ContinuousDynamicsWorld* m_dynamicsWorld;
+    ParallelDynamicsWorld* m_parallelWorld; // NULL if not in use
+    int m_solverThreads;
+
+    // Fixed time step of the world; see SetContinuousCollision()
+    bool m_continuousCollision;
+    int m_physicsStepsPerSecond;
+    btScalar m_physicsTimeStep;
 
     // Time of the previous physics step / frame render
     timeval m_lastStepTime;
+
+    // Physics thread; steps the world at a fixed rate and hands the body
+    // states over to the renderer through m_physicsStates
+    bool m_threadedPhysics;
+    pthread_t m_physicsThread;
+    volatile bool m_physicsThreadAlive;
+    bool m_physicsThreadRunning;
+    volatile int m_numPhysicsSteps;
+
+    // Serializes the changes made to the world by the render thread (the
+    // timer callbacks) with the physics steps
+    pthread_mutex_t m_physicsMutex;
+
+    // The two latest physics states taken by the renderer; it draws the
+    // scene interpolated between these
+    PhysicsStateBuffer m_physicsStates;
+    PhysicsState m_previousPhysicsState;
+    PhysicsState m_currentPhysicsState;
+
+    // Whether the tick callback watches for the pillars to first collide;
+    // the vehicle coasts from then on
+    bool m_detectPillarCollisions;
+
+    // Tunnelling check; see SetTunnellingCheck(). The centers of the
+    // pillars and the vehicle, last, after the previous step; empty when
+    // the bodies have been moved outside the steps. The incidents and the
+    // time of the check, in milliseconds, are counted by the thread
+    // stepping the world
+    bool m_checkTunnelling;
+    btAlignedObjectArray<btVector3> m_tunnellingCenters;
+    int m_numPillarTunnellings;
+    int m_numVehicleTunnellings;
+    double m_tunnellingCheckTime;
+
+    // Stress mode; see SetStressMode(). The counters of the running level
+    // are updated by the thread stepping the world
+    int m_stressRows;
+    int m_stressColumns;
+    int m_stressExtraBodies;
+    int m_numStressLevels;
+    int m_stressLevel; // -1 if not in stress mode
+    StressLevelResult m_stressCounters;
+    std::vector<StressLevelResult> m_stressResults;
+
+    // State of the bodies as they were created, for restarting the physics
+    // or checking the replay; NULL when neither is requested
+    PhysicsSnapshot* m_initialSnapshot;
+    bool m_restartable;
+    int m_replayCheckSteps;
+
+    // Bullet's profile samples, collected by the thread stepping the world
+    // after every step: the total time of the steps and the time of each
+    // phase, in milliseconds
+    double m_physicsProfileTime;
+    double m_physicsPhaseTimes[NumPhysicsPhases];
+
+    // Steps profiled since the profile was reset
+    int m_numProfiledSteps;
+
+    // Simulation steps taken in the profiled steps, and the overlapping
+    // broadphase pairs summed over them
+    int m_numSimulationSteps;
+    double m_numBroadphasePairs;
+
+    // Allocations made by the profiled steps, and the latest step that
+    // needed memory from the heap
+    PhysicsAllocatorStats m_stepAllocations;
+    int m_lastHeapAllocationStep;
+
+    // The profiled steps in which the collision pools overflowed, and
+    // their total time in milliseconds
+    int m_numPoolOverflowSteps;
+    double m_poolOverflowStepTime;
+
+    // Set for the pillars drawn at rest with the physics thread; their
+    // transforms are left alone until they wake up
+    std::vector<bool> m_pillarResting;
+
+    // Awake pillars over the stage, sampled every few seconds; the frames
+    // and awake pillars of the interval being sampled are summed up
+    std::vector<ActivitySample> m_activitySamples;
+    double m_activityStartTime;
+    double m_activityIntervalStart;
+    int m_activityIntervalFrames;
+    double m_activityIntervalBodies;
+    double m_totalActiveBodies;
+
+    // Scene query workload; see SetQueryBenchmark(). The queries of the
+    // frame and their results, and the totals over the stage with the
+    // query times in seconds
+    SceneQueryBatch* m_sceneQueries; // NULL if not in use
+    int m_queryRaysPerFrame;
+    int m_querySweepsPerFrame;
+    int m_queryThreads;
+    btSphereShape* m_querySphere;
+    btAlignedObjectArray<btVector3> m_queryFrom;
+    btAlignedObjectArray<btVector3> m_queryTo;
+    SceneQueryResults m_queryResults;
+    double m_numQueryRays;
+    double m_numQuerySweeps;
+    double m_numQueryHits;
+    double m_queryRayTime;
+    double m_querySweepTime;
+
+    // The vehicle's transform for this frame
+    float m_vehicleTransform[16];
 };
 
 #endif // PILLARSTAGE_H
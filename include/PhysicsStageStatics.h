@@ -1,14 +1,12 @@
 #ifndef PILLARSGROUND_H
 #define PILLARSGROUND_H
 
-#include <vector>
-#include <list>
-
 #include <btBulletDynamicsCommon.h>
 #include "OpenGLAPI.h"
 
 // Forward declarations
-class ObjectInstance;
+class SceneInstanceStore;
+class ChunkedTerrain;
 
 /**
  * Represents the ground & all static objects in the physics scene.
@@ -23,15 +21,26 @@ public: // Construction and destruction
     static PhysicsStageStatics* Create();
 
 public: // Public API
-    void CreateObjects(std::list<ObjectInstance*>& terrains, 
-                       std::list<ObjectInstance*>& wallCorners,
-                       std::list<ObjectInstance*>& wallSegments,
-                       std::list<ObjectInstance*>& trees);
+    /** Half dimensions of the renderable objects; used for culling. */
+    static btVector3 GetWallSegmentExtents();
+    static btVector3 GetWallCornerExtents();
+    static btVector3 GetTreeExtents();
+
+    void CreateObjects(SceneInstanceStore& terrains,
+                       SceneInstanceStore& wallCorners,
+                       SceneInstanceStore& wallSegments,
+                       SceneInstanceStore& trees);
     void PrepareRenderWallSegment();
     void RenderWallSegment();
     void PrepareRenderWallCorner();
     void RenderWallCorner();
-    void RenderTerrain();
+
+    /**
+     * Renders the terrain chunks within the frustum; see
+     * ChunkedTerrain::Render(). Returns the number of indices drawn.
+     */
+    int RenderTerrain(const float* frustumPlanes, const float* eyePosition);
+
     void PrepareRenderTreeTrunkShadowMap();
     void PrepareRenderTreeLeavesShadowMap();
     void PrepareRenderTreeTrunk();
@@ -43,31 +52,34 @@ public: // Public API
 private:
     bool Setup();
     PhysicsStageStatics();
+    void CreateTerrainShape();
     void AddStaticBody(const btVector3& translation,
                        const btQuaternion& rotation,
                        btCollisionShape* shape,
-                       std::list<ObjectInstance*>& objects);
+                       SceneInstanceStore& objects);
     void AddWallSegment(float x, float y, float z, const btQuaternion& rotation,
-                        std::list<ObjectInstance*>& objects);
+                        SceneInstanceStore& objects);
     void AddWallCorner(float x, float y, float z,
-                       std::list<ObjectInstance*>& objects);
+                       SceneInstanceStore& objects);
     void AddTree(float x, float y, float z, float yRotAngle,
-                 std::list<ObjectInstance*>& objects);
+                 SceneInstanceStore& objects);
 
 private: // Data
     // Vertex/index buffers
     GLuint m_wallSegmentVertexBuffer;
     GLuint m_wallCornerVertexBuffer;
-    GLuint m_terrainVertexBuffer;
-    GLuint m_terrainIndexBuffer;
     GLuint m_treeVertexBuffer;
     GLuint m_treeLeavesIndexBuffer;
     GLuint m_treeTrunkIndexBuffer;
     GLuint m_walkwayVertexBuffer;
     GLuint m_walkwayIndexBuffer;
 
-    // Collision shapes
-    btStaticPlaneShape* m_floorShape;
+    // Terrain, split into chunks
+    ChunkedTerrain* m_terrain;
+
+    // Collision shapes; the terrain shape uses the render mesh directly
+    btTriangleIndexVertexArray* m_terrainMesh;
+    btBvhTriangleMeshShape* m_terrainShape;
     btBoxShape* m_wallSegmentShape;
     btBoxShape* m_wallCornerShape;
 };
@@ -0,0 +1,82 @@
+#ifndef PHYSICSSTATEBUFFER_H
+#define PHYSICSSTATEBUFFER_H
+
+#include <vector>
+
+// Number of floats per body in PhysicsState::m_bodies; the orientation
+// quaternion (x, y, z, w) followed by the position (x, y, z)
+static const int PhysicsStateBodySize = 7;
+
+/**
+ * The orientations and positions of the dynamic bodies, and the rotations
+ * of the vehicle wheels, after a physics step.
+ */
+struct PhysicsState
+{
+    PhysicsState() : m_time(0.0), m_frontWheelRotation(0.0),
+        m_rearWheelRotation(0.0) {}
+
+    // Time the state is for, in seconds
+    double m_time;
+
+    // PhysicsStateBodySize floats per body
+    std::vector<float> m_bodies;
+
+    // Whether each body was awake after the step; a sleeping body keeps
+    // its transform until it is woken up
+    std::vector<bool> m_active;
+
+    // Rotation of the vehicle's front and rear wheels, in radians
+    float m_frontWheelRotation;
+    float m_rearWheelRotation;
+};
+
+/**
+ * Lock-free triple buffer handing physics states from the physics thread
+ * (the writer) over to the render thread (the reader). The writer and the
+ * reader each own one of the three states and swap it with the latest
+ * published one; neither ever waits for the other. The reader always gets
+ * the newest complete state; the ones published in between are dropped.
+ *
+ * There must be exactly one writer and one reader thread.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class PhysicsStateBuffer
+{
+public: // Construction and destruction
+    PhysicsStateBuffer();
+    ~PhysicsStateBuffer();
+
+public: // Public API
+    /** Returns the writer's state to be filled in. */
+    PhysicsState& WriteState() { return m_states[m_writeIndex]; }
+
+    /** Publishes the writer's state; the writer gets another to fill in. */
+    void Publish();
+
+    /**
+     * Takes the latest published state as the reader's state. Returns
+     * false, keeping the reader's state, if nothing has been published
+     * since the previous call.
+     */
+    bool Acquire();
+
+    /** Returns the reader's state. */
+    const PhysicsState& ReadState() const { return m_states[m_readIndex]; }
+
+    /** Forgets any published state. Neither thread may be using the buffer. */
+    void Reset();
+
+private: // Data
+    PhysicsState m_states[3];
+    int m_writeIndex;
+    int m_readIndex;
+
+    // Index of the latest published state, with a flag set if the reader
+    // has not taken it yet
+    volatile int m_sharedIndex;
+};
+
+#endif // PHYSICSSTATEBUFFER_H
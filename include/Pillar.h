@@ -22,6 +22,9 @@ public: // Public API
     void PrepareRender();
     void Render();
 
+    /** Renders numInstances pillars; requires instancing support. */
+    void RenderInstanced(int numInstances);
+
     /** Returns the extents for the Bullet collision shape. */
     static btVector3 GetExtents();
 
@@ -0,0 +1,45 @@
+#ifndef POOLEDCOLLISIONDISPATCHER_H
+#define POOLEDCOLLISIONDISPATCHER_H
+
+#include <btBulletCollisionCommon.h>
+
+/**
+ * Collision dispatcher that counts the pool overflows: the contact
+ * manifolds and collision algorithms that did not fit in the pools of the
+ * collision configuration and had to be allocated from the heap in the
+ * middle of a step.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class PooledCollisionDispatcher : public btCollisionDispatcher
+{
+public: // Construction and destruction
+    PooledCollisionDispatcher(btCollisionConfiguration* collisionConfiguration);
+    virtual ~PooledCollisionDispatcher();
+
+public: // Public API
+    /** Returns the number of manifolds allocated outside the pool. */
+    int NumManifoldPoolOverflows() const { return m_numManifoldPoolOverflows; }
+
+    /** Returns the number of algorithms allocated outside the pool. */
+    int NumAlgorithmPoolOverflows() const
+    {
+        return m_numAlgorithmPoolOverflows;
+    }
+
+public: // From btCollisionDispatcher
+    virtual btPersistentManifold* getNewManifold(void* b0, void* b1);
+    virtual void* allocateCollisionAlgorithm(int size);
+
+protected:
+    // Count an overflow; may be called from several threads at once
+    void CountManifoldPoolOverflow();
+    void CountAlgorithmPoolOverflow();
+
+private: // Data
+    volatile int m_numManifoldPoolOverflows;
+    volatile int m_numAlgorithmPoolOverflows;
+};
+
+#endif // POOLEDCOLLISIONDISPATCHER_H
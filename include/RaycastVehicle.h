@@ -0,0 +1,116 @@
+#ifndef RAYCASTVEHICLE_H
+#define RAYCASTVEHICLE_H
+
+#include <btBulletDynamicsCommon.h>
+
+/**
+ * Vehicle raycaster that looks up the objects under all the wheels with a
+ * single broadphase query per step. btDefaultVehicleRaycaster walks the
+ * broadphase once for every wheel ray; here the objects overlapping the
+ * box around all the rays are gathered once by FindCandidates(), and each
+ * ray is then only tested against the candidates whose bounding boxes it
+ * crosses.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class BatchedVehicleRaycaster : public btVehicleRaycaster
+{
+public: // Construction and destruction
+    BatchedVehicleRaycaster(btCollisionWorld* world);
+    virtual ~BatchedVehicleRaycaster();
+
+public: // Public API
+    /**
+     * Gathers the objects the given rays may hit, except for the excluded
+     * one; the rays cast until the next call are only tested against them.
+     */
+    void FindCandidates(const btVector3* rayFrom, const btVector3* rayTo,
+                        int numRays, const btCollisionObject* exclude);
+
+    /** Returns the number of broadphase queries made. */
+    int NumQueries() const { return m_numQueries; }
+
+    /** Returns the number of rays cast. */
+    int NumRays() const { return m_numRays; }
+
+    /** Returns the number of rays tested against the candidate shapes. */
+    int NumShapeTests() const { return m_numShapeTests; }
+
+    /** Resets the query counters. */
+    void ResetCounters();
+
+public: // From btVehicleRaycaster
+    virtual void* castRay(const btVector3& from, const btVector3& to,
+                          btVehicleRaycasterResult& result);
+
+private: // Data
+    btCollisionWorld* m_world;
+
+    // The objects found by the last query and their bounding boxes
+    btAlignedObjectArray<btCollisionObject*> m_candidates;
+    btAlignedObjectArray<btVector3> m_candidateAabbMin;
+    btAlignedObjectArray<btVector3> m_candidateAabbMax;
+
+    // Query counters
+    int m_numQueries;
+    int m_numRays;
+    int m_numShapeTests;
+};
+
+/**
+ * btRaycastVehicle that casts the rays of its wheels through a
+ * BatchedVehicleRaycaster, and drives itself at a set speed.
+ *
+ * The vehicle is driven by its rear wheels towards the negative z axis of
+ * the chassis; it is set up with setCoordinateSystem(0, 1, 2).
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class RaycastVehicle : public btRaycastVehicle
+{
+public: // Construction and destruction
+    RaycastVehicle(const btVehicleTuning& tuning, btRigidBody* chassis,
+                   BatchedVehicleRaycaster& raycaster);
+    virtual ~RaycastVehicle();
+
+public: // Public API
+    /**
+     * Accelerates the vehicle at most at the given rate (in m/s^2) up to
+     * the given speed (in m/s) and holds it there; releases the brakes.
+     */
+    void Drive(btScalar speed, btScalar acceleration);
+
+    /** Lets the vehicle roll freely. */
+    void Coast();
+
+    /** Stops driving and holds all the wheels with the given brake force. */
+    void Brake(btScalar force);
+
+    /**
+     * Puts the wheels back to rest and stops driving; called when the
+     * chassis has been put back to an earlier state.
+     */
+    void Reset(btScalar brakeForce);
+
+public: // From btRaycastVehicle
+    virtual void updateVehicle(btScalar step);
+
+private:
+    void ApplyDriveForce(btScalar step);
+
+private: // Data
+    BatchedVehicleRaycaster& m_raycaster;
+
+    // Wheel rays of the current step
+    btAlignedObjectArray<btVector3> m_rayFrom;
+    btAlignedObjectArray<btVector3> m_rayTo;
+
+    // Speed to drive at and the acceleration to get there; no engine
+    // force when the acceleration is zero
+    btScalar m_driveSpeed;
+    btScalar m_driveAcceleration;
+};
+
+#endif // RAYCASTVEHICLE_H
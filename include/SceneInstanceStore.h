@@ -0,0 +1,74 @@
+#ifndef SCENEINSTANCESTORE_H
+#define SCENEINSTANCESTORE_H
+
+#include <btBulletDynamicsCommon.h>
+
+/**
+ * Contiguous storage for a group of visual object instances (eg. all the
+ * wall segments), optionally backed by Bullet collision bodies. The data
+ * is kept as a structure of arrays: the 4x4 transforms are packed one
+ * after another in a 16-byte aligned array, with parallel arrays for the
+ * type ids and bodies, so render passes can walk linear memory and hand
+ * all the transforms to the batched matrix kernels or an instance buffer
+ * at once.
+ *
+ * The transforms are captured when the instance is added, so body backed
+ * instances are meant for static (immovable) bodies.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class SceneInstanceStore
+{
+public: // Construction and destruction
+    SceneInstanceStore();
+    ~SceneInstanceStore();
+
+public: // Public API
+    /**
+     * Adds an instance of a Bullet rigid body with an optional freeform
+     * type id; the transform is read from the body's motion state.
+     * Does NOT take ownership of the rigid body. Returns the index of the
+     * new instance.
+     */
+    int Add(btRigidBody* rigidBody, int type = 0);
+
+    /**
+     * Adds an instance with a transform and optional freeform type id.
+     *
+     * @param transform must point to a float[16]
+     */
+    int Add(const float* transform, int type = 0);
+
+    /** Removes all the instances. Does not delete the bodies. */
+    void Clear();
+
+    int Count() const { return m_types.size(); }
+    bool Empty() const { return (m_types.size() == 0); }
+
+    /** Returns all the transforms, packed; Count() * 16 floats. */
+    const float* Transforms() const
+    {
+        return Empty() ? NULL : &m_transforms[0];
+    }
+
+    const float* GetTransform(int index) const
+    {
+        return &m_transforms[index * 16];
+    }
+    int GetType(int index) const { return m_types[index]; }
+    btRigidBody* GetBody(int index) const { return m_bodies[index]; }
+
+    /**
+     * Multiplies all the transforms by matrix into out, which must have
+     * room for Count() * 16 floats: out[i] = transform[i] * matrix.
+     */
+    void MultiplyTransforms(const float* matrix, float* out) const;
+
+private: // Data
+    btAlignedObjectArray<float> m_transforms;
+    btAlignedObjectArray<int> m_types;
+    btAlignedObjectArray<btRigidBody*> m_bodies;
+};
+
+#endif // SCENEINSTANCESTORE_H
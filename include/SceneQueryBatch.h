@@ -0,0 +1,154 @@
+#ifndef SCENEQUERYBATCH_H
+#define SCENEQUERYBATCH_H
+
+#include <pthread.h>
+#include <vector>
+
+#include <btBulletCollisionCommon.h>
+
+// Forward declarations
+class ProxyTester;
+
+// Maximum number of scene query threads
+static const int MaxSceneQueryThreads = 8;
+
+/**
+ * Closest hits of a batch of scene queries, as one array per field with
+ * an element for each query. The point, normal and object are only set
+ * for the queries that hit something.
+ */
+struct SceneQueryResults
+{
+    SceneQueryResults() : m_numHits(0) {}
+
+    /** Sizes the arrays for the given number of queries. */
+    void Resize(int numQueries)
+    {
+        m_hitFraction.resize(numQueries);
+        m_hitPoint.resize(numQueries);
+        m_hitNormal.resize(numQueries);
+        m_hitObject.resize(numQueries);
+    }
+
+    /** Frees the arrays. */
+    void Clear()
+    {
+        m_hitFraction.clear();
+        m_hitPoint.clear();
+        m_hitNormal.clear();
+        m_hitObject.clear();
+        m_numHits = 0;
+    }
+
+    // Fraction of the way from the start to the end of the query where
+    // it hit; 1.0 if it did not
+    btAlignedObjectArray<btScalar> m_hitFraction;
+
+    // Hit point and surface normal, in world coordinates
+    btAlignedObjectArray<btVector3> m_hitPoint;
+    btAlignedObjectArray<btVector3> m_hitNormal;
+
+    // Object hit; NULL if none
+    btAlignedObjectArray<const btCollisionObject*> m_hitObject;
+
+    // Number of queries that hit something
+    int m_numHits;
+};
+
+/**
+ * Casts batches of rays and convex sweeps into a collision world on a
+ * pool of worker threads, and returns the closest hit of each.
+ *
+ * btCollisionWorld::rayTest() and convexSweepTest() cannot be called from
+ * several threads at once: btDbvt walks the tree along the ray with a
+ * stack shared by all callers, and the queries against compound shapes
+ * temporarily replace the shape of the collision object. Here each thread
+ * walks the broadphase tree with a stack of its own and hands the objects
+ * to btCollisionWorld::rayTestSingle() / objectQuerySingle(), going into
+ * the children of compound shapes itself. The walk skips the tree nodes
+ * beyond the closest hit found so far.
+ *
+ * The broadphase trees are walked directly when the world's broadphase
+ * is a btDbvtBroadphase; with other broadphases each query only looks up
+ * the objects within its bounding box with an AABB query.
+ *
+ * The world must not be changed or stepped while a batch is running.
+ * The objects are tested with the default collision filter.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class SceneQueryBatch
+{
+public: // Construction and destruction
+    /**
+     * Creates a batch with the given number of threads, including the
+     * calling one. dbvt is the broadphase of the world if it is a
+     * btDbvtBroadphase, otherwise NULL. Returns NULL on failure.
+     */
+    static SceneQueryBatch* Create(btCollisionWorld* world,
+                                   btDbvtBroadphase* dbvt, int numThreads);
+    ~SceneQueryBatch();
+
+public: // Public API
+    int NumThreads() const { return m_numThreads; }
+
+    /** Casts the rays from[i] .. to[i]. */
+    void CastRays(const btVector3* from, const btVector3* to, int numRays,
+                  SceneQueryResults& results);
+
+    /**
+     * Sweeps the shape, without rotating it, from from[i] to to[i]. The
+     * shape must be convex.
+     */
+    void SweepShape(const btConvexShape* shape, const btVector3* from,
+                    const btVector3* to, int numSweeps,
+                    SceneQueryResults& results);
+
+private:
+    SceneQueryBatch(btCollisionWorld* world, btDbvtBroadphase* dbvt,
+                    int numThreads);
+    bool Setup();
+    void RunQueries(int numQueries);
+    void ProcessQueries(int thread, int numThreads);
+    void WalkBroadphase(int thread, const btVector3& from,
+                        const btVector3& to, const btVector3& shapeMin,
+                        const btVector3& shapeMax, ProxyTester& tester);
+    void WalkTree(int thread, const btDbvtNode* root, const btVector3& from,
+                  const btVector3& directionInverse,
+                  const unsigned int* signs, btScalar length,
+                  const btVector3& shapeMin, const btVector3& shapeMax,
+                  ProxyTester& tester);
+    void WorkerThreadLoop(int thread);
+    static void* WorkerThreadMethod(void* data);
+
+private: // Data
+    btCollisionWorld* m_world;
+    btDbvtBroadphase* m_dbvt;
+    int m_numThreads;
+
+    // The batch being run; m_shape is NULL for rays
+    const btConvexShape* m_shape;
+    const btVector3* m_from;
+    const btVector3* m_to;
+    SceneQueryResults* m_results;
+    int m_numQueries;
+
+    // Per thread tree walk stacks, broadphase candidates and hit counts
+    btAlignedObjectArray<const btDbvtNode*> m_stacks[MaxSceneQueryThreads];
+    btAlignedObjectArray<btBroadphaseProxy*>
+            m_candidates[MaxSceneQueryThreads];
+    int m_numHits[MaxSceneQueryThreads];
+
+    // Worker threads and their synchronization. A new batch is started by
+    // incrementing the generation
+    std::vector<pthread_t> m_threads;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_startCondition;
+    pthread_cond_t m_doneCondition;
+    int m_generation;
+    int m_numBusyThreads;
+    bool m_threadsAlive;
+};
+
+#endif // SCENEQUERYBATCH_H
@@ -0,0 +1,120 @@
+#ifndef SIMDCONSTRAINTSOLVER_H
+#define SIMDCONSTRAINTSOLVER_H
+
+#include <btBulletDynamicsCommon.h>
+
+/**
+ * Row kernel implementations of SimdConstraintSolver.
+ */
+enum RowKernels
+{
+    // The best one available on the device
+    RowKernelsAuto = 0,
+
+    // Bullet's own scalar rows
+    RowKernelsGeneric,
+
+    // x86 SSE2 rows
+    RowKernelsSse,
+
+    // ARM NEON rows
+    RowKernelsNeon
+};
+
+/**
+ * Sequential impulse constraint solver whose constraint rows are solved
+ * with SIMD kernels selected at runtime.
+ *
+ * Bullet's own SSE rows are only compiled in when BT_USE_SSE is defined
+ * (Visual Studio and 32-bit Mac builds) and have no NEON counterpart.
+ * This solver replaces the iteration loops of
+ * btSequentialImpulseConstraintSolver with ones that call the selected
+ * kernels: SSE2 on x86 and NEON on ARM, where the compiler targets them.
+ * The kernels perform the same floating point operations in the same
+ * order as the generic rows, so they give identical results.
+ *
+ * The kernels are used when the solver mode includes SOLVER_SIMD (the
+ * default). With SOLVER_RANDMIZE_ORDER, or when the generic rows are
+ * selected, the solving is left to btSequentialImpulseConstraintSolver.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class SimdConstraintSolver : public btSequentialImpulseConstraintSolver
+{
+public: // Construction and destruction
+    /** Creates a solver using the best available row kernels. */
+    SimdConstraintSolver();
+    virtual ~SimdConstraintSolver();
+
+public: // Public API
+    /**
+     * Selects the row kernels. Returns false, keeping the current ones, if
+     * the given kernels are not available on this device.
+     */
+    bool SetRowKernels(RowKernels kernels);
+
+    /** Returns the selected row kernels; never RowKernelsAuto. */
+    RowKernels ActiveRowKernels() const { return m_rowKernels; }
+
+    /** Returns whether the given row kernels are available. */
+    static bool RowKernelsAvailable(RowKernels kernels);
+
+    /** Returns a printable name of the row kernels. */
+    static const char* RowKernelsName(RowKernels kernels);
+
+    /**
+     * Micro-benchmark of the row kernels: solves the given number of
+     * random constraint rows numPasses times with each available
+     * implementation and logs the time per row and the largest deviation
+     * from the generic rows. Returns false if any kernels give results
+     * different from the generic ones.
+     */
+    static bool BenchmarkRowKernels(int numRows, int numPasses);
+
+public: // Row kernel signature
+    /**
+     * Solves one constraint row between two bodies; the velocities are
+     * those of the bodies the row is applied to. With clampUpper unset
+     * only the lower limit of the row is applied.
+     */
+    typedef void (*SolveRowFunction)(btRigidBody& body1, btRigidBody& body2,
+                                     const btSolverConstraint& c,
+                                     btVector3& linearVelocity1,
+                                     btVector3& angularVelocity1,
+                                     btVector3& linearVelocity2,
+                                     btVector3& angularVelocity2,
+                                     btScalar rhs,
+                                     btSimdScalar& appliedImpulse,
+                                     bool clampUpper);
+
+protected: // From btSequentialImpulseConstraintSolver
+    virtual void solveGroupCacheFriendlySplitImpulseIterations(
+            btCollisionObject** bodies, int numBodies,
+            btPersistentManifold** manifoldPtr, int numManifolds,
+            btTypedConstraint** constraints, int numConstraints,
+            const btContactSolverInfo& infoGlobal, btIDebugDraw* debugDrawer,
+            btStackAlloc* stackAlloc);
+    virtual btScalar solveGroupCacheFriendlyIterations(
+            btCollisionObject** bodies, int numBodies,
+            btPersistentManifold** manifoldPtr, int numManifolds,
+            btTypedConstraint** constraints, int numConstraints,
+            const btContactSolverInfo& infoGlobal, btIDebugDraw* debugDrawer,
+            btStackAlloc* stackAlloc);
+
+private:
+    bool UseRowKernels(const btContactSolverInfo& infoGlobal) const;
+    void SolveIteration(int iteration, btTypedConstraint** constraints,
+                        int numConstraints,
+                        const btContactSolverInfo& infoGlobal);
+    void ResolveRow(const btSolverConstraint& c);
+    void ResolveRowLowerLimit(const btSolverConstraint& c);
+    void ResolveSplitPenetration(const btSolverConstraint& c);
+    void SolveBenchmarkRows(btConstraintArray& rows, int numPasses);
+
+private: // Data
+    RowKernels m_rowKernels;
+    SolveRowFunction m_solveRow;
+};
+
+#endif // SIMDCONSTRAINTSOLVER_H
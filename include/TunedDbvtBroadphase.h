@@ -0,0 +1,76 @@
+#ifndef TUNEDDBVTBROADPHASE_H
+#define TUNEDDBVTBROADPHASE_H
+
+#include <btBulletCollisionCommon.h>
+
+/**
+ * Tuning parameters of the dynamic AABB tree broadphase; the defaults are
+ * the ones btDbvtBroadphase is created with.
+ */
+struct DbvtBroadphaseTuning
+{
+    DbvtBroadphaseTuning() : m_deferredCollide(false),
+        m_dynamicOptimizePercent(0), m_fixedOptimizePercent(1),
+        m_cleanupPercent(10), m_velocityPrediction(0.0) {}
+
+    // Find the new pairs of the moved proxies all at once, tree against
+    // tree, at the end of the AABB update instead of one proxy at a time
+    // as each of them moves
+    bool m_deferredCollide;
+
+    // Percentage of the leaves of the dynamic / fixed tree re-inserted
+    // each step to keep the tree balanced
+    int m_dynamicOptimizePercent;
+    int m_fixedOptimizePercent;
+
+    // Percentage of the overlapping pairs checked each step for pairs
+    // that no longer overlap
+    int m_cleanupPercent;
+
+    // How far ahead a moving proxy's leaf is stretched in the direction
+    // of the movement, relative to the half extents of its AABB; a
+    // stretched leaf needs to be re-inserted less often
+    float m_velocityPrediction;
+};
+
+/**
+ * btDbvtBroadphase for a world of mostly static geometry.
+ *
+ * btDbvtBroadphase keeps two trees: the proxies that moved lately are in
+ * the dynamic tree, which is refitted incrementally as they move, and
+ * the rest are moved into the fixed tree. All proxies start out in the
+ * dynamic tree, and the fixed tree is only balanced a little each step.
+ * FreezeStaticProxies() moves the proxies of the static objects into the
+ * fixed tree at once and builds it top down, so that the dynamic tree
+ * only holds the moving bodies from the start.
+ *
+ * The world must not update the AABBs of the static objects, or they move
+ * back into the dynamic tree; see
+ * btCollisionWorld::setForceUpdateAllAabbs().
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class TunedDbvtBroadphase : public btDbvtBroadphase
+{
+public: // Construction and destruction
+    TunedDbvtBroadphase(const DbvtBroadphaseTuning& tuning);
+    virtual ~TunedDbvtBroadphase();
+
+public: // Public API
+    /**
+     * Moves the proxies of the static objects into the fixed tree and
+     * rebuilds the tree top down. Called after the static objects have
+     * been added, and again whenever they have been re-added. Returns the
+     * number of proxies moved.
+     */
+    int FreezeStaticProxies();
+
+    /** Returns the number of proxies in the fixed tree. */
+    int NumFixedProxies() const { return m_sets[FIXED_SET].m_leaves; }
+
+    /** Returns the number of proxies in the dynamic tree. */
+    int NumDynamicProxies() const { return m_sets[DYNAMIC_SET].m_leaves; }
+};
+
+#endif // TUNEDDBVTBROADPHASE_H
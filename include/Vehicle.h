@@ -5,6 +5,39 @@
 
 #include "OpenGLAPI.h"
 
+/** The wheels of the vehicle. */
+enum VehicleWheel
+{
+    FrontRightWheel = 0,
+    FrontLeftWheel,
+    RearRightWheel,
+    RearLeftWheel,
+    NumVehicleWheels
+};
+
+/**
+ * Collision shape of the vehicle: the convex hulls of the body and the
+ * four wheels in a compound. The hulls are generated offline by
+ * tools/hull2c.cpp. Owns the hull shapes.
+ *
+ * The wheel hulls can be lifted up from where the wheels are drawn; a
+ * raycast vehicle rides on the rays of its wheels, and the hulls only
+ * keep the wheels from going through the objects next to them.
+ *
+ * @author Matti Dahlbom
+ * @since 0.1
+ */
+class VehicleShape : public btCompoundShape
+{
+public: // Construction and destruction
+    VehicleShape(btScalar wheelLift = 0.0);
+    virtual ~VehicleShape();
+
+private:
+    void AddHull(const float* vertices, int numVertices,
+                 const btTransform& transform);
+};
+
 /**
  * Represents a vehicle in the physics scene.
  *
@@ -18,7 +51,7 @@ public: // Construction and deconstruction
    ~Vehicle();
 
 public: // Public API
-    void UpdateWheelTransforms(float rotation);
+    void UpdateWheelTransforms(float frontRotation, float rearRotation);
     void RenderBody();
     void PrepareRenderFrontWheel();
     void RenderFrontWheel();
@@ -41,9 +74,15 @@ public: // Public API
         return m_rearLeftWheelTransform;
     }
 
-    /** Returns the extents for the Bullet collision shape. */
+    /** Returns the outer extents of the vehicle. */
     static btVector3 GetExtents();
 
+    /** Returns the center of a wheel relative to the body, as drawn. */
+    static btVector3 GetWheelPosition(VehicleWheel wheel);
+
+    /** Returns the radius of a wheel. */
+    static float GetWheelRadius(VehicleWheel wheel);
+
 private:
     Vehicle();
     bool Setup();
@@ -9,9 +9,12 @@
 #include "ChesspieceAnimation.h"
 #include "ScalarAnimation.h"
 #include "MatrixOperations.h"
+#include "MatrixKernels.h"
 #include "Skybox.h"
 #include "TextRenderer.h"
 #include "InfoPopupAnimation.h"
+#include "GLExtensions.h"
+#include "InstanceBuffer.h"
 
 // Width of one chessboard square
 static const float SqrW = 1.0;
@@ -87,6 +90,7 @@ ChessboardStage::ChessboardStage(TextRenderer& textRenderer,
       m_chessqueen(NULL),
       m_chessking(NULL),
       m_skybox(NULL),
+      m_pieceInstances(NULL),
       m_chessboardTopTexture(0),
       m_whiteMarbleTexture(0),
       m_darkMarbleTexture(0),
@@ -106,6 +110,8 @@ ChessboardStage::ChessboardStage(TextRenderer& textRenderer,
       m_xBlurProgram(0),
       m_yBlurProgram(0),
       m_combineProgram(0),
+      m_chesspieceInstancedProgram(0),
+      m_chesspieceReflInstancedProgram(0),
       m_chessboardMvpLoc(-1),
       m_chessboardMvLoc(-1),
       m_chessboardTextureLoc(-1),
@@ -128,7 +134,18 @@ ChessboardStage::ChessboardStage(TextRenderer& textRenderer,
       m_yBlurTextureLoc(-1),
       m_yBlurSampleHeightLoc(-1),
       m_combineUnblurredTextureLoc(-1),
-      m_combineBlurredTextureLoc(-1)
+      m_combineBlurredTextureLoc(-1),
+      m_chesspieceInstancedVpLoc(-1),
+      m_chesspieceInstancedVLoc(-1),
+      m_chesspieceInstancedTextureLoc(-1),
+      m_chesspieceInstancedEyeposLoc(-1),
+      m_chesspieceInstancedEnvmapLoc(-1),
+      m_chesspieceInstancedDofParamsLoc(-1),
+      m_chesspieceReflInstancedVpLoc(-1),
+      m_chesspieceReflInstancedTextureLoc(-1),
+      m_chesspieceReflInstancedEyeposLoc(-1),
+      m_chesspieceInstancedModelMatrixLoc(-1),
+      m_chesspieceReflInstancedModelMatrixLoc(-1)
 {
     memset(m_cameraTarget, 0, sizeof(m_cameraTarget));
     memset(m_cameraLocation, 0, sizeof(m_cameraLocation));
@@ -216,21 +233,19 @@ void ChessboardStage::RenderPieces(float* vMatrix, float* vpMatrix)
         ChesspieceInstance* piece = m_pieces[i];
 
         // Transform the camera position to object space
-        float inverseObjectTransform[16];
-        CalculateInverseTransform(piece->Transform(), inverseObjectTransform);
         float eyeObjectSpacePos[3];
-        Transformv3(inverseObjectTransform, m_cameraLocation,
-                    eyeObjectSpacePos);
+        InverseTransformPointRigid(piece->Transform(), m_cameraLocation,
+                                   eyeObjectSpacePos);
         glUniform3fv(m_chesspieceEyeposLoc, 1, eyeObjectSpacePos);
 
         // Calculate & upload mvp matrix
         float mvpMatrix[16];
-        MatrixMultiply(piece->Transform(), vpMatrix, mvpMatrix);
+        MatrixMultiplyKernel(piece->Transform(), vpMatrix, mvpMatrix);
         glUniformMatrix4fv(m_chesspieceMvpLoc, 1, GL_FALSE, mvpMatrix);
 
         // Calculate & upload mv matrix for blur
         float mvMatrix[16];
-        MatrixMultiply(piece->Transform(), vMatrix, mvMatrix);
+        MatrixMultiplyKernel(piece->Transform(), vMatrix, mvMatrix);
         glUniformMatrix4fv(m_chesspieceMvLoc, 1, GL_FALSE, mvMatrix);
 
         // Set fade value
@@ -277,8 +292,9 @@ void ChessboardStage::RenderReflectedPieces(float* vpMatrix)
         // Calculate mvp matrix
         float mvpMatrix[16];
         float objectMatrix[16];
-        MatrixMultiply(piece->Transform(), ReflectionScaleMatrix, objectMatrix);
-        MatrixMultiply(objectMatrix, vpMatrix, mvpMatrix);
+        MatrixMultiplyKernel(piece->Transform(), ReflectionScaleMatrix,
+                             objectMatrix);
+        MatrixMultiplyKernel(objectMatrix, vpMatrix, mvpMatrix);
         glUniformMatrix4fv(m_chesspieceReflMvpLoc, 1, GL_FALSE, mvpMatrix);
 
         // Set fade value
@@ -305,6 +321,149 @@ void ChessboardStage::RenderReflectedPieces(float* vpMatrix)
     glStencilFunc(GL_ALWAYS, 0, 0);
 }
 
+void ChessboardStage::UpdatePieceInstances()
+{
+    // Group the pieces by geometry, texture and fade
+    m_pieceBatches.clear();
+    for ( unsigned int i = 0; i < m_pieces.size(); i++ )
+    {
+        ChesspieceInstance* piece = m_pieces[i];
+        unsigned int b = 0;
+        for ( ; b < m_pieceBatches.size(); b++ )
+        {
+            PieceBatch& batch = m_pieceBatches[b];
+            if ( (batch.m_object == &piece->Object()) &&
+                 (batch.m_texture == piece->Texture()) &&
+                 (batch.m_fade == piece->Fade()) )
+            {
+                break;
+            }
+        }
+
+        if ( b == m_pieceBatches.size() )
+        {
+            PieceBatch batch;
+            batch.m_object = &piece->Object();
+            batch.m_texture = piece->Texture();
+            batch.m_fade = piece->Fade();
+            batch.m_firstInstance = 0;
+            batch.m_numInstances = 0;
+            m_pieceBatches.push_back(batch);
+        }
+        m_pieceBatches[b].m_numInstances++;
+    }
+
+    // Lay out the batches one after another in the instance buffer
+    int firstInstance = 0;
+    for ( unsigned int b = 0; b < m_pieceBatches.size(); b++ )
+    {
+        m_pieceBatches[b].m_firstInstance = firstInstance;
+        firstInstance += m_pieceBatches[b].m_numInstances;
+        m_pieceBatches[b].m_numInstances = 0;
+    }
+
+    // Write the transforms; the counts are rebuilt while doing so
+    for ( unsigned int i = 0; i < m_pieces.size(); i++ )
+    {
+        ChesspieceInstance* piece = m_pieces[i];
+        for ( unsigned int b = 0; b < m_pieceBatches.size(); b++ )
+        {
+            PieceBatch& batch = m_pieceBatches[b];
+            if ( (batch.m_object == &piece->Object()) &&
+                 (batch.m_texture == piece->Texture()) &&
+                 (batch.m_fade == piece->Fade()) )
+            {
+                int index = batch.m_firstInstance + batch.m_numInstances;
+                memcpy(m_pieceInstances->InstanceMatrix(index),
+                       piece->Transform(), 16 * sizeof(float));
+                batch.m_numInstances++;
+                break;
+            }
+        }
+    }
+
+    m_pieceInstances->Upload(m_pieces.size());
+}
+
+void ChessboardStage::RenderPieceBatches(GLint textureLoc,
+                                         GLint modelMatrixLoc)
+{
+    GLuint texture = 0;
+    float fade = -1;
+
+    for ( unsigned int b = 0; b < m_pieceBatches.size(); b++ )
+    {
+        const PieceBatch& batch = m_pieceBatches[b];
+
+        // Set fade value
+        if ( batch.m_fade != fade )
+        {
+            fade = batch.m_fade;
+            glBlendColor(0.0, 0.0, 0.0, fade);
+        }
+
+        // Only set main texture when needed
+        if ( texture != batch.m_texture )
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glUniform1i(textureLoc, 0);
+            glBindTexture(GL_TEXTURE_2D, batch.m_texture);
+            texture = batch.m_texture;
+        }
+
+        m_pieceInstances->Bind(modelMatrixLoc, batch.m_firstInstance);
+        batch.m_object->RenderInstanced(batch.m_numInstances);
+    }
+
+    m_pieceInstances->Unbind(modelMatrixLoc);
+}
+
+void ChessboardStage::RenderPiecesInstanced(float* vMatrix, float* vpMatrix)
+{
+    glUseProgram(m_chesspieceInstancedProgram);
+
+    // Lighting is done against the world space eye position; the shader
+    // transforms it into each instance's object space
+    glUniformMatrix4fv(m_chesspieceInstancedVpLoc, 1, GL_FALSE, vpMatrix);
+    glUniformMatrix4fv(m_chesspieceInstancedVLoc, 1, GL_FALSE, vMatrix);
+    glUniform3fv(m_chesspieceInstancedEyeposLoc, 1, m_cameraLocation);
+
+    // Set DoF parameters
+    glUniform2fv(m_chesspieceInstancedDofParamsLoc, 1, m_dofParams);
+
+    glActiveTexture(GL_TEXTURE1);
+    glUniform1i(m_chesspieceInstancedEnvmapLoc, 1);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_skyboxTexture);
+
+    // Use constant alpha for blending, leaving actual alpha channel
+    // for the depth blur information
+    glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+
+    RenderPieceBatches(m_chesspieceInstancedTextureLoc,
+                       m_chesspieceInstancedModelMatrixLoc);
+}
+
+void ChessboardStage::RenderReflectedPiecesInstanced(float* vpMatrix)
+{
+    glUseProgram(m_chesspieceReflInstancedProgram);
+    glCullFace(GL_FRONT);
+
+    // Set stencil params so that we only draw where stencil buffer value = 1
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glStencilFunc(GL_EQUAL, 1, 1);
+
+    // The reflection flip is applied in the vertex shader
+    glUniformMatrix4fv(m_chesspieceReflInstancedVpLoc, 1, GL_FALSE, vpMatrix);
+    glUniform3fv(m_chesspieceReflInstancedEyeposLoc, 1, m_cameraLocation);
+
+    RenderPieceBatches(m_chesspieceReflInstancedTextureLoc,
+                       m_chesspieceReflInstancedModelMatrixLoc);
+
+    glCullFace(GL_BACK);
+
+    glStencilFunc(GL_ALWAYS, 0, 0);
+}
+
 void ChessboardStage::RenderSkybox(float* viewMatrix)
 {
     // Extract rotation from the view matrix and calculate (m)vp matrix
@@ -459,7 +618,15 @@ void ChessboardStage::RenderImpl(const TimeSample& time)
     glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_FALSE);
 
     // Draw the pieces inverted (reflection)
-    RenderReflectedPieces(vpMatrix);
+    if ( m_pieceInstances != NULL )
+    {
+        UpdatePieceInstances();
+        RenderReflectedPiecesInstanced(vpMatrix);
+    }
+    else
+    {
+        RenderReflectedPieces(vpMatrix);
+    }
     glDisable(GL_STENCIL_TEST);
 
     // Re-enable writing all components
@@ -469,7 +636,14 @@ void ChessboardStage::RenderImpl(const TimeSample& time)
     RenderBoard(lookat, vpMatrix);
 
     // Draw the pieces
-    RenderPieces(lookat, vpMatrix);
+    if ( m_pieceInstances != NULL )
+    {
+        RenderPiecesInstanced(lookat, vpMatrix);
+    }
+    else
+    {
+        RenderPieces(lookat, vpMatrix);
+    }
 
     glDisable(GL_BLEND);
 
@@ -699,6 +873,75 @@ bool ChessboardStage::SetupOffscreenRendering()
     return true;
 }
 
+bool ChessboardStage::SetupInstancing()
+{
+    if ( !InstancingSupported() )
+    {
+        return false;
+    }
+
+    if ( !LoadShaderFromBundle("ChesspieceInstanced",
+                               &m_chesspieceInstancedProgram) )
+    {
+        return false;
+    }
+
+    if ( !LoadShaderFromBundle("ChesspieceReflectionInstanced",
+                               &m_chesspieceReflInstancedProgram) )
+    {
+        return false;
+    }
+
+    m_chesspieceInstancedVpLoc =
+            glGetUniformLocation(m_chesspieceInstancedProgram, "vp_matrix");
+    m_chesspieceInstancedVLoc =
+            glGetUniformLocation(m_chesspieceInstancedProgram, "v_matrix");
+    m_chesspieceInstancedTextureLoc =
+            glGetUniformLocation(m_chesspieceInstancedProgram, "texture");
+    m_chesspieceInstancedEyeposLoc =
+            glGetUniformLocation(m_chesspieceInstancedProgram, "eye_pos");
+    m_chesspieceInstancedEnvmapLoc =
+            glGetUniformLocation(m_chesspieceInstancedProgram, "env_cube_map");
+    m_chesspieceInstancedDofParamsLoc =
+            glGetUniformLocation(m_chesspieceInstancedProgram, "dof_params");
+    m_chesspieceInstancedModelMatrixLoc =
+            glGetAttribLocation(m_chesspieceInstancedProgram,
+                                "in_modelMatrix");
+
+    m_chesspieceReflInstancedVpLoc =
+            glGetUniformLocation(m_chesspieceReflInstancedProgram,
+                                 "vp_matrix");
+    m_chesspieceReflInstancedTextureLoc =
+            glGetUniformLocation(m_chesspieceReflInstancedProgram, "texture");
+    m_chesspieceReflInstancedEyeposLoc =
+            glGetUniformLocation(m_chesspieceReflInstancedProgram, "eye_pos");
+    m_chesspieceReflInstancedModelMatrixLoc =
+            glGetAttribLocation(m_chesspieceReflInstancedProgram,
+                                "in_modelMatrix");
+
+    if ( (m_chesspieceInstancedModelMatrixLoc < 0) ||
+         (m_chesspieceReflInstancedModelMatrixLoc < 0) )
+    {
+        return false;
+    }
+
+    m_pieceInstances = InstanceBuffer::Create(m_pieces.size());
+
+    return (m_pieceInstances != NULL);
+}
+
+void ChessboardStage::TeardownInstancing()
+{
+    delete m_pieceInstances;
+    m_pieceInstances = NULL;
+    m_pieceBatches.clear();
+
+    UnloadShader(m_chesspieceInstancedProgram);
+    m_chesspieceInstancedProgram = 0;
+    UnloadShader(m_chesspieceReflInstancedProgram);
+    m_chesspieceReflInstancedProgram = 0;
+}
+
 bool ChessboardStage::SetupImpl()
 {
     LOG_DEBUG("ChessboardStage::Setup()");
@@ -850,6 +1093,13 @@ bool ChessboardStage::SetupImpl()
     // Setup the chess pieces
     SetupPieces();
 
+    // Draw the pieces in batches of instances if possible
+    if ( !SetupInstancing() )
+    {
+        LOG_DEBUG("Instanced rendering disabled.");
+        TeardownInstancing();
+    }
+
     // Setup DoF params
     m_dofParams[0] = 4.0;
     m_dofParams[1] = 4.0;
@@ -888,6 +1138,8 @@ void ChessboardStage::TeardownImpl()
     UnloadShader(m_yBlurProgram);
     UnloadShader(m_combineProgram);
 
+    TeardownInstancing();
+
     for ( size_t i = 0; i < m_pieces.size(); i++ )
     {
         delete m_pieces[i];
@@ -7,6 +7,7 @@
 #include "Chessqueen_data.h"
 #include "Chessking_data.h"
 #include "CommonFunctions.h"
+#include "GLExtensions.h"
 
 Chesspiece::Chesspiece()
     : m_numPolygons(0),
@@ -23,7 +24,7 @@ Chesspiece::~Chesspiece()
     glDeleteBuffers(1, &m_indexBuffer);
 }
 
-void Chesspiece::Render()
+void Chesspiece::BindBuffers()
 {
     glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
     glVertexAttribPointer(COORD_INDEX, 3, GL_FLOAT, GL_FALSE,
@@ -37,9 +38,21 @@ void Chesspiece::Render()
                           (const GLvoid*)offsetof(VertexAttribs, nx));
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+}
+
+void Chesspiece::Render()
+{
+    BindBuffers();
     glDrawElements(GL_TRIANGLES, m_numPolygons * 3, m_indicesDatatype, NULL);
 }
 
+void Chesspiece::RenderInstanced(int numInstances)
+{
+    BindBuffers();
+    DrawElementsInstanced(GL_TRIANGLES, m_numPolygons * 3, m_indicesDatatype,
+                          NULL, numInstances);
+}
+
 bool Chesspiece::Setup(Chesspiece::Type type)
 {
     // Create vertex/index buffers
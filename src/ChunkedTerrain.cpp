@@ -0,0 +1,348 @@
+#include <math.h>
+#include <map>
+#include <algorithm>
+
+#include "ChunkedTerrain.h"
+#include "CommonFunctions.h"
+#include "MatrixKernels.h"
+
+// The terrain is split into NumChunksPerSide x NumChunksPerSide chunks on
+// the XZ plane
+static const int NumChunksPerSide = 4;
+
+// Vertex clustering cell sizes for each detail level (in meters); level 0
+// is the original mesh
+static const float LodCellSizes[TerrainNumLodLevels] = { 0.0, 10.0, 20.0 };
+
+// Minimum distance from the eye to a chunk for each detail level
+static const float LodDistances[TerrainNumLodLevels] = { 0.0, 80.0, 160.0 };
+
+// Vertices falling into the same clustering cell
+struct VertexCluster
+{
+    VertexCluster()
+        : m_sumX(0.0), m_sumZ(0.0), m_count(0),
+          m_representative(0), m_representativeDistance(-1.0) {}
+
+    float m_sumX;
+    float m_sumZ;
+    int m_count;
+
+    // The vertex closest to the cluster's average position; all the
+    // vertices in the cluster are replaced by this one. The distance is
+    // negative until one has been picked.
+    GLushort m_representative;
+    float m_representativeDistance;
+};
+
+typedef std::pair<int, int> CellKey;
+
+static CellKey CellOf(const VertexAttribs& vertex, float cellSize)
+{
+    return CellKey((int)floor(vertex.x / cellSize),
+                   (int)floor(vertex.z / cellSize));
+}
+
+ChunkedTerrain::ChunkedTerrain()
+    : m_vertexBuffer(0),
+      m_indexBuffer(0)
+{
+}
+
+ChunkedTerrain::~ChunkedTerrain()
+{
+    glDeleteBuffers(1, &m_vertexBuffer);
+    glDeleteBuffers(1, &m_indexBuffer);
+}
+
+ChunkedTerrain* ChunkedTerrain::Create(const VertexAttribs* vertices,
+                                       int numVertices,
+                                       const GLushort* indices,
+                                       int numIndices)
+{
+    ChunkedTerrain* terrain = new ChunkedTerrain();
+    if ( !terrain->Setup(vertices, numVertices, indices, numIndices) )
+    {
+        delete terrain;
+        LOG_DEBUG("ChunkedTerrain::Setup() failed");
+        return NULL;
+    }
+    else
+    {
+        return terrain;
+    }
+}
+
+void ChunkedTerrain::BuildLod(const VertexAttribs* vertices,
+                              const std::vector<GLushort>& chunkIndices,
+                              const std::vector<bool>& locked, float cellSize,
+                              std::vector<GLushort>& lodIndices)
+{
+    // Assign the movable vertices to cells and calculate the cell averages
+    std::map<GLushort, CellKey> vertexCells;
+    std::map<CellKey, VertexCluster> clusters;
+    for ( unsigned int i = 0; i < chunkIndices.size(); i++ )
+    {
+        GLushort index = chunkIndices[i];
+        if ( locked[index] || (vertexCells.count(index) > 0) )
+        {
+            continue;
+        }
+
+        const VertexAttribs& vertex = vertices[index];
+        CellKey cell = CellOf(vertex, cellSize);
+        vertexCells[index] = cell;
+
+        VertexCluster& cluster = clusters[cell];
+        cluster.m_sumX += vertex.x;
+        cluster.m_sumZ += vertex.z;
+        cluster.m_count++;
+    }
+
+    // Pick the vertex closest to the average as the cluster representative
+    std::map<GLushort, CellKey>::const_iterator iter = vertexCells.begin();
+    for ( ; iter != vertexCells.end(); iter++ )
+    {
+        const VertexAttribs& vertex = vertices[iter->first];
+        VertexCluster& cluster = clusters[iter->second];
+        float dx = vertex.x - (cluster.m_sumX / cluster.m_count);
+        float dz = vertex.z - (cluster.m_sumZ / cluster.m_count);
+        float distance = (dx * dx) + (dz * dz);
+        if ( (cluster.m_representativeDistance < 0.0) ||
+             (distance < cluster.m_representativeDistance) )
+        {
+            cluster.m_representative = iter->first;
+            cluster.m_representativeDistance = distance;
+        }
+    }
+
+    // Remap the triangles, dropping the ones that collapse
+    lodIndices.clear();
+    for ( unsigned int i = 0; i < chunkIndices.size(); i += 3 )
+    {
+        GLushort triangle[3];
+        for ( int j = 0; j < 3; j++ )
+        {
+            GLushort index = chunkIndices[i + j];
+            if ( !locked[index] )
+            {
+                index = clusters[vertexCells[index]].m_representative;
+            }
+            triangle[j] = index;
+        }
+
+        if ( (triangle[0] != triangle[1]) && (triangle[1] != triangle[2]) &&
+             (triangle[0] != triangle[2]) )
+        {
+            lodIndices.insert(lodIndices.end(), triangle, triangle + 3);
+        }
+    }
+}
+
+bool ChunkedTerrain::Setup(const VertexAttribs* vertices, int numVertices,
+                           const GLushort* indices, int numIndices)
+{
+    // Find the extents of the terrain on the XZ plane
+    float minX = vertices[0].x;
+    float maxX = vertices[0].x;
+    float minZ = vertices[0].z;
+    float maxZ = vertices[0].z;
+    for ( int i = 1; i < numVertices; i++ )
+    {
+        minX = std::min(minX, vertices[i].x);
+        maxX = std::max(maxX, vertices[i].x);
+        minZ = std::min(minZ, vertices[i].z);
+        maxZ = std::max(maxZ, vertices[i].z);
+    }
+    float chunkWidth = (maxX - minX) / NumChunksPerSide;
+    float chunkDepth = (maxZ - minZ) / NumChunksPerSide;
+
+    // Assign each triangle to the chunk its centroid falls into. Vertices
+    // shared by several chunks must not move or cracks would appear.
+    const int numChunks = NumChunksPerSide * NumChunksPerSide;
+    std::vector< std::vector<GLushort> > chunkIndices(numChunks);
+    std::vector<int> vertexChunks(numVertices, -1);
+    std::vector<bool> locked(numVertices, false);
+    for ( int i = 0; i < numIndices; i += 3 )
+    {
+        const VertexAttribs& a = vertices[indices[i]];
+        const VertexAttribs& b = vertices[indices[i + 1]];
+        const VertexAttribs& c = vertices[indices[i + 2]];
+        float x = (a.x + b.x + c.x) / 3.0;
+        float z = (a.z + b.z + c.z) / 3.0;
+        int column = std::min((int)((x - minX) / chunkWidth),
+                              NumChunksPerSide - 1);
+        int row = std::min((int)((z - minZ) / chunkDepth),
+                           NumChunksPerSide - 1);
+        int chunk = (row * NumChunksPerSide) + column;
+
+        for ( int j = 0; j < 3; j++ )
+        {
+            GLushort index = indices[i + j];
+            chunkIndices[chunk].push_back(index);
+            if ( vertexChunks[index] < 0 )
+            {
+                vertexChunks[index] = chunk;
+            }
+            else if ( vertexChunks[index] != chunk )
+            {
+                locked[index] = true;
+            }
+        }
+    }
+
+    // The vertices on the outer edges of the mesh are locked too so that
+    // the silhouette of the terrain stays intact; those edges are used by
+    // a single triangle only
+    std::vector<unsigned int> edges;
+    edges.reserve(numIndices);
+    for ( int i = 0; i < numIndices; i += 3 )
+    {
+        for ( int j = 0; j < 3; j++ )
+        {
+            unsigned int first = indices[i + j];
+            unsigned int second = indices[i + ((j + 1) % 3)];
+            edges.push_back((std::min(first, second) << 16) |
+                            std::max(first, second));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for ( unsigned int i = 0; i < edges.size(); )
+    {
+        unsigned int j = i + 1;
+        while ( (j < edges.size()) && (edges[j] == edges[i]) )
+        {
+            j++;
+        }
+        if ( (j - i) == 1 )
+        {
+            locked[edges[i] >> 16] = true;
+            locked[edges[i] & 0xffff] = true;
+        }
+        i = j;
+    }
+
+    // Build the detail levels of each chunk into a single index array
+    std::vector<GLushort> allIndices;
+    std::vector<GLushort> lodIndices;
+    int lodTotals[TerrainNumLodLevels] = { 0 };
+    for ( int i = 0; i < numChunks; i++ )
+    {
+        const std::vector<GLushort>& chunk = chunkIndices[i];
+        if ( chunk.empty() )
+        {
+            continue;
+        }
+
+        TerrainChunk terrainChunk;
+        for ( int axis = 0; axis < 3; axis++ )
+        {
+            const float* position = &vertices[chunk[0]].x;
+            terrainChunk.m_min[axis] = position[axis];
+            terrainChunk.m_max[axis] = position[axis];
+        }
+        for ( unsigned int j = 1; j < chunk.size(); j++ )
+        {
+            const float* position = &vertices[chunk[j]].x;
+            for ( int axis = 0; axis < 3; axis++ )
+            {
+                terrainChunk.m_min[axis] = std::min(terrainChunk.m_min[axis],
+                                                    position[axis]);
+                terrainChunk.m_max[axis] = std::max(terrainChunk.m_max[axis],
+                                                    position[axis]);
+            }
+        }
+
+        for ( int lod = 0; lod < TerrainNumLodLevels; lod++ )
+        {
+            if ( lod == 0 )
+            {
+                lodIndices = chunk;
+            }
+            else
+            {
+                BuildLod(vertices, chunk, locked, LodCellSizes[lod],
+                         lodIndices);
+            }
+
+            if ( lodIndices.empty() )
+            {
+                // Nothing left; keep using the previous level
+                terrainChunk.m_lodOffset[lod] =
+                        terrainChunk.m_lodOffset[lod - 1];
+                terrainChunk.m_lodCount[lod] = terrainChunk.m_lodCount[lod - 1];
+            }
+            else
+            {
+                terrainChunk.m_lodOffset[lod] = allIndices.size();
+                terrainChunk.m_lodCount[lod] = lodIndices.size();
+                allIndices.insert(allIndices.end(), lodIndices.begin(),
+                                  lodIndices.end());
+            }
+            lodTotals[lod] += terrainChunk.m_lodCount[lod];
+        }
+
+        m_chunks.push_back(terrainChunk);
+    }
+
+    LOG_DEBUG("ChunkedTerrain: %d chunks, indices per detail level: "
+              "%d / %d / %d", (int)m_chunks.size(),
+              lodTotals[0], lodTotals[1], lodTotals[2]);
+
+    // Create vertex/index buffers
+    glGenBuffers(1, &m_vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(VertexAttribs),
+                 vertices, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &m_indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, allIndices.size() * sizeof(GLushort),
+                 &allIndices[0], GL_STATIC_DRAW);
+
+    return (glGetError() == GL_NO_ERROR);
+}
+
+int ChunkedTerrain::Render(const float* frustumPlanes,
+                           const float* eyePosition)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+    SetVertexAttribsPointers();
+
+    int numIndicesDrawn = 0;
+    for ( unsigned int i = 0; i < m_chunks.size(); i++ )
+    {
+        const TerrainChunk& chunk = m_chunks[i];
+        if ( !AabbInFrustum(frustumPlanes, chunk.m_min, chunk.m_max) )
+        {
+            continue;
+        }
+
+        // Distance from the eye to the closest point of the chunk
+        float distanceSquared = 0.0;
+        for ( int axis = 0; axis < 3; axis++ )
+        {
+            float closest = std::max(chunk.m_min[axis],
+                                     std::min(eyePosition[axis],
+                                              chunk.m_max[axis]));
+            float d = eyePosition[axis] - closest;
+            distanceSquared += d * d;
+        }
+
+        int lod = 0;
+        while ( ((lod + 1) < TerrainNumLodLevels) &&
+                (distanceSquared >= (LodDistances[lod + 1] *
+                                     LodDistances[lod + 1])) )
+        {
+            lod++;
+        }
+
+        size_t offset = chunk.m_lodOffset[lod] * sizeof(GLushort);
+        glDrawElements(GL_TRIANGLES, chunk.m_lodCount[lod], GL_UNSIGNED_SHORT,
+                       (const GLvoid*)offset);
+        numIndicesDrawn += chunk.m_lodCount[lod];
+    }
+
+    return numIndicesDrawn;
+}
@@ -0,0 +1,143 @@
+#include <BulletDynamics/ConstraintSolver/btContactConstraint.h>
+
+#include "ContinuousDynamicsWorld.h"
+
+/**
+ * Finds the first object a body's swept sphere hits on its way, as the
+ * motion clamping of btDiscreteDynamicsWorld does: the body itself, the
+ * objects it does not respond to and the hits the body moves away from
+ * are ignored.
+ */
+class MotionSweepCallback
+    : public btCollisionWorld::ClosestConvexResultCallback
+{
+public:
+    MotionSweepCallback(btCollisionObject* body, const btVector3& from,
+                        const btVector3& to, btDispatcher* dispatcher,
+                        btScalar allowedPenetration)
+        : btCollisionWorld::ClosestConvexResultCallback(from, to),
+          m_body(body), m_dispatcher(dispatcher),
+          m_allowedPenetration(allowedPenetration)
+    {
+    }
+
+    virtual bool needsCollision(btBroadphaseProxy* proxy) const
+    {
+        btCollisionObject* object =
+                static_cast<btCollisionObject*>(proxy->m_clientObject);
+        return (object != m_body) &&
+               btCollisionWorld::ClosestConvexResultCallback::
+               needsCollision(proxy) &&
+               m_dispatcher->needsResponse(m_body, object);
+    }
+
+    virtual btScalar addSingleResult(
+            btCollisionWorld::LocalConvexResult& result,
+            bool normalInWorldSpace)
+    {
+        if ( (result.m_hitCollisionObject == m_body) ||
+             !result.m_hitCollisionObject->hasContactResponse() )
+        {
+            return 1.0;
+        }
+
+        btVector3 motion = m_convexToWorld - m_convexFromWorld;
+        if ( result.m_hitNormalLocal.dot(motion) >= -m_allowedPenetration )
+        {
+            return 1.0;
+        }
+
+        return btCollisionWorld::ClosestConvexResultCallback::
+                addSingleResult(result, normalInWorldSpace);
+    }
+
+private:
+    btCollisionObject* m_body;
+    btDispatcher* m_dispatcher;
+    btScalar m_allowedPenetration;
+};
+
+ContinuousDynamicsWorld::ContinuousDynamicsWorld(
+        btDispatcher* dispatcher, btBroadphaseInterface* broadphase,
+        btConstraintSolver* constraintSolver,
+        btCollisionConfiguration* collisionConfiguration)
+    : btDiscreteDynamicsWorld(dispatcher, broadphase, constraintSolver,
+                              collisionConfiguration),
+      m_numClampedMotions(0)
+{
+}
+
+ContinuousDynamicsWorld::~ContinuousDynamicsWorld()
+{
+}
+
+void ContinuousDynamicsWorld::integrateTransforms(btScalar timeStep)
+{
+    BT_PROFILE("integrateTransforms");
+    bool useContinuous = getDispatchInfo().m_useContinuous;
+    btTransform predictedTransform;
+    for ( int i = 0; i < m_nonStaticRigidBodies.size(); i++ )
+    {
+        btRigidBody* body = m_nonStaticRigidBodies[i];
+        body->setHitFraction(1.0);
+        if ( !body->isActive() || body->isStaticOrKinematicObject() )
+        {
+            continue;
+        }
+
+        body->predictIntegratedTransform(timeStep, predictedTransform);
+
+        btScalar squareMotion = (predictedTransform.getOrigin() -
+                body->getWorldTransform().getOrigin()).length2();
+        btScalar squareThreshold = body->getCcdSquareMotionThreshold();
+        if ( useContinuous && (squareThreshold > 0.0) &&
+             (squareThreshold < squareMotion) &&
+             ClampMotion(body, timeStep, predictedTransform) )
+        {
+            continue;
+        }
+
+        body->proceedToTransform(predictedTransform);
+    }
+}
+
+bool ContinuousDynamicsWorld::ClampMotion(
+        btRigidBody* body, btScalar timeStep,
+        const btTransform& predictedTransform)
+{
+    BT_PROFILE("CCD motion clamping");
+
+    // The sphere is swept without rotating the body
+    const btTransform& transform = body->getWorldTransform();
+    btTransform sweepEnd(transform.getBasis(), predictedTransform.getOrigin());
+    MotionSweepCallback callback(body, transform.getOrigin(),
+                                 sweepEnd.getOrigin(), getDispatcher(),
+                                 getDispatchInfo().m_allowedCcdPenetration);
+    callback.m_collisionFilterGroup =
+            body->getBroadphaseProxy()->m_collisionFilterGroup;
+    callback.m_collisionFilterMask =
+            body->getBroadphaseProxy()->m_collisionFilterMask;
+
+    btSphereShape sphere(body->getCcdSweptSphereRadius());
+    convexSweepTest(&sphere, transform, sweepEnd, callback);
+    if ( !callback.hasHit() || (callback.m_closestHitFraction >= 1.0) )
+    {
+        return false;
+    }
+
+    // Move up to the hit and respond to it as btDiscreteDynamicsWorld does
+    body->setHitFraction(callback.m_closestHitFraction);
+    btTransform clampedTransform;
+    body->predictIntegratedTransform(timeStep * body->getHitFraction(),
+                                     clampedTransform);
+    body->setHitFraction(0.0);
+    body->proceedToTransform(clampedTransform);
+
+    btScalar depth = 0.0;
+    resolveSingleCollision(body, callback.m_hitCollisionObject,
+                           callback.m_hitPointWorld, callback.m_hitNormalWorld,
+                           getSolverInfo(), depth);
+    m_numClampedMotions++;
+
+    return true;
+}
@@ -0,0 +1,60 @@
+#include <algorithm>
+
+#include "DrawQueue.h"
+
+static bool CompareDrawItems(const DrawItem& first, const DrawItem& second)
+{
+    if ( first.m_pass != second.m_pass )
+    {
+        return (first.m_pass < second.m_pass);
+    }
+    if ( first.m_program != second.m_program )
+    {
+        return (first.m_program < second.m_program);
+    }
+    if ( first.m_texture != second.m_texture )
+    {
+        return (first.m_texture < second.m_texture);
+    }
+    if ( first.m_mesh != second.m_mesh )
+    {
+        return (first.m_mesh < second.m_mesh);
+    }
+    return (first.m_depth < second.m_depth);
+}
+
+DrawQueue::DrawQueue(DrawCallback callback, void* userData)
+    : m_callback(callback),
+      m_userData(userData)
+{
+}
+
+DrawQueue::~DrawQueue()
+{
+}
+
+void DrawQueue::Add(int pass, GLuint program, GLuint texture, int mesh,
+                    float depth, int data)
+{
+    DrawItem item;
+    item.m_pass = pass;
+    item.m_program = program;
+    item.m_texture = texture;
+    item.m_mesh = mesh;
+    item.m_depth = depth;
+    item.m_data = data;
+    m_items.push_back(item);
+}
+
+void DrawQueue::Submit()
+{
+    // Stable so that items with equal keys are drawn in the order added
+    std::stable_sort(m_items.begin(), m_items.end(), CompareDrawItems);
+
+    for ( unsigned int i = 0; i < m_items.size(); i++ )
+    {
+        m_callback(m_userData, m_items[i]);
+    }
+
+    m_items.clear();
+}
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "GLExtensions.h"
+#include "CommonFunctions.h"
+
+#if !defined(__BUILD_DESKTOP__) && !defined(__IOS__)
+#include <EGL/egl.h>
+
+// Entry point types for the instancing functions; resolved at runtime
+// since the ES 2.0 headers do not necessarily declare them
+typedef void (GL_APIENTRYP DrawElementsInstancedFunc)(GLenum mode,
+                                                      GLsizei count,
+                                                      GLenum type,
+                                                      const GLvoid* indices,
+                                                      GLsizei primcount);
+typedef void (GL_APIENTRYP VertexAttribDivisorFunc)(GLuint index,
+                                                    GLuint divisor);
+
+static DrawElementsInstancedFunc DrawElementsInstancedPtr = NULL;
+static VertexAttribDivisorFunc VertexAttribDivisorPtr = NULL;
+
+// Entry point types for the occlusion query functions
+typedef void (GL_APIENTRYP GenQueriesFunc)(GLsizei n, GLuint* ids);
+typedef void (GL_APIENTRYP DeleteQueriesFunc)(GLsizei n, const GLuint* ids);
+typedef void (GL_APIENTRYP BeginQueryFunc)(GLenum target, GLuint id);
+typedef void (GL_APIENTRYP EndQueryFunc)(GLenum target);
+typedef void (GL_APIENTRYP GetQueryObjectuivFunc)(GLuint id, GLenum pname,
+                                                   GLuint* params);
+
+static GenQueriesFunc GenQueriesPtr = NULL;
+static DeleteQueriesFunc DeleteQueriesPtr = NULL;
+static BeginQueryFunc BeginQueryPtr = NULL;
+static EndQueryFunc EndQueryPtr = NULL;
+static GetQueryObjectuivFunc GetQueryObjectuivPtr = NULL;
+
+/**
+ * Resolves the instancing entry points with the given name suffixes.
+ */
+static bool ResolveInstancingFunctions(const char* drawSuffix,
+                                       const char* divisorSuffix)
+{
+    char name[64];
+
+    snprintf(name, sizeof(name), "glDrawElementsInstanced%s", drawSuffix);
+    DrawElementsInstancedPtr =
+            (DrawElementsInstancedFunc)eglGetProcAddress(name);
+
+    snprintf(name, sizeof(name), "glVertexAttribDivisor%s", divisorSuffix);
+    VertexAttribDivisorPtr =
+            (VertexAttribDivisorFunc)eglGetProcAddress(name);
+
+    return ((DrawElementsInstancedPtr != NULL) &&
+            (VertexAttribDivisorPtr != NULL));
+}
+
+/**
+ * Resolves the occlusion query entry points with the given name suffix.
+ */
+static bool ResolveQueryFunctions(const char* suffix)
+{
+    char name[64];
+
+    snprintf(name, sizeof(name), "glGenQueries%s", suffix);
+    GenQueriesPtr = (GenQueriesFunc)eglGetProcAddress(name);
+    snprintf(name, sizeof(name), "glDeleteQueries%s", suffix);
+    DeleteQueriesPtr = (DeleteQueriesFunc)eglGetProcAddress(name);
+    snprintf(name, sizeof(name), "glBeginQuery%s", suffix);
+    BeginQueryPtr = (BeginQueryFunc)eglGetProcAddress(name);
+    snprintf(name, sizeof(name), "glEndQuery%s", suffix);
+    EndQueryPtr = (EndQueryFunc)eglGetProcAddress(name);
+    snprintf(name, sizeof(name), "glGetQueryObjectuiv%s", suffix);
+    GetQueryObjectuivPtr = (GetQueryObjectuivFunc)eglGetProcAddress(name);
+
+    return ((GenQueriesPtr != NULL) && (DeleteQueriesPtr != NULL) &&
+            (BeginQueryPtr != NULL) && (EndQueryPtr != NULL) &&
+            (GetQueryObjectuivPtr != NULL));
+}
+#endif
+
+// Occlusion query tokens; the ES 3.0 values match the EXT ones
+#ifndef GL_ANY_SAMPLES_PASSED_EXT
+#define GL_ANY_SAMPLES_PASSED_EXT 0x8C2F
+#endif
+#ifndef GL_QUERY_RESULT_EXT
+#define GL_QUERY_RESULT_EXT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE_EXT
+#define GL_QUERY_RESULT_AVAILABLE_EXT 0x8867
+#endif
+
+// Whether the GL context has been probed yet / the probe result
+static bool InstancingChecked = false;
+static bool InstancingAvailable = false;
+static bool OcclusionQueriesChecked = false;
+static bool OcclusionQueriesAvailable = false;
+
+bool GLExtensionPresent(const char* extensionName)
+{
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    if ( extensions == NULL )
+    {
+        return false;
+    }
+
+    // Match whole, space-separated names only
+    size_t nameLength = strlen(extensionName);
+    const char* start = extensions;
+    while ( (start = strstr(start, extensionName)) != NULL )
+    {
+        if ( ((start == extensions) || (*(start - 1) == ' ')) &&
+             ((start[nameLength] == ' ') || (start[nameLength] == '\0')) )
+        {
+            return true;
+        }
+        start += nameLength;
+    }
+
+    return false;
+}
+
+static bool DetectInstancing()
+{
+#if defined(__BUILD_DESKTOP__)
+    // GLEW has resolved the ARB entry points on init
+    return (GLEW_ARB_draw_instanced && GLEW_ARB_instanced_arrays);
+#elif defined(__IOS__)
+#ifdef GL_EXT_instanced_arrays
+    return GLExtensionPresent("GL_EXT_instanced_arrays");
+#else
+    return false;
+#endif
+#else
+    const char* version = (const char*)glGetString(GL_VERSION);
+    if ( (version != NULL) && (strstr(version, "OpenGL ES 3.") != NULL) )
+    {
+        // Core functionality in ES 3.0
+        if ( ResolveInstancingFunctions("", "") )
+        {
+            return true;
+        }
+    }
+
+    if ( GLExtensionPresent("GL_EXT_instanced_arrays") &&
+         ResolveInstancingFunctions("EXT", "EXT") )
+    {
+        return true;
+    }
+
+    if ( GLExtensionPresent("GL_ANGLE_instanced_arrays") &&
+         ResolveInstancingFunctions("ANGLE", "ANGLE") )
+    {
+        return true;
+    }
+
+    if ( GLExtensionPresent("GL_NV_instanced_arrays") &&
+         GLExtensionPresent("GL_NV_draw_instanced") &&
+         ResolveInstancingFunctions("NV", "NV") )
+    {
+        return true;
+    }
+
+    return false;
+#endif
+}
+
+bool InstancingSupported()
+{
+    if ( !InstancingChecked )
+    {
+        InstancingAvailable = DetectInstancing();
+        InstancingChecked = true;
+        LOG_DEBUG("Instanced drawing supported: %d", InstancingAvailable);
+    }
+
+    return InstancingAvailable;
+}
+
+void DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type,
+                           const GLvoid* indices, GLsizei primcount)
+{
+#if defined(__BUILD_DESKTOP__)
+    glDrawElementsInstancedARB(mode, count, type, indices, primcount);
+#elif defined(__IOS__)
+#ifdef GL_EXT_instanced_arrays
+    glDrawElementsInstancedEXT(mode, count, type, indices, primcount);
+#endif
+#else
+    DrawElementsInstancedPtr(mode, count, type, indices, primcount);
+#endif
+}
+
+void VertexAttribDivisor(GLuint index, GLuint divisor)
+{
+#if defined(__BUILD_DESKTOP__)
+    glVertexAttribDivisorARB(index, divisor);
+#elif defined(__IOS__)
+#ifdef GL_EXT_instanced_arrays
+    glVertexAttribDivisorEXT(index, divisor);
+#endif
+#else
+    VertexAttribDivisorPtr(index, divisor);
+#endif
+}
+
+static bool DetectOcclusionQueries()
+{
+#if defined(__BUILD_DESKTOP__)
+    // GLEW has resolved the ARB entry points on init
+    return GLEW_ARB_occlusion_query;
+#elif defined(__IOS__)
+#ifdef GL_EXT_occlusion_query_boolean
+    return GLExtensionPresent("GL_EXT_occlusion_query_boolean");
+#else
+    return false;
+#endif
+#else
+    const char* version = (const char*)glGetString(GL_VERSION);
+    if ( (version != NULL) && (strstr(version, "OpenGL ES 3.") != NULL) )
+    {
+        // Core functionality in ES 3.0
+        if ( ResolveQueryFunctions("") )
+        {
+            return true;
+        }
+    }
+
+    return (GLExtensionPresent("GL_EXT_occlusion_query_boolean") &&
+            ResolveQueryFunctions("EXT"));
+#endif
+}
+
+bool OcclusionQueriesSupported()
+{
+    if ( !OcclusionQueriesChecked )
+    {
+        OcclusionQueriesAvailable = DetectOcclusionQueries();
+        OcclusionQueriesChecked = true;
+        LOG_DEBUG("Occlusion queries supported: %d",
+                  OcclusionQueriesAvailable);
+    }
+
+    return OcclusionQueriesAvailable;
+}
+
+void GenQueries(GLsizei n, GLuint* ids)
+{
+#if defined(__BUILD_DESKTOP__)
+    glGenQueriesARB(n, ids);
+#elif defined(__IOS__)
+#ifdef GL_EXT_occlusion_query_boolean
+    glGenQueriesEXT(n, ids);
+#endif
+#else
+    GenQueriesPtr(n, ids);
+#endif
+}
+
+void DeleteQueries(GLsizei n, const GLuint* ids)
+{
+#if defined(__BUILD_DESKTOP__)
+    glDeleteQueriesARB(n, ids);
+#elif defined(__IOS__)
+#ifdef GL_EXT_occlusion_query_boolean
+    glDeleteQueriesEXT(n, ids);
+#endif
+#else
+    DeleteQueriesPtr(n, ids);
+#endif
+}
+
+void BeginOcclusionQuery(GLuint id)
+{
+#if defined(__BUILD_DESKTOP__)
+    // Desktop GL counts the samples; any non-zero count means visible
+    glBeginQueryARB(GL_SAMPLES_PASSED_ARB, id);
+#elif defined(__IOS__)
+#ifdef GL_EXT_occlusion_query_boolean
+    glBeginQueryEXT(GL_ANY_SAMPLES_PASSED_EXT, id);
+#endif
+#else
+    BeginQueryPtr(GL_ANY_SAMPLES_PASSED_EXT, id);
+#endif
+}
+
+void EndOcclusionQuery()
+{
+#if defined(__BUILD_DESKTOP__)
+    glEndQueryARB(GL_SAMPLES_PASSED_ARB);
+#elif defined(__IOS__)
+#ifdef GL_EXT_occlusion_query_boolean
+    glEndQueryEXT(GL_ANY_SAMPLES_PASSED_EXT);
+#endif
+#else
+    EndQueryPtr(GL_ANY_SAMPLES_PASSED_EXT);
+#endif
+}
+
+bool GetOcclusionQueryResult(GLuint id, bool* anySamplesPassed)
+{
+    GLuint available = 0;
+    GLuint result = 0;
+
+#if defined(__BUILD_DESKTOP__)
+    glGetQueryObjectuivARB(id, GL_QUERY_RESULT_AVAILABLE_ARB, &available);
+    if ( available )
+    {
+        glGetQueryObjectuivARB(id, GL_QUERY_RESULT_ARB, &result);
+    }
+#elif defined(__IOS__)
+#ifdef GL_EXT_occlusion_query_boolean
+    glGetQueryObjectuivEXT(id, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+    if ( available )
+    {
+        glGetQueryObjectuivEXT(id, GL_QUERY_RESULT_EXT, &result);
+    }
+#endif
+#else
+    GetQueryObjectuivPtr(id, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+    if ( available )
+    {
+        GetQueryObjectuivPtr(id, GL_QUERY_RESULT_EXT, &result);
+    }
+#endif
+
+    if ( !available )
+    {
+        return false;
+    }
+
+    *anySamplesPassed = (result != 0);
+    return true;
+}
@@ -0,0 +1,148 @@
+#include "GLStateCache.h"
+
+// The texture targets tracked by the cache
+static const GLenum CachedTextureTargets[StateCacheTextureTargets] = {
+    GL_TEXTURE_2D,
+    GL_TEXTURE_CUBE_MAP
+};
+
+// The capabilities tracked by the cache
+static const GLenum CachedCapabilities[StateCacheCapabilities] = {
+    GL_CULL_FACE,
+    GL_BLEND,
+    GL_DEPTH_TEST,
+    GL_POLYGON_OFFSET_FILL
+};
+
+GLStateCache::GLStateCache()
+    : m_numStateChanges(0),
+      m_numRedundantChanges(0)
+{
+    Invalidate();
+}
+
+GLStateCache::~GLStateCache()
+{
+}
+
+void GLStateCache::Invalidate()
+{
+    m_program = -1;
+    m_activeUnit = -1;
+    for ( int i = 0; i < StateCacheTextureUnits; i++ )
+    {
+        for ( int j = 0; j < StateCacheTextureTargets; j++ )
+        {
+            m_textures[i][j] = -1;
+        }
+    }
+    for ( int i = 0; i < StateCacheCapabilities; i++ )
+    {
+        m_capabilities[i] = -1;
+    }
+    m_depthMask = -1;
+}
+
+bool GLStateCache::Update(int& current, int value)
+{
+    if ( current == value )
+    {
+        m_numRedundantChanges++;
+        return false;
+    }
+
+    current = value;
+    m_numStateChanges++;
+    return true;
+}
+
+void GLStateCache::UseProgram(GLuint program)
+{
+    if ( Update(m_program, program) )
+    {
+        glUseProgram(program);
+    }
+}
+
+void GLStateCache::BindTexture(int unit, GLenum target, GLuint texture)
+{
+    int index = 0;
+    while ( (index < StateCacheTextureTargets) &&
+            (CachedTextureTargets[index] != target) )
+    {
+        index++;
+    }
+
+    if ( (unit >= StateCacheTextureUnits) ||
+         (index == StateCacheTextureTargets) )
+    {
+        // Not tracked
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+        m_activeUnit = -1;
+        m_numStateChanges += 2;
+        return;
+    }
+
+    // Each target of a unit has a binding of its own
+    if ( m_textures[unit][index] == (int)texture )
+    {
+        m_numRedundantChanges++;
+        return;
+    }
+
+    if ( Update(m_activeUnit, unit) )
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    Update(m_textures[unit][index], texture);
+    glBindTexture(target, texture);
+}
+
+void GLStateCache::SetEnabled(GLenum capability, bool enabled)
+{
+    int index = 0;
+    while ( (index < StateCacheCapabilities) &&
+            (CachedCapabilities[index] != capability) )
+    {
+        index++;
+    }
+
+    bool changed = false;
+    if ( index == StateCacheCapabilities )
+    {
+        // Not tracked
+        m_numStateChanges++;
+        changed = true;
+    }
+    else
+    {
+        changed = Update(m_capabilities[index], enabled ? 1 : 0);
+    }
+
+    if ( changed )
+    {
+        if ( enabled )
+        {
+            glEnable(capability);
+        }
+        else
+        {
+            glDisable(capability);
+        }
+    }
+}
+
+void GLStateCache::SetDepthMask(bool enabled)
+{
+    if ( Update(m_depthMask, enabled ? 1 : 0) )
+    {
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+    }
+}
+
+void GLStateCache::ResetCounters()
+{
+    m_numStateChanges = 0;
+    m_numRedundantChanges = 0;
+}
@@ -0,0 +1,85 @@
+#include "InstanceBuffer.h"
+#include "GLExtensions.h"
+#include "CommonFunctions.h"
+
+// Size of a single instance's data (a 4x4 float matrix), in bytes
+static const int InstanceStride = 16 * sizeof(float);
+
+InstanceBuffer::InstanceBuffer(int maxInstances)
+    : m_maxInstances(maxInstances),
+      m_instanceData(NULL),
+      m_buffer(0)
+{
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+    glDeleteBuffers(1, &m_buffer);
+    delete [] m_instanceData;
+}
+
+bool InstanceBuffer::Setup()
+{
+    m_instanceData = new float[m_maxInstances * 16];
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    glBufferData(GL_ARRAY_BUFFER, m_maxInstances * InstanceStride, NULL,
+                 GL_STREAM_DRAW);
+
+    return (glGetError() == GL_NO_ERROR);
+}
+
+InstanceBuffer* InstanceBuffer::Create(int maxInstances)
+{
+    InstanceBuffer* buffer = new InstanceBuffer(maxInstances);
+    if ( !buffer->Setup() )
+    {
+        delete buffer;
+        LOG_DEBUG("InstanceBuffer::Setup() failed");
+        return NULL;
+    }
+    else
+    {
+        return buffer;
+    }
+}
+
+void InstanceBuffer::Upload(int numInstances)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+
+    // Orphan the old storage so that the driver does not have to wait for
+    // the previous frame's draws to finish before we overwrite it
+    glBufferData(GL_ARRAY_BUFFER, m_maxInstances * InstanceStride, NULL,
+                 GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, numInstances * InstanceStride,
+                    m_instanceData);
+}
+
+void InstanceBuffer::Bind(GLint attribLocation, int firstInstance)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+
+    // A mat4 attribute takes up 4 slots, one per matrix column
+    size_t offset = firstInstance * InstanceStride;
+    for ( int i = 0; i < 4; i++ )
+    {
+        GLuint index = attribLocation + i;
+        glEnableVertexAttribArray(index);
+        size_t columnOffset = offset + (i * 4 * sizeof(float));
+        glVertexAttribPointer(index, 4, GL_FLOAT, GL_FALSE, InstanceStride,
+                              (const GLvoid*)columnOffset);
+        VertexAttribDivisor(index, 1);
+    }
+}
+
+void InstanceBuffer::Unbind(GLint attribLocation)
+{
+    for ( int i = 0; i < 4; i++ )
+    {
+        GLuint index = attribLocation + i;
+        VertexAttribDivisor(index, 0);
+        glDisableVertexAttribArray(index);
+    }
+}
@@ -8,6 +8,8 @@
 #include "ChessboardStage.h"
 #include "FractalStage.h"
 #include "PhysicsStage.h"
+#include "ParallelCollisionDispatcher.h"
+#include "ParallelDynamicsWorld.h"
 #include "FillrateStage.h"
 #include "CommonFunctions.h"
 #include "MMarkTextRenderer.h"
@@ -16,10 +18,47 @@
 #include "RotationAnimation.h"
 #include "ChessboardDemoMode.h"
 #include "md5.h"
+#include "MatrixKernels.h"
 
 // For debugging purposes only!
 //#define USE_DEBUG_SCORES
 
+// For profiling the physics stage; cycles the collision dispatch through
+// 1 .. N threads and logs the narrowphase time of each thread count
+//#define MEASURE_COLLISION_SCALING
+
+// For profiling the physics stage; runs the constraint row kernel
+// benchmark, which also checks the SIMD rows against the generic ones
+//#define BENCHMARK_ROW_KERNELS
+
+// Runs the physics stage as a stress test of growing pillar grids, up to
+// 40 x 50 pillars and 500 more piled up in 5 levels, instead of the
+// benchmark scene. The throughput curve is reported with the score
+//#define PHYSICS_STRESS_TEST
+
+// For checking the physics stage; steps the world 600 fixed steps twice
+// from its initial state at setup and logs whether the end states match
+//#define CHECK_PHYSICS_REPLAY
+
+// For profiling the physics stage; overrides the broadphase of the physics
+// world with one of the PhysicsBroadphase values. The overlapping pairs and
+// the broadphase time are reported with the score
+//#define PHYSICS_BROADPHASE PhysicsBroadphaseAxisSweep
+
+// For checking the physics stage; counts the bodies tunnelling through
+// others and logs them with the score
+//#define CHECK_PHYSICS_TUNNELLING
+
+// Runs a scene query workload in the physics stage: every frame, 2000 rays
+// and 200 sphere sweeps are cast from the camera as it moves along its
+// spline. The query throughput is reported with the score
+//#define PHYSICS_QUERY_BENCHMARK
+
+// Physics steps per simulated second. With continuous collision detection
+// the bodies do not tunnel at 30 steps per second, at about half the step
+// time of 60; below 20 the vehicle becomes unstable
+static const int PhysicsStepsPerSecond = 30;
+
 // Fade in/out duration (in seconds)
 static const float FadeInOutDuration = 0.4;
 
@@ -490,10 +529,82 @@ void MMarkController::SetupDeviceInfo()
     m_deviceInfoStrings.push_back(ss.str());
 }
 
+void MMarkController::ConfigurePhysicsStage(PhysicsStage& stage)
+{
+    int numCores = m_deviceInfo.m_numCpuCores;
+
+    // The best constraint rows the CPU runs
+#ifdef BENCHMARK_ROW_KERNELS
+    stage.SetRowKernels(RowKernelsAuto, true);
+#else
+    stage.SetRowKernels(RowKernelsAuto);
+#endif
+
+#ifdef PHYSICS_STRESS_TEST
+    stage.SetStressMode(40, 50, 500, 5);
+#endif
+
+    // Restart the physics world on repeated runs instead of rebuilding it
+    stage.SetRestartable(true);
+
+#ifdef CHECK_PHYSICS_REPLAY
+    stage.SetReplayCheck(600);
+#endif
+
+    // Step the physics at a lower rate, sweeping the fast bodies so that
+    // they do not pass through the others
+    stage.SetContinuousCollision(true, PhysicsStepsPerSecond);
+#ifdef CHECK_PHYSICS_TUNNELLING
+    stage.SetTunnellingCheck(true);
+#endif
+
+    // Keep the static bodies frozen in a tree of their own, so that only
+    // the moving ones are refitted each step
+#ifdef PHYSICS_BROADPHASE
+    stage.SetBroadphase(PHYSICS_BROADPHASE);
+#else
+    stage.SetBroadphase(PhysicsBroadphaseStaticDbvt);
+#endif
+
+    // Step the physics on a thread of its own when there is a core to
+    // spare for it
+    bool threadedPhysics = (numCores > 1);
+    stage.SetThreadedPhysics(threadedPhysics);
+
+    // The cores left for the physics; with the physics on a thread of its
+    // own, the render thread keeps one of them busy at the same time
+    int physicsCores = threadedPhysics ? std::max(numCores - 1, 1) : numCores;
+
+    // Process the colliding pairs on the physics cores
+    if ( physicsCores > 1 )
+    {
+#ifdef MEASURE_COLLISION_SCALING
+        bool measureScaling = true;
+#else
+        bool measureScaling = false;
+#endif
+        stage.SetCollisionThreads(std::min(physicsCores, MaxCollisionThreads),
+                                  measureScaling);
+
+        // ..and solve the simulation islands on them too
+        stage.SetSolverThreads(std::min(physicsCores, MaxSolverThreads));
+    }
+
+#ifdef PHYSICS_QUERY_BENCHMARK
+    // Cast the queries on the cores the physics thread leaves free, the
+    // render thread being one of them
+    stage.SetQueryBenchmark(2000, 200,
+                            std::min(physicsCores, MaxSceneQueryThreads));
+#endif
+}
+
 bool MMarkController::InitController()
 {
     LOG_DEBUG("MMarkController::InitController()");
 
+    // Pick the fastest matrix routines for this CPU
+    InitMatrixKernels();
+
     // Get device info and generate the strings to be displayed
     SetupDeviceInfo();
 
@@ -590,10 +701,12 @@ bool MMarkController::InitController()
 	    new ChessboardStage(*m_textRenderer, g_rectangleIndexBuffer,
 		    m_defaultFrameBuffer, m_simpleColorProgram,
 		    m_simpleColorMvpLoc, m_simpleColorColorLoc));
-    m_stages.push_back(
+    PhysicsStage* physicsStage =
 	    new PhysicsStage(*m_textRenderer, g_rectangleIndexBuffer,
 		    m_defaultFrameBuffer, m_simpleColorProgram,
-		    m_simpleColorMvpLoc, m_simpleColorColorLoc));
+		    m_simpleColorMvpLoc, m_simpleColorColorLoc);
+    ConfigurePhysicsStage(*physicsStage);
+    m_stages.push_back(physicsStage);
 #endif
     m_stageIterator = m_stages.begin();
 
@@ -773,6 +886,8 @@ std::string MMarkController::CreateScoreSubmissionJson()
     data4.m_cpuScore = 0;
     data4.m_fillRateScore = 0;
     data4.m_loadTime = 4.0;
+    data4.m_physicsTime = 6.2;
+    data4.m_renderTime = 29.5;
 #else
     StageData data1 = m_stages[0]->GetStageData();
     StageData data2 = m_stages[1]->GetStageData();
@@ -797,6 +912,37 @@ std::string MMarkController::CreateScoreSubmissionJson()
     score["mountains_score"] = data4.m_score;
     score["mountains_loadtime"] = data4.m_loadTime;
     score["mountains_fps"] = data4.m_fps;
+    score["mountains_physics_time"] = data4.m_physicsTime;
+    score["mountains_render_time"] = data4.m_renderTime;
+    for ( unsigned int i = 0; i < data4.m_physicsPhaseTimes.size(); i++ )
+    {
+        const std::pair<std::string, float>& phase =
+                data4.m_physicsPhaseTimes[i];
+        score["mountains_physics_" + phase.first + "_time"] = phase.second;
+    }
+    if ( !data4.m_broadphase.empty() )
+    {
+        score["mountains_broadphase"] = data4.m_broadphase;
+        score["mountains_broadphase_pairs"] = data4.m_broadphasePairs;
+        score["mountains_broadphase_step_time"] = data4.m_broadphaseStepTime;
+    }
+    if ( data4.m_queryTime > 0.0 )
+    {
+        score["mountains_query_rays_per_second"] =
+                data4.m_queryRaysPerSecond;
+        score["mountains_query_sweeps_per_second"] =
+                data4.m_querySweepsPerSecond;
+        score["mountains_query_time"] = data4.m_queryTime;
+    }
+    for ( unsigned int i = 0; i < data4.m_physicsStress.size(); i++ )
+    {
+        const PhysicsStressPoint& point = data4.m_physicsStress[i];
+        Json::Value level;
+        level["bodies"] = point.m_numBodies;
+        level["steps_per_second"] = point.m_stepsPerSecond;
+        level["contacts_per_second"] = point.m_contactsPerSecond;
+        score["mountains_physics_stress"].append(level);
+    }
 
     score["total_score"] = m_overallScore;
     score["loadtime_score"] = m_loadTimeScore;
@@ -0,0 +1,561 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "MatrixKernels.h"
+#include "CommonFunctions.h"
+
+#if defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 1))
+#define MATRIXKERNELS_SSE
+#include <xmmintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define MATRIXKERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+// Function table for one kernel implementation
+struct MatrixKernels
+{
+    void (*m_multiply)(const float* a, const float* b, float* out);
+    void (*m_multiplyBatch)(const float* matrices, const float* m,
+                            float* out, int count);
+    void (*m_multiplyBatchIndirect)(const float* const* matrices,
+                                    const float* m, float* out, int count);
+    int (*m_cullSpheres)(const float* planes, const float* transforms,
+                         int count, float radius, int* visible);
+};
+
+// Offsets of the translation components from the start of a matrix
+static const int TranslationX = 12;
+static const int TranslationY = 13;
+static const int TranslationZ = 14;
+
+// Distance of the point (x, y, z) from the plane, positive on the inside
+static inline float PlaneDistance(const float* plane, float x, float y,
+                                  float z)
+{
+    return (plane[0] * x) + (plane[1] * y) + (plane[2] * z) + plane[3];
+}
+
+static inline bool SphereInPlanes(const float* planes, float x, float y,
+                                  float z, float radius)
+{
+    for ( int p = 0; p < FrustumPlanesSize; p += 4 )
+    {
+        if ( PlaneDistance(&planes[p], x, y, z) < -radius )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Scalar reference implementation
+/////////////////////////////////////////////////////////////////////////
+
+static inline void MultiplyScalar(const float* a, const float* b, float* out)
+{
+    float result[16];
+    for ( int row = 0; row < 4; row++ )
+    {
+        const float* ar = &a[row * 4];
+        for ( int col = 0; col < 4; col++ )
+        {
+            result[row * 4 + col] = (ar[0] * b[col]) +
+                                    (ar[1] * b[4 + col]) +
+                                    (ar[2] * b[8 + col]) +
+                                    (ar[3] * b[12 + col]);
+        }
+    }
+    memcpy(out, result, sizeof(result));
+}
+
+static void MultiplyBatchScalar(const float* matrices, const float* m,
+                                float* out, int count)
+{
+    for ( int i = 0; i < count; i++ )
+    {
+        MultiplyScalar(&matrices[i * 16], m, &out[i * 16]);
+    }
+}
+
+static void MultiplyBatchIndirectScalar(const float* const* matrices,
+                                        const float* m, float* out, int count)
+{
+    for ( int i = 0; i < count; i++ )
+    {
+        MultiplyScalar(matrices[i], m, &out[i * 16]);
+    }
+}
+
+static int CullSpheresScalar(const float* planes, const float* transforms,
+                             int count, float radius, int* visible)
+{
+    int numVisible = 0;
+    for ( int i = 0; i < count; i++ )
+    {
+        const float* t = &transforms[i * 16];
+        if ( SphereInPlanes(planes, t[TranslationX], t[TranslationY],
+                            t[TranslationZ], radius) )
+        {
+            visible[numVisible++] = i;
+        }
+    }
+
+    return numVisible;
+}
+
+static const MatrixKernels ScalarKernels = {
+    MultiplyScalar,
+    MultiplyBatchScalar,
+    MultiplyBatchIndirectScalar,
+    CullSpheresScalar
+};
+
+/////////////////////////////////////////////////////////////////////////
+// SSE implementation
+/////////////////////////////////////////////////////////////////////////
+
+#ifdef MATRIXKERNELS_SSE
+
+// Each result row is a linear combination of the rows of b, weighted by
+// the elements of the corresponding row of a
+static inline void MultiplyRowsSSE(const float* a, __m128 b0, __m128 b1,
+                                   __m128 b2, __m128 b3, float* out)
+{
+    for ( int row = 0; row < 16; row += 4 )
+    {
+        __m128 r = _mm_mul_ps(_mm_load1_ps(&a[row]), b0);
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_load1_ps(&a[row + 1]), b1));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_load1_ps(&a[row + 2]), b2));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_load1_ps(&a[row + 3]), b3));
+        _mm_storeu_ps(&out[row], r);
+    }
+}
+
+// b is loaded up front so out may alias either input; each row of a is
+// read before the corresponding row of out is written.
+static inline void MultiplySSE(const float* a, const float* b, float* out)
+{
+    MultiplyRowsSSE(a, _mm_loadu_ps(&b[0]), _mm_loadu_ps(&b[4]),
+                    _mm_loadu_ps(&b[8]), _mm_loadu_ps(&b[12]), out);
+}
+
+static void MultiplyBatchSSE(const float* matrices, const float* m,
+                             float* out, int count)
+{
+    // The shared matrix stays in registers for the whole batch
+    __m128 m0 = _mm_loadu_ps(&m[0]);
+    __m128 m1 = _mm_loadu_ps(&m[4]);
+    __m128 m2 = _mm_loadu_ps(&m[8]);
+    __m128 m3 = _mm_loadu_ps(&m[12]);
+
+    for ( int i = 0; i < count; i++ )
+    {
+        MultiplyRowsSSE(&matrices[i * 16], m0, m1, m2, m3, &out[i * 16]);
+    }
+}
+
+static void MultiplyBatchIndirectSSE(const float* const* matrices,
+                                     const float* m, float* out, int count)
+{
+    __m128 m0 = _mm_loadu_ps(&m[0]);
+    __m128 m1 = _mm_loadu_ps(&m[4]);
+    __m128 m2 = _mm_loadu_ps(&m[8]);
+    __m128 m3 = _mm_loadu_ps(&m[12]);
+
+    for ( int i = 0; i < count; i++ )
+    {
+        MultiplyRowsSSE(matrices[i], m0, m1, m2, m3, &out[i * 16]);
+    }
+}
+
+// Tests four spheres at a time against each plane; the translation
+// components are gathered into x, y, z lanes
+static int CullSpheresSSE(const float* planes, const float* transforms,
+                          int count, float radius, int* visible)
+{
+    __m128 negRadius = _mm_set1_ps(-radius);
+    int numVisible = 0;
+    int i = 0;
+
+    for ( ; (i + 4) <= count; i += 4 )
+    {
+        const float* t = &transforms[i * 16];
+        __m128 x = _mm_set_ps(t[48 + TranslationX], t[32 + TranslationX],
+                              t[16 + TranslationX], t[TranslationX]);
+        __m128 y = _mm_set_ps(t[48 + TranslationY], t[32 + TranslationY],
+                              t[16 + TranslationY], t[TranslationY]);
+        __m128 z = _mm_set_ps(t[48 + TranslationZ], t[32 + TranslationZ],
+                              t[16 + TranslationZ], t[TranslationZ]);
+
+        __m128 outside = _mm_setzero_ps();
+        for ( int p = 0; p < FrustumPlanesSize; p += 4 )
+        {
+            __m128 d = _mm_mul_ps(x, _mm_load1_ps(&planes[p]));
+            d = _mm_add_ps(d, _mm_mul_ps(y, _mm_load1_ps(&planes[p + 1])));
+            d = _mm_add_ps(d, _mm_mul_ps(z, _mm_load1_ps(&planes[p + 2])));
+            d = _mm_add_ps(d, _mm_load1_ps(&planes[p + 3]));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(d, negRadius));
+        }
+
+        int mask = _mm_movemask_ps(outside);
+        for ( int j = 0; j < 4; j++ )
+        {
+            if ( (mask & (1 << j)) == 0 )
+            {
+                visible[numVisible++] = i + j;
+            }
+        }
+    }
+
+    // Leftovers
+    for ( ; i < count; i++ )
+    {
+        const float* t = &transforms[i * 16];
+        if ( SphereInPlanes(planes, t[TranslationX], t[TranslationY],
+                            t[TranslationZ], radius) )
+        {
+            visible[numVisible++] = i;
+        }
+    }
+
+    return numVisible;
+}
+
+static const MatrixKernels SSEKernels = {
+    MultiplySSE,
+    MultiplyBatchSSE,
+    MultiplyBatchIndirectSSE,
+    CullSpheresSSE
+};
+
+#endif // MATRIXKERNELS_SSE
+
+/////////////////////////////////////////////////////////////////////////
+// NEON implementation
+/////////////////////////////////////////////////////////////////////////
+
+#ifdef MATRIXKERNELS_NEON
+
+static inline void MultiplyRowsNEON(const float* a, float32x4_t b0,
+                                    float32x4_t b1, float32x4_t b2,
+                                    float32x4_t b3, float* out)
+{
+    for ( int row = 0; row < 16; row += 4 )
+    {
+        float32x4_t ar = vld1q_f32(&a[row]);
+        float32x2_t low = vget_low_f32(ar);
+        float32x2_t high = vget_high_f32(ar);
+        float32x4_t r = vmulq_lane_f32(b0, low, 0);
+        r = vmlaq_lane_f32(r, b1, low, 1);
+        r = vmlaq_lane_f32(r, b2, high, 0);
+        r = vmlaq_lane_f32(r, b3, high, 1);
+        vst1q_f32(&out[row], r);
+    }
+}
+
+// b is loaded up front so out may alias either input; each row of a is
+// read before the corresponding row of out is written.
+static inline void MultiplyNEON(const float* a, const float* b, float* out)
+{
+    MultiplyRowsNEON(a, vld1q_f32(&b[0]), vld1q_f32(&b[4]),
+                     vld1q_f32(&b[8]), vld1q_f32(&b[12]), out);
+}
+
+static void MultiplyBatchNEON(const float* matrices, const float* m,
+                              float* out, int count)
+{
+    // The shared matrix stays in registers for the whole batch
+    float32x4_t m0 = vld1q_f32(&m[0]);
+    float32x4_t m1 = vld1q_f32(&m[4]);
+    float32x4_t m2 = vld1q_f32(&m[8]);
+    float32x4_t m3 = vld1q_f32(&m[12]);
+
+    for ( int i = 0; i < count; i++ )
+    {
+        MultiplyRowsNEON(&matrices[i * 16], m0, m1, m2, m3, &out[i * 16]);
+    }
+}
+
+static void MultiplyBatchIndirectNEON(const float* const* matrices,
+                                      const float* m, float* out, int count)
+{
+    float32x4_t m0 = vld1q_f32(&m[0]);
+    float32x4_t m1 = vld1q_f32(&m[4]);
+    float32x4_t m2 = vld1q_f32(&m[8]);
+    float32x4_t m3 = vld1q_f32(&m[12]);
+
+    for ( int i = 0; i < count; i++ )
+    {
+        MultiplyRowsNEON(matrices[i], m0, m1, m2, m3, &out[i * 16]);
+    }
+}
+
+// Tests four spheres at a time against each plane; the translation
+// components are gathered into x, y, z lanes
+static int CullSpheresNEON(const float* planes, const float* transforms,
+                           int count, float radius, int* visible)
+{
+    float32x4_t negRadius = vdupq_n_f32(-radius);
+    int numVisible = 0;
+    int i = 0;
+
+    for ( ; (i + 4) <= count; i += 4 )
+    {
+        const float* t = &transforms[i * 16];
+        float32x4_t x = vdupq_n_f32(0.0f);
+        float32x4_t y = vdupq_n_f32(0.0f);
+        float32x4_t z = vdupq_n_f32(0.0f);
+        x = vsetq_lane_f32(t[TranslationX], x, 0);
+        x = vsetq_lane_f32(t[16 + TranslationX], x, 1);
+        x = vsetq_lane_f32(t[32 + TranslationX], x, 2);
+        x = vsetq_lane_f32(t[48 + TranslationX], x, 3);
+        y = vsetq_lane_f32(t[TranslationY], y, 0);
+        y = vsetq_lane_f32(t[16 + TranslationY], y, 1);
+        y = vsetq_lane_f32(t[32 + TranslationY], y, 2);
+        y = vsetq_lane_f32(t[48 + TranslationY], y, 3);
+        z = vsetq_lane_f32(t[TranslationZ], z, 0);
+        z = vsetq_lane_f32(t[16 + TranslationZ], z, 1);
+        z = vsetq_lane_f32(t[32 + TranslationZ], z, 2);
+        z = vsetq_lane_f32(t[48 + TranslationZ], z, 3);
+
+        uint32x4_t outside = vdupq_n_u32(0);
+        for ( int p = 0; p < FrustumPlanesSize; p += 4 )
+        {
+            float32x4_t d = vdupq_n_f32(planes[p + 3]);
+            d = vmlaq_n_f32(d, x, planes[p]);
+            d = vmlaq_n_f32(d, y, planes[p + 1]);
+            d = vmlaq_n_f32(d, z, planes[p + 2]);
+            outside = vorrq_u32(outside, vcltq_f32(d, negRadius));
+        }
+
+        uint32_t lanes[4];
+        vst1q_u32(lanes, outside);
+        for ( int j = 0; j < 4; j++ )
+        {
+            if ( lanes[j] == 0 )
+            {
+                visible[numVisible++] = i + j;
+            }
+        }
+    }
+
+    // Leftovers
+    for ( ; i < count; i++ )
+    {
+        const float* t = &transforms[i * 16];
+        if ( SphereInPlanes(planes, t[TranslationX], t[TranslationY],
+                            t[TranslationZ], radius) )
+        {
+            visible[numVisible++] = i;
+        }
+    }
+
+    return numVisible;
+}
+
+static const MatrixKernels NEONKernels = {
+    MultiplyNEON,
+    MultiplyBatchNEON,
+    MultiplyBatchIndirectNEON,
+    CullSpheresNEON
+};
+
+#endif // MATRIXKERNELS_NEON
+
+/////////////////////////////////////////////////////////////////////////
+// Runtime selection
+/////////////////////////////////////////////////////////////////////////
+
+static const MatrixKernels* ActiveKernels = &ScalarKernels;
+static MatrixKernelType ActiveKernelType = MatrixKernelScalar;
+
+// ARMv7 builds may end up on eg. Tegra 2 which does not have NEON
+bool NEONPresent()
+{
+#if !defined(MATRIXKERNELS_NEON)
+    return false;
+#elif defined(__IOS__) || defined(__BLACKBERRY__)
+    // All the supported devices have NEON
+    return true;
+#else
+    FILE* cpuinfo = fopen("/proc/cpuinfo", "r");
+    if ( cpuinfo == NULL )
+    {
+        // Cannot tell; trust the build target
+        return true;
+    }
+
+    bool present = false;
+    char line[512];
+    while ( !present && (fgets(line, sizeof(line), cpuinfo) != NULL) )
+    {
+        if ( (strncmp(line, "Features", 8) == 0) &&
+             ((strstr(line, " neon") != NULL) ||
+              (strstr(line, " asimd") != NULL)) )
+        {
+            present = true;
+        }
+    }
+    fclose(cpuinfo);
+
+    return present;
+#endif
+}
+
+bool SetMatrixKernel(MatrixKernelType type)
+{
+    switch ( type )
+    {
+        case MatrixKernelScalar:
+            ActiveKernels = &ScalarKernels;
+            break;
+#ifdef MATRIXKERNELS_SSE
+        case MatrixKernelSSE:
+            ActiveKernels = &SSEKernels;
+            break;
+#endif
+#ifdef MATRIXKERNELS_NEON
+        case MatrixKernelNEON:
+            if ( !NEONPresent() )
+            {
+                return false;
+            }
+            ActiveKernels = &NEONKernels;
+            break;
+#endif
+        default:
+            return false;
+    }
+
+    ActiveKernelType = type;
+    return true;
+}
+
+void InitMatrixKernels()
+{
+    if ( !SetMatrixKernel(MatrixKernelNEON) &&
+         !SetMatrixKernel(MatrixKernelSSE) )
+    {
+        SetMatrixKernel(MatrixKernelScalar);
+    }
+
+    LOG_DEBUG("Using %s matrix kernels", MatrixKernelName());
+}
+
+MatrixKernelType ActiveMatrixKernel()
+{
+    return ActiveKernelType;
+}
+
+const char* MatrixKernelName()
+{
+    switch ( ActiveKernelType )
+    {
+        case MatrixKernelSSE:
+            return "sse";
+        case MatrixKernelNEON:
+            return "neon";
+        default:
+            return "scalar";
+    }
+}
+
+void MatrixMultiplyKernel(const float* a, const float* b, float* out)
+{
+    ActiveKernels->m_multiply(a, b, out);
+}
+
+void MatrixMultiplyBatch(const float* matrices, const float* m, float* out,
+                         int count)
+{
+    ActiveKernels->m_multiplyBatch(matrices, m, out, count);
+}
+
+void MatrixMultiplyBatchIndirect(const float* const* matrices,
+                                 const float* m, float* out, int count)
+{
+    ActiveKernels->m_multiplyBatchIndirect(matrices, m, out, count);
+}
+
+void InverseTransformPointRigid(const float* m, const float* v, float* out)
+{
+    // For a rigid transform the inverse rotation is the transpose, so the
+    // object space point is the offset from the translation projected onto
+    // each of the rotation rows
+    float dx = v[0] - m[12];
+    float dy = v[1] - m[13];
+    float dz = v[2] - m[14];
+
+    out[0] = (dx * m[0]) + (dy * m[1]) + (dz * m[2]);
+    out[1] = (dx * m[4]) + (dy * m[5]) + (dz * m[6]);
+    out[2] = (dx * m[8]) + (dy * m[9]) + (dz * m[10]);
+}
+
+void ExtractFrustumPlanes(const float* vpMatrix, float* planes)
+{
+    // With row vectors clip = p * vp, so the clip space coordinates are
+    // the dot products of p with the columns of vp. The planes are then
+    // w + x >= 0 (left), w - x >= 0 (right), w + y, w - y, w + z, w - z.
+    const float* m = vpMatrix;
+    for ( int axis = 0; axis < 3; axis++ )
+    {
+        for ( int side = 0; side < 2; side++ )
+        {
+            float sign = (side == 0) ? 1.0f : -1.0f;
+            float* plane = &planes[((axis * 2) + side) * 4];
+            for ( int i = 0; i < 4; i++ )
+            {
+                plane[i] = m[(i * 4) + 3] + (sign * m[(i * 4) + axis]);
+            }
+
+            // Normalize so that the distances are in world units
+            float length = sqrt((plane[0] * plane[0]) +
+                                (plane[1] * plane[1]) +
+                                (plane[2] * plane[2]));
+            if ( length > 0.0f )
+            {
+                for ( int i = 0; i < 4; i++ )
+                {
+                    plane[i] /= length;
+                }
+            }
+        }
+    }
+}
+
+bool SphereInFrustum(const float* planes, const float* center, float radius)
+{
+    return SphereInPlanes(planes, center[0], center[1], center[2], radius);
+}
+
+bool AabbInFrustum(const float* planes, const float* min, const float* max)
+{
+    for ( int p = 0; p < FrustumPlanesSize; p += 4 )
+    {
+        // Test the corner furthest along the plane normal
+        const float* plane = &planes[p];
+        float x = (plane[0] >= 0.0f) ? max[0] : min[0];
+        float y = (plane[1] >= 0.0f) ? max[1] : min[1];
+        float z = (plane[2] >= 0.0f) ? max[2] : min[2];
+        if ( PlaneDistance(plane, x, y, z) < 0.0f )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int FrustumCullSpheres(const float* planes, const float* transforms,
+                       int count, float radius, int* visible)
+{
+    return ActiveKernels->m_cullSpheres(planes, transforms, count, radius,
+                                        visible);
+}
@@ -0,0 +1,685 @@
+#include <sys/time.h>
+#include <algorithm>
+
+#include "ParallelCollisionDispatcher.h"
+#include "CommonFunctions.h"
+#include "LinearMath/btPoolAllocator.h"
+
+// Bullet's count of live manifolds
+extern int gNumManifold;
+
+// Size of the header in front of each collision algorithm allocation;
+// keeps the algorithm 16 byte aligned
+static const int AlgorithmHeaderSize = 16;
+
+// New pairs are spread evenly over the contexts, so the pools of the
+// contexts other than the first are sized for their share of those of the
+// given configuration, plus this fraction of headroom
+static const float ContextPoolHeadroom = 0.5;
+
+/**
+ * A manifold created or released while the threads are running, to be
+ * merged into the manifold list afterwards.
+ */
+struct PendingManifold
+{
+    // Index of the pair being processed
+    int m_pair;
+
+    // Order within the context
+    int m_sequence;
+
+    btPersistentManifold* m_manifold;
+};
+
+/**
+ * Everything a thread may modify while processing pairs.
+ */
+struct CollisionContext
+{
+    CollisionContext() : m_index(0), m_configuration(NULL),
+        m_ownsConfiguration(false), m_algorithmPool(NULL), m_currentPair(-1)
+    {
+    }
+
+    int m_index;
+
+    // The simplex solver and the manifold pool of the context
+    btCollisionConfiguration* m_configuration;
+    bool m_ownsConfiguration;
+    btCollisionAlgorithmCreateFunc*
+            m_createFuncs[MAX_BROADPHASE_COLLISION_TYPES]
+                         [MAX_BROADPHASE_COLLISION_TYPES];
+
+    btPoolAllocator* m_algorithmPool;
+
+    // Indices of the pairs to process in this dispatch, ascending
+    std::vector<int> m_pairs;
+    int m_currentPair;
+
+    std::vector<PendingManifold> m_newManifolds;
+    std::vector<PendingManifold> m_releasedManifolds;
+};
+
+/**
+ * Argument of a worker thread.
+ */
+struct WorkerThreadData
+{
+    ParallelCollisionDispatcher* m_dispatcher;
+    int m_thread;
+};
+
+// Returns the current time in seconds
+static double CurrentTime()
+{
+    timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + (now.tv_usec * 0.000001);
+}
+
+// Whether the collision algorithms of the object change it while
+// processing a pair; the compound algorithm and the triangle mesh
+// algorithm temporarily swap the shape of the object
+static bool NeedsExclusiveAccess(const btCollisionObject* object)
+{
+    const btCollisionShape* shape = object->getCollisionShape();
+    return shape->isCompound() ||
+            (shape->isConcave() &&
+             (shape->getShapeType() != STATIC_PLANE_PROXYTYPE));
+}
+
+// Returns the index of the context that allocated the algorithm
+static int AlgorithmContext(const void* algorithm)
+{
+    const char* header = static_cast<const char*>(algorithm) -
+            AlgorithmHeaderSize;
+    return *reinterpret_cast<const int*>(header);
+}
+
+static bool ComparePendingManifolds(const PendingManifold& first,
+                                    const PendingManifold& second)
+{
+    if ( first.m_pair != second.m_pair )
+    {
+        return (first.m_pair < second.m_pair);
+    }
+    return (first.m_sequence < second.m_sequence);
+}
+
+ParallelCollisionDispatcher::ParallelCollisionDispatcher(
+        btCollisionConfiguration* collisionConfiguration, int numThreads)
+    : PooledCollisionDispatcher(collisionConfiguration),
+      m_numThreads(numThreads),
+      m_activeThreads(numThreads),
+      m_cycleThreads(false),
+      m_contextKeyCreated(false),
+      m_pairs(NULL),
+      m_dispatchInfo(NULL),
+      m_dispatching(false),
+      m_generation(0),
+      m_dispatchThreads(1),
+      m_numBusyThreads(0),
+      m_threadsAlive(false)
+{
+    for ( int i = 0; i < MaxCollisionThreads; i++ )
+    {
+        m_contexts[i] = NULL;
+    }
+    for ( int i = 0; i <= MaxCollisionThreads; i++ )
+    {
+        m_totalDispatchTime[i] = 0.0;
+        m_numDispatches[i] = 0;
+    }
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_startCondition, NULL);
+    pthread_cond_init(&m_doneCondition, NULL);
+}
+
+ParallelCollisionDispatcher::~ParallelCollisionDispatcher()
+{
+    // Terminate the worker threads
+    pthread_mutex_lock(&m_mutex);
+    m_threadsAlive = false;
+    pthread_cond_broadcast(&m_startCondition);
+    pthread_mutex_unlock(&m_mutex);
+    for ( unsigned int i = 0; i < m_threads.size(); i++ )
+    {
+        pthread_join(m_threads[i], NULL);
+    }
+    m_threads.clear();
+
+    for ( int i = 0; i < MaxCollisionThreads; i++ )
+    {
+        CollisionContext* context = m_contexts[i];
+        if ( context != NULL )
+        {
+            delete context->m_algorithmPool;
+            if ( context->m_ownsConfiguration )
+            {
+                delete context->m_configuration;
+            }
+            delete context;
+            m_contexts[i] = NULL;
+        }
+    }
+
+    if ( m_contextKeyCreated )
+    {
+        pthread_key_delete(m_contextKey);
+    }
+    pthread_cond_destroy(&m_doneCondition);
+    pthread_cond_destroy(&m_startCondition);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+ParallelCollisionDispatcher* ParallelCollisionDispatcher::Create(
+        btCollisionConfiguration* collisionConfiguration, int numThreads)
+{
+    ParallelCollisionDispatcher* self =
+            new ParallelCollisionDispatcher(collisionConfiguration,
+                                            numThreads);
+    if ( !self->Setup() )
+    {
+        delete self;
+        return NULL;
+    }
+
+    return self;
+}
+
+bool ParallelCollisionDispatcher::Setup()
+{
+    if ( (m_numThreads < 1) || (m_numThreads > MaxCollisionThreads) )
+    {
+        LOG_DEBUG("ParallelCollisionDispatcher: invalid thread count %d",
+                  m_numThreads);
+        return false;
+    }
+
+    if ( pthread_key_create(&m_contextKey, NULL) != 0 )
+    {
+        LOG_DEBUG("ParallelCollisionDispatcher: failed to create key");
+        return false;
+    }
+    m_contextKeyCreated = true;
+
+    // Algorithm pool elements have room for the header. The first context
+    // also gets the pairs of the compound and triangle mesh shapes, so its
+    // pools are as large as those of the given configuration; the pools of
+    // the others take their even share of the pairs. Pairs that do not
+    // fit are allocated from the heap and counted as pool overflows
+    btPoolAllocator* algorithmPool =
+            m_collisionConfiguration->getCollisionAlgorithmPool();
+    int algorithmSize = algorithmPool->getElementSize() + AlgorithmHeaderSize;
+    int algorithmPoolSize = algorithmPool->getMaxCount();
+    int manifoldPoolSize =
+            m_collisionConfiguration->getPersistentManifoldPool()->
+            getMaxCount();
+    float shareScale = (1.0 + ContextPoolHeadroom) / m_numThreads;
+    int algorithmShareSize =
+            std::max((int)(algorithmPoolSize * shareScale), 1);
+
+    btDefaultCollisionConstructionInfo constructionInfo;
+    constructionInfo.m_defaultMaxPersistentManifoldPoolSize =
+            std::max((int)(manifoldPoolSize * shareScale), 1);
+    constructionInfo.m_defaultMaxCollisionAlgorithmPoolSize = 1;
+
+    for ( int i = 0; i < m_numThreads; i++ )
+    {
+        CollisionContext* context = new CollisionContext();
+        m_contexts[i] = context;
+        context->m_index = i;
+        if ( i == 0 )
+        {
+            context->m_configuration = m_collisionConfiguration;
+        }
+        else
+        {
+            context->m_configuration =
+                    new btDefaultCollisionConfiguration(constructionInfo);
+            context->m_ownsConfiguration = true;
+        }
+
+        for ( int j = 0; j < MAX_BROADPHASE_COLLISION_TYPES; j++ )
+        {
+            for ( int k = 0; k < MAX_BROADPHASE_COLLISION_TYPES; k++ )
+            {
+                context->m_createFuncs[j][k] =
+                        context->m_configuration->
+                        getCollisionAlgorithmCreateFunc(j, k);
+            }
+        }
+
+        context->m_algorithmPool =
+                new btPoolAllocator(algorithmSize, (i == 0) ?
+                                    algorithmPoolSize : algorithmShareSize);
+    }
+
+    // Create the worker threads; the calling thread is the first
+    m_threadsAlive = true;
+    for ( int i = 1; i < m_numThreads; i++ )
+    {
+        WorkerThreadData* data = new WorkerThreadData();
+        data->m_dispatcher = this;
+        data->m_thread = i;
+
+        pthread_t thread;
+        if ( pthread_create(&thread, NULL,
+                            &ParallelCollisionDispatcher::WorkerThreadMethod,
+                            data) != 0 )
+        {
+            LOG_DEBUG("ParallelCollisionDispatcher: thread creation failed!");
+            delete data;
+            return false;
+        }
+        m_threads.push_back(thread);
+    }
+
+    return true;
+}
+
+void ParallelCollisionDispatcher::SetActiveThreads(int numThreads, bool cycle)
+{
+    m_activeThreads = std::max(1, std::min(numThreads, m_numThreads));
+    m_cycleThreads = cycle;
+}
+
+double ParallelCollisionDispatcher::AverageDispatchTime(int numThreads) const
+{
+    if ( (numThreads < 1) || (numThreads > MaxCollisionThreads) ||
+         (m_numDispatches[numThreads] == 0) )
+    {
+        return -1.0;
+    }
+
+    return m_totalDispatchTime[numThreads] / m_numDispatches[numThreads];
+}
+
+CollisionContext* ParallelCollisionDispatcher::CurrentContext() const
+{
+    CollisionContext* context =
+            static_cast<CollisionContext*>(pthread_getspecific(m_contextKey));
+    return (context != NULL) ? context : m_contexts[0];
+}
+
+btPersistentManifold* ParallelCollisionDispatcher::getNewManifold(void* b0,
+                                                                  void* b1)
+{
+    CollisionContext* context = CurrentContext();
+    btCollisionObject* body0 = static_cast<btCollisionObject*>(b0);
+    btCollisionObject* body1 = static_cast<btCollisionObject*>(b1);
+
+    // As in btCollisionDispatcher
+    btScalar contactBreakingThreshold = gContactBreakingThreshold;
+    if ( m_dispatcherFlags & CD_USE_RELATIVE_CONTACT_BREAKING_THRESHOLD )
+    {
+        contactBreakingThreshold = btMin(
+                body0->getCollisionShape()->getContactBreakingThreshold(
+                    gContactBreakingThreshold),
+                body1->getCollisionShape()->getContactBreakingThreshold(
+                    gContactBreakingThreshold));
+    }
+    btScalar contactProcessingThreshold =
+            btMin(body0->getContactProcessingThreshold(),
+                  body1->getContactProcessingThreshold());
+
+    // From the context's own pool
+    btPoolAllocator* pool =
+            context->m_configuration->getPersistentManifoldPool();
+    void* mem = NULL;
+    if ( pool->getFreeCount() > 0 )
+    {
+        mem = pool->allocate(sizeof(btPersistentManifold));
+    }
+    else
+    {
+        CountManifoldPoolOverflow();
+        mem = btAlignedAlloc(sizeof(btPersistentManifold), 16);
+    }
+    btPersistentManifold* manifold =
+            new (mem) btPersistentManifold(body0, body1, 0,
+                                           contactBreakingThreshold,
+                                           contactProcessingThreshold);
+
+    if ( m_dispatching )
+    {
+        // Added to the list once all the threads are done
+        PendingManifold pending;
+        pending.m_pair = context->m_currentPair;
+        pending.m_sequence = context->m_newManifolds.size();
+        pending.m_manifold = manifold;
+        context->m_newManifolds.push_back(pending);
+    }
+    else
+    {
+        manifold->m_index1a = m_manifoldsPtr.size();
+        m_manifoldsPtr.push_back(manifold);
+        gNumManifold++;
+    }
+
+    return manifold;
+}
+
+void ParallelCollisionDispatcher::releaseManifold(
+        btPersistentManifold* manifold)
+{
+    if ( m_dispatching )
+    {
+        // Removed from the list once all the threads are done
+        CollisionContext* context = CurrentContext();
+        clearManifold(manifold);
+        PendingManifold pending;
+        pending.m_pair = context->m_currentPair;
+        pending.m_sequence = context->m_releasedManifolds.size();
+        pending.m_manifold = manifold;
+        context->m_releasedManifolds.push_back(pending);
+        return;
+    }
+
+    DestroyManifold(manifold);
+}
+
+void ParallelCollisionDispatcher::DestroyManifold(
+        btPersistentManifold* manifold)
+{
+    gNumManifold--;
+    clearManifold(manifold);
+
+    // Swap with the last one, as in btCollisionDispatcher
+    int index = manifold->m_index1a;
+    btAssert(index < m_manifoldsPtr.size());
+    m_manifoldsPtr.swap(index, m_manifoldsPtr.size() - 1);
+    m_manifoldsPtr[index]->m_index1a = index;
+    m_manifoldsPtr.pop_back();
+
+    manifold->~btPersistentManifold();
+    for ( int i = 0; i < m_numThreads; i++ )
+    {
+        btPoolAllocator* pool =
+                m_contexts[i]->m_configuration->getPersistentManifoldPool();
+        if ( pool->validPtr(manifold) )
+        {
+            pool->freeMemory(manifold);
+            return;
+        }
+    }
+    btAlignedFree(manifold);
+}
+
+btCollisionAlgorithm* ParallelCollisionDispatcher::findAlgorithm(
+        btCollisionObject* body0, btCollisionObject* body1,
+        btPersistentManifold* sharedManifold)
+{
+    // Created with the context's simplex solver
+    CollisionContext* context = CurrentContext();
+    btCollisionAlgorithmConstructionInfo ci;
+    ci.m_dispatcher1 = this;
+    ci.m_manifold = sharedManifold;
+
+    int type0 = body0->getCollisionShape()->getShapeType();
+    int type1 = body1->getCollisionShape()->getShapeType();
+    return context->m_createFuncs[type0][type1]->
+            CreateCollisionAlgorithm(ci, body0, body1);
+}
+
+void* ParallelCollisionDispatcher::allocateCollisionAlgorithm(int size)
+{
+    CollisionContext* context = CurrentContext();
+    btPoolAllocator* pool = context->m_algorithmPool;
+    int allocationSize = size + AlgorithmHeaderSize;
+
+    char* mem = NULL;
+    if ( (allocationSize <= pool->getElementSize()) &&
+         (pool->getFreeCount() > 0) )
+    {
+        mem = static_cast<char*>(pool->allocate(allocationSize));
+    }
+    else
+    {
+        CountAlgorithmPoolOverflow();
+        mem = static_cast<char*>(btAlignedAlloc(allocationSize, 16));
+    }
+
+    // Record the owner context in the header
+    *reinterpret_cast<int*>(mem) = context->m_index;
+
+    return mem + AlgorithmHeaderSize;
+}
+
+void ParallelCollisionDispatcher::freeCollisionAlgorithm(void* ptr)
+{
+    if ( ptr == NULL )
+    {
+        return;
+    }
+
+    char* mem = static_cast<char*>(ptr) - AlgorithmHeaderSize;
+    btPoolAllocator* pool = m_contexts[AlgorithmContext(ptr)]->m_algorithmPool;
+    if ( pool->validPtr(mem) )
+    {
+        pool->freeMemory(mem);
+    }
+    else
+    {
+        btAlignedFree(mem);
+    }
+}
+
+void ParallelCollisionDispatcher::AssignPairs(btBroadphasePairArray& pairs)
+{
+    for ( int i = 0; i < m_numThreads; i++ )
+    {
+        m_contexts[i]->m_pairs.clear();
+    }
+
+    for ( int i = 0; i < pairs.size(); i++ )
+    {
+        btBroadphasePair& pair = pairs[i];
+        btCollisionObject* body0 =
+                static_cast<btCollisionObject*>(pair.m_pProxy0->m_clientObject);
+        btCollisionObject* body1 =
+                static_cast<btCollisionObject*>(pair.m_pProxy1->m_clientObject);
+        if ( !needsCollision(body0, body1) )
+        {
+            continue;
+        }
+
+        if ( pair.m_algorithm == NULL )
+        {
+            // Bind a new pair to the context with the fewest pairs so far
+            int index = 0;
+            if ( !NeedsExclusiveAccess(body0) &&
+                 !NeedsExclusiveAccess(body1) )
+            {
+                for ( int j = 1; j < m_numThreads; j++ )
+                {
+                    if ( m_contexts[j]->m_pairs.size() <
+                         m_contexts[index]->m_pairs.size() )
+                    {
+                        index = j;
+                    }
+                }
+            }
+
+            pthread_setspecific(m_contextKey, m_contexts[index]);
+            pair.m_algorithm = findAlgorithm(body0, body1);
+            pthread_setspecific(m_contextKey, NULL);
+            if ( pair.m_algorithm == NULL )
+            {
+                continue;
+            }
+        }
+
+        m_contexts[AlgorithmContext(pair.m_algorithm)]->m_pairs.push_back(i);
+    }
+}
+
+void ParallelCollisionDispatcher::ProcessContexts(int thread, int numThreads)
+{
+    // The thread serves every numThreads'th context
+    for ( int i = thread; i < m_numThreads; i += numThreads )
+    {
+        CollisionContext* context = m_contexts[i];
+        pthread_setspecific(m_contextKey, context);
+
+        for ( unsigned int j = 0; j < context->m_pairs.size(); j++ )
+        {
+            int index = context->m_pairs[j];
+            btBroadphasePair& pair = (*m_pairs)[index];
+            btCollisionObject* body0 = static_cast<btCollisionObject*>(
+                    pair.m_pProxy0->m_clientObject);
+            btCollisionObject* body1 = static_cast<btCollisionObject*>(
+                    pair.m_pProxy1->m_clientObject);
+
+            context->m_currentPair = index;
+            btManifoldResult contactPointResult(body0, body1);
+            pair.m_algorithm->processCollision(body0, body1, *m_dispatchInfo,
+                                               &contactPointResult);
+        }
+        context->m_currentPair = -1;
+    }
+
+    pthread_setspecific(m_contextKey, NULL);
+}
+
+void ParallelCollisionDispatcher::MergeManifolds()
+{
+    // New manifolds are appended in pair order
+    std::vector<PendingManifold> pending;
+    for ( int i = 0; i < m_numThreads; i++ )
+    {
+        std::vector<PendingManifold>& manifolds = m_contexts[i]->m_newManifolds;
+        pending.insert(pending.end(), manifolds.begin(), manifolds.end());
+        manifolds.clear();
+    }
+    std::sort(pending.begin(), pending.end(), ComparePendingManifolds);
+    for ( unsigned int i = 0; i < pending.size(); i++ )
+    {
+        btPersistentManifold* manifold = pending[i].m_manifold;
+        manifold->m_index1a = m_manifoldsPtr.size();
+        m_manifoldsPtr.push_back(manifold);
+        gNumManifold++;
+    }
+
+    // ..and the released ones removed in pair order
+    pending.clear();
+    for ( int i = 0; i < m_numThreads; i++ )
+    {
+        std::vector<PendingManifold>& manifolds =
+                m_contexts[i]->m_releasedManifolds;
+        pending.insert(pending.end(), manifolds.begin(), manifolds.end());
+        manifolds.clear();
+    }
+    std::sort(pending.begin(), pending.end(), ComparePendingManifolds);
+    for ( unsigned int i = 0; i < pending.size(); i++ )
+    {
+        DestroyManifold(pending[i].m_manifold);
+    }
+}
+
+void ParallelCollisionDispatcher::dispatchAllCollisionPairs(
+        btOverlappingPairCache* pairCache, const btDispatcherInfo& dispatchInfo,
+        btDispatcher* dispatcher)
+{
+    if ( dispatchInfo.m_dispatchFunc != btDispatcherInfo::DISPATCH_DISCRETE )
+    {
+        btCollisionDispatcher::dispatchAllCollisionPairs(pairCache,
+                                                         dispatchInfo,
+                                                         dispatcher);
+        return;
+    }
+
+    double startTime = CurrentTime();
+    int numThreads = m_activeThreads;
+    if ( m_cycleThreads )
+    {
+        m_activeThreads = (m_activeThreads % m_numThreads) + 1;
+    }
+
+    // Create the algorithms of the new pairs and divide the pairs between
+    // the contexts
+    m_pairs = &pairCache->getOverlappingPairArray();
+    m_dispatchInfo = &dispatchInfo;
+    AssignPairs(*m_pairs);
+
+    m_dispatching = true;
+    if ( numThreads > 1 )
+    {
+        // Wake up the worker threads
+        pthread_mutex_lock(&m_mutex);
+        m_dispatchThreads = numThreads;
+        m_numBusyThreads = numThreads - 1;
+        m_generation++;
+        pthread_cond_broadcast(&m_startCondition);
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    ProcessContexts(0, numThreads);
+
+    if ( numThreads > 1 )
+    {
+        // Wait for the worker threads
+        pthread_mutex_lock(&m_mutex);
+        while ( m_numBusyThreads > 0 )
+        {
+            pthread_cond_wait(&m_doneCondition, &m_mutex);
+        }
+        pthread_mutex_unlock(&m_mutex);
+    }
+    m_dispatching = false;
+
+    MergeManifolds();
+    m_pairs = NULL;
+    m_dispatchInfo = NULL;
+
+    m_totalDispatchTime[numThreads] += CurrentTime() - startTime;
+    m_numDispatches[numThreads]++;
+}
+
+void ParallelCollisionDispatcher::WorkerThreadLoop(int thread)
+{
+    int generation = 0;
+
+    while ( true )
+    {
+        // Wait for the next dispatch
+        pthread_mutex_lock(&m_mutex);
+        while ( m_threadsAlive && (m_generation == generation) )
+        {
+            pthread_cond_wait(&m_startCondition, &m_mutex);
+        }
+        generation = m_generation;
+        bool alive = m_threadsAlive;
+        int numThreads = m_dispatchThreads;
+        pthread_mutex_unlock(&m_mutex);
+
+        if ( !alive )
+        {
+            return;
+        }
+
+        if ( thread < numThreads )
+        {
+            ProcessContexts(thread, numThreads);
+
+            // Signal the dispatching thread
+            pthread_mutex_lock(&m_mutex);
+            m_numBusyThreads--;
+            if ( m_numBusyThreads == 0 )
+            {
+                pthread_cond_signal(&m_doneCondition);
+            }
+            pthread_mutex_unlock(&m_mutex);
+        }
+    }
+}
+
+void* ParallelCollisionDispatcher::WorkerThreadMethod(void* data)
+{
+    WorkerThreadData* threadData = static_cast<WorkerThreadData*>(data);
+    threadData->m_dispatcher->WorkerThreadLoop(threadData->m_thread);
+    delete threadData;
+
+    return NULL;
+}
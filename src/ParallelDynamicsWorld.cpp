@@ -0,0 +1,514 @@
+#include <sys/time.h>
+#include <algorithm>
+
+#include "ParallelDynamicsWorld.h"
+#include "CommonFunctions.h"
+#include "BulletCollision/CollisionDispatch/btSimulationIslandManager.h"
+
+// Islands are batched into at most this many batches per thread, unless
+// btContactSolverInfo::m_minimumSolverBatchSize asks for smaller ones
+static const int BatchesPerThread = 4;
+
+/**
+ * The bodies, contact manifolds and constraints of one island, or of a
+ * batch of consecutive islands; ranges in the world's island arrays.
+ */
+struct SolverIsland
+{
+    int m_firstBody;
+    int m_numBodies;
+    int m_firstManifold;
+    int m_numManifolds;
+    int m_firstConstraint;
+    int m_numConstraints;
+};
+
+/**
+ * Argument of a worker thread.
+ */
+struct SolverThreadData
+{
+    ParallelDynamicsWorld* m_world;
+    int m_thread;
+};
+
+// Returns the island of a constraint, as btDiscreteDynamicsWorld does
+static int ConstraintIslandId(const btTypedConstraint* constraint)
+{
+    const btCollisionObject& body0 = constraint->getRigidBodyA();
+    const btCollisionObject& body1 = constraint->getRigidBodyB();
+    return (body0.getIslandTag() >= 0) ? body0.getIslandTag() :
+                                         body1.getIslandTag();
+}
+
+/**
+ * Orders the constraints by their island.
+ */
+class ConstraintIslandPredicate
+{
+public:
+    bool operator()(const btTypedConstraint* first,
+                    const btTypedConstraint* second) const
+    {
+        return (ConstraintIslandId(first) < ConstraintIslandId(second));
+    }
+};
+
+/**
+ * Copies the awake islands built by the island manager into the world's
+ * island arrays instead of solving them.
+ */
+class IslandCollector : public btSimulationIslandManager::IslandCallback
+{
+public:
+    IslandCollector(std::vector<SolverIsland>& islands,
+                    std::vector<btCollisionObject*>& bodies,
+                    std::vector<btPersistentManifold*>& manifolds,
+                    std::vector<btTypedConstraint*>& constraints)
+        : m_islands(islands), m_bodies(bodies), m_manifolds(manifolds),
+          m_constraints(constraints), m_sortedConstraints(NULL),
+          m_numSortedConstraints(0)
+    {
+    }
+
+    void Setup(btTypedConstraint** sortedConstraints, int numConstraints)
+    {
+        m_sortedConstraints = sortedConstraints;
+        m_numSortedConstraints = numConstraints;
+        m_islands.clear();
+        m_bodies.clear();
+        m_manifolds.clear();
+        m_constraints.clear();
+    }
+
+    virtual void processIsland(btCollisionObject** bodies, int numBodies,
+                               btPersistentManifold** manifolds,
+                               int numManifolds, int islandId)
+    {
+        // The island's constraints are consecutive in the sorted ones;
+        // when the islands are not split, all of them are solved together
+        int firstConstraint = 0;
+        int endConstraint = m_numSortedConstraints;
+        if ( islandId >= 0 )
+        {
+            while ( (firstConstraint < m_numSortedConstraints) &&
+                    (ConstraintIslandId(m_sortedConstraints[firstConstraint])
+                     != islandId) )
+            {
+                firstConstraint++;
+            }
+            endConstraint = firstConstraint;
+            while ( (endConstraint < m_numSortedConstraints) &&
+                    (ConstraintIslandId(m_sortedConstraints[endConstraint])
+                     == islandId) )
+            {
+                endConstraint++;
+            }
+        }
+
+        if ( (numManifolds + endConstraint - firstConstraint) == 0 )
+        {
+            // Nothing to solve
+            return;
+        }
+
+        SolverIsland island;
+        island.m_firstBody = m_bodies.size();
+        island.m_numBodies = numBodies;
+        m_bodies.insert(m_bodies.end(), bodies, bodies + numBodies);
+        island.m_firstManifold = m_manifolds.size();
+        island.m_numManifolds = numManifolds;
+        m_manifolds.insert(m_manifolds.end(), manifolds,
+                           manifolds + numManifolds);
+        island.m_firstConstraint = m_constraints.size();
+        island.m_numConstraints = endConstraint - firstConstraint;
+        m_constraints.insert(m_constraints.end(),
+                             m_sortedConstraints + firstConstraint,
+                             m_sortedConstraints + endConstraint);
+        m_islands.push_back(island);
+    }
+
+private:
+    std::vector<SolverIsland>& m_islands;
+    std::vector<btCollisionObject*>& m_bodies;
+    std::vector<btPersistentManifold*>& m_manifolds;
+    std::vector<btTypedConstraint*>& m_constraints;
+    btTypedConstraint** m_sortedConstraints;
+    int m_numSortedConstraints;
+};
+
+// Returns the current time in seconds
+static double CurrentTime()
+{
+    timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + (now.tv_usec * 0.000001);
+}
+
+// Estimated work of solving an island
+static int IslandCost(const SolverIsland& island)
+{
+    return island.m_numBodies + (island.m_numManifolds * 4) +
+            (island.m_numConstraints * 4);
+}
+
+/**
+ * Orders islands by decreasing cost; equal ones by their index so that
+ * the order does not depend on the sorting algorithm.
+ */
+class IslandCostPredicate
+{
+public:
+    IslandCostPredicate(const std::vector<SolverIsland>& islands)
+        : m_islands(islands)
+    {
+    }
+
+    bool operator()(int first, int second) const
+    {
+        int firstCost = IslandCost(m_islands[first]);
+        int secondCost = IslandCost(m_islands[second]);
+        if ( firstCost != secondCost )
+        {
+            return (firstCost > secondCost);
+        }
+        return (first < second);
+    }
+
+private:
+    const std::vector<SolverIsland>& m_islands;
+};
+
+ParallelDynamicsWorld::ParallelDynamicsWorld(
+        btDispatcher* dispatcher, btBroadphaseInterface* broadphase,
+        btConstraintSolver* const* constraintSolvers,
+        btCollisionConfiguration* collisionConfiguration, int numThreads)
+    : ContinuousDynamicsWorld(dispatcher, broadphase, constraintSolvers[0],
+                                collisionConfiguration),
+      m_numThreads(numThreads),
+      m_islandCollector(NULL),
+      m_solverInfo(NULL),
+      m_generation(0),
+      m_solveThreads(1),
+      m_numBusyThreads(0),
+      m_threadsAlive(false),
+      m_totalSolveTime(0.0),
+      m_totalIslands(0),
+      m_numSolves(0)
+{
+    for ( int i = 0; i < MaxSolverThreads; i++ )
+    {
+        m_solvers[i] = NULL;
+        if ( i < numThreads )
+        {
+            m_solvers[i] = constraintSolvers[i];
+        }
+    }
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_startCondition, NULL);
+    pthread_cond_init(&m_doneCondition, NULL);
+}
+
+ParallelDynamicsWorld::~ParallelDynamicsWorld()
+{
+    // Terminate the worker threads
+    pthread_mutex_lock(&m_mutex);
+    m_threadsAlive = false;
+    pthread_cond_broadcast(&m_startCondition);
+    pthread_mutex_unlock(&m_mutex);
+    for ( unsigned int i = 0; i < m_threads.size(); i++ )
+    {
+        pthread_join(m_threads[i], NULL);
+    }
+    m_threads.clear();
+
+    delete m_islandCollector;
+    m_islandCollector = NULL;
+
+    pthread_cond_destroy(&m_doneCondition);
+    pthread_cond_destroy(&m_startCondition);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+ParallelDynamicsWorld* ParallelDynamicsWorld::Create(
+        btDispatcher* dispatcher, btBroadphaseInterface* broadphase,
+        btConstraintSolver* const* constraintSolvers,
+        btCollisionConfiguration* collisionConfiguration, int numThreads)
+{
+    if ( (numThreads < 1) || (numThreads > MaxSolverThreads) )
+    {
+        LOG_DEBUG("ParallelDynamicsWorld: invalid thread count %d",
+                  numThreads);
+        return NULL;
+    }
+
+    ParallelDynamicsWorld* self =
+            new ParallelDynamicsWorld(dispatcher, broadphase,
+                                      constraintSolvers,
+                                      collisionConfiguration, numThreads);
+    if ( !self->Setup() )
+    {
+        delete self;
+        return NULL;
+    }
+
+    return self;
+}
+
+bool ParallelDynamicsWorld::Setup()
+{
+    m_islandCollector = new IslandCollector(m_islands, m_islandBodies,
+                                            m_islandManifolds,
+                                            m_islandConstraints);
+
+    // Create the worker threads; the calling thread is the first
+    m_threadsAlive = true;
+    for ( int i = 1; i < m_numThreads; i++ )
+    {
+        SolverThreadData* data = new SolverThreadData();
+        data->m_world = this;
+        data->m_thread = i;
+
+        pthread_t thread;
+        if ( pthread_create(&thread, NULL,
+                            &ParallelDynamicsWorld::WorkerThreadMethod,
+                            data) != 0 )
+        {
+            LOG_DEBUG("ParallelDynamicsWorld: thread creation failed!");
+            delete data;
+            return false;
+        }
+        m_threads.push_back(thread);
+    }
+
+    return true;
+}
+
+double ParallelDynamicsWorld::AverageSolveTime() const
+{
+    if ( m_numSolves == 0 )
+    {
+        return -1.0;
+    }
+
+    return m_totalSolveTime / m_numSolves;
+}
+
+double ParallelDynamicsWorld::AverageIslandsPerStep() const
+{
+    if ( m_numSolves == 0 )
+    {
+        return 0.0;
+    }
+
+    return (double)m_totalIslands / m_numSolves;
+}
+
+void ParallelDynamicsWorld::SortConstraints()
+{
+    m_sortedConstraints.resize(m_constraints.size());
+    for ( int i = 0; i < m_constraints.size(); i++ )
+    {
+        m_sortedConstraints[i] = m_constraints[i];
+    }
+    m_sortedConstraints.quickSort(ConstraintIslandPredicate());
+}
+
+void ParallelDynamicsWorld::BatchIslands(int batchSize)
+{
+    // Consecutive islands are solved together until the batch has more
+    // than batchSize manifolds and constraints, as btDiscreteDynamicsWorld
+    // does, to save on the solver's per call overhead
+    m_batches.clear();
+    bool batchOpen = false;
+    for ( unsigned int i = 0; i < m_islands.size(); i++ )
+    {
+        const SolverIsland& island = m_islands[i];
+        if ( !batchOpen )
+        {
+            m_batches.push_back(island);
+        }
+        else
+        {
+            SolverIsland& batch = m_batches.back();
+            batch.m_numBodies += island.m_numBodies;
+            batch.m_numManifolds += island.m_numManifolds;
+            batch.m_numConstraints += island.m_numConstraints;
+        }
+
+        const SolverIsland& batch = m_batches.back();
+        batchOpen = (batchSize > 1) &&
+                ((batch.m_numManifolds + batch.m_numConstraints) <= batchSize);
+    }
+}
+
+void ParallelDynamicsWorld::AssignBatches(int numThreads)
+{
+    for ( int i = 0; i < MaxSolverThreads; i++ )
+    {
+        m_threadBatches[i].clear();
+    }
+
+    // Largest batches first, each to the least loaded thread
+    std::vector<int> order(m_batches.size());
+    for ( unsigned int i = 0; i < order.size(); i++ )
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), IslandCostPredicate(m_batches));
+
+    int load[MaxSolverThreads] = { 0 };
+    for ( unsigned int i = 0; i < order.size(); i++ )
+    {
+        int thread = 0;
+        for ( int j = 1; j < numThreads; j++ )
+        {
+            if ( load[j] < load[thread] )
+            {
+                thread = j;
+            }
+        }
+        m_threadBatches[thread].push_back(order[i]);
+        load[thread] += IslandCost(m_batches[order[i]]);
+    }
+}
+
+void ParallelDynamicsWorld::SolveBatches(int thread)
+{
+    btConstraintSolver* solver = m_solvers[thread];
+    const std::vector<int>& batches = m_threadBatches[thread];
+
+    for ( unsigned int i = 0; i < batches.size(); i++ )
+    {
+        const SolverIsland& batch = m_batches[batches[i]];
+        btCollisionObject** bodies = (batch.m_numBodies > 0) ?
+                    &m_islandBodies[batch.m_firstBody] : NULL;
+        btPersistentManifold** manifolds = (batch.m_numManifolds > 0) ?
+                    &m_islandManifolds[batch.m_firstManifold] : NULL;
+        btTypedConstraint** constraints = (batch.m_numConstraints > 0) ?
+                    &m_islandConstraints[batch.m_firstConstraint] : NULL;
+
+        solver->solveGroup(bodies, batch.m_numBodies,
+                           manifolds, batch.m_numManifolds,
+                           constraints, batch.m_numConstraints,
+                           *m_solverInfo, m_debugDrawer, m_stackAlloc,
+                           m_dispatcher1);
+    }
+}
+
+void ParallelDynamicsWorld::solveConstraints(btContactSolverInfo& solverInfo)
+{
+    BT_PROFILE("solveConstraints");
+
+    double startTime = CurrentTime();
+
+    // Collect the islands to solve
+    SortConstraints();
+    m_islandCollector->Setup(
+            (m_sortedConstraints.size() > 0) ? &m_sortedConstraints[0] : NULL,
+            m_sortedConstraints.size());
+    m_islandManager->buildAndProcessIslands(m_dispatcher1, this,
+                                            m_islandCollector);
+
+    // Batch them so that each thread gets several batches to balance
+    int totalWork = 0;
+    for ( unsigned int i = 0; i < m_islands.size(); i++ )
+    {
+        totalWork += m_islands[i].m_numManifolds +
+                m_islands[i].m_numConstraints;
+    }
+    int batchSize = std::min(solverInfo.m_minimumSolverBatchSize,
+                             totalWork / (m_numThreads * BatchesPerThread));
+    BatchIslands(batchSize);
+
+    int numThreads = std::min(m_numThreads, (int)m_batches.size());
+    numThreads = std::max(numThreads, 1);
+    for ( int i = 0; i < numThreads; i++ )
+    {
+        m_solvers[i]->prepareSolve(getNumCollisionObjects(),
+                                   m_dispatcher1->getNumManifolds());
+    }
+    AssignBatches(numThreads);
+    m_solverInfo = &solverInfo;
+
+    if ( numThreads > 1 )
+    {
+        // Wake up the worker threads
+        pthread_mutex_lock(&m_mutex);
+        m_solveThreads = numThreads;
+        m_numBusyThreads = numThreads - 1;
+        m_generation++;
+        pthread_cond_broadcast(&m_startCondition);
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    SolveBatches(0);
+
+    if ( numThreads > 1 )
+    {
+        // Wait for the worker threads
+        pthread_mutex_lock(&m_mutex);
+        while ( m_numBusyThreads > 0 )
+        {
+            pthread_cond_wait(&m_doneCondition, &m_mutex);
+        }
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    for ( int i = 0; i < numThreads; i++ )
+    {
+        m_solvers[i]->allSolved(solverInfo, m_debugDrawer, m_stackAlloc);
+    }
+    m_solverInfo = NULL;
+
+    m_totalSolveTime += CurrentTime() - startTime;
+    m_totalIslands += m_islands.size();
+    m_numSolves++;
+}
+
+void ParallelDynamicsWorld::WorkerThreadLoop(int thread)
+{
+    int generation = 0;
+
+    while ( true )
+    {
+        // Wait for the next step
+        pthread_mutex_lock(&m_mutex);
+        while ( m_threadsAlive && (m_generation == generation) )
+        {
+            pthread_cond_wait(&m_startCondition, &m_mutex);
+        }
+        generation = m_generation;
+        bool alive = m_threadsAlive;
+        int numThreads = m_solveThreads;
+        pthread_mutex_unlock(&m_mutex);
+
+        if ( !alive )
+        {
+            return;
+        }
+
+        if ( thread < numThreads )
+        {
+            SolveBatches(thread);
+
+            // Signal the stepping thread
+            pthread_mutex_lock(&m_mutex);
+            m_numBusyThreads--;
+            if ( m_numBusyThreads == 0 )
+            {
+                pthread_cond_signal(&m_doneCondition);
+            }
+            pthread_mutex_unlock(&m_mutex);
+        }
+    }
+}
+
+void* ParallelDynamicsWorld::WorkerThreadMethod(void* data)
+{
+    SolverThreadData* threadData = static_cast<SolverThreadData*>(data);
+    threadData->m_world->WorkerThreadLoop(threadData->m_thread);
+    delete threadData;
+
+    return NULL;
+}
@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include <btBulletDynamicsCommon.h>
+
+#include "PhysicsAllocator.h"
+#include "CommonFunctions.h"
+
+// Size of the header in front of each block; keeps the blocks 16 byte
+// aligned
+static const size_t BlockHeaderSize = 16;
+
+// Payload size of the smallest size class; each class doubles it
+static const size_t MinClassSize = 16;
+
+// Payload size of the largest size class
+static const size_t MaxClassSize = MinClassSize << (NumAllocatorSizeClasses - 1);
+
+/**
+ * Header in front of each block.
+ */
+struct BlockHeader
+{
+    // Heap allocation of a block outside the size classes; NULL for the
+    // pooled blocks
+    void* m_heapBase;
+
+    // Size class of a pooled block
+    int m_sizeClass;
+};
+
+// The allocator Bullet's allocations currently go to
+static PhysicsAllocator* InstalledAllocator = NULL;
+
+// Returns the size class for the given size or -1 if it is too large
+static int SizeClass(size_t size)
+{
+    int sizeClass = 0;
+    size_t classSize = MinClassSize;
+    while ( classSize < size )
+    {
+        classSize <<= 1;
+        sizeClass++;
+    }
+
+    return (sizeClass < NumAllocatorSizeClasses) ? sizeClass : -1;
+}
+
+// Rounds the pointer up to the given power of two alignment
+static char* AlignPointer(char* ptr, size_t alignment)
+{
+    uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+    address = (address + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    return reinterpret_cast<char*>(address);
+}
+
+static BlockHeader* GetHeader(void* ptr)
+{
+    return reinterpret_cast<BlockHeader*>(static_cast<char*>(ptr) -
+                                          BlockHeaderSize);
+}
+
+PhysicsAllocator* PhysicsAllocator::Create(size_t chunkSize)
+{
+    PhysicsAllocator* self = new PhysicsAllocator(chunkSize);
+    if ( !self->Setup() )
+    {
+        delete self;
+        return NULL;
+    }
+
+    return self;
+}
+
+PhysicsAllocator::PhysicsAllocator(size_t chunkSize)
+    : m_chunkSize(std::max(chunkSize, BlockHeaderSize + MaxClassSize)),
+      m_chunkPos(NULL),
+      m_chunkEnd(NULL)
+{
+    for ( int i = 0; i < NumAllocatorSizeClasses; i++ )
+    {
+        m_freeLists[i] = NULL;
+    }
+    pthread_mutex_init(&m_mutex, NULL);
+}
+
+PhysicsAllocator::~PhysicsAllocator()
+{
+    Uninstall();
+
+    if ( m_stats.m_numLiveBlocks > 0 )
+    {
+        LOG_DEBUG("PhysicsAllocator: %d blocks still allocated!",
+                  m_stats.m_numLiveBlocks);
+    }
+
+    // Release the whole arena at once
+    for ( unsigned int i = 0; i < m_chunks.size(); i++ )
+    {
+        free(m_chunks[i]);
+    }
+
+    pthread_mutex_destroy(&m_mutex);
+}
+
+bool PhysicsAllocator::Setup()
+{
+    if ( !AllocateChunk() )
+    {
+        LOG_DEBUG("PhysicsAllocator: failed to allocate the arena!");
+        return false;
+    }
+
+    return true;
+}
+
+bool PhysicsAllocator::AllocateChunk()
+{
+    char* chunk = static_cast<char*>(malloc(m_chunkSize + BlockHeaderSize));
+    if ( chunk == NULL )
+    {
+        return false;
+    }
+
+    m_chunks.push_back(chunk);
+    m_chunkPos = AlignPointer(chunk, BlockHeaderSize);
+    m_chunkEnd = m_chunkPos + m_chunkSize;
+    m_stats.m_numHeapAllocations++;
+    m_stats.m_heapBytes += m_chunkSize + BlockHeaderSize;
+
+    return true;
+}
+
+void* PhysicsAllocator::AllocateHeapBlock(size_t size, int alignment)
+{
+    size_t blockAlignment = std::max((size_t)alignment, BlockHeaderSize);
+    size_t heapSize = size + BlockHeaderSize + blockAlignment - 1;
+    char* base = static_cast<char*>(malloc(heapSize));
+    if ( base == NULL )
+    {
+        return NULL;
+    }
+
+    char* ptr = AlignPointer(base + BlockHeaderSize, blockAlignment);
+    BlockHeader* header = GetHeader(ptr);
+    header->m_heapBase = base;
+    header->m_sizeClass = -1;
+    m_stats.m_numHeapAllocations++;
+    m_stats.m_heapBytes += heapSize;
+
+    return ptr;
+}
+
+void* PhysicsAllocator::Allocate(size_t size, int alignment)
+{
+    pthread_mutex_lock(&m_mutex);
+
+    void* ptr = NULL;
+    int sizeClass = SizeClass(size);
+    if ( (sizeClass < 0) || (alignment > (int)BlockHeaderSize) )
+    {
+        ptr = AllocateHeapBlock(size, alignment);
+    }
+    else if ( m_freeLists[sizeClass] != NULL )
+    {
+        // Reuse a freed block; its header is still valid
+        ptr = m_freeLists[sizeClass];
+        m_freeLists[sizeClass] = *static_cast<void**>(ptr);
+    }
+    else
+    {
+        // Carve a new block out of the arena
+        size_t blockSize = BlockHeaderSize + (MinClassSize << sizeClass);
+        if ( (m_chunkPos + blockSize <= m_chunkEnd) || AllocateChunk() )
+        {
+            ptr = m_chunkPos + BlockHeaderSize;
+            m_chunkPos += blockSize;
+            BlockHeader* header = GetHeader(ptr);
+            header->m_heapBase = NULL;
+            header->m_sizeClass = sizeClass;
+        }
+    }
+
+    if ( ptr != NULL )
+    {
+        m_stats.m_numAllocations++;
+        m_stats.m_allocatedBytes += size;
+        m_stats.m_numLiveBlocks++;
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+
+    return ptr;
+}
+
+void PhysicsAllocator::Free(void* ptr)
+{
+    if ( ptr == NULL )
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&m_mutex);
+
+    BlockHeader* header = GetHeader(ptr);
+    if ( header->m_heapBase != NULL )
+    {
+        free(header->m_heapBase);
+    }
+    else
+    {
+        *static_cast<void**>(ptr) = m_freeLists[header->m_sizeClass];
+        m_freeLists[header->m_sizeClass] = ptr;
+    }
+    m_stats.m_numFrees++;
+    m_stats.m_numLiveBlocks--;
+
+    pthread_mutex_unlock(&m_mutex);
+}
+
+void PhysicsAllocator::Install()
+{
+    InstalledAllocator = this;
+    btAlignedAllocSetCustom(&PhysicsAllocator::BulletAlloc,
+                            &PhysicsAllocator::BulletFree);
+    btAlignedAllocSetCustomAligned(&PhysicsAllocator::BulletAlignedAlloc,
+                                   &PhysicsAllocator::BulletFree);
+}
+
+void PhysicsAllocator::Uninstall()
+{
+    if ( InstalledAllocator == this )
+    {
+        btAlignedAllocSetCustom(NULL, NULL);
+        btAlignedAllocSetCustomAligned(NULL, NULL);
+        InstalledAllocator = NULL;
+    }
+}
+
+PhysicsAllocatorStats PhysicsAllocator::Stats()
+{
+    pthread_mutex_lock(&m_mutex);
+    PhysicsAllocatorStats stats = m_stats;
+    pthread_mutex_unlock(&m_mutex);
+
+    return stats;
+}
+
+void* PhysicsAllocator::BulletAlloc(size_t size)
+{
+    return InstalledAllocator->Allocate(size);
+}
+
+void* PhysicsAllocator::BulletAlignedAlloc(size_t size, int alignment)
+{
+    return InstalledAllocator->Allocate(size, alignment);
+}
+
+void PhysicsAllocator::BulletFree(void* ptr)
+{
+    InstalledAllocator->Free(ptr);
+}
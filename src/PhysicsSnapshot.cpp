@@ -0,0 +1,311 @@
+#include <string.h>
+
+#include "PhysicsSnapshot.h"
+#include "CommonFunctions.h"
+
+// Starting value and multiplier of the FNV-1a hash used for the checksum
+static const unsigned int ChecksumBasis = 2166136261u;
+static const unsigned int ChecksumPrime = 16777619u;
+
+// Reads the chunk at the given offset of a serialized world. The chunks
+// are packed without padding, so they are copied out instead of accessed
+// in place
+static void ReadChunk(const std::vector<unsigned char>& buffer, int offset,
+                      btChunk& chunk)
+{
+    memcpy(&chunk, &buffer[offset], sizeof(btChunk));
+}
+
+static void ReadBody(const std::vector<unsigned char>& buffer, int offset,
+                     btRigidBodyData& data)
+{
+    memcpy(&data, &buffer[offset + sizeof(btChunk)], sizeof(btRigidBodyData));
+}
+
+// Adds the x, y and z of a serialized vector to the checksum; the unused w
+// may hold anything
+static unsigned int HashVector(unsigned int hash, const btVector3Data& vector)
+{
+    const unsigned char* bytes =
+            reinterpret_cast<const unsigned char*>(vector.m_floats);
+    for ( unsigned int i = 0; i < 3 * sizeof(vector.m_floats[0]); i++ )
+    {
+        hash = (hash ^ bytes[i]) * ChecksumPrime;
+    }
+
+    return hash;
+}
+
+PhysicsSnapshot* PhysicsSnapshot::Create(btDynamicsWorld* world)
+{
+    // The terrain's BVH is pregenerated; leave it out of the snapshots
+    btDefaultSerializer serializer;
+    serializer.setSerializationFlags(BT_SERIALIZE_NO_BVH |
+                                     BT_SERIALIZE_NO_TRIANGLEINFOMAP);
+    world->serialize(&serializer);
+
+    PhysicsSnapshot* self = new PhysicsSnapshot(true);
+    GetBodies(world, self->m_liveBodies);
+    if ( !self->Setup(serializer.getBufferPointer(),
+                      serializer.getCurrentBufferSize()) )
+    {
+        delete self;
+        return NULL;
+    }
+
+    return self;
+}
+
+PhysicsSnapshot* PhysicsSnapshot::CreateFromBuffer(const unsigned char* data,
+                                                   int size)
+{
+    // The chunks are only readable as they are if the header matches the
+    // one this build writes
+    unsigned char header[BT_HEADER_LENGTH];
+    btDefaultSerializer serializer;
+    serializer.writeHeader(header);
+    if ( (size < BT_HEADER_LENGTH) ||
+         (memcmp(data, header, BT_HEADER_LENGTH) != 0) )
+    {
+        LOG_DEBUG("PhysicsSnapshot: not a snapshot of this build!");
+        return NULL;
+    }
+
+    PhysicsSnapshot* self = new PhysicsSnapshot(false);
+    if ( !self->Setup(data, size) )
+    {
+        delete self;
+        return NULL;
+    }
+
+    return self;
+}
+
+PhysicsSnapshot::PhysicsSnapshot(bool restorable)
+    : m_restorable(restorable)
+{
+}
+
+PhysicsSnapshot::~PhysicsSnapshot()
+{
+}
+
+bool PhysicsSnapshot::Setup(const unsigned char* data, int size)
+{
+    if ( size <= BT_HEADER_LENGTH )
+    {
+        LOG_DEBUG("PhysicsSnapshot: empty snapshot!");
+        return false;
+    }
+    m_buffer.assign(data, data + size);
+
+    // Find the rigid bodies; they are in the order of the world's
+    // collision object array
+    int offset = BT_HEADER_LENGTH;
+    while ( offset + (int)sizeof(btChunk) <= size )
+    {
+        btChunk chunk;
+        ReadChunk(m_buffer, offset, chunk);
+        if ( (chunk.m_length < 0) ||
+             (chunk.m_length > size - offset - (int)sizeof(btChunk)) )
+        {
+            LOG_DEBUG("PhysicsSnapshot: corrupt chunk at %d!", offset);
+            return false;
+        }
+
+        if ( chunk.m_chunkCode == BT_RIGIDBODY_CODE )
+        {
+            if ( chunk.m_length != (int)sizeof(btRigidBodyData) )
+            {
+                LOG_DEBUG("PhysicsSnapshot: unknown rigid body layout!");
+                return false;
+            }
+            m_bodies.push_back(offset);
+        }
+
+        offset += sizeof(btChunk) + chunk.m_length;
+    }
+
+    // Snapshots of this process have a chunk for each live body
+    if ( m_restorable && (m_bodies.size() != m_liveBodies.size()) )
+    {
+        LOG_DEBUG("PhysicsSnapshot: %d bodies, %d serialized!",
+                  (int)m_liveBodies.size(), (int)m_bodies.size());
+        return false;
+    }
+
+    return true;
+}
+
+void PhysicsSnapshot::GetBodies(btDynamicsWorld* world,
+                                std::vector<btRigidBody*>& bodies)
+{
+    // In the order btDiscreteDynamicsWorld serializes them
+    const btCollisionObjectArray& objects = world->getCollisionObjectArray();
+    for ( int i = 0; i < objects.size(); i++ )
+    {
+        btRigidBody* body = btRigidBody::upcast(objects[i]);
+        if ( body != NULL )
+        {
+            bodies.push_back(body);
+        }
+    }
+}
+
+bool PhysicsSnapshot::Restore(btDynamicsWorld* world) const
+{
+    if ( !m_restorable )
+    {
+        LOG_DEBUG("PhysicsSnapshot: snapshot is not of this process!");
+        return false;
+    }
+
+    std::vector<btRigidBody*> bodies;
+    GetBodies(world, bodies);
+    if ( bodies != m_liveBodies )
+    {
+        LOG_DEBUG("PhysicsSnapshot: bodies differ from the snapshot!");
+        return false;
+    }
+
+    // Take everything out of the world and reset the broadphase; this
+    // drops the overlapping pairs and the contact manifolds, whose cached
+    // impulses would otherwise carry over into the restored state
+    btCollisionObjectArray& objects = world->getCollisionObjectArray();
+    std::vector<btCollisionObject*> removed(objects.size());
+    std::vector<short> groups(objects.size());
+    std::vector<short> masks(objects.size());
+    for ( int i = objects.size() - 1; i >= 0; i-- )
+    {
+        btCollisionObject* object = objects[i];
+        removed[i] = object;
+        groups[i] = object->getBroadphaseHandle()->m_collisionFilterGroup;
+        masks[i] = object->getBroadphaseHandle()->m_collisionFilterMask;
+
+        btRigidBody* body = btRigidBody::upcast(object);
+        if ( body != NULL )
+        {
+            world->removeRigidBody(body);
+        }
+        else
+        {
+            world->removeCollisionObject(object);
+        }
+    }
+    world->getBroadphase()->resetPool(world->getDispatcher());
+    world->getConstraintSolver()->reset();
+
+    // Put them back in the original order, so that the proxies and pairs
+    // get created the same way as they were for the snapshot
+    int bodyIndex = 0;
+    for ( unsigned int i = 0; i < removed.size(); i++ )
+    {
+        btRigidBody* body = btRigidBody::upcast(removed[i]);
+        if ( body == NULL )
+        {
+            world->addCollisionObject(removed[i], groups[i], masks[i]);
+            continue;
+        }
+
+        // The proxy is created from the restored transform; adding resets
+        // the gravity and, for static bodies, the activation state, so the
+        // body is restored once more after it
+        btRigidBodyData data;
+        ReadBody(m_buffer, m_bodies[bodyIndex++], data);
+        RestoreBody(data, body);
+        world->addRigidBody(body, groups[i], masks[i]);
+        RestoreBody(data, body);
+    }
+
+    return true;
+}
+
+void PhysicsSnapshot::RestoreBody(const btRigidBodyData& data,
+                                  btRigidBody* body) const
+{
+    const btCollisionObjectData& objectData = data.m_collisionObjectData;
+    btTransform transform;
+    btVector3 vector;
+
+    transform.deSerialize(objectData.m_interpolationWorldTransform);
+    body->setInterpolationWorldTransform(transform);
+    vector.deSerialize(objectData.m_interpolationLinearVelocity);
+    body->setInterpolationLinearVelocity(vector);
+    vector.deSerialize(objectData.m_interpolationAngularVelocity);
+    body->setInterpolationAngularVelocity(vector);
+
+    transform.deSerialize(objectData.m_worldTransform);
+    body->setWorldTransform(transform);
+    body->updateInertiaTensor();
+    vector.deSerialize(data.m_linearVelocity);
+    body->setLinearVelocity(vector);
+    vector.deSerialize(data.m_angularVelocity);
+    body->setAngularVelocity(vector);
+    vector.deSerialize(data.m_gravity_acceleration);
+    body->setGravity(vector);
+
+    // Bullet clears the forces after every step
+    body->clearForces();
+
+    body->setFriction(objectData.m_friction);
+    body->setRestitution(objectData.m_restitution);
+    body->setDamping(data.m_linearDamping, data.m_angularDamping);
+    body->setHitFraction(objectData.m_hitFraction);
+    body->forceActivationState(objectData.m_activationState1);
+    body->setDeactivationTime(objectData.m_deactivationTime);
+
+    // Sleeping bodies do not update their motion states when stepped
+    if ( body->getMotionState() != NULL )
+    {
+        body->getMotionState()->setWorldTransform(transform);
+    }
+}
+
+unsigned int PhysicsSnapshot::Checksum() const
+{
+    unsigned int hash = ChecksumBasis;
+    for ( unsigned int i = 0; i < m_bodies.size(); i++ )
+    {
+        btRigidBodyData data;
+        ReadBody(m_buffer, m_bodies[i], data);
+        const btTransformData& transform =
+                data.m_collisionObjectData.m_worldTransform;
+        for ( int j = 0; j < 3; j++ )
+        {
+            hash = HashVector(hash, transform.m_basis.m_el[j]);
+        }
+        hash = HashVector(hash, transform.m_origin);
+        hash = HashVector(hash, data.m_linearVelocity);
+        hash = HashVector(hash, data.m_angularVelocity);
+    }
+
+    return hash;
+}
+
+float PhysicsSnapshot::MaxDistance(const PhysicsSnapshot& other) const
+{
+    if ( m_bodies.size() != other.m_bodies.size() )
+    {
+        return -1.0;
+    }
+
+    float maxDistance = 0.0;
+    for ( unsigned int i = 0; i < m_bodies.size(); i++ )
+    {
+        btRigidBodyData data;
+        btRigidBodyData otherData;
+        ReadBody(m_buffer, m_bodies[i], data);
+        ReadBody(other.m_buffer, other.m_bodies[i], otherData);
+
+        btVector3 position;
+        btVector3 otherPosition;
+        position.deSerialize(
+                data.m_collisionObjectData.m_worldTransform.m_origin);
+        otherPosition.deSerialize(
+                otherData.m_collisionObjectData.m_worldTransform.m_origin);
+        maxDistance = btMax(maxDistance,
+                            (float)position.distance(otherPosition));
+    }
+
+    return maxDistance;
+}
@@ -1,18 +1,28 @@
+#include <unistd.h>
+#include <algorithm>
+#include <new>
+
 #include "PhysicsStage.h"
 #include "CommonFunctions.h"
 #include "PhysicsStageStatics.h"
 #include "Pillar.h"
 #include "Skybox.h"
 #include "Vehicle.h"
+#include "RaycastVehicle.h"
 #include "MatrixOperations.h"
+#include "MatrixKernels.h"
 #include "ObjectMotionState.h"
 #include "TranslationAnimation.h"
-#include "RotationAnimation.h"
 #include "BSplineAnimation.h"
 #include "SplineCameraPathAnimation.h"
 #include "SimpleTimer.h"
-#include "ObjectInstance.h"
 #include "TextRenderer.h"
+#include "GLExtensions.h"
+#include "InstanceBuffer.h"
+#include "ParallelCollisionDispatcher.h"
+#include "ContinuousDynamicsWorld.h"
+#include "ParallelDynamicsWorld.h"
+#include "PhysicsSnapshot.h"
 
 // REFERENCES
 // - Tangent Space Bump Mapping:
@@ -29,16 +39,6 @@
 // - change Terrain secondary texture & shading
 // - lens flare occlusion sampling every 100ms
 
-// bias matrix is used to transform unit cube [-1,1] into [0,1]
-// all components get c = c*0.5 + 0.5
-// Used for shadow mapping.
-static const float BiasMatrix[16] = {
-    0.5, 0.0, 0.0, 0.0,
-    0.0, 0.5, 0.0, 0.0,
-    0.0, 0.0, 0.5, 0.0,
-    0.5, 0.5, 0.5, 1.0
-};
-
 // Identity matrix
 static const float IdentityMatrix[16] = {
     1.0, 0.0, 0.0, 0.0,
@@ -54,17 +54,101 @@ enum TimerIds
     VehicleAccelerateTimer,
     SetSmallestFarClipTimer,
     SetMediumFarClipTimer,
-    SetSmallerFarClipTimer
+    SetSmallerFarClipTimer,
+    StressLevelTimer
 //    ,
 //    SetLargeFarClipTimer
 };
 
-// Sun occlusion test interval for Lens flares (in seconds)
+// Render passes of the draw queue
+enum DrawPasses
+{
+    BackgroundPass,
+    OpaquePass,
+    TransparentPass
+};
+
+// Mesh ids of the draw queue items
+enum DrawMeshes
+{
+    SkyboxMesh,
+    TerrainMesh,
+    WalkwayMesh,
+    VehicleMesh,
+    WallCornerMesh,
+    WallSegmentMesh,
+    TreeTrunkMesh,
+    TreeLeavesMesh,
+    PillarMesh,
+    PillarInstancedMesh
+};
+
+// Sun occlusion test interval for Lens flares (in seconds); only used
+// when occlusion queries are not available
 const float SunOcclusionTestInterval = 0.1;
 
+// The sun visibility is measured with a SunSampleGridSize x
+// SunSampleGridSize grid of small quads around the sun, each with its own
+// occlusion query; the fraction of visible samples gives the visibility
+static const int SunSampleGridSize = 4;
+static const int NumSunSamples = SunSampleGridSize * SunSampleGridSize;
+static const float SunSampleSpacing = 4.0; // pixels
+static const float SunSampleSize = 2.0; // pixels
+
+// Sun samples are drawn just short of the far plane, so they only pass the
+// depth test where no object has been drawn
+static const float SunSampleDepth = 0.9999;
+
+// Number of query sets in flight; the results are read this many frames
+// late at most
+static const int SunQueryLatency = 3;
+
+// Lens flare fade in / out speed, in visibility units per second
+static const float SunVisibilityFadeSpeed = 4.0;
+
+// Lens flare blending alpha at full sun visibility
+static const float LensFlareAlpha = 0.3;
+
 // Default gravity vector
 const btVector3 DefaultGravity(0.0, -9.81, 0.0);
 
+// Contact manifolds and collision algorithms reserved in the pools per
+// dynamic body. A settled pile of pillars peaks at about 5.4 of each per
+// body
+static const int ManifoldsPerDynamicBody = 8;
+static const int AlgorithmsPerDynamicBody = 8;
+static const int MinCollisionPoolSize = 256;
+
+// Size of the chunks the physics allocator reserves its arena in
+static const size_t PhysicsArenaChunkSize = 256 * 1024;
+
+// The btAxisSweep3 broadphase covers the bounds of the static bodies, plus
+// this much room above them for the bodies thrown in the air (in meters)
+static const float AxisSweepHeadroom = 50.0;
+
+// Most proxies the 16-bit btAxisSweep3 takes; bt32BitAxisSweep3 is used
+// for more
+static const int AxisSweepMaxHandles = 32767;
+
+// Interval of the awake pillar samples, in seconds
+static const double ActivitySampleInterval = 4.0;
+
+// Scene query workload: the rays reach the far clip plane, and the
+// spheres of this radius are swept this far from the camera (in meters)
+static const float QuerySphereRadius = 0.5;
+static const float QuerySweepLength = 50.0;
+
+// Continuous collision detection: a body's motion is swept once it moves
+// further in a step than this fraction of the smallest half extent of its
+// shape, with a sphere of this fraction of it. The vehicle's sphere stays
+// clear of the ground under it
+static const float CcdMotionThresholdScale = 0.5;
+static const float CcdSweptSphereScale = 0.8;
+
+// The tunnelling check leaves alone the bodies that moved less than this
+// in a step (in meters)
+static const float TunnellingCheckMinMotion = 0.01;
+
 // Pillar object's Bullet properties
 static const float PillarMass = 0.5;
 static const float PillarBounciness = 0.3;
@@ -75,11 +159,47 @@ static const int NumPillarRows = 5;
 static const int NumPillarColumns = 10;
 static const float PillarSpacing = 5.0; // meters
 
+// Stress mode pillar layout. The grid is packed into the walkway plaza
+// down to the minimum spacing; the extra pillars are piled lying across
+// the walkway path between the plaza and the vehicle
+static const float StressPlazaWidth = 54.0; // meters
+static const float StressPlazaDepth = 26.0;
+static const float MinPillarSpacing = 1.6;
+static const float PillarPileX = -60.0;
+static const float PillarPileStartZ = -18.0;
+static const float PillarPileEndZ = 60.0;
+static const float PillarPileGap = 0.3;
+
 // Vehicle object's Bullet properties
 static const float VehicleMass = 0.7;
 static const float VehicleBounciness = 0.1;
 static const float VehicleFriction = 0.15;
 
+// Raycast vehicle tuning. The suspension sags by g / (4 * stiffness) under
+// the weight of the vehicle; the wheels are mounted that much higher so
+// that the body rests on them as drawn
+static const float VehicleSuspensionRestLength = 0.3;
+static const float VehicleSuspensionStiffness = 20.0;
+static const float VehicleSuspensionCompression = 4.4;
+static const float VehicleSuspensionDamping = 2.3;
+static const float VehicleSuspensionTravelCm = 20.0;
+static const float VehicleFrictionSlip = 1.2;
+static const float VehicleRollInfluence = 0.1;
+
+// How far the wheel hulls are lifted off the ground; the vehicle rides on
+// the wheel rays and the hulls only hit the objects beside it
+static const float VehicleWheelHullLift = 0.1;
+
+// Brake holding the vehicle in place until it starts
+static const float VehicleParkingBrake = 1.0;
+
+// Cruising towards the pillars and the run-up into them; speeds in m/s and
+// accelerations in m/s^2
+static const float VehicleCruiseSpeed = 5.5;
+static const float VehicleCruiseAcceleration = 3.0;
+static const float VehicleRunUpSpeed = 20.0;
+static const float VehicleRunUpAcceleration = 3.5;
+
 // Vehicle's initial position (on the XZ plane)
 const float VehicleInitialX = -60;
 const float VehicleInitialZ = 72;
@@ -97,12 +217,213 @@ static const float StageDuration = 76.0;
 static const char* InfoPopupHeader = "game environment test";
 static const char* InfoPopupMessage = "physics / shadow mapping";
 
+// Printable names of the broadphases
+static const char* const PhysicsBroadphaseNames[] = {
+    "dbvt", "static_dbvt", "axis_sweep"
+};
+
+// Printable names of the physics phases
+static const char* const PhysicsPhaseNames[NumPhysicsPhases] = {
+    "broadphase", "narrowphase", "solver", "integrate", "vehicle", "other"
+};
+
+// Bullet's profile zones of a simulation step and the phases they are
+// reported in; the time outside them counts as PhysicsPhaseOther
+struct PhysicsProfileZone
+{
+    const char* m_name;
+    PhysicsPhase m_phase;
+};
+
+static const PhysicsProfileZone PhysicsProfileZones[] = {
+    { "updateAabbs", PhysicsPhaseBroadphase },
+    { "calculateOverlappingPairs", PhysicsPhaseBroadphase },
+    { "dispatchAllCollisionPairs", PhysicsPhaseNarrowphase },
+    { "calculateSimulationIslands", PhysicsPhaseSolver },
+    { "solveConstraints", PhysicsPhaseSolver },
+    { "predictUnconstraintMotion", PhysicsPhaseIntegrate },
+    { "integrateTransforms", PhysicsPhaseIntegrate },
+    { "synchronizeMotionStates", PhysicsPhaseIntegrate },
+    { "updateActions", PhysicsPhaseVehicle }
+};
+
+static const int NumPhysicsProfileZones =
+        sizeof(PhysicsProfileZones) / sizeof(PhysicsProfileZones[0]);
+
+// Returns the current time in seconds
+static double CurrentTime()
+{
+    timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + (now.tv_usec * 0.000001);
+}
+
+#ifndef BT_NO_PROFILE
+// Adds the times of the profile zones below the iterator's current parent
+// to their phases and returns their sum
+static double AddProfileZoneTimes(CProfileIterator* iterator,
+                                  double* phaseTimes)
+{
+    double zoneTime = 0.0;
+
+    iterator->First();
+    for ( int i = 0; !iterator->Is_Done(); i++ )
+    {
+        const char* name = iterator->Get_Current_Name();
+        int zone = 0;
+        while ( (zone < NumPhysicsProfileZones) &&
+                (strcmp(name, PhysicsProfileZones[zone].m_name) != 0) )
+        {
+            zone++;
+        }
+
+        if ( zone < NumPhysicsProfileZones )
+        {
+            double time = iterator->Get_Current_Total_Time();
+            phaseTimes[PhysicsProfileZones[zone].m_phase] += time;
+            zoneTime += time;
+            iterator->Next();
+        }
+        else
+        {
+            // Look for the zones inside this one. Returning to the parent
+            // rewinds the iterator to its first child
+            iterator->Enter_Child(i);
+            zoneTime += AddProfileZoneTimes(iterator, phaseTimes);
+            iterator->Enter_Parent();
+            for ( int j = 0; j <= i; j++ )
+            {
+                iterator->Next();
+            }
+        }
+    }
+
+    return zoneTime;
+}
+#endif // BT_NO_PROFILE
+
+// Enables continuous collision detection for a body, scaled by the size
+// of its shape
+static void EnableContinuousCollision(btRigidBody* body)
+{
+    btVector3 aabbMin;
+    btVector3 aabbMax;
+    body->getCollisionShape()->getAabb(btTransform::getIdentity(),
+                                       aabbMin, aabbMax);
+    btVector3 halfExtents = (aabbMax - aabbMin) * btScalar(0.5);
+    btScalar size = halfExtents[halfExtents.minAxis()];
+    body->setCcdMotionThreshold(size * CcdMotionThresholdScale);
+    body->setCcdSweptSphereRadius(size * CcdSweptSphereScale);
+}
+
+/**
+ * Finds the closest object, other than the body itself, that a ray cast
+ * along the body's motion passes through.
+ */
+class TunnellingRayCallback
+    : public btCollisionWorld::ClosestRayResultCallback
+{
+public:
+    TunnellingRayCallback(const btCollisionObject* body,
+                          const btVector3& from, const btVector3& to)
+        : btCollisionWorld::ClosestRayResultCallback(from, to),
+          m_body(body)
+    {
+    }
+
+    virtual bool needsCollision(btBroadphaseProxy* proxy) const
+    {
+        return (proxy->m_clientObject != m_body) &&
+               btCollisionWorld::ClosestRayResultCallback::
+               needsCollision(proxy);
+    }
+
+    virtual btScalar addSingleResult(
+            btCollisionWorld::LocalRayResult& result,
+            bool normalInWorldSpace)
+    {
+        if ( !result.m_collisionObject->hasContactResponse() )
+        {
+            return 1.0;
+        }
+
+        return btCollisionWorld::ClosestRayResultCallback::
+                addSingleResult(result, normalInWorldSpace);
+    }
+
+private:
+    const btCollisionObject* m_body;
+};
+
+// Stores the orientation and position of a body into a physics state
+static void StoreBodyState(const btRigidBody* body, float* state)
+{
+    const btTransform& transform = body->getWorldTransform();
+    btQuaternion rotation = transform.getRotation();
+    const btVector3& position = transform.getOrigin();
+    state[0] = rotation.x();
+    state[1] = rotation.y();
+    state[2] = rotation.z();
+    state[3] = rotation.w();
+    state[4] = position.x();
+    state[5] = position.y();
+    state[6] = position.z();
+}
+
+// Calculates the transform of a body at t (0.0 .. 1.0) between two
+// physics states
+static void InterpolateBodyState(const float* previous, const float* current,
+                                 float t, float* transform)
+{
+    btQuaternion rotation(current[0], current[1], current[2], current[3]);
+    btVector3 position(current[4], current[5], current[6]);
+
+    // A body at rest keeps its exact transform
+    if ( memcmp(previous, current,
+                PhysicsStateBodySize * sizeof(float)) != 0 )
+    {
+        btQuaternion previousRotation(previous[0], previous[1], previous[2],
+                                      previous[3]);
+        btVector3 previousPosition(previous[4], previous[5], previous[6]);
+        rotation = previousRotation.slerp(rotation, t);
+        position = previousPosition.lerp(position, t);
+    }
+
+    btTransform(rotation, position).getOpenGLMatrix(transform);
+}
+
 // Near / far clip planes for this stage
 const float PhysicsStageNearClip = 1.0;
 const float PhysicsStageFarClip = 300.0;
 
-// Size of the shadow map (ShadowMapSize * ShadowMapSize)
-const int ShadowMapSize = 2048;
+// Number of shadow cascades and the size of each cascade's tile in the
+// shadow map (CascadeSize * CascadeSize) for each ShadowQuality tier
+struct ShadowQualitySettings
+{
+    int m_numCascades;
+    int m_cascadeSize;
+};
+static const ShadowQualitySettings ShadowQualities[] = {
+    { 2, 512 },  // ShadowQualityLow
+    { 3, 1024 }, // ShadowQualityMedium
+    { 4, 1024 }  // ShadowQualityHigh
+};
+
+// The cascades are laid out in the shadow map in rows of this many tiles
+static const int ShadowMapColumns = 2;
+
+// Shadows are only drawn up to this distance from the camera (in meters)
+static const float ShadowDistance = 200.0;
+
+// Blend between logarithmic (1.0) and uniform (0.0) cascade splits
+static const float CascadeSplitLambda = 0.75;
+
+// Depth range of the light's view; the whole level fits in it
+static const float LightNearClip = 760.0;
+static const float LightFarClip = 870.0;
+
+// Point the light is looking at
+static const float LightTarget[3] = { -60.0, 0.0, 0.0 };
 
 // Sun position
 static const float SunWorldPosition[4] = { -550.0, 470.0, -450.0, 1.0 };
@@ -122,6 +443,8 @@ PhysicsStage::PhysicsStage(TextRenderer& textRenderer,
       m_shadowMapProgram(0),
       m_shadowMapTransparentProgram(0),
       m_vehicleProgram(0),
+      m_defaultInstancedProgram(0),
+      m_shadowMapInstancedProgram(0),
       m_pillarTexture(0),
       m_wallSegmentTexture(0),
       m_skyboxTexture(0),
@@ -158,38 +481,127 @@ PhysicsStage::PhysicsStage(TextRenderer& textRenderer,
       m_vehicleShadowMatrixLoc(-1),
       m_vehicleShininessLoc(-1),
       m_vehicleSpecularColorLoc(-1),
+      m_defaultInstancedVpLoc(-1),
+      m_defaultInstancedTextureLoc(-1),
+      m_defaultInstancedLightPosLoc(-1),
+      m_defaultInstancedShadowTextureLoc(-1),
+      m_defaultInstancedShadowMatrixLoc(-1),
+      m_shadowMapInstancedVpLoc(-1),
+      m_defaultInstancedModelMatrixLoc(-1),
+      m_shadowMapInstancedModelMatrixLoc(-1),
       m_shadowMapTexture(0),
       m_shadowMapFBO(0),
       m_shadowMapDepthRenderBuffer(0),
+      m_shadowMapping(false),
+      m_shadowQuality(ShadowQualityAuto),
+      m_shadowMapWidth(0),
+      m_shadowMapHeight(0),
+      m_numCascades(0),
+      m_cascadeSize(0),
+      m_totalCameraCulled(0),
+      m_totalLightCulled(0),
+      m_totalTerrainIndices(0),
+      m_drawQueue(PhysicsStage::DrawQueueCallback, this),
+      m_lastDrawMesh(-1),
+      m_totalDrawItems(0),
+      m_totalStateChanges(0),
+      m_totalRedundantStateChanges(0),
+      m_totalObjectUniformUpdates(0),
       m_lensFlareMaxSize(-1),
-      m_sunVisible(false),
+      m_sunOnScreen(false),
       m_sunScreenX(-1),
       m_sunScreenY(-1),
       m_lastSunVisibilityTestTime(NULL),
+      m_sunVisibility(0.0),
+      m_sunVisibilityTarget(0.0),
+      m_sunSampleVertexBuffer(0),
+      m_oldestSunQuerySet(0),
+      m_numPendingSunQuerySets(0),
       m_statics(NULL),
       m_pillar(NULL),
+      m_pillarInstances(NULL),
       m_skybox(NULL),
       m_vehicle(NULL),
-      m_wheelRotation(0.0),
+      m_frontWheelRotation(0.0),
+      m_rearWheelRotation(0.0),
       m_pillarShape(NULL),
       m_vehicleShape(NULL),
       m_vehicleBody(NULL),
+      m_vehicleRaycaster(NULL),
+      m_raycastVehicle(NULL),
+      m_allocator(NULL),
       m_broadphase(NULL),
+      m_tunedBroadphase(NULL),
+      m_broadphaseType(PhysicsBroadphaseDbvt),
       m_collisionConfiguration(NULL),
       m_dispatcher(NULL),
-      m_solver(NULL),
-      m_dynamicsWorld(NULL)
+      m_parallelDispatcher(NULL),
+      m_collisionThreads(0),
+      m_measureCollisionScaling(false),
+      m_rowKernels(RowKernelsAuto),
+      m_benchmarkRowKernels(false),
+      m_dynamicsWorld(NULL),
+      m_parallelWorld(NULL),
+      m_solverThreads(0),
+      m_continuousCollision(false),
+      m_physicsStepsPerSecond(60),
+      m_physicsTimeStep(btScalar(1.0) / btScalar(60.0)),
+      m_threadedPhysics(false),
+      m_physicsThreadAlive(false),
+      m_physicsThreadRunning(false),
+      m_numPhysicsSteps(0),
+      m_detectPillarCollisions(false),
+      m_checkTunnelling(false),
+      m_numPillarTunnellings(0),
+      m_numVehicleTunnellings(0),
+      m_tunnellingCheckTime(0.0),
+      m_stressRows(0),
+      m_stressColumns(0),
+      m_stressExtraBodies(0),
+      m_numStressLevels(0),
+      m_stressLevel(-1),
+      m_initialSnapshot(NULL),
+      m_restartable(false),
+      m_replayCheckSteps(0),
+      m_physicsProfileTime(0.0),
+      m_numProfiledSteps(0),
+      m_numSimulationSteps(0),
+      m_numBroadphasePairs(0.0),
+      m_lastHeapAllocationStep(0),
+      m_numPoolOverflowSteps(0),
+      m_poolOverflowStepTime(0.0),
+      m_activityStartTime(0.0),
+      m_activityIntervalStart(0.0),
+      m_activityIntervalFrames(0),
+      m_activityIntervalBodies(0.0),
+      m_totalActiveBodies(0.0),
+      m_sceneQueries(NULL),
+      m_queryRaysPerFrame(0),
+      m_querySweepsPerFrame(0),
+      m_queryThreads(1),
+      m_querySphere(NULL),
+      m_numQueryRays(0.0),
+      m_numQuerySweeps(0.0),
+      m_numQueryHits(0.0),
+      m_queryRayTime(0.0),
+      m_querySweepTime(0.0)
 {
+    memset(m_physicsPhaseTimes, 0, sizeof(m_physicsPhaseTimes));
     memset(m_cameraTarget, 0, sizeof(m_cameraTarget));
     memset(m_cameraLocation, 0, sizeof(m_cameraLocation));
+    memset(m_lightViewMatrix, 0, sizeof(m_lightViewMatrix));
+    memset(m_vehicleTransform, 0, sizeof(m_vehicleTransform));
     m_lastStepTime.tv_sec = 0;
     m_lastStepTime.tv_usec = 0;
+    pthread_mutex_init(&m_physicsMutex, NULL);
 }
 
 PhysicsStage::~PhysicsStage()
 {
     LOG_DEBUG("PhysicsStage::~PhysicsStage()");
     TeardownImpl();
+    TeardownPhysics();
+    pthread_mutex_destroy(&m_physicsMutex);
 }
 
 void PhysicsStage::UpdateScore(const TimeSample& now)
@@ -205,266 +617,1008 @@ void PhysicsStage::UpdateScore(const TimeSample& now)
         LOG_DEBUG("Depth buffer support missing, reducing score");
         m_stageData.m_score /= 2;
     }
-}
 
-void PhysicsStage::UpdateDefaultUniforms(const float* objectTransform)
-{
-    // Transform the light position into object space
-    float inverseObjectTransform[16];
-    CalculateInverseTransform(objectTransform, inverseObjectTransform);
-    float lightObjectSpacePos[3];
-    Transformv3(inverseObjectTransform, SunWorldPosition,
-                lightObjectSpacePos);
+    if ( m_numFrames > 0 )
+    {
+        LOG_DEBUG("PhysicsStage: culled objects per frame: camera %.1f, "
+                  "light %.1f", (float)m_totalCameraCulled / m_numFrames,
+                  (float)m_totalLightCulled / m_numFrames);
+        LOG_DEBUG("PhysicsStage: terrain indices per frame: %.1f",
+                  (float)m_totalTerrainIndices / m_numFrames);
+        LOG_DEBUG("PhysicsStage: per frame: %.1f draw items, %.1f GL state "
+                  "changes, %.1f redundant ones dropped",
+                  (float)m_totalDrawItems / m_numFrames,
+                  (float)m_totalStateChanges / m_numFrames,
+                  (float)m_totalRedundantStateChanges / m_numFrames);
+        LOG_DEBUG("PhysicsStage: object uniform recalculations per frame: "
+                  "%.1f", (float)m_totalObjectUniformUpdates / m_numFrames);
+        if ( m_threadedPhysics )
+        {
+            LOG_DEBUG("PhysicsStage: physics thread steps per frame: %.2f",
+                      (float)m_numPhysicsSteps / m_numFrames);
+        }
+        for ( int i = 0; i < m_numCascades; i++ )
+        {
+            LOG_DEBUG("PhysicsStage: shadow cascade %d (to %.1f m): "
+                      "%.1f draws per frame", i, m_cascades[i].m_far,
+                      (float)m_cascades[i].m_totalDraws / m_numFrames);
+        }
+    }
 
-    // Update uniforms
-    glUniform3fv(m_defaultLightPosLoc, 1, lightObjectSpacePos);
+    if ( m_parallelDispatcher != NULL )
+    {
+        for ( int i = 1; i <= m_parallelDispatcher->NumThreads(); i++ )
+        {
+            double dispatchTime = m_parallelDispatcher->AverageDispatchTime(i);
+            if ( dispatchTime >= 0.0 )
+            {
+                LOG_DEBUG("PhysicsStage: narrowphase with %d thread(s): "
+                          "%.3f ms per step", i, dispatchTime * 1000.0);
+            }
+        }
+    }
 
-    // Setup shadow matrix: modelMatrix*lightVPmatrix*biasMatrix.
-    float shadowMatrix[16];
-    MatrixMultiply(objectTransform, m_lightMatrix, shadowMatrix);
-    MatrixMultiply(shadowMatrix, BiasMatrix, shadowMatrix);
-    glUniformMatrix4fv(m_defaultShadowMatrixLoc, 1, GL_FALSE, shadowMatrix);
-}
+    if ( (m_parallelWorld != NULL) &&
+         (m_parallelWorld->AverageSolveTime() >= 0.0) )
+    {
+        LOG_DEBUG("PhysicsStage: constraint solving with %d thread(s): "
+                  "%.3f ms per step, %.1f islands",
+                  m_parallelWorld->NumThreads(),
+                  m_parallelWorld->AverageSolveTime() * 1000.0,
+                  m_parallelWorld->AverageIslandsPerStep());
+    }
 
-void PhysicsStage::RenderTreeTrunksDepthMap(float* vpMatrix)
-{
-    m_statics->PrepareRenderTreeTrunkShadowMap();
+    UpdatePhysicsProfileResults();
+    UpdateBroadphaseResults();
+    UpdateContinuousCollisionResults();
+    UpdateSceneQueryResults();
+    LogActivitySamples();
+    LogStepAllocations();
+    LogPoolOverflows();
 
-    for (std::list<ObjectInstance*>::iterator iter = m_trees.begin();
-         iter != m_trees.end(); iter++ )
+    if ( m_stressLevel >= 0 )
     {
-        float mvpMatrix[16];
-        MatrixMultiply((*iter)->GetTransform(), vpMatrix, mvpMatrix);
-        glUniformMatrix4fv(m_shadowMapMvpLoc, 1, GL_FALSE, mvpMatrix);
-        m_statics->RenderTreeTrunk();
+        pthread_mutex_lock(&m_physicsMutex);
+        FinishStressLevel();
+        pthread_mutex_unlock(&m_physicsMutex);
+        UpdateStressResults();
     }
 }
 
-void PhysicsStage::RenderTreeLeavesDepthMap(float* vpMatrix)
+void PhysicsStage::ResetPhysicsProfile()
 {
-    m_statics->PrepareRenderTreeLeavesShadowMap();
-
-    // Provide texture for alpha-testing
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(m_shadowMapTransparentTextureLoc, 0);
-    glBindTexture(GL_TEXTURE_2D, m_treeLeavesTexture);
-
-    glDisable(GL_CULL_FACE);
-    for (std::list<ObjectInstance*>::iterator iter = m_trees.begin();
-         iter != m_trees.end(); iter++ )
+    m_physicsProfileTime = 0.0;
+    memset(m_physicsPhaseTimes, 0, sizeof(m_physicsPhaseTimes));
+    m_numProfiledSteps = 0;
+    m_numSimulationSteps = 0;
+    m_numBroadphasePairs = 0.0;
+    m_stepAllocations = PhysicsAllocatorStats();
+    m_lastHeapAllocationStep = 0;
+    m_numPoolOverflowSteps = 0;
+    m_poolOverflowStepTime = 0.0;
+    if ( m_vehicleRaycaster != NULL )
     {
-        float mvpMatrix[16];
-        MatrixMultiply((*iter)->GetTransform(), vpMatrix, mvpMatrix);
-        glUniformMatrix4fv(m_shadowMapTransparentMvpLoc,
-                           1, GL_FALSE, mvpMatrix);
-        m_statics->RenderTreeLeaves();
+        m_vehicleRaycaster->ResetCounters();
+    }
+    if ( m_dynamicsWorld != NULL )
+    {
+        m_dynamicsWorld->ResetClampedMotions();
     }
-    glEnable(GL_CULL_FACE);
+    m_numPillarTunnellings = 0;
+    m_numVehicleTunnellings = 0;
+    m_tunnellingCheckTime = 0.0;
+    m_numQueryRays = 0.0;
+    m_numQuerySweeps = 0.0;
+    m_numQueryHits = 0.0;
+    m_queryRayTime = 0.0;
+    m_querySweepTime = 0.0;
+#ifndef BT_NO_PROFILE
+    CProfileManager::Reset();
+#endif
 }
 
-void PhysicsStage::RenderDepthMap()
+double PhysicsStage::CollectPhysicsProfile()
 {
-    // Adjust viewport to match the shadow map size
-    glViewport(0, 0, ShadowMapSize, ShadowMapSize);
-
-    // Start using our offscreen FBO & texture
-    glBindFramebuffer(GL_FRAMEBUFFER, m_shadowMapFBO);
-
-    // Check FBO status
-    //TODO remove this; shouldnt be necessary
-    GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if ( fboStatus != GL_FRAMEBUFFER_COMPLETE )
+    m_numProfiledSteps++;
+    double totalTime = 0.0;
+
+#ifndef BT_NO_PROFILE
+    // Only the thread stepping the world records samples, so the profile
+    // tree is safe to read and reset here
+    CProfileIterator* iterator = CProfileManager::Get_Iterator();
+    for ( iterator->First(); !iterator->Is_Done(); iterator->Next() )
     {
-        LOG_DEBUG("RenderDepthMap(): FBO not complete.");
-        return;
+        totalTime += iterator->Get_Current_Total_Time();
     }
 
-    // Depth checking on and clear the buffer
-    glClear(GL_DEPTH_BUFFER_BIT);
+    double zoneTime = AddProfileZoneTimes(iterator, m_physicsPhaseTimes);
+    m_physicsPhaseTimes[PhysicsPhaseOther] += totalTime - zoneTime;
+    m_physicsProfileTime += totalTime;
+    CProfileManager::Release_Iterator(iterator);
 
-    // Render the shadow-casting objects
-    glUseProgram(m_shadowMapProgram);
-    glDisableVertexAttribArray(NORMAL_INDEX);
-    glDisableVertexAttribArray(TEXCOORD_INDEX);
-    RenderPillars(m_lightMatrix, m_shadowMapMvpLoc);
-    RenderWallCorners(m_lightMatrix, m_shadowMapMvpLoc);
-    RenderWallSegments(m_lightMatrix, m_shadowMapMvpLoc);
-    RenderTreeTrunksDepthMap(m_lightMatrix);
-    RenderVehicle(m_lightMatrix, m_shadowMapMvpLoc);
-    glUseProgram(m_shadowMapTransparentProgram);
-    glEnableVertexAttribArray(TEXCOORD_INDEX);
-    RenderTreeLeavesDepthMap(m_lightMatrix);
-    glEnableVertexAttribArray(NORMAL_INDEX);
+    CProfileManager::Reset();
+#endif
 
-    // Go back to using the default frame buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, m_defaultFrameBuffer);
+    return totalTime;
+}
 
-    // Reset the viewport
-    glViewport(0, 0, m_viewportWidth, m_viewportHeight);
+void PhysicsStage::CountStepAllocations(const PhysicsAllocatorStats& before)
+{
+    PhysicsAllocatorStats after = m_allocator->Stats();
+    m_stepAllocations.m_numAllocations +=
+            after.m_numAllocations - before.m_numAllocations;
+    m_stepAllocations.m_numFrees += after.m_numFrees - before.m_numFrees;
+    m_stepAllocations.m_allocatedBytes +=
+            after.m_allocatedBytes - before.m_allocatedBytes;
+    m_stepAllocations.m_heapBytes += after.m_heapBytes - before.m_heapBytes;
+    if ( after.m_numHeapAllocations > before.m_numHeapAllocations )
+    {
+        m_stepAllocations.m_numHeapAllocations +=
+                after.m_numHeapAllocations - before.m_numHeapAllocations;
+        m_lastHeapAllocationStep = m_numProfiledSteps;
+    }
 }
 
-void PhysicsStage::RenderSkybox(float* viewMatrix)
+void PhysicsStage::LogStepAllocations()
 {
-    // Extract rotation from the view matrix and calculate (m)vp matrix
-    float rotationMatrix[16];
-    MatrixExtractRotation(viewMatrix, rotationMatrix);
-    float skyboxMvpMatrix[16];
-    MatrixMultiply(rotationMatrix, m_perspectiveProjectionMatrix,
-                   skyboxMvpMatrix);
+    pthread_mutex_lock(&m_physicsMutex);
+    int numSteps = m_numProfiledSteps;
+    PhysicsAllocatorStats allocations = m_stepAllocations;
+    int lastHeapAllocationStep = m_lastHeapAllocationStep;
+    pthread_mutex_unlock(&m_physicsMutex);
 
-    glUniformMatrix4fv(m_skyboxMvpLoc, 1, GL_FALSE, skyboxMvpMatrix);
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(m_skyboxTextureLoc, 0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, m_skyboxTexture);
+    if ( numSteps == 0 )
+    {
+        return;
+    }
 
-    glDisable(GL_DEPTH_TEST);
-    glDepthMask(false);
-    m_skybox->Render();
-    glDepthMask(true);
-    glEnable(GL_DEPTH_TEST);
+    LOG_DEBUG("PhysicsStage: per step: %.2f Bullet allocations (%.0f bytes), "
+              "%.3f heap allocations (%.0f bytes)",
+              (float)allocations.m_numAllocations / numSteps,
+              (float)allocations.m_allocatedBytes / numSteps,
+              (float)allocations.m_numHeapAllocations / numSteps,
+              (float)allocations.m_heapBytes / numSteps);
+    LOG_DEBUG("PhysicsStage: %d heap allocations while stepping, the last "
+              "one in step %d of %d", allocations.m_numHeapAllocations,
+              lastHeapAllocationStep, numSteps);
 }
 
-void PhysicsStage::PrepareRenderPillars()
+void PhysicsStage::CountPoolOverflows(int before, double stepTime)
 {
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(m_defaultTextureLoc, 0);
-    glBindTexture(GL_TEXTURE_2D, m_pillarTexture);
+    int numOverflows = m_dispatcher->NumManifoldPoolOverflows() +
+            m_dispatcher->NumAlgorithmPoolOverflows() - before;
+    if ( numOverflows > 0 )
+    {
+        m_numPoolOverflowSteps++;
+        m_poolOverflowStepTime += stepTime;
+        if ( m_stressLevel >= 0 )
+        {
+            m_stressCounters.m_numPoolOverflows += numOverflows;
+        }
+    }
 }
 
-void PhysicsStage::RenderPillars(float* vpMatrix, GLint mvpLoc)
+void PhysicsStage::LogPoolOverflows()
 {
-    m_pillar->PrepareRender();
+    pthread_mutex_lock(&m_physicsMutex);
+    int numSteps = m_numProfiledSteps;
+    int numOverflowSteps = m_numPoolOverflowSteps;
+    double overflowStepTime = m_poolOverflowStepTime;
+    double stepTime = m_physicsProfileTime;
+    pthread_mutex_unlock(&m_physicsMutex);
+
+    LOG_DEBUG("PhysicsStage: pool overflows: %d manifolds, %d collision "
+              "algorithms", m_dispatcher->NumManifoldPoolOverflows(),
+              m_dispatcher->NumAlgorithmPoolOverflows());
+    if ( numOverflowSteps > 0 )
+    {
+        // Ties the spikes in the step time to the overflows
+        LOG_DEBUG("PhysicsStage: %d of %d steps overflowed the pools, "
+                  "%.3f ms per step vs. %.3f ms on average",
+                  numOverflowSteps, numSteps,
+                  overflowStepTime / numOverflowSteps, stepTime / numSteps);
+    }
+}
 
-    for ( unsigned int i = 0; i < m_pillarBodies.size(); i++ )
+void PhysicsStage::UpdatePhysicsProfileResults()
+{
+    if ( (m_numFrames == 0) || (m_stageData.m_fps <= 0.0) )
     {
-        btRigidBody* body = m_pillarBodies[i];
-        ObjectMotionState* motionState =
-                static_cast<ObjectMotionState*>(body->getMotionState());
+        return;
+    }
 
-        // Upload this pillar's transform
-        float mvpMatrix[16];
-        MatrixMultiply(motionState->GetObjectTransform(), vpMatrix, mvpMatrix);
-        glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, mvpMatrix);
-        if ( mvpLoc == m_defaultMvpLoc )
-        {
-            UpdateDefaultUniforms(motionState->GetObjectTransform());
-        }
+    pthread_mutex_lock(&m_physicsMutex);
+    float physicsTime = m_physicsProfileTime / m_numFrames;
+    float frameTime = 1000.0 / m_stageData.m_fps;
 
-        // Render the pillar
-        m_pillar->Render();
+    // The physics thread steps the world alongside the rendering instead
+    // of taking up a part of the frame
+    m_stageData.m_physicsTime = physicsTime;
+    if ( m_threadedPhysics )
+    {
+        m_stageData.m_renderTime = frameTime;
+    }
+    else
+    {
+        m_stageData.m_renderTime = std::max(frameTime - physicsTime, 0.0f);
+    }
+
+    m_stageData.m_physicsPhaseTimes.clear();
+    for ( int i = 0; i < NumPhysicsPhases; i++ )
+    {
+        m_stageData.m_physicsPhaseTimes.push_back(
+                std::make_pair(std::string(PhysicsPhaseNames[i]),
+                               (float)(m_physicsPhaseTimes[i] / m_numFrames)));
+    }
+    int numWheelQueries = m_vehicleRaycaster->NumQueries();
+    int numWheelRays = m_vehicleRaycaster->NumRays();
+    int numWheelShapeTests = m_vehicleRaycaster->NumShapeTests();
+    pthread_mutex_unlock(&m_physicsMutex);
+
+    LOG_DEBUG("PhysicsStage: per frame: %.2f ms physics, %.2f ms rendering",
+              m_stageData.m_physicsTime, m_stageData.m_renderTime);
+    for ( unsigned int i = 0; i < m_stageData.m_physicsPhaseTimes.size(); i++ )
+    {
+        LOG_DEBUG("PhysicsStage: physics %s: %.3f ms per frame",
+                  m_stageData.m_physicsPhaseTimes[i].first.c_str(),
+                  m_stageData.m_physicsPhaseTimes[i].second);
+    }
+    if ( numWheelRays > 0 )
+    {
+        LOG_DEBUG("PhysicsStage: %d wheel rays in %d broadphase queries, "
+                  "%.2f shapes tested per ray", numWheelRays, numWheelQueries,
+                  (float)numWheelShapeTests / numWheelRays);
     }
 }
 
-void PhysicsStage::RenderTerrain(float* vMatrix, float* vpMatrix)
+void PhysicsStage::UpdateBroadphaseResults()
 {
-    glUniformMatrix4fv(m_terrainMvpLoc, 1, GL_FALSE, vpMatrix);
-    glUniformMatrix4fv(m_terrainMvLoc, 1, GL_FALSE, vMatrix);
+    pthread_mutex_lock(&m_physicsMutex);
+    int numSteps = m_numSimulationSteps;
+    double numPairs = m_numBroadphasePairs;
+    double broadphaseTime = m_physicsPhaseTimes[PhysicsPhaseBroadphase];
+    pthread_mutex_unlock(&m_physicsMutex);
 
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(m_terrainTextureLoc, 0);
-    glBindTexture(GL_TEXTURE_2D, m_terrainTexture);
-    glActiveTexture(GL_TEXTURE1);
-    glUniform1i(m_terrainTextureLoc, 1);
-    glBindTexture(GL_TEXTURE_2D, m_terrainTexture2);
+    if ( numSteps == 0 )
+    {
+        return;
+    }
 
-    glActiveTexture(GL_TEXTURE2);
-    glUniform1i(m_terrainShadowTextureLoc, 2);
-    glBindTexture(GL_TEXTURE_2D, m_shadowMapTexture);
+    m_stageData.m_broadphase = PhysicsBroadphaseNames[m_broadphaseType];
+    m_stageData.m_broadphasePairs = numPairs / numSteps;
+    m_stageData.m_broadphaseStepTime = broadphaseTime / numSteps;
+    LOG_DEBUG("PhysicsStage: %s broadphase: %.1f pairs, %.3f ms per step",
+              m_stageData.m_broadphase.c_str(), m_stageData.m_broadphasePairs,
+              m_stageData.m_broadphaseStepTime);
+    if ( m_tunedBroadphase != NULL )
+    {
+        LOG_DEBUG("PhysicsStage: %d fixed and %d dynamic broadphase proxies",
+                  m_tunedBroadphase->NumFixedProxies(),
+                  m_tunedBroadphase->NumDynamicProxies());
+    }
+}
 
-    // Setup shadow matrix: modelMatrix*lightVPmatrix*biasMatrix.
-    // modelMatrix = identity for terrain
-    float shadowMatrix[16];
-    MatrixMultiply(m_lightMatrix, BiasMatrix, shadowMatrix);
-    glUniformMatrix4fv(m_terrainShadowMatrixLoc, 1, GL_FALSE, shadowMatrix);
+void PhysicsStage::UpdateContinuousCollisionResults()
+{
+    pthread_mutex_lock(&m_physicsMutex);
+    int numSteps = m_numSimulationSteps;
+    double stepTime = std::max(m_physicsProfileTime - m_tunnellingCheckTime,
+                               0.0);
+    int numClampedMotions = m_dynamicsWorld->NumClampedMotions();
+    int numPillarTunnellings = m_numPillarTunnellings;
+    int numVehicleTunnellings = m_numVehicleTunnellings;
+    pthread_mutex_unlock(&m_physicsMutex);
+
+    if ( numSteps == 0 )
+    {
+        return;
+    }
 
-    m_statics->RenderTerrain();
+    // The time per simulated second tells the step rates apart
+    stepTime /= numSteps;
+    LOG_DEBUG("PhysicsStage: %d physics steps per second, CCD %s: %.3f ms "
+              "per step, %.2f ms per simulated second",
+              m_physicsStepsPerSecond, m_continuousCollision ? "on" : "off",
+              stepTime, stepTime * m_physicsStepsPerSecond);
+    if ( m_continuousCollision )
+    {
+        LOG_DEBUG("PhysicsStage: %d body motions cut short by CCD in %d "
+                  "steps", numClampedMotions, numSteps);
+    }
+    if ( m_checkTunnelling )
+    {
+        LOG_DEBUG("PhysicsStage: tunnelling in %d steps: %d by pillars, %d "
+                  "by the vehicle", numSteps, numPillarTunnellings,
+                  numVehicleTunnellings);
+    }
 }
 
-void PhysicsStage::RenderWalkway(float* vpMatrix)
+void PhysicsStage::SetupSceneQueries()
 {
-    glUniformMatrix4fv(m_defaultMvpLoc, 1, GL_FALSE, vpMatrix);
-
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(m_defaultTextureLoc, 0);
-    glBindTexture(GL_TEXTURE_2D, m_walkwayTexture);
+    if ( (m_queryRaysPerFrame <= 0) && (m_querySweepsPerFrame <= 0) )
+    {
+        return;
+    }
 
-    UpdateDefaultUniforms(IdentityMatrix);
+    // The trees of the DBVT broadphases are walked along the queries
+    btDbvtBroadphase* dbvt = NULL;
+    if ( m_broadphaseType != PhysicsBroadphaseAxisSweep )
+    {
+        dbvt = static_cast<btDbvtBroadphase*>(m_broadphase);
+    }
 
-    glEnable(GL_POLYGON_OFFSET_FILL);
-    glPolygonOffset(-2, -2);
-    m_statics->RenderWalkway();
-    glDisable(GL_POLYGON_OFFSET_FILL);
+    m_sceneQueries = SceneQueryBatch::Create(m_dynamicsWorld, dbvt,
+                                             m_queryThreads);
+    if ( m_sceneQueries == NULL )
+    {
+        LOG_DEBUG("Scene query workload disabled.");
+        return;
+    }
+    m_querySphere = new btSphereShape(QuerySphereRadius);
 }
 
-void PhysicsStage::PrepareRenderWall()
+void PhysicsStage::AimQueries(int numQueries, float length)
 {
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(m_defaultTextureLoc, 0);
-    glBindTexture(GL_TEXTURE_2D, m_wallSegmentTexture);
+    btVector3 eye(m_cameraLocation[0], m_cameraLocation[1],
+                  m_cameraLocation[2]);
+    btVector3 forward = btVector3(m_cameraTarget[0], m_cameraTarget[1],
+                                  m_cameraTarget[2]) - eye;
+    btVector3 right = forward.cross(btVector3(0.0, 1.0, 0.0));
+    if ( (forward.length2() < SIMD_EPSILON) ||
+         (right.length2() < SIMD_EPSILON) )
+    {
+        forward.setValue(0.0, 0.0, -1.0);
+        right.setValue(1.0, 0.0, 0.0);
+    }
+    forward.normalize();
+    right.normalize();
+    btVector3 up = right.cross(forward);
+
+    // The queries are spread evenly over the camera's view, in a grid of
+    // its aspect ratio
+    float tanX = 1.0 / m_perspectiveProjectionMatrix[0];
+    float tanY = 1.0 / m_perspectiveProjectionMatrix[5];
+    int numColumns = std::max(1, (int)sqrt(numQueries * tanX / tanY));
+    int numRows = (numQueries + numColumns - 1) / numColumns;
+
+    m_queryFrom.resize(numQueries);
+    m_queryTo.resize(numQueries);
+    for ( int i = 0; i < numQueries; i++ )
+    {
+        float x = ((i % numColumns) + 0.5) / numColumns * 2.0 - 1.0;
+        float y = ((i / numColumns) + 0.5) / numRows * 2.0 - 1.0;
+        btVector3 direction = forward + (right * (x * tanX)) +
+                (up * (y * tanY));
+        m_queryFrom[i] = eye;
+        m_queryTo[i] = eye + (direction.normalized() * length);
+    }
 }
 
-void PhysicsStage::RenderWallCorners(float* vpMatrix, GLint mvpLoc)
+void PhysicsStage::RunSceneQueries()
 {
-    m_statics->PrepareRenderWallCorner();
-    
-    for ( std::list<ObjectInstance*>::iterator iter = m_wallCorners.begin();
-         iter != m_wallCorners.end(); iter++ )
+    // The world must hold still while the queries run
+    if ( m_queryRaysPerFrame > 0 )
     {
-        float mvpMatrix[16];
-        btRigidBody* body = (*iter)->GetBody();
-        ObjectMotionState* motionState =
-            static_cast<ObjectMotionState*>(body->getMotionState());
-        MatrixMultiply(motionState->GetObjectTransform(),
-                       vpMatrix, mvpMatrix);
-        glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, mvpMatrix);
-        m_statics->RenderWallCorner();
+        AimQueries(m_queryRaysPerFrame, m_farClip);
+        pthread_mutex_lock(&m_physicsMutex);
+        double startTime = CurrentTime();
+        m_sceneQueries->CastRays(&m_queryFrom[0], &m_queryTo[0],
+                                 m_queryRaysPerFrame, m_queryResults);
+        m_queryRayTime += CurrentTime() - startTime;
+        pthread_mutex_unlock(&m_physicsMutex);
+        m_numQueryRays += m_queryRaysPerFrame;
+        m_numQueryHits += m_queryResults.m_numHits;
+    }
+
+    if ( m_querySweepsPerFrame > 0 )
+    {
+        AimQueries(m_querySweepsPerFrame, QuerySweepLength);
+        pthread_mutex_lock(&m_physicsMutex);
+        double startTime = CurrentTime();
+        m_sceneQueries->SweepShape(m_querySphere, &m_queryFrom[0],
+                                   &m_queryTo[0], m_querySweepsPerFrame,
+                                   m_queryResults);
+        m_querySweepTime += CurrentTime() - startTime;
+        pthread_mutex_unlock(&m_physicsMutex);
+        m_numQuerySweeps += m_querySweepsPerFrame;
+        m_numQueryHits += m_queryResults.m_numHits;
     }
 }
 
-void PhysicsStage::RenderWallSegments(float* vpMatrix, GLint mvpLoc)
+void PhysicsStage::UpdateSceneQueryResults()
 {
-    m_statics->PrepareRenderWallSegment();
-    
-    for ( std::list<ObjectInstance*>::iterator iter = m_wallSegments.begin();
-         iter != m_wallSegments.end(); iter++ )
+    if ( (m_sceneQueries == NULL) || (m_numFrames == 0) )
     {
-        float mvpMatrix[16];
-        btRigidBody* body = (*iter)->GetBody();
-        ObjectMotionState* motionState =
-                static_cast<ObjectMotionState*>(body->getMotionState());
-        MatrixMultiply(motionState->GetObjectTransform(),
-                       vpMatrix, mvpMatrix);
-        glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, mvpMatrix);
-        if ( mvpLoc == m_defaultMvpLoc )
-        {
-            UpdateDefaultUniforms(motionState->GetObjectTransform());
-        }
-        m_statics->RenderWallSegment();
+        return;
+    }
+
+    if ( m_queryRayTime > 0.0 )
+    {
+        m_stageData.m_queryRaysPerSecond = m_numQueryRays / m_queryRayTime;
+    }
+    if ( m_querySweepTime > 0.0 )
+    {
+        m_stageData.m_querySweepsPerSecond =
+                m_numQuerySweeps / m_querySweepTime;
+    }
+    m_stageData.m_queryTime =
+            (m_queryRayTime + m_querySweepTime) * 1000.0 / m_numFrames;
+
+    LOG_DEBUG("PhysicsStage: scene queries on %d thread(s): %.0f rays/s, "
+              "%.0f sweeps/s, %.3f ms per frame",
+              m_sceneQueries->NumThreads(), m_stageData.m_queryRaysPerSecond,
+              m_stageData.m_querySweepsPerSecond, m_stageData.m_queryTime);
+    double numQueries = m_numQueryRays + m_numQuerySweeps;
+    if ( numQueries > 0.0 )
+    {
+        LOG_DEBUG("PhysicsStage: %.1f%% of the scene queries hit",
+                  m_numQueryHits * 100.0 / numQueries);
     }
 }
 
-void PhysicsStage::UpdateVehicleUniforms(const float* objectTransform)
+void PhysicsStage::UpdateStressResults()
 {
-    // Transform the camera / eye position into object space
-    float inverseObjectTransform[16];
-    CalculateInverseTransform(objectTransform, inverseObjectTransform);
-    float eyeObjectSpacePos[3];
-    Transformv3(inverseObjectTransform, m_cameraLocation,
-                eyeObjectSpacePos);
+    m_stageData.m_physicsStress.clear();
+    for ( unsigned int i = 0; i < m_stressResults.size(); i++ )
+    {
+        const StressLevelResult& result = m_stressResults[i];
+        if ( result.m_stepTime <= 0.0 )
+        {
+            continue;
+        }
+
+        double stepsPerSecond = result.m_numSteps / result.m_stepTime;
+        PhysicsStressPoint point;
+        point.m_numBodies = result.m_numBodies;
+        point.m_stepsPerSecond = stepsPerSecond;
+        point.m_contactsPerSecond = result.m_numContacts / result.m_stepTime;
+        m_stageData.m_physicsStress.push_back(point);
+
+        LOG_DEBUG("PhysicsStage: stress level %d: %d bodies, %d steps, "
+                  "%.1f steps/s, %.0f contacts/s, %.0f body steps/s, "
+                  "%d pool overflows", i,
+                  result.m_numBodies, result.m_numSteps, stepsPerSecond,
+                  result.m_numContacts / result.m_stepTime,
+                  stepsPerSecond * result.m_numBodies,
+                  result.m_numPoolOverflows);
+        if ( result.m_numSteps > 0 )
+        {
+            LOG_DEBUG("PhysicsStage: stress level %d: %.1f broadphase pairs, "
+                      "%.3f ms broadphase per step", i,
+                      result.m_numPairs / result.m_numSteps,
+                      result.m_broadphaseTime / result.m_numSteps);
+        }
+    }
+}
+
+void PhysicsStage::UpdateDefaultUniforms(ObjectUniforms& uniforms,
+                                         const float* objectTransform)
+{
+    if ( !uniforms.m_valid )
+    {
+        // Transform the light position into object space
+        InverseTransformPointRigid(objectTransform, SunWorldPosition,
+                                   uniforms.m_lightPosition);
+
+        // Setup shadow matrix: modelMatrix*lightViewMatrix; the cascade is
+        // picked per pixel
+        MatrixMultiplyKernel(objectTransform, m_lightViewMatrix,
+                             uniforms.m_shadowMatrix);
+
+        uniforms.m_valid = true;
+        m_totalObjectUniformUpdates++;
+    }
+
+    // Update uniforms
+    glUniform3fv(m_defaultLightPosLoc, 1, uniforms.m_lightPosition);
+    glUniformMatrix4fv(m_defaultShadowMatrixLoc, 1, GL_FALSE,
+                       uniforms.m_shadowMatrix);
+}
+
+const float* PhysicsStage::MultiplyBatchTransforms(const float* matrix)
+{
+    int count = m_batchTransforms.size();
+    if ( count == 0 )
+    {
+        return NULL;
+    }
+
+    m_batchMatrices.resize(count * 16);
+    MatrixMultiplyBatchIndirect(&m_batchTransforms[0], matrix,
+                                &m_batchMatrices[0], count);
+
+    return &m_batchMatrices[0];
+}
+
+void PhysicsStage::GatherVisibleTransforms(
+        const SceneInstanceStore& instances, const std::vector<int>& visible)
+{
+    for ( unsigned int i = 0; i < visible.size(); i++ )
+    {
+        m_batchTransforms.push_back(instances.GetTransform(visible[i]));
+    }
+}
+
+const float* PhysicsStage::MultiplyVisibleTransforms(
+        const SceneInstanceStore& instances, const std::vector<int>& visible,
+        const float* matrix)
+{
+    m_batchTransforms.clear();
+    GatherVisibleTransforms(instances, visible);
+
+    return MultiplyBatchTransforms(matrix);
+}
+
+void PhysicsStage::CullInstances(const float* planes, const float* transforms,
+                                 int count, float radius,
+                                 std::vector<int>& visible)
+{
+    m_cullScratch.resize(count);
+    int numVisible = 0;
+    if ( count > 0 )
+    {
+        numVisible = FrustumCullSpheres(planes, transforms, count, radius,
+                                        &m_cullScratch[0]);
+    }
+    visible.assign(m_cullScratch.begin(), m_cullScratch.begin() + numVisible);
+}
+
+void PhysicsStage::CullObjects(const float* vpMatrix, VisibleObjects& visible)
+{
+    float planes[FrustumPlanesSize];
+    ExtractFrustumPlanes(vpMatrix, planes);
+
+    // All the objects are centered around their origin so a bounding sphere
+    // around the translation covers the half extents in any orientation
+    CullInstances(planes, m_pillarTransforms.empty() ? NULL :
+                  &m_pillarTransforms[0], m_pillarBodies.size(),
+                  Pillar::GetExtents().length(), visible.m_pillars);
+    CullInstances(planes, m_wallCorners.Transforms(), m_wallCorners.Count(),
+                  PhysicsStageStatics::GetWallCornerExtents().length(),
+                  visible.m_wallCorners);
+    CullInstances(planes, m_wallSegments.Transforms(), m_wallSegments.Count(),
+                  PhysicsStageStatics::GetWallSegmentExtents().length(),
+                  visible.m_wallSegments);
+    CullInstances(planes, m_trees.Transforms(), m_trees.Count(),
+                  PhysicsStageStatics::GetTreeExtents().length(),
+                  visible.m_trees);
+
+    const float* vehiclePosition = &m_vehicleTransform[MatrixTranslationOffset];
+    visible.m_vehicle = SphereInFrustum(planes, vehiclePosition,
+                                        Vehicle::GetExtents().length());
+
+    int numObjects = m_pillarBodies.size() + m_wallCorners.Count() +
+            m_wallSegments.Count() + m_trees.Count() + 1;
+    int numVisible = visible.m_pillars.size() + visible.m_wallCorners.size() +
+            visible.m_wallSegments.size() + visible.m_trees.size() +
+            (visible.m_vehicle ? 1 : 0);
+    visible.m_numCulled = numObjects - numVisible;
+}
+
+void PhysicsStage::RenderTreeTrunksDepthMap(float* vpMatrix,
+                                            const std::vector<int>& visible)
+{
+    m_statics->PrepareRenderTreeTrunkShadowMap();
+
+    // Calculate all the MVP matrices at once
+    const float* mvpMatrices = MultiplyVisibleTransforms(m_trees, visible,
+                                                         vpMatrix);
+
+    for ( unsigned int i = 0; i < visible.size(); i++ )
+    {
+        glUniformMatrix4fv(m_shadowMapMvpLoc, 1, GL_FALSE,
+                           &mvpMatrices[i * 16]);
+        m_statics->RenderTreeTrunk();
+    }
+}
+
+void PhysicsStage::RenderTreeLeavesDepthMap(float* vpMatrix,
+                                            const std::vector<int>& visible)
+{
+    m_statics->PrepareRenderTreeLeavesShadowMap();
+
+    // Provide texture for alpha-testing
+    m_stateCache.BindTexture(0, GL_TEXTURE_2D, m_treeLeavesTexture);
+
+    // Calculate all the MVP matrices at once
+    const float* mvpMatrices = MultiplyVisibleTransforms(m_trees, visible,
+                                                         vpMatrix);
+
+    m_stateCache.SetEnabled(GL_CULL_FACE, false);
+    for ( unsigned int i = 0; i < visible.size(); i++ )
+    {
+        glUniformMatrix4fv(m_shadowMapTransparentMvpLoc,
+                           1, GL_FALSE, &mvpMatrices[i * 16]);
+        m_statics->RenderTreeLeaves();
+    }
+    m_stateCache.SetEnabled(GL_CULL_FACE, true);
+}
+
+void PhysicsStage::RenderDepthMap()
+{
+    // Start using our offscreen FBO & texture
+    glBindFramebuffer(GL_FRAMEBUFFER, m_shadowMapFBO);
+
+    // Check FBO status
+    //TODO remove this; shouldnt be necessary
+    GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if ( fboStatus != GL_FRAMEBUFFER_COMPLETE )
+    {
+        LOG_DEBUG("RenderDepthMap(): FBO not complete.");
+        return;
+    }
+
+    // Depth checking on and clear the buffer; all the cascades at once
+    glViewport(0, 0, m_shadowMapWidth, m_shadowMapHeight);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    glDisableVertexAttribArray(NORMAL_INDEX);
+    glDisableVertexAttribArray(TEXCOORD_INDEX);
+
+    // Render the shadow-casting objects within each cascade into its tile
+    for ( int i = 0; i < m_numCascades; i++ )
+    {
+        ShadowCascade& cascade = m_cascades[i];
+        const VisibleObjects& visible = cascade.m_visible;
+        glViewport(cascade.m_viewportX, cascade.m_viewportY,
+                   m_cascadeSize, m_cascadeSize);
+
+        if ( m_pillarInstances != NULL )
+        {
+            m_stateCache.UseProgram(m_shadowMapInstancedProgram);
+            RenderPillarsDepthMap(cascade.m_vpMatrix, visible);
+            m_stateCache.UseProgram(m_shadowMapProgram);
+            cascade.m_totalDraws += visible.m_pillars.empty() ? 0 : 1;
+        }
+        else
+        {
+            m_stateCache.UseProgram(m_shadowMapProgram);
+            RenderPillars(cascade.m_vpMatrix, m_shadowMapMvpLoc,
+                          visible.m_pillars);
+            cascade.m_totalDraws += visible.m_pillars.size();
+        }
+        RenderWallCorners(cascade.m_vpMatrix, m_shadowMapMvpLoc,
+                          visible.m_wallCorners);
+        RenderWallSegments(cascade.m_vpMatrix, m_shadowMapMvpLoc,
+                           visible.m_wallSegments);
+        RenderTreeTrunksDepthMap(cascade.m_vpMatrix, visible.m_trees);
+        if ( visible.m_vehicle )
+        {
+            RenderVehicle(cascade.m_vpMatrix, m_shadowMapMvpLoc);
+        }
+        m_stateCache.UseProgram(m_shadowMapTransparentProgram);
+        glEnableVertexAttribArray(TEXCOORD_INDEX);
+        RenderTreeLeavesDepthMap(cascade.m_vpMatrix, visible.m_trees);
+        glDisableVertexAttribArray(TEXCOORD_INDEX);
+
+        // Trees are drawn twice (trunk + leaves), the vehicle as the body
+        // and four wheels
+        cascade.m_totalDraws += visible.m_wallCorners.size() +
+                visible.m_wallSegments.size() + (2 * visible.m_trees.size()) +
+                (visible.m_vehicle ? 5 : 0);
+    }
+
+    glEnableVertexAttribArray(TEXCOORD_INDEX);
+    glEnableVertexAttribArray(NORMAL_INDEX);
+
+    // Go back to using the default frame buffer
+    glBindFramebuffer(GL_FRAMEBUFFER, m_defaultFrameBuffer);
+
+    // Reset the viewport
+    glViewport(0, 0, m_viewportWidth, m_viewportHeight);
+}
+
+void PhysicsStage::UpdateShadowCascades()
+{
+    // Camera view direction
+    float viewDir[3];
+    float viewLength = 0.0;
+    for ( int i = 0; i < 3; i++ )
+    {
+        viewDir[i] = m_cameraTarget[i] - m_cameraLocation[i];
+        viewLength += viewDir[i] * viewDir[i];
+    }
+    viewLength = sqrt(viewLength);
+
+    // Squared tangent of the camera frustum's half diagonal angle, from
+    // the projection matrix
+    float tanX = 1.0 / m_perspectiveProjectionMatrix[0];
+    float tanY = 1.0 / m_perspectiveProjectionMatrix[5];
+    float tanSquared = (tanX * tanX) + (tanY * tanY);
+
+    float nearClip = m_nearClip;
+    float farClip = std::min(m_farClip, ShadowDistance);
+    float sliceNear = nearClip;
+    for ( int i = 0; i < m_numCascades; i++ )
+    {
+        ShadowCascade& cascade = m_cascades[i];
+
+        // Split the view depth range between logarithmic and uniform
+        float t = (float)(i + 1) / m_numCascades;
+        float logSplit = nearClip * pow(farClip / nearClip, t);
+        float uniformSplit = nearClip + ((farClip - nearClip) * t);
+        float sliceFar = (CascadeSplitLambda * logSplit) +
+                ((1.0 - CascadeSplitLambda) * uniformSplit);
+        cascade.m_far = sliceFar;
+
+        // Smallest sphere around the frustum slice. It only depends on the
+        // slice depths, so the cascade does not change size (and shimmer)
+        // while the camera turns.
+        float centerDepth = 0.5 * (sliceNear + sliceFar) * (1.0 + tanSquared);
+        centerDepth = std::min(centerDepth, sliceFar);
+        float dFar = sliceFar - centerDepth;
+        float radius = sqrt((dFar * dFar) + (sliceFar * sliceFar * tanSquared));
+
+        // Leave a texel of margin for the snapping below
+        radius *= (float)m_cascadeSize / (m_cascadeSize - 2);
+
+        float center[4];
+        for ( int j = 0; j < 3; j++ )
+        {
+            center[j] = m_cameraLocation[j] +
+                    (viewDir[j] * (centerDepth / viewLength));
+        }
+        center[3] = 1.0;
+        float lightCenter[4];
+        Transformv4(m_lightViewMatrix, center, lightCenter);
+
+        // Snap the center to the shadow map texels so that the shadow
+        // edges stay put while the camera moves
+        float texelSize = (2.0 * radius) / m_cascadeSize;
+        lightCenter[0] = floor(lightCenter[0] / texelSize) * texelSize;
+        lightCenter[1] = floor(lightCenter[1] / texelSize) * texelSize;
+
+        float projection[16];
+        MatrixOrthographicProjection(projection,
+                                     lightCenter[0] - radius,
+                                     lightCenter[0] + radius,
+                                     lightCenter[1] - radius,
+                                     lightCenter[1] + radius,
+                                     LightNearClip, LightFarClip);
+        MatrixMultiply(m_lightViewMatrix, projection, cascade.m_vpMatrix);
+
+        // Light view space -> [-1,1] by the projection, then into [0,1]
+        // and the cascade's tile in the shadow map
+        float tileScaleX = (float)m_cascadeSize / m_shadowMapWidth;
+        float tileScaleY = (float)m_cascadeSize / m_shadowMapHeight;
+        float tileX = (float)cascade.m_viewportX / m_shadowMapWidth;
+        float tileY = (float)cascade.m_viewportY / m_shadowMapHeight;
+        cascade.m_scale[0] = projection[0] * 0.5 * tileScaleX;
+        cascade.m_scale[1] = projection[5] * 0.5 * tileScaleY;
+        cascade.m_scale[2] = projection[10] * 0.5;
+        cascade.m_offset[0] = ((projection[12] * 0.5) + 0.5) * tileScaleX +
+                tileX;
+        cascade.m_offset[1] = ((projection[13] * 0.5) + 0.5) * tileScaleY +
+                tileY;
+        cascade.m_offset[2] = (projection[14] * 0.5) + 0.5;
+
+        sliceNear = sliceFar;
+    }
+}
+
+void PhysicsStage::UpdateCascadeUniforms(const CascadeUniformLocs& locs)
+{
+    float cascadeFar[MaxShadowCascades];
+    float scales[MaxShadowCascades * 3];
+    float offsets[MaxShadowCascades * 3];
+    for ( int i = 0; i < MaxShadowCascades; i++ )
+    {
+        // The unused cascades repeat the last one; the shaders pick the
+        // cascade by counting the far distances behind the pixel, so the
+        // pixels past the last cascade get no shadow
+        int cascade = std::max(std::min(i, m_numCascades - 1), 0);
+        cascadeFar[i] = (m_numCascades > 0) ? m_cascades[cascade].m_far : 0.0;
+        for ( int j = 0; j < 3; j++ )
+        {
+            scales[(i * 3) + j] = m_cascades[cascade].m_scale[j];
+            offsets[(i * 3) + j] = m_cascades[cascade].m_offset[j];
+        }
+    }
+
+    glUniform4fv(locs.m_farLoc, 1, cascadeFar);
+    glUniform3fv(locs.m_scalesLoc, MaxShadowCascades, scales);
+    glUniform3fv(locs.m_offsetsLoc, MaxShadowCascades, offsets);
+}
+
+void PhysicsStage::GetCascadeUniformLocations(GLuint program,
+                                              CascadeUniformLocs& locs)
+{
+    locs.m_farLoc = glGetUniformLocation(program, "cascade_far");
+    locs.m_scalesLoc = glGetUniformLocation(program, "cascade_scales");
+    locs.m_offsetsLoc = glGetUniformLocation(program, "cascade_offsets");
+}
+
+void PhysicsStage::RenderSkybox(float* viewMatrix)
+{
+    // Extract rotation from the view matrix and calculate (m)vp matrix
+    float rotationMatrix[16];
+    MatrixExtractRotation(viewMatrix, rotationMatrix);
+    float skyboxMvpMatrix[16];
+    MatrixMultiply(rotationMatrix, m_perspectiveProjectionMatrix,
+                   skyboxMvpMatrix);
+
+    glUniformMatrix4fv(m_skyboxMvpLoc, 1, GL_FALSE, skyboxMvpMatrix);
+    m_stateCache.BindTexture(0, GL_TEXTURE_CUBE_MAP, m_skyboxTexture);
+
+    // Depth testing and writes are off for the skybox item
+    m_skybox->Render();
+}
+
+void PhysicsStage::RenderPillars(float* vpMatrix, GLint mvpLoc,
+                                 const std::vector<int>& visible)
+{
+    m_pillar->PrepareRender();
+
+    // Calculate all the MVP matrices at once
+    m_batchTransforms.clear();
+    for ( unsigned int i = 0; i < visible.size(); i++ )
+    {
+        m_batchTransforms.push_back(&m_pillarTransforms[visible[i] * 16]);
+    }
+    const float* mvpMatrices = MultiplyBatchTransforms(vpMatrix);
+
+    for ( unsigned int i = 0; i < m_batchTransforms.size(); i++ )
+    {
+        // Upload this pillar's transform
+        glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, &mvpMatrices[i * 16]);
+
+        // Render the pillar
+        m_pillar->Render();
+    }
+}
+
+void PhysicsStage::UpdatePillarInstances()
+{
+    // Stream this frame's visible pillar transforms with a single upload;
+    // the ones within each shadow cascade go first, followed by the ones
+    // within the camera's frustum
+    int numInstances = 0;
+    VisibleObjects* lists[MaxShadowCascades + 1];
+    int numLists = 0;
+    for ( int i = 0; i < m_numCascades; i++ )
+    {
+        lists[numLists++] = &m_cascades[i].m_visible;
+    }
+    lists[numLists++] = &m_cameraVisible;
+
+    for ( int i = 0; i < numLists; i++ )
+    {
+        VisibleObjects& visible = *lists[i];
+        visible.m_firstPillarInstance = numInstances;
+        for ( unsigned int j = 0; j < visible.m_pillars.size(); j++ )
+        {
+            memcpy(m_pillarInstances->InstanceMatrix(numInstances++),
+                   &m_pillarTransforms[visible.m_pillars[j] * 16],
+                   16 * sizeof(float));
+        }
+    }
+
+    m_pillarInstances->Upload(numInstances);
+}
+
+void PhysicsStage::RenderPillarsDepthMap(float* vpMatrix,
+                                         const VisibleObjects& visible)
+{
+    if ( visible.m_pillars.empty() )
+    {
+        return;
+    }
+
+    m_pillar->PrepareRender();
+    glUniformMatrix4fv(m_shadowMapInstancedVpLoc, 1, GL_FALSE, vpMatrix);
+
+    m_pillarInstances->Bind(m_shadowMapInstancedModelMatrixLoc,
+                            visible.m_firstPillarInstance);
+    m_pillar->RenderInstanced(visible.m_pillars.size());
+    m_pillarInstances->Unbind(m_shadowMapInstancedModelMatrixLoc);
+}
+
+void PhysicsStage::RenderPillarsInstanced(float* vpMatrix)
+{
+    m_stateCache.BindTexture(0, GL_TEXTURE_2D, m_pillarTexture);
+    m_stateCache.BindTexture(1, GL_TEXTURE_2D, m_shadowMapTexture);
+
+    // Lighting is done in world space so these are shared by all instances
+    glUniformMatrix4fv(m_defaultInstancedShadowMatrixLoc, 1, GL_FALSE,
+                       m_lightViewMatrix);
+    UpdateCascadeUniforms(m_defaultInstancedCascadeLocs);
+    glUniformMatrix4fv(m_defaultInstancedVpLoc, 1, GL_FALSE, vpMatrix);
+
+    // The camera's instances follow the cascades' in the instance buffer
+    m_pillar->PrepareRender();
+    m_pillarInstances->Bind(m_defaultInstancedModelMatrixLoc,
+                            m_cameraVisible.m_firstPillarInstance);
+    m_pillar->RenderInstanced(m_cameraVisible.m_pillars.size());
+    m_pillarInstances->Unbind(m_defaultInstancedModelMatrixLoc);
+}
+
+void PhysicsStage::RenderTerrain(float* vMatrix, float* vpMatrix)
+{
+    glUniformMatrix4fv(m_terrainMvpLoc, 1, GL_FALSE, vpMatrix);
+    glUniformMatrix4fv(m_terrainMvLoc, 1, GL_FALSE, vMatrix);
+
+    m_stateCache.BindTexture(0, GL_TEXTURE_2D, m_terrainTexture);
+    m_stateCache.BindTexture(1, GL_TEXTURE_2D, m_terrainTexture2);
+    m_stateCache.BindTexture(2, GL_TEXTURE_2D, m_shadowMapTexture);
+
+    // Setup shadow matrix: modelMatrix*lightViewMatrix.
+    // modelMatrix = identity for terrain
+    glUniformMatrix4fv(m_terrainShadowMatrixLoc, 1, GL_FALSE,
+                       m_lightViewMatrix);
+    UpdateCascadeUniforms(m_terrainCascadeLocs);
+
+    // Draw the visible terrain chunks at a detail level matching their
+    // distance from the camera
+    float frustumPlanes[FrustumPlanesSize];
+    ExtractFrustumPlanes(vpMatrix, frustumPlanes);
+    m_totalTerrainIndices += m_statics->RenderTerrain(frustumPlanes,
+                                                      m_cameraLocation);
+}
+
+void PhysicsStage::RenderWalkway(float* vpMatrix)
+{
+    glUniformMatrix4fv(m_defaultMvpLoc, 1, GL_FALSE, vpMatrix);
+
+    m_stateCache.BindTexture(0, GL_TEXTURE_2D, m_walkwayTexture);
+
+    UpdateDefaultUniforms(m_walkwayUniforms, IdentityMatrix);
+
+    // Polygon offset is enabled for the walkway item
+    glPolygonOffset(-2, -2);
+    m_statics->RenderWalkway();
+}
+
+void PhysicsStage::RenderWallCorners(float* vpMatrix, GLint mvpLoc,
+                                     const std::vector<int>& visible)
+{
+    m_statics->PrepareRenderWallCorner();
+
+    // Calculate all the MVP matrices at once
+    const float* mvpMatrices = MultiplyVisibleTransforms(m_wallCorners,
+                                                         visible, vpMatrix);
+
+    for ( unsigned int i = 0; i < visible.size(); i++ )
+    {
+        glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, &mvpMatrices[i * 16]);
+        m_statics->RenderWallCorner();
+    }
+}
+
+void PhysicsStage::RenderWallSegments(float* vpMatrix, GLint mvpLoc,
+                                      const std::vector<int>& visible)
+{
+    m_statics->PrepareRenderWallSegment();
+
+    // Calculate all the MVP matrices at once
+    const float* mvpMatrices = MultiplyVisibleTransforms(m_wallSegments,
+                                                         visible, vpMatrix);
+
+    for ( unsigned int i = 0; i < visible.size(); i++ )
+    {
+        glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, &mvpMatrices[i * 16]);
+        m_statics->RenderWallSegment();
+    }
+}
+
+void PhysicsStage::UpdateVehicleUniforms(const float* objectTransform)
+{
+    // Transform the camera / eye position into object space
+    float eyeObjectSpacePos[3];
+    InverseTransformPointRigid(objectTransform, m_cameraLocation,
+                               eyeObjectSpacePos);
 
     // Transform the light position into object space
     float lightObjectSpacePos[3];
-    Transformv3(inverseObjectTransform, SunWorldPosition,
-                lightObjectSpacePos);
+    InverseTransformPointRigid(objectTransform, SunWorldPosition,
+                               lightObjectSpacePos);
 
     // Update uniforms
     glUniform3fv(m_vehicleLightPosLoc, 1, lightObjectSpacePos);
     glUniform3fv(m_vehicleEyePosLoc, 1, eyeObjectSpacePos);
 
-    // Setup shadow matrix: modelMatrix*lightVPmatrix*biasMatrix.
+    // Setup shadow matrix: modelMatrix*lightViewMatrix
     float shadowMatrix[16];
-    MatrixMultiply(objectTransform, m_lightMatrix, shadowMatrix);
-    MatrixMultiply(shadowMatrix, BiasMatrix, shadowMatrix);
+    MatrixMultiplyKernel(objectTransform, m_lightViewMatrix, shadowMatrix);
     glUniformMatrix4fv(m_vehicleShadowMatrixLoc, 1, GL_FALSE, shadowMatrix);
 }
 
@@ -476,8 +1630,8 @@ void PhysicsStage::SetupWheelRender(const float* wheelTransform,
     float modelTransform[16];
     float mvpMatrix[16];
 
-    MatrixMultiply(wheelTransform, objectTransform, modelTransform);
-    MatrixMultiply(modelTransform, vpMatrix, mvpMatrix);
+    MatrixMultiplyKernel(wheelTransform, objectTransform, modelTransform);
+    MatrixMultiplyKernel(modelTransform, vpMatrix, mvpMatrix);
     glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, mvpMatrix);
     if ( mvpLoc == m_vehicleMvpLoc )
     {
@@ -490,34 +1644,26 @@ void PhysicsStage::RenderVehicle(float* vpMatrix, GLint mvpLoc)
     if ( mvpLoc == m_vehicleMvpLoc )
     {
         // Rendering normally instead of the shadow map
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(m_vehicleTextureLoc, 0);
-        glBindTexture(GL_TEXTURE_2D, m_buggyBlueTexture);
-
-        glActiveTexture(GL_TEXTURE1);
-        glUniform1i(m_vehicleNormalmapLoc, 1);
-        glBindTexture(GL_TEXTURE_2D, m_buggyNormalmap);
-
-        glActiveTexture(GL_TEXTURE2);
-        glUniform1i(m_vehicleShadowTextureLoc, 2);
-        glBindTexture(GL_TEXTURE_2D, m_shadowMapTexture);
+        m_stateCache.BindTexture(0, GL_TEXTURE_2D, m_buggyBlueTexture);
+        m_stateCache.BindTexture(1, GL_TEXTURE_2D, m_buggyNormalmap);
+        m_stateCache.BindTexture(2, GL_TEXTURE_2D, m_shadowMapTexture);
+        UpdateCascadeUniforms(m_vehicleCascadeLocs);
 
         glEnableVertexAttribArray(TANGENT_INDEX);
     }
 
-    ObjectMotionState* motionState =
-            static_cast<ObjectMotionState*>(m_vehicleBody->getMotionState());
-    const float* objectTransform = motionState->GetObjectTransform();
+    const float* objectTransform = m_vehicleTransform;
 
     // Update the wheel transforms with current rotation
-    m_vehicle->UpdateWheelTransforms(m_wheelRotation);
+    m_vehicle->UpdateWheelTransforms(m_frontWheelRotation,
+                                     m_rearWheelRotation);
 
     // Disable element buffer
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
     // Render vehicle body
     float mvpMatrix[16];
-    MatrixMultiply(objectTransform, vpMatrix, mvpMatrix);
+    MatrixMultiplyKernel(objectTransform, vpMatrix, mvpMatrix);
     glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, mvpMatrix);
     if ( mvpLoc == m_vehicleMvpLoc )
     {
@@ -564,72 +1710,193 @@ void PhysicsStage::RenderVehicle(float* vpMatrix, GLint mvpLoc)
     }
 }
 
-// For sorting the trees
-struct ObjectTransform
+void PhysicsStage::GatherObjectUniforms(std::vector<ObjectUniforms>& uniforms,
+                                        int numObjects,
+                                        const std::vector<int>& visible)
 {
-    // Object transform
-    float m_transform[16];
-
-    // The MVP matrix for the object
-    float m_mvpMatrix[16];
-};
+    // New objects start out with invalid uniforms
+    uniforms.resize(numObjects);
+    for ( unsigned int i = 0; i < visible.size(); i++ )
+    {
+        m_batchUniforms.push_back(&uniforms[visible[i]]);
+    }
+}
 
-bool CompareMvps(ObjectTransform& first, ObjectTransform& second)
+void PhysicsStage::QueueObjects(int pass, GLuint texture, int mesh,
+                                int firstTransform, int numTransforms,
+                                bool backToFront)
 {
-    // Compare the Z components of the matrix translation part
-    return (first.m_mvpMatrix[14] > second.m_mvpMatrix[14]);
+    for ( int i = firstTransform; i < (firstTransform + numTransforms); i++ )
+    {
+        // W of the MVP translation is the view depth of the object
+        float depth = m_batchMatrices[(i * 16) + 15];
+        m_drawQueue.Add(pass, m_defaultProgram, texture, mesh,
+                        backToFront ? -depth : depth, i);
+    }
 }
 
-void PhysicsStage::RenderTrees(float* vpMatrix)
+void PhysicsStage::QueueCameraPass(float* vpMatrix)
 {
-    // Sort the trees back to front
-    std::list<ObjectTransform> trees;
+    m_drawQueue.Clear();
+
+    m_drawQueue.Add(BackgroundPass, m_skyboxProgram, m_skyboxTexture,
+                    SkyboxMesh, 0.0);
+    m_drawQueue.Add(OpaquePass, m_terrainProgram, m_terrainTexture,
+                    TerrainMesh, 0.0);
+    m_drawQueue.Add(OpaquePass, m_defaultProgram, m_walkwayTexture,
+                    WalkwayMesh, 0.0);
+    if ( m_cameraVisible.m_vehicle )
+    {
+        m_drawQueue.Add(OpaquePass, m_vehicleProgram, m_buggyBlueTexture,
+                        VehicleMesh, 0.0);
+    }
 
-    for ( std::list<ObjectInstance*>::iterator iter = m_trees.begin();
-          iter != m_trees.end(); iter++ )
+    // Calculate the MVP matrices of all the visible objects at once; the
+    // draw items refer to them, and to the objects' cached uniforms, by
+    // index
+    m_batchTransforms.clear();
+    m_batchUniforms.clear();
+    int firstWallCorner = m_batchTransforms.size();
+    GatherVisibleTransforms(m_wallCorners, m_cameraVisible.m_wallCorners);
+    GatherObjectUniforms(m_wallCornerUniforms, m_wallCorners.Count(),
+                         m_cameraVisible.m_wallCorners);
+    int firstWallSegment = m_batchTransforms.size();
+    GatherVisibleTransforms(m_wallSegments, m_cameraVisible.m_wallSegments);
+    GatherObjectUniforms(m_wallSegmentUniforms, m_wallSegments.Count(),
+                         m_cameraVisible.m_wallSegments);
+    int firstTree = m_batchTransforms.size();
+    GatherVisibleTransforms(m_trees, m_cameraVisible.m_trees);
+    GatherObjectUniforms(m_treeUniforms, m_trees.Count(),
+                         m_cameraVisible.m_trees);
+    int firstPillar = m_batchTransforms.size();
+    if ( m_pillarInstances == NULL )
     {
-        ObjectTransform transform;
-        CopyMatrix((*iter)->GetTransform(), transform.m_transform);
-        MatrixMultiply((*iter)->GetTransform(), vpMatrix,
-                       transform.m_mvpMatrix);
-        trees.push_back(transform);
+        const std::vector<int>& pillars = m_cameraVisible.m_pillars;
+        for ( unsigned int i = 0; i < pillars.size(); i++ )
+        {
+            m_batchTransforms.push_back(&m_pillarTransforms[pillars[i] * 16]);
+        }
+        GatherObjectUniforms(m_pillarUniforms, m_pillarBodies.size(),
+                             pillars);
     }
-    trees.sort(CompareMvps);
+    int numPillars = m_batchTransforms.size() - firstPillar;
+    MultiplyBatchTransforms(vpMatrix);
 
-    // First pass; render the trunks of each tree
-    m_statics->PrepareRenderTreeTrunk();
+    QueueObjects(OpaquePass, m_wallSegmentTexture, WallCornerMesh,
+                 firstWallCorner, firstWallSegment - firstWallCorner, false);
+    QueueObjects(OpaquePass, m_wallSegmentTexture, WallSegmentMesh,
+                 firstWallSegment, firstTree - firstWallSegment, false);
+    QueueObjects(OpaquePass, m_treeBarkTexture, TreeTrunkMesh,
+                 firstTree, firstPillar - firstTree, false);
 
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(m_defaultTextureLoc, 0);
-    glBindTexture(GL_TEXTURE_2D, m_treeBarkTexture);
+    // The leaves are blended, so they go last and back to front
+    QueueObjects(TransparentPass, m_treeLeavesTexture, TreeLeavesMesh,
+                 firstTree, firstPillar - firstTree, true);
 
-    std::list<ObjectTransform>::const_iterator iter = trees.begin();
-    for (; iter != trees.end(); iter++ )
+    if ( m_pillarInstances != NULL )
     {
-        glUniformMatrix4fv(m_defaultMvpLoc, 1, GL_FALSE, (*iter).m_mvpMatrix);
-        UpdateDefaultUniforms((*iter).m_transform);
-        m_statics->RenderTreeTrunk();
+        if ( !m_cameraVisible.m_pillars.empty() )
+        {
+            m_drawQueue.Add(OpaquePass, m_defaultInstancedProgram,
+                            m_pillarTexture, PillarInstancedMesh, 0.0);
+        }
     }
+    else
+    {
+        QueueObjects(OpaquePass, m_pillarTexture, PillarMesh,
+                     firstPillar, numPillars, false);
+    }
+}
 
-    // Second pass; render the leaves of each tree
-    m_statics->PrepareRenderTreeLeaves();
-
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(m_defaultTextureLoc, 0);
-    glBindTexture(GL_TEXTURE_2D, m_treeLeavesTexture);
+void PhysicsStage::DrawQueueCallback(void* userData, const DrawItem& item)
+{
+    static_cast<PhysicsStage*>(userData)->RenderDrawItem(item);
+}
 
-    glDisable(GL_CULL_FACE);
-    glDepthMask(GL_FALSE);
+void PhysicsStage::RenderDrawItem(const DrawItem& item)
+{
+    // Render state of the item; the cache drops the redundant changes
+    bool leaves = (item.m_mesh == TreeLeavesMesh);
+    bool skybox = (item.m_mesh == SkyboxMesh);
+    m_stateCache.UseProgram(item.m_program);
+    m_stateCache.SetEnabled(GL_DEPTH_TEST, !skybox);
+    m_stateCache.SetDepthMask(!skybox && !leaves);
+    m_stateCache.SetEnabled(GL_CULL_FACE, !leaves);
+    m_stateCache.SetEnabled(GL_POLYGON_OFFSET_FILL,
+                            (item.m_mesh == WalkwayMesh));
+
+    bool meshChanged = (item.m_mesh != m_lastDrawMesh);
+    m_lastDrawMesh = item.m_mesh;
+
+    switch ( item.m_mesh )
+    {
+        case SkyboxMesh:
+            RenderSkybox(m_cameraViewMatrix);
+            return;
+        case TerrainMesh:
+            RenderTerrain(m_cameraViewMatrix, m_cameraVpMatrix);
+            return;
+        case WalkwayMesh:
+            RenderWalkway(m_cameraVpMatrix);
+            return;
+        case VehicleMesh:
+            RenderVehicle(m_cameraVpMatrix, m_vehicleMvpLoc);
+            return;
+        case PillarInstancedMesh:
+            RenderPillarsInstanced(m_cameraVpMatrix);
+            return;
+        default:
+            break;
+    }
 
-    for ( iter = trees.begin(); iter != trees.end(); iter++ )
+    // Instances rendered with the default program
+    if ( meshChanged )
     {
-        glUniformMatrix4fv(m_defaultMvpLoc, 1, GL_FALSE, (*iter).m_mvpMatrix);
-        UpdateDefaultUniforms((*iter).m_transform);
-        m_statics->RenderTreeLeaves();
+        switch ( item.m_mesh )
+        {
+            case WallCornerMesh:
+                m_statics->PrepareRenderWallCorner();
+                break;
+            case WallSegmentMesh:
+                m_statics->PrepareRenderWallSegment();
+                break;
+            case TreeTrunkMesh:
+                m_statics->PrepareRenderTreeTrunk();
+                break;
+            case TreeLeavesMesh:
+                m_statics->PrepareRenderTreeLeaves();
+                break;
+            case PillarMesh:
+                m_pillar->PrepareRender();
+                break;
+        }
     }
 
-    glDepthMask(GL_TRUE);
-    glEnable(GL_CULL_FACE);
+    m_stateCache.BindTexture(0, GL_TEXTURE_2D, item.m_texture);
+    m_stateCache.BindTexture(1, GL_TEXTURE_2D, m_shadowMapTexture);
+    glUniformMatrix4fv(m_defaultMvpLoc, 1, GL_FALSE,
+                       &m_batchMatrices[item.m_data * 16]);
+    UpdateDefaultUniforms(*m_batchUniforms[item.m_data],
+                          m_batchTransforms[item.m_data]);
+
+    switch ( item.m_mesh )
+    {
+        case WallCornerMesh:
+            m_statics->RenderWallCorner();
+            break;
+        case WallSegmentMesh:
+            m_statics->RenderWallSegment();
+            break;
+        case TreeTrunkMesh:
+            m_statics->RenderTreeTrunk();
+            break;
+        case TreeLeavesMesh:
+            m_statics->RenderTreeLeaves();
+            break;
+        case PillarMesh:
+            m_pillar->Render();
+            break;
+    }
 }
 
 void PhysicsStage::Animate(const TimeSample& time)
@@ -661,18 +1928,25 @@ void PhysicsStage::DetectSunVisibility(float* vpMatrix)
     m_sunScreenX = int(((x * 0.5) + 0.5) * m_viewportWidth);
     m_sunScreenY = int(((-y * 0.5) + 0.5) * m_viewportHeight);
 
-    bool flareOnScreen = false;
+    m_sunOnScreen = false;
 
     // Check if Sun position is on screen
     if ( (sunScreenPos[2] > PhysicsStageNearClip) &&
         (m_sunScreenX >= 0) && (m_sunScreenX < m_viewportWidth) &&
         (m_sunScreenY >= 0) && (m_sunScreenY < m_viewportHeight) ) {
-        flareOnScreen = true;
+        m_sunOnScreen = true;
+    }
+
+    if ( !m_sunQueries.empty() )
+    {
+        // Visibility from the occlusion queries issued on earlier frames
+        UpdateSunVisibility();
+        return;
     }
 
-    if ( !flareOnScreen )
+    if ( !m_sunOnScreen )
     {
-        m_sunVisible = false;
+        m_sunVisibility = 0.0;
         return;
     }
 
@@ -699,9 +1973,115 @@ void PhysicsStage::DetectSunVisibility(float* vpMatrix)
                      GL_UNSIGNED_BYTE, (GLvoid*)pixel);
 
         // If alpha = 1.0 at the pixel, the sun is occluded by an object
-        m_sunVisible = ( pixel[3] < 255 );
+        m_sunVisibility = ( pixel[3] < 255 ) ? 1.0 : 0.0;
+        m_lastSunVisibilityTestTime->Reset();
+    }
+}
+
+void PhysicsStage::UpdateSunVisibility()
+{
+    ReadSunQueries();
+    if ( !m_sunOnScreen )
+    {
+        m_sunVisibilityTarget = 0.0;
+    }
+
+    float elapsed = 0.0;
+    if ( m_lastSunVisibilityTestTime == NULL )
+    {
+        m_lastSunVisibilityTestTime = new TimeSample();
+    }
+    else
+    {
+        elapsed = m_lastSunVisibilityTestTime->ElapsedTime();
         m_lastSunVisibilityTestTime->Reset();
     }
+
+    // Fade towards the measured visibility instead of popping the flares
+    float maxChange = SunVisibilityFadeSpeed * elapsed;
+    float change = m_sunVisibilityTarget - m_sunVisibility;
+    change = std::max(-maxChange, std::min(change, maxChange));
+    m_sunVisibility += change;
+}
+
+void PhysicsStage::ReadSunQueries()
+{
+    // Consume the finished query sets, oldest first. A set whose results
+    // are not available yet is left for a later frame; never wait for them.
+    while ( m_numPendingSunQuerySets > 0 )
+    {
+        const GLuint* queries =
+                &m_sunQueries[m_oldestSunQuerySet * NumSunSamples];
+        int numVisibleSamples = 0;
+        for ( int i = 0; i < NumSunSamples; i++ )
+        {
+            bool passed = false;
+            if ( !GetOcclusionQueryResult(queries[i], &passed) )
+            {
+                return;
+            }
+
+            if ( passed )
+            {
+                numVisibleSamples++;
+            }
+        }
+
+        m_sunVisibilityTarget = (float)numVisibleSamples / NumSunSamples;
+        m_oldestSunQuerySet = (m_oldestSunQuerySet + 1) % SunQueryLatency;
+        m_numPendingSunQuerySets--;
+    }
+}
+
+void PhysicsStage::IssueSunQueries()
+{
+    if ( m_numPendingSunQuerySets == SunQueryLatency )
+    {
+        // The GPU is lagging behind; skip a frame rather than stall
+        return;
+    }
+
+    int set = (m_oldestSunQuerySet + m_numPendingSunQuerySets) %
+            SunQueryLatency;
+    const GLuint* queries = &m_sunQueries[set * NumSunSamples];
+
+    // Map the sample offsets (in pixels) around the sun's screen position
+    float mvpMatrix[16];
+    memset(mvpMatrix, 0, sizeof(mvpMatrix));
+    mvpMatrix[0] = 2.0 / m_viewportWidth;
+    mvpMatrix[5] = 2.0 / m_viewportHeight;
+    mvpMatrix[12] = ((2.0 * m_sunScreenX) / m_viewportWidth) - 1.0;
+    mvpMatrix[13] = 1.0 - ((2.0 * m_sunScreenY) / m_viewportHeight);
+    mvpMatrix[14] = SunSampleDepth;
+    mvpMatrix[15] = 1.0;
+
+    m_stateCache.UseProgram(m_simpleColorProgram);
+    glUniformMatrix4fv(m_simpleColorMvpLoc, 1, GL_FALSE, mvpMatrix);
+
+    // Only the depth test is needed
+    glColorMask(false, false, false, false);
+    m_stateCache.SetDepthMask(false);
+
+    // The sample quads only have positions
+    glDisableVertexAttribArray(NORMAL_INDEX);
+    glDisableVertexAttribArray(TEXCOORD_INDEX);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_sunSampleVertexBuffer);
+    glVertexAttribPointer(COORD_INDEX, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+    for ( int i = 0; i < NumSunSamples; i++ )
+    {
+        BeginOcclusionQuery(queries[i]);
+        glDrawArrays(GL_TRIANGLES, i * 6, 6);
+        EndOcclusionQuery();
+    }
+
+    glEnableVertexAttribArray(TEXCOORD_INDEX);
+    glEnableVertexAttribArray(NORMAL_INDEX);
+
+    m_stateCache.SetDepthMask(true);
+    glColorMask(true, true, true, true);
+
+    m_numPendingSunQuerySets++;
 }
 
 void PhysicsStage::RenderLensFlares()
@@ -711,8 +2091,9 @@ void PhysicsStage::RenderLensFlares()
     m_textRenderer.SetProgram();
     m_textRenderer.SetTexture(m_lensFlareTexture);
 
-    // Use additive blending for drawing the flares
+    // Use additive blending for drawing the flares, faded by the visibility
     glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE);
+    glBlendColor(1.0, 1.0, 1.0, LensFlareAlpha * m_sunVisibility);
 
     // Prevent lens flares affecting the alpha buffer
     glColorMask(true, true, true, false);
@@ -738,6 +2119,7 @@ void PhysicsStage::RenderLensFlares()
 
     // Restore alpha based blending
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBlendColor(1.0, 1.0, 1.0, LensFlareAlpha);
     glColorMask(true, true, true, true);
 }
 
@@ -745,21 +2127,35 @@ void PhysicsStage::RenderImpl(const TimeSample& time)
 {
 //    LOG_DEBUG("error 1 = 0x%x", glGetError());
 
-    // Advance the physics calculations
-    StepPhysics();
+    if ( !m_threadedPhysics )
+    {
+        // Advance the physics calculations
+        StepPhysics();
+    }
 
     // Animate everything
     Animate(time);
 
     // Copy the object transforms
-    CopyPhysicsTransforms();
-
-    if ( m_shadowMapping )
+    if ( m_threadedPhysics )
     {
-        // Render the shadow depth map for this frame
-        RenderDepthMap();
+        InterpolatePhysicsTransforms();
+    }
+    else
+    {
+        CopyPhysicsTransforms();
+    }
+
+    if ( m_sceneQueries != NULL )
+    {
+        // Cast the queries of the frame from the camera
+        RunSceneQueries();
     }
 
+    // The state may have been changed by others since the last frame
+    m_stateCache.Invalidate();
+    m_stateCache.ResetCounters();
+
     // Create a look-at matrix
     float lookat[16];
     MatrixSetLookat(lookat, m_cameraLocation, m_cameraTarget);
@@ -768,6 +2164,31 @@ void PhysicsStage::RenderImpl(const TimeSample& time)
     float vpMatrix[16];
     MatrixMultiply(lookat, m_perspectiveProjectionMatrix, vpMatrix);
 
+    // Cull the objects outside the camera's / shadow cascades' view
+    CullObjects(vpMatrix, m_cameraVisible);
+    m_totalCameraCulled += m_cameraVisible.m_numCulled;
+    if ( m_shadowMapping )
+    {
+        // Fit the shadow cascades to the camera frustum
+        UpdateShadowCascades();
+        for ( int i = 0; i < m_numCascades; i++ )
+        {
+            CullObjects(m_cascades[i].m_vpMatrix, m_cascades[i].m_visible);
+            m_totalLightCulled += m_cascades[i].m_visible.m_numCulled;
+        }
+    }
+
+    if ( m_pillarInstances != NULL )
+    {
+        UpdatePillarInstances();
+    }
+
+    if ( m_shadowMapping )
+    {
+        // Render the shadow depth map for this frame
+        RenderDepthMap();
+    }
+
     // Calculate sun position on screen from previous frame and detect occlusion
     DetectSunVisibility(vpMatrix);
 
@@ -775,42 +2196,35 @@ void PhysicsStage::RenderImpl(const TimeSample& time)
     //glClearColor(0.0, 0.0, 0.0, 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Draw the skybox
-    glUseProgram(m_skyboxProgram);
-    RenderSkybox(lookat);
-
-    // Use terrain shader and draw terrain
-    glUseProgram(m_terrainProgram);
-    RenderTerrain(lookat, vpMatrix);
-
-    // Render the vehicle
-    glUseProgram(m_vehicleProgram);
-    RenderVehicle(vpMatrix, m_vehicleMvpLoc);
-
-    // Use the default program; shared by most renders in this scene
-    glUseProgram(m_defaultProgram);
-
-    // Setup shadow texture
-    glActiveTexture(GL_TEXTURE1);
-    glUniform1i(m_defaultShadowTextureLoc, 1);
-    glBindTexture(GL_TEXTURE_2D, m_shadowMapTexture);
-
-    // Render the road/walkway
-    RenderWalkway(vpMatrix);
-
-    // Render most of the static objects
-    PrepareRenderWall();
-    RenderWallCorners(vpMatrix, m_defaultMvpLoc);
-    RenderWallSegments(vpMatrix, m_defaultMvpLoc);
+    // Per-frame uniforms of the default program; shared by most renders
+    // in this scene
+    m_stateCache.UseProgram(m_defaultProgram);
+    UpdateCascadeUniforms(m_defaultCascadeLocs);
+
+    // Draw the scene sorted by render state
+    CopyMatrix(lookat, m_cameraViewMatrix);
+    CopyMatrix(vpMatrix, m_cameraVpMatrix);
+    QueueCameraPass(vpMatrix);
+    m_totalDrawItems += m_drawQueue.Count();
+    m_lastDrawMesh = -1;
+    m_drawQueue.Submit();
+
+    // Back to the default state
+    m_stateCache.SetEnabled(GL_DEPTH_TEST, true);
+    m_stateCache.SetDepthMask(true);
+    m_stateCache.SetEnabled(GL_CULL_FACE, true);
+    m_stateCache.SetEnabled(GL_POLYGON_OFFSET_FILL, false);
+
+    if ( !m_sunQueries.empty() && m_sunOnScreen )
+    {
+        // Test the sun against this frame's depth; read on a later frame
+        IssueSunQueries();
+    }
 
-    // Render all the pillars
-    PrepareRenderPillars();
-    RenderPillars(vpMatrix, m_defaultMvpLoc);
-    
-    // Render trees last so the transparency of the leaves works properly
-    RenderTrees(vpMatrix);
+    m_totalStateChanges += m_stateCache.NumStateChanges();
+    m_totalRedundantStateChanges += m_stateCache.NumRedundantChanges();
 
-    if ( m_sunVisible )
+    if ( m_sunVisibility > 0.0 )
     {
         // Draw the lens flares
         RenderLensFlares();
@@ -845,31 +2259,325 @@ void PhysicsStage::StepPhysics()
     // Keep vehicle from "falling asleep"
     m_vehicleBody->activate();
 
-    // Be sure that timeStep < substeps*fixedTimeStep (1/60)
-    int substeps = ceil(seconds / (1/60.0));
-    m_dynamicsWorld->stepSimulation(seconds, substeps);
+    // Be sure that timeStep < substeps*fixedTimeStep
+    int substeps = ceil(seconds / m_physicsTimeStep);
+    StepWorld(seconds, substeps, m_physicsTimeStep);
+}
+
+void PhysicsStage::StepWorld(btScalar timeStep, int maxSubSteps,
+                             btScalar fixedTimeStep)
+{
+    PhysicsAllocatorStats allocations = m_allocator->Stats();
+    int poolOverflows = m_dispatcher->NumManifoldPoolOverflows() +
+            m_dispatcher->NumAlgorithmPoolOverflows();
+
+    int numSteps = 0;
+    if ( m_stressLevel < 0 )
+    {
+        numSteps = m_dynamicsWorld->stepSimulation(timeStep, maxSubSteps,
+                                                   fixedTimeStep);
+    }
+    else
+    {
+        // Only the time spent in the simulation counts towards the stress
+        // results; the steps, contacts and pairs are counted by the tick
+        // callback
+        double startTime = CurrentTime();
+        numSteps = m_dynamicsWorld->stepSimulation(timeStep, maxSubSteps,
+                                                   fixedTimeStep);
+        m_stressCounters.m_stepTime += CurrentTime() - startTime;
+    }
+
+    // The pairs of the last substep stand for all of them
+    m_numSimulationSteps += numSteps;
+    m_numBroadphasePairs += numSteps *
+            m_broadphase->getOverlappingPairCache()->getNumOverlappingPairs();
+
+    double broadphaseTime = m_physicsPhaseTimes[PhysicsPhaseBroadphase];
+    double stepTime = CollectPhysicsProfile();
+    if ( m_stressLevel >= 0 )
+    {
+        m_stressCounters.m_broadphaseTime +=
+                m_physicsPhaseTimes[PhysicsPhaseBroadphase] - broadphaseTime;
+    }
+    CountStepAllocations(allocations);
+    CountPoolOverflows(poolOverflows, stepTime);
 }
 
 void PhysicsStage::CopyPhysicsTransforms()
 {
-    // Pillars
+    // Pillars; also keep a packed copy of the transforms for culling
+    m_pillarTransforms.resize(m_pillarBodies.size() * 16);
+    m_pillarUniforms.resize(m_pillarBodies.size());
+    int numActive = 0;
     for ( unsigned int i = 0; i < m_pillarBodies.size(); i++ )
     {
+        // Bullet only updates the motion states of active bodies, so a
+        // sleeping pillar has not moved
         btRigidBody* body = m_pillarBodies[i];
+        if ( !body->isActive() )
+        {
+            continue;
+        }
+
         ObjectMotionState* motionState =
                 static_cast<ObjectMotionState*>(body->getMotionState());
         motionState->UpdateObjectTransform();
+        UpdatePillarTransform(i, motionState->GetObjectTransform());
+        numActive++;
     }
+    SampleActivity(numActive);
 
     // Vehicle
     ObjectMotionState* motionState =
             static_cast<ObjectMotionState*>(m_vehicleBody->getMotionState());
     motionState->UpdateObjectTransform();
+    memcpy(m_vehicleTransform, motionState->GetObjectTransform(),
+           sizeof(m_vehicleTransform));
+    m_frontWheelRotation =
+            m_raycastVehicle->getWheelInfo(FrontRightWheel).m_rotation;
+    m_rearWheelRotation =
+            m_raycastVehicle->getWheelInfo(RearRightWheel).m_rotation;
 
     // TODO boards?
 }
 
-void PhysicsStage::AddNewPillar(float x, float y, float z)
+void PhysicsStage::UpdatePillarTransform(int index, const float* transform)
+{
+    float* pillarTransform = &m_pillarTransforms[index * 16];
+    if ( memcmp(pillarTransform, transform, 16 * sizeof(float)) != 0 )
+    {
+        // Moved; the cached uniforms must be recalculated
+        memcpy(pillarTransform, transform, 16 * sizeof(float));
+        m_pillarUniforms[index].m_valid = false;
+    }
+}
+
+void PhysicsStage::SampleActivity(int numActiveBodies)
+{
+    m_totalActiveBodies += numActiveBodies;
+
+    double now = CurrentTime();
+    if ( m_activityStartTime <= 0.0 )
+    {
+        // The first frame only starts the first interval
+        m_activityStartTime = now;
+        m_activityIntervalStart = now;
+        return;
+    }
+
+    m_activityIntervalFrames++;
+    m_activityIntervalBodies += numActiveBodies;
+    double elapsed = now - m_activityIntervalStart;
+    if ( elapsed >= ActivitySampleInterval )
+    {
+        ActivitySample sample;
+        sample.m_time = m_activityIntervalStart - m_activityStartTime;
+        sample.m_activeBodies =
+                m_activityIntervalBodies / m_activityIntervalFrames;
+        sample.m_frameTime = elapsed * 1000.0 / m_activityIntervalFrames;
+        m_activitySamples.push_back(sample);
+
+        m_activityIntervalStart = now;
+        m_activityIntervalFrames = 0;
+        m_activityIntervalBodies = 0.0;
+    }
+}
+
+void PhysicsStage::LogActivitySamples()
+{
+    if ( m_numFrames == 0 )
+    {
+        return;
+    }
+
+    // Ties the frame time to the number of pillars in motion
+    LOG_DEBUG("PhysicsStage: %.1f of %d pillars awake per frame",
+              (float)(m_totalActiveBodies / m_numFrames),
+              (int)m_pillarBodies.size());
+    for ( unsigned int i = 0; i < m_activitySamples.size(); i++ )
+    {
+        const ActivitySample& sample = m_activitySamples[i];
+        LOG_DEBUG("PhysicsStage: at %4.1f s: %.1f pillars awake, %.2f ms "
+                  "per frame", sample.m_time, sample.m_activeBodies,
+                  sample.m_frameTime);
+    }
+}
+
+void PhysicsStage::InterpolatePhysicsTransforms()
+{
+    // Take the latest state published by the physics thread
+    if ( m_physicsStates.Acquire() )
+    {
+        m_previousPhysicsState.m_bodies.swap(m_currentPhysicsState.m_bodies);
+        m_previousPhysicsState.m_active.swap(m_currentPhysicsState.m_active);
+        m_previousPhysicsState.m_time = m_currentPhysicsState.m_time;
+        m_currentPhysicsState = m_physicsStates.ReadState();
+    }
+
+    // Draw the scene one physics step in the past so that there is nearly
+    // always a state on both sides of the render time
+    double renderTime = CurrentTime() - m_physicsTimeStep;
+    double interval = m_currentPhysicsState.m_time -
+            m_previousPhysicsState.m_time;
+    float t = 1.0;
+    if ( interval > 0.0 )
+    {
+        t = (renderTime - m_previousPhysicsState.m_time) / interval;
+        t = std::max(0.0f, std::min(t, 1.0f));
+    }
+
+    const float* previous = &m_previousPhysicsState.m_bodies[0];
+    const float* current = &m_currentPhysicsState.m_bodies[0];
+    float transform[16];
+
+    // Pillars
+    m_pillarTransforms.resize(m_pillarBodies.size() * 16);
+    m_pillarUniforms.resize(m_pillarBodies.size());
+    m_pillarResting.resize(m_pillarBodies.size(), false);
+    int numActive = 0;
+    for ( unsigned int i = 0; i < m_pillarBodies.size(); i++ )
+    {
+        bool active = m_currentPhysicsState.m_active[i];
+        if ( active )
+        {
+            numActive++;
+            m_pillarResting[i] = false;
+        }
+
+        if ( !m_pillarResting[i] )
+        {
+            InterpolateBodyState(previous, current, t, transform);
+            UpdatePillarTransform(i, transform);
+
+            // Asleep at the same place in both states, the pillar is now
+            // drawn exactly where it rests
+            m_pillarResting[i] = !active &&
+                    !m_previousPhysicsState.m_active[i] &&
+                    (memcmp(previous, current,
+                            PhysicsStateBodySize * sizeof(float)) == 0);
+        }
+        previous += PhysicsStateBodySize;
+        current += PhysicsStateBodySize;
+    }
+    SampleActivity(numActive);
+
+    // Vehicle
+    InterpolateBodyState(previous, current, t, m_vehicleTransform);
+    m_frontWheelRotation = m_previousPhysicsState.m_frontWheelRotation +
+            (t * (m_currentPhysicsState.m_frontWheelRotation -
+                  m_previousPhysicsState.m_frontWheelRotation));
+    m_rearWheelRotation = m_previousPhysicsState.m_rearWheelRotation +
+            (t * (m_currentPhysicsState.m_rearWheelRotation -
+                  m_previousPhysicsState.m_rearWheelRotation));
+}
+
+void PhysicsStage::WritePhysicsState(PhysicsState& state)
+{
+    // The pillars followed by the vehicle
+    state.m_bodies.resize((m_pillarBodies.size() + 1) *
+                          PhysicsStateBodySize);
+    state.m_active.resize(m_pillarBodies.size() + 1);
+    float* data = &state.m_bodies[0];
+    for ( unsigned int i = 0; i < m_pillarBodies.size(); i++ )
+    {
+        StoreBodyState(m_pillarBodies[i], data);
+        state.m_active[i] = m_pillarBodies[i]->isActive();
+        data += PhysicsStateBodySize;
+    }
+    StoreBodyState(m_vehicleBody, data);
+    state.m_active[m_pillarBodies.size()] = m_vehicleBody->isActive();
+    state.m_frontWheelRotation =
+            m_raycastVehicle->getWheelInfo(FrontRightWheel).m_rotation;
+    state.m_rearWheelRotation =
+            m_raycastVehicle->getWheelInfo(RearRightWheel).m_rotation;
+}
+
+bool PhysicsStage::StartPhysicsThread()
+{
+    // Start out from the current state; the bodies may have been moved or
+    // replaced while the thread was stopped
+    m_pillarResting.clear();
+    m_physicsStates.Reset();
+    WritePhysicsState(m_currentPhysicsState);
+    m_currentPhysicsState.m_time = CurrentTime();
+    m_previousPhysicsState = m_currentPhysicsState;
+    m_numPhysicsSteps = 0;
+
+    m_physicsThreadAlive = true;
+    if ( pthread_create(&m_physicsThread, NULL,
+                        &PhysicsStage::PhysicsThreadMethod, this) != 0 )
+    {
+        LOG_DEBUG("Physics thread creation failed!");
+        m_physicsThreadAlive = false;
+        return false;
+    }
+    m_physicsThreadRunning = true;
+
+    return true;
+}
+
+void PhysicsStage::StopPhysicsThread()
+{
+    if ( !m_physicsThreadRunning )
+    {
+        return;
+    }
+
+    m_physicsThreadAlive = false;
+    pthread_join(m_physicsThread, NULL);
+    m_physicsThreadRunning = false;
+
+#ifndef BT_NO_PROFILE
+    // The next thread to step the world claims the profile for itself
+    CProfileManager::Release_Profiled_Thread();
+#endif
+}
+
+void PhysicsStage::PhysicsThreadLoop()
+{
+    double stepTime = CurrentTime();
+
+    while ( m_physicsThreadAlive )
+    {
+        // Advance the world by exactly one fixed step
+        pthread_mutex_lock(&m_physicsMutex);
+        m_vehicleBody->activate();
+        StepWorld(m_physicsTimeStep, 1, m_physicsTimeStep);
+        stepTime += m_physicsTimeStep;
+
+        // Hand the new state over to the renderer
+        PhysicsState& state = m_physicsStates.WriteState();
+        WritePhysicsState(state);
+        pthread_mutex_unlock(&m_physicsMutex);
+        state.m_time = stepTime;
+        m_physicsStates.Publish();
+        m_numPhysicsSteps++;
+
+        // Wait for the next step to be due. If the steps take longer than
+        // their interval, the simulation falls behind instead of trying to
+        // catch up
+        double now = CurrentTime();
+        if ( now < stepTime )
+        {
+            usleep((useconds_t)((stepTime - now) * 1000000));
+        }
+        else
+        {
+            stepTime = now;
+        }
+    }
+}
+
+void* PhysicsStage::PhysicsThreadMethod(void* data)
+{
+    PhysicsStage* stage = static_cast<PhysicsStage*>(data);
+    stage->PhysicsThreadLoop();
+
+    return NULL;
+}
+
+void PhysicsStage::AddNewPillar(float x, float y, float z, bool lying)
 {
 //    LOG_DEBUG("AddNewPillar(): %f, %f, %f", x, y, z);
 
@@ -881,11 +2589,20 @@ void PhysicsStage::AddNewPillar(float x, float y, float z)
         m_pillarShape = new btCylinderShape(Pillar::GetExtents());
     }
 
+    // Upright, or on its side along the x axis
+    btQuaternion rotation(0.0, 0.0, 0.0, 1.0);
+    if ( lying )
+    {
+        rotation.setRotation(btVector3(0.0, 0.0, 1.0), SIMD_HALF_PI);
+    }
+
     // Create the motion state. It will reflect the given initial position
     // and orientation of the object
-    ObjectMotionState* motionState =
-            new ObjectMotionState(btTransform(btQuaternion(0.0, 0.0, 0.0, 1.0),
-                                              btVector3(x, y, z)), m_pillar);
+    void* motionStateMemory =
+            m_allocator->Allocate(sizeof(ObjectMotionState));
+    ObjectMotionState* motionState = new (motionStateMemory)
+            ObjectMotionState(btTransform(rotation, btVector3(x, y, z)),
+                              m_pillar);
 
     // Calculate inertia
     btScalar mass = PillarMass;
@@ -899,6 +2616,10 @@ void PhysicsStage::AddNewPillar(float x, float y, float z)
     bodyCI.m_restitution = PillarBounciness;
     btRigidBody* body = new btRigidBody(bodyCI);
     body->setUserPointer(m_pillar);
+    if ( m_continuousCollision )
+    {
+        EnableContinuousCollision(body);
+    }
 
     // Add the created body to the world
     m_dynamicsWorld->addRigidBody(body);
@@ -907,32 +2628,275 @@ void PhysicsStage::AddNewPillar(float x, float y, float z)
     m_pillarBodies.push_back(body);
 }
 
+int PhysicsStage::MaxPillars() const
+{
+    if ( m_numStressLevels > 0 )
+    {
+        // The largest stress level
+        int numRows = 0;
+        int numColumns = 0;
+        int numExtraBodies = 0;
+        GetStressLevelSize(m_numStressLevels - 1, numRows, numColumns,
+                           numExtraBodies);
+        return (numRows * numColumns) + numExtraBodies;
+    }
+
+    return NumPillarRows * NumPillarColumns;
+}
+
 void PhysicsStage::CreatePillars()
 {
-    // Create NumPillarRows x NumPillarColumns pillars
+    if ( m_numStressLevels > 0 )
+    {
+        // Start the stress test from its smallest level
+        m_stressResults.clear();
+        CreateStressLevel(0);
+    }
+    else
+    {
+        CreatePillarGrid(NumPillarRows, NumPillarColumns, PillarSpacing);
+    }
+}
+
+void PhysicsStage::CreatePillarGrid(int numRows, int numColumns,
+                                    float spacing)
+{
+    // Create numRows x numColumns pillars
     const float Xoffs = -58;
     const float Zoffs = -33;
     
     btVector3 extents = Pillar::GetExtents();
 
-    for ( int j = 0; j < NumPillarRows; j++ )
+    for ( int j = 0; j < numRows; j++ )
     {
-        for ( int i = 0; i < NumPillarColumns; i++ )
+        for ( int i = 0; i < numColumns; i++ )
         {
-            float x = (i - (NumPillarColumns / 2)) * PillarSpacing + Xoffs;
+            float x = (i - (numColumns / 2)) * spacing + Xoffs;
             float y = extents.getY();
-            float z = (j - (NumPillarRows / 2)) * PillarSpacing + Zoffs;
+            float z = (j - (numRows / 2)) * spacing + Zoffs;
             AddNewPillar(x, y, z);
         }
     }
 }
 
+void PhysicsStage::CreatePillarPile(int numPillars)
+{
+    // Lay the pillars across the walkway path in layers; every other
+    // layer is offset by half a spacing so that it settles into the gaps
+    // of the one below
+    btVector3 extents = Pillar::GetExtents();
+    float spacing = (2.0 * extents.getX()) + PillarPileGap;
+    int pillarsPerLayer = (int)((PillarPileEndZ - PillarPileStartZ) /
+                                spacing);
+
+    for ( int i = 0; i < numPillars; i++ )
+    {
+        int layer = i / pillarsPerLayer;
+        float offset = (layer % 2) * 0.5;
+        float y = extents.getX() + (layer * spacing) + PillarPileGap;
+        float z = PillarPileStartZ +
+                (((i % pillarsPerLayer) + offset) * spacing);
+        AddNewPillar(PillarPileX, y, z, true);
+    }
+}
+
+void PhysicsStage::GetStressLevelSize(int level, int& numRows,
+                                      int& numColumns,
+                                      int& numExtraBodies) const
+{
+    // The number of bodies grows linearly from level to level
+    float scale = sqrt((level + 1) / (float)m_numStressLevels);
+    numRows = std::max(1, (int)((m_stressRows * scale) + 0.5));
+    numColumns = std::max(1, (int)((m_stressColumns * scale) + 0.5));
+    numExtraBodies = (m_stressExtraBodies * (level + 1)) / m_numStressLevels;
+}
+
+void PhysicsStage::CreateStressLevel(int level)
+{
+    int numRows = 0;
+    int numColumns = 0;
+    int numExtraBodies = 0;
+    GetStressLevelSize(level, numRows, numColumns, numExtraBodies);
+
+    // Pack the grid into the walkway plaza as far as the pillars allow
+    float spacing = std::min(StressPlazaWidth / numColumns,
+                             StressPlazaDepth / numRows);
+    spacing = std::max(MinPillarSpacing, std::min(spacing, PillarSpacing));
+
+    // Replace the pillars of the previous level
+    DestroyBodies(m_pillarBodies);
+    m_pillarTransforms.clear();
+    m_pillarUniforms.clear();
+    CreatePillarGrid(numRows, numColumns, spacing);
+    CreatePillarPile(numExtraBodies);
+    m_tunnellingCenters.clear();
+
+    LOG_DEBUG("PhysicsStage: stress level %d: %d x %d pillars %.1f m apart, "
+              "%d extra", level, numRows, numColumns, spacing,
+              numExtraBodies);
+
+    // The pillars and the vehicle
+    m_stressLevel = level;
+    m_stressCounters = StressLevelResult();
+    m_stressCounters.m_numBodies = m_pillarBodies.size() + 1;
+}
+
+void PhysicsStage::FinishStressLevel()
+{
+    m_stressResults.push_back(m_stressCounters);
+    m_stressCounters = StressLevelResult();
+    m_stressCounters.m_numBodies = m_pillarBodies.size() + 1;
+}
+
+void PhysicsStage::NextStressLevel()
+{
+    // Rebuild the world with the physics thread stopped; the states it has
+    // published would not match the new set of bodies
+    bool threaded = m_physicsThreadRunning;
+    StopPhysicsThread();
+
+    FinishStressLevel();
+    CreateStressLevel(m_stressLevel + 1);
+    if ( m_restartable )
+    {
+        TakeInitialSnapshot();
+    }
+
+    // The rebuild is not simulated time
+    m_lastStepTime.tv_sec = 0;
+    m_lastStepTime.tv_usec = 0;
+
+    if ( threaded && !StartPhysicsThread() )
+    {
+        LOG_DEBUG("Threaded physics disabled.");
+        m_threadedPhysics = false;
+    }
+}
+
+void PhysicsStage::TakeInitialSnapshot()
+{
+    delete m_initialSnapshot;
+    m_initialSnapshot = PhysicsSnapshot::Create(m_dynamicsWorld);
+    if ( m_initialSnapshot == NULL )
+    {
+        LOG_DEBUG("PhysicsStage: initial physics snapshot failed!");
+    }
+}
+
+bool PhysicsStage::RestorePhysics(const PhysicsSnapshot& snapshot)
+{
+    if ( !snapshot.Restore(m_dynamicsWorld) )
+    {
+        LOG_DEBUG("PhysicsStage: physics restore failed!");
+        return false;
+    }
+
+    // The static bodies were re-added into the dynamic tree
+    if ( m_tunedBroadphase != NULL )
+    {
+        m_tunedBroadphase->FreezeStaticProxies();
+    }
+
+    // The world only resets the solver it was created with
+    for ( unsigned int i = 0; i < m_solvers.size(); i++ )
+    {
+        m_solvers[i]->reset();
+    }
+
+    // The vehicle is parked again; its wheels are not part of the snapshot
+    m_raycastVehicle->Reset(VehicleParkingBrake);
+
+    // Watch for the pillars colliding again; the bodies did not move
+    // through anything on their way back
+    m_detectPillarCollisions = true;
+    m_tunnellingCenters.clear();
+    m_dynamicsWorld->setInternalTickCallback(PhysicsStage::BulletTickCallback,
+                                             this);
+
+    // The restore is not simulated time
+    m_lastStepTime.tv_sec = 0;
+    m_lastStepTime.tv_usec = 0;
+
+    return true;
+}
+
+bool PhysicsStage::RestartPhysics()
+{
+    if ( m_initialSnapshot == NULL )
+    {
+        return false;
+    }
+
+    // Restore the world with the physics thread stopped; the states it has
+    // published would not match the restored bodies
+    bool threaded = m_physicsThreadRunning;
+    StopPhysicsThread();
+
+    bool restored = RestorePhysics(*m_initialSnapshot);
+
+    if ( threaded && !StartPhysicsThread() )
+    {
+        LOG_DEBUG("Threaded physics disabled.");
+        m_threadedPhysics = false;
+    }
+
+    return restored;
+}
+
+void PhysicsStage::CheckReplay()
+{
+    // Keep the steps out of the stress results
+    StressLevelResult stressCounters = m_stressCounters;
+
+    // Step the world from its initial state twice
+    PhysicsSnapshot* results[2] = { NULL, NULL };
+    for ( int i = 0; i < 2; i++ )
+    {
+        if ( (i > 0) && !RestorePhysics(*m_initialSnapshot) )
+        {
+            break;
+        }
+
+        for ( int step = 0; step < m_replayCheckSteps; step++ )
+        {
+            m_vehicleBody->activate();
+            m_dynamicsWorld->stepSimulation(m_physicsTimeStep, 1,
+                                            m_physicsTimeStep);
+        }
+        results[i] = PhysicsSnapshot::Create(m_dynamicsWorld);
+    }
+
+    if ( (results[0] == NULL) || (results[1] == NULL) )
+    {
+        LOG_DEBUG("PhysicsStage: replay check failed!");
+    }
+    else if ( results[0]->Checksum() == results[1]->Checksum() )
+    {
+        LOG_DEBUG("PhysicsStage: replay of %d steps matches, checksum %08x",
+                  m_replayCheckSteps, results[0]->Checksum());
+    }
+    else
+    {
+        LOG_DEBUG("PhysicsStage: replay of %d steps differs by up to %.6f m, "
+                  "checksums %08x / %08x", m_replayCheckSteps,
+                  results[0]->MaxDistance(*results[1]),
+                  results[0]->Checksum(), results[1]->Checksum());
+    }
+    delete results[0];
+    delete results[1];
+
+    // The stage starts from the initial state
+    RestorePhysics(*m_initialSnapshot);
+    m_stressCounters = stressCounters;
+}
+
 void PhysicsStage::CreateVehicle()
 {
     btVector3 extents = Vehicle::GetExtents();
     if ( m_vehicleShape == NULL )
     {
-        m_vehicleShape = new btBoxShape(extents);
+        // The hulls of the body and the wheels
+        m_vehicleShape = new VehicleShape(VehicleWheelHullLift);
     }
 
     // Initial position of the vehicle
@@ -940,14 +2904,16 @@ void PhysicsStage::CreateVehicle()
 
     // Create the motion state. It will reflect the given initial position
     // and orientation of the object
-    ObjectMotionState* motionState =
-            new ObjectMotionState(btTransform(btQuaternion(0.0, 0.0, 0.0, 1.0),
-                                              initialPos), m_vehicle);
+    void* motionStateMemory =
+            m_allocator->Allocate(sizeof(ObjectMotionState));
+    ObjectMotionState* motionState = new (motionStateMemory)
+            ObjectMotionState(btTransform(btQuaternion(0.0, 0.0, 0.0, 1.0),
+                                          initialPos), m_vehicle);
 
-    // Calculate inertia
+    // Calculate inertia from the vehicle's own shape
     btScalar mass = VehicleMass;
     btVector3 inertia(0, 0, 0);
-    m_pillarShape->calculateLocalInertia(mass, inertia);
+    m_vehicleShape->calculateLocalInertia(mass, inertia);
 
     // Construct the rigid body for this block
     btRigidBody::btRigidBodyConstructionInfo
@@ -959,9 +2925,43 @@ void PhysicsStage::CreateVehicle()
 
     m_vehicleBody = new btRigidBody(bodyCI);
     m_vehicleBody->setUserPointer(m_vehicle);
+    if ( m_continuousCollision )
+    {
+        EnableContinuousCollision(m_vehicleBody);
+    }
 
     // Add the created body to the world
     m_dynamicsWorld->addRigidBody(m_vehicleBody);
+
+    // Put the body on wheels; x is right, y is up and the vehicle faces
+    // towards negative z
+    btRaycastVehicle::btVehicleTuning tuning;
+    tuning.m_suspensionStiffness = VehicleSuspensionStiffness;
+    tuning.m_suspensionCompression = VehicleSuspensionCompression;
+    tuning.m_suspensionDamping = VehicleSuspensionDamping;
+    tuning.m_maxSuspensionTravelCm = VehicleSuspensionTravelCm;
+    tuning.m_frictionSlip = VehicleFrictionSlip;
+    m_vehicleRaycaster = new BatchedVehicleRaycaster(m_dynamicsWorld);
+    m_raycastVehicle = new RaycastVehicle(tuning, m_vehicleBody,
+                                          *m_vehicleRaycaster);
+    m_raycastVehicle->setCoordinateSystem(0, 1, 2);
+
+    btVector3 wheelDirection(0.0, -1.0, 0.0);
+    btVector3 wheelAxle(-1.0, 0.0, 0.0);
+    btScalar sag = -DefaultGravity.getY() / (4 * VehicleSuspensionStiffness);
+    btVector3 mount(0.0, VehicleSuspensionRestLength - sag, 0.0);
+    for ( int i = 0; i < NumVehicleWheels; i++ )
+    {
+        VehicleWheel wheel = (VehicleWheel)i;
+        bool front = (wheel == FrontRightWheel) || (wheel == FrontLeftWheel);
+        btWheelInfo& wheelInfo = m_raycastVehicle->addWheel(
+                Vehicle::GetWheelPosition(wheel) + mount, wheelDirection,
+                wheelAxle, VehicleSuspensionRestLength,
+                Vehicle::GetWheelRadius(wheel), tuning, front);
+        wheelInfo.m_rollInfluence = VehicleRollInfluence;
+    }
+    m_raycastVehicle->Reset(VehicleParkingBrake);
+    m_dynamicsWorld->addAction(m_raycastVehicle);
 }
 
 void PhysicsStage::BulletTickCallback(btDynamicsWorld* world,
@@ -969,9 +2969,36 @@ void PhysicsStage::BulletTickCallback(btDynamicsWorld* world,
 {
     // NOTE this is executed in the physics thread
 
-    PhysicsStage* stage =
-            reinterpret_cast<PhysicsStage*>(world->getWorldUserInfo());
-    int numManifolds = world->getDispatcher()->getNumManifolds();
+    PhysicsStage* stage =
+            reinterpret_cast<PhysicsStage*>(world->getWorldUserInfo());
+    int numManifolds = world->getDispatcher()->getNumManifolds();
+
+    if ( stage->m_stressLevel >= 0 )
+    {
+        // Count the step, its contact points and broadphase pairs for the
+        // stress results
+        stage->m_stressCounters.m_numSteps++;
+        stage->m_stressCounters.m_numPairs +=
+                world->getBroadphase()->getOverlappingPairCache()->
+                getNumOverlappingPairs();
+        for ( int i = 0; i < numManifolds; i++ )
+        {
+            stage->m_stressCounters.m_numContacts +=
+                    world->getDispatcher()->getManifoldByIndexInternal(i)->
+                    getNumContacts();
+        }
+    }
+
+    if ( stage->m_checkTunnelling )
+    {
+        stage->CheckTunnelling(world);
+    }
+
+    if ( !stage->m_detectPillarCollisions )
+    {
+        return;
+    }
+
     for ( int i = 0; i < numManifolds; i++ )
     {
         btPersistentManifold* contactManifold =
@@ -982,35 +3009,248 @@ void PhysicsStage::BulletTickCallback(btDynamicsWorld* world,
                 static_cast<btCollisionObject*>(contactManifold->getBody1());
 
         // Detect a collision between two pillars; when this happens,
-        // set normal gravity to the vehicle and stop listening to callbacks
+        // let the vehicle coast and stop listening to callbacks unless the
+        // stress mode or the tunnelling check still needs them
         if ( (objA->getUserPointer() == stage->m_pillar) &&
              (objB->getUserPointer() == stage->m_pillar) )
         {
-            stage->m_wheelRotationAnimation->SetRotationSpeed(0.2 * M_PI);
-            stage->m_vehicleBody->setGravity(DefaultGravity);
-            world->setInternalTickCallback(NULL);
+            stage->m_raycastVehicle->Coast();
+            stage->m_detectPillarCollisions = false;
+            if ( (stage->m_stressLevel < 0) && !stage->m_checkTunnelling )
+            {
+                world->setInternalTickCallback(NULL);
+            }
             break;
         }
     }
 }
 
+void PhysicsStage::CheckTunnelling(btDynamicsWorld* world)
+{
+    double startTime = CurrentTime();
+
+    // The centers are taken again after the bodies have been replaced or
+    // moved outside the steps
+    int numBodies = m_pillarBodies.size() + 1;
+    bool haveCenters = (m_tunnellingCenters.size() == numBodies);
+    m_tunnellingCenters.resize(numBodies);
+
+    for ( int i = 0; i < numBodies; i++ )
+    {
+        btRigidBody* body = (i < numBodies - 1) ?
+                m_pillarBodies[i] : m_vehicleBody;
+        btVector3 center = body->getCenterOfMassPosition();
+        btVector3 previousCenter = m_tunnellingCenters[i];
+        m_tunnellingCenters[i] = center;
+        if ( !haveCenters || !body->isActive() ||
+             (center.distance2(previousCenter) <
+              TunnellingCheckMinMotion * TunnellingCheckMinMotion) )
+        {
+            continue;
+        }
+
+        // A center going through the surface of another object means that
+        // the body passed through it, or far enough into it to be pushed
+        // out the other side
+        TunnellingRayCallback callback(body, previousCenter, center);
+        world->rayTest(previousCenter, center, callback);
+        if ( callback.hasHit() )
+        {
+            if ( body == m_vehicleBody )
+            {
+                m_numVehicleTunnellings++;
+            }
+            else
+            {
+                m_numPillarTunnellings++;
+            }
+        }
+    }
+
+    m_tunnellingCheckTime += (CurrentTime() - startTime) * 1000.0;
+}
+
 void PhysicsStage::SetupPhysicsEngine()
 {
     // create the engine resources
-    m_broadphase = new btDbvtBroadphase();
-    m_collisionConfiguration = new btDefaultCollisionConfiguration();
-    m_dispatcher = new btCollisionDispatcher(m_collisionConfiguration);
-    m_solver = new btSequentialImpulseConstraintSolver();
+    m_broadphase = CreateBroadphase();
+    if ( m_physicsStepsPerSecond > 0 )
+    {
+        m_physicsTimeStep = btScalar(1.0) / btScalar(m_physicsStepsPerSecond);
+    }
+    else
+    {
+        LOG_DEBUG("PhysicsStage: invalid physics step rate %d, using 60",
+                  m_physicsStepsPerSecond);
+        m_physicsStepsPerSecond = 60;
+        m_physicsTimeStep = btScalar(1.0) / btScalar(60.0);
+    }
+
+    // Size the manifold and collision algorithm pools for the largest set
+    // of pillars and the vehicle, so a pile of them does not overflow
+    // them in the middle of a step
+    int maxDynamicBodies = MaxPillars() + 1;
+    btDefaultCollisionConstructionInfo constructionInfo;
+    constructionInfo.m_defaultMaxPersistentManifoldPoolSize =
+            std::max(maxDynamicBodies * ManifoldsPerDynamicBody,
+                     MinCollisionPoolSize);
+    constructionInfo.m_defaultMaxCollisionAlgorithmPoolSize =
+            std::max(maxDynamicBodies * AlgorithmsPerDynamicBody,
+                     MinCollisionPoolSize);
+    LOG_DEBUG("PhysicsStage: pools for %d manifolds and %d collision "
+              "algorithms",
+              constructionInfo.m_defaultMaxPersistentManifoldPoolSize,
+              constructionInfo.m_defaultMaxCollisionAlgorithmPoolSize);
+    m_collisionConfiguration =
+            new btDefaultCollisionConfiguration(constructionInfo);
+
+    if ( m_collisionThreads > 0 )
+    {
+        // Process the colliding pairs in parallel
+        m_parallelDispatcher =
+                ParallelCollisionDispatcher::Create(m_collisionConfiguration,
+                                                    m_collisionThreads);
+        if ( m_parallelDispatcher != NULL )
+        {
+            if ( m_measureCollisionScaling )
+            {
+                m_parallelDispatcher->SetActiveThreads(1, true);
+            }
+            m_dispatcher = m_parallelDispatcher;
+        }
+        else
+        {
+            LOG_DEBUG("Parallel collision dispatch disabled.");
+        }
+    }
+    if ( m_dispatcher == NULL )
+    {
+        m_dispatcher = new PooledCollisionDispatcher(m_collisionConfiguration);
+    }
+
+    if ( m_benchmarkRowKernels &&
+         !SimdConstraintSolver::BenchmarkRowKernels(4096, 100) )
+    {
+        LOG_DEBUG("PhysicsStage: SIMD constraint rows differ from the "
+                  "generic ones!");
+    }
+
+    // One constraint solver for each solver thread
+    int numSolvers = std::max(m_solverThreads, 1);
+    for ( int i = 0; i < numSolvers; i++ )
+    {
+        SimdConstraintSolver* solver = new SimdConstraintSolver();
+        if ( !solver->SetRowKernels(m_rowKernels) )
+        {
+            LOG_DEBUG("PhysicsStage: %s constraint rows not available",
+                      SimdConstraintSolver::RowKernelsName(m_rowKernels));
+        }
+        m_solvers.push_back(solver);
+    }
+    LOG_DEBUG("PhysicsStage: using %s constraint rows",
+              SimdConstraintSolver::RowKernelsName(
+                  m_solvers[0]->ActiveRowKernels()));
 
     // create the 'world' and apply gravity
-    m_dynamicsWorld = new btDiscreteDynamicsWorld(m_dispatcher, m_broadphase,
-                                                  m_solver,
-                                                  m_collisionConfiguration);
+    if ( m_solverThreads > 0 )
+    {
+        // Solve the simulation islands in parallel
+        std::vector<btConstraintSolver*> solvers(m_solvers.begin(),
+                                                 m_solvers.end());
+        m_parallelWorld =
+                ParallelDynamicsWorld::Create(m_dispatcher, m_broadphase,
+                                              &solvers[0],
+                                              m_collisionConfiguration,
+                                              m_solverThreads);
+        if ( m_parallelWorld != NULL )
+        {
+            m_dynamicsWorld = m_parallelWorld;
+        }
+        else
+        {
+            LOG_DEBUG("Parallel constraint solving disabled.");
+        }
+    }
+    if ( m_dynamicsWorld == NULL )
+    {
+        m_dynamicsWorld = new ContinuousDynamicsWorld(m_dispatcher,
+                                                      m_broadphase,
+                                                      m_solvers[0],
+                                                      m_collisionConfiguration);
+    }
     m_dynamicsWorld->setGravity(DefaultGravity);
+    if ( m_tunedBroadphase != NULL )
+    {
+        // Leave the static bodies alone in the fixed tree; only the active
+        // bodies get their AABBs updated
+        m_dynamicsWorld->setForceUpdateAllAabbs(false);
+    }
+    m_detectPillarCollisions = true;
     m_dynamicsWorld->setInternalTickCallback(PhysicsStage::BulletTickCallback,
                                              this);
 }
 
+btBroadphaseInterface* PhysicsStage::CreateBroadphase()
+{
+    if ( m_broadphaseType == PhysicsBroadphaseStaticDbvt )
+    {
+        m_tunedBroadphase = new TunedDbvtBroadphase(m_broadphaseTuning);
+        return m_tunedBroadphase;
+    }
+
+    if ( m_broadphaseType == PhysicsBroadphaseAxisSweep )
+    {
+        // Sweep over the static bodies; the bodies outside the bounds are
+        // clamped to them and only overlap more than they should
+        btVector3 worldMin(BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT);
+        btVector3 worldMax(-BT_LARGE_FLOAT, -BT_LARGE_FLOAT, -BT_LARGE_FLOAT);
+        SceneInstanceStore* statics[] = {
+            &m_terrains, &m_wallCorners, &m_wallSegments
+        };
+        int numStaticBodies = 0;
+        for ( unsigned int i = 0; i < sizeof(statics) / sizeof(statics[0]);
+              i++ )
+        {
+            for ( int j = 0; j < statics[i]->Count(); j++ )
+            {
+                btRigidBody* body = statics[i]->GetBody(j);
+                if ( body != NULL )
+                {
+                    btVector3 aabbMin;
+                    btVector3 aabbMax;
+                    body->getAabb(aabbMin, aabbMax);
+                    worldMin.setMin(aabbMin);
+                    worldMax.setMax(aabbMax);
+                    numStaticBodies++;
+                }
+            }
+        }
+
+        if ( numStaticBodies > 0 )
+        {
+            worldMax.setY(worldMax.y() + AxisSweepHeadroom);
+
+            // One handle for each pillar, the vehicle and the statics
+            int maxHandles = MaxPillars() + 1 + numStaticBodies;
+            LOG_DEBUG("PhysicsStage: axis sweep broadphase of %d handles "
+                      "over (%.0f, %.0f, %.0f) .. (%.0f, %.0f, %.0f)",
+                      maxHandles, worldMin.x(), worldMin.y(), worldMin.z(),
+                      worldMax.x(), worldMax.y(), worldMax.z());
+            if ( maxHandles < AxisSweepMaxHandles )
+            {
+                return new btAxisSweep3(worldMin, worldMax, maxHandles);
+            }
+            return new bt32BitAxisSweep3(worldMin, worldMax, maxHandles);
+        }
+
+        LOG_DEBUG("PhysicsStage: no static bodies to bound the axis sweep "
+                  "broadphase");
+        m_broadphaseType = PhysicsBroadphaseDbvt;
+    }
+
+    return new btDbvtBroadphase();
+}
+
 void PhysicsStage::SetupLensFlares()
 {
     // Calculate the lens flare size from the screen height so it will
@@ -1066,29 +3306,25 @@ void PhysicsStage::AddTransAnim(const float* initialPtr,
 
 void PhysicsStage::TimerCallback(SimpleTimer* timer, int timerId)
 {
-    // TODO: be sure not to execute these while physics thread is going on
-
     PhysicsStage* stage = reinterpret_cast<PhysicsStage*>(timer->GetUserData());
 
     switch ( timerId )
     {
         case VehicleStartTimer:
-        {
-            // Start moving vehicle slowly; set zero friction and apply velocity
+            // Release the brakes and start cruising towards the pillars
             LOG_DEBUG("start vehicle");
-            stage->m_vehicleBody->setFriction(0);
-            btVector3 velocity(0, 0, -5.5);
-            stage->m_vehicleBody->setLinearVelocity(velocity);
-            
-            stage->m_wheelRotationAnimation->SetRotationSpeed(1.2 * M_PI);
+            pthread_mutex_lock(&stage->m_physicsMutex);
+            stage->m_raycastVehicle->Drive(VehicleCruiseSpeed,
+                                           VehicleCruiseAcceleration);
+            pthread_mutex_unlock(&stage->m_physicsMutex);
             break;
-        }
         case VehicleAccelerateTimer:
-            // Start accelerating the vehicle towards the pillars; restore
-            // friction and apply sideways gravity
+            // Step on it for the run-up into the pillars
             LOG_DEBUG("accelerate vehicle");
-            stage->m_vehicleBody->setFriction(VehicleFriction);
-            stage->m_vehicleBody->setGravity(btVector3(0.0, -0.0, -5.0));
+            pthread_mutex_lock(&stage->m_physicsMutex);
+            stage->m_raycastVehicle->Drive(VehicleRunUpSpeed,
+                                           VehicleRunUpAcceleration);
+            pthread_mutex_unlock(&stage->m_physicsMutex);
             break;
         case SetSmallestFarClipTimer:
             LOG_DEBUG("Setting shortest frustum");
@@ -1107,6 +3343,9 @@ void PhysicsStage::TimerCallback(SimpleTimer* timer, int timerId)
             stage->m_farClip = 250.0;
             stage->RecalculateProjection();
             break;
+        case StressLevelTimer:
+            stage->NextStressLevel();
+            break;
 //        case SetLargeFarClipTimer:
 //            LOG_DEBUG("Setting large frustum");
 //            stage->m_nearClip = PhysicsStageNearClip;
@@ -1199,17 +3438,69 @@ void PhysicsStage::SetupAnimations()
 //                                           SetLargeFarClipTimer,
 //                                           false, PhysicsStage::TimerCallback));
 
-    // Vehicle wheel rotation
-    m_wheelRotationAnimation = new RotationAnimation(0, 0, &m_wheelRotation);
-    m_animations.push_back(m_wheelRotationAnimation);
+    // Stress mode levels, evenly over the stage
+    for ( int i = 1; i < m_numStressLevels; i++ )
+    {
+        float levelStart = (StageDuration * i) / m_numStressLevels;
+        m_animations.push_back(new SimpleTimer(0, levelStart, this,
+                                               StressLevelTimer, false,
+                                               PhysicsStage::TimerCallback));
+    }
+}
+
+ShadowQuality PhysicsStage::SelectShadowQuality()
+{
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    if ( maxTextureSize < 2048 )
+    {
+        return ShadowQualityLow;
+    }
+
+#ifdef __BUILD_DESKTOP__
+    return ShadowQualityHigh;
+#else
+    return ShadowQualityMedium;
+#endif
 }
 
 bool PhysicsStage::SetupShadowMapping()
 {
+    ShadowQuality quality = m_shadowQuality;
+    if ( quality == ShadowQualityAuto )
+    {
+        quality = SelectShadowQuality();
+    }
+    m_numCascades = ShadowQualities[quality].m_numCascades;
+    m_cascadeSize = ShadowQualities[quality].m_cascadeSize;
+
+    // Lay the cascades out in a grid of tiles; shrink the tiles if the
+    // shadow map would not fit in a texture
+    int columns = std::min(m_numCascades, ShadowMapColumns);
+    int rows = (m_numCascades + ShadowMapColumns - 1) / ShadowMapColumns;
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    while ( (std::max(columns, rows) * m_cascadeSize) > maxTextureSize )
+    {
+        m_cascadeSize /= 2;
+    }
+    m_shadowMapWidth = columns * m_cascadeSize;
+    m_shadowMapHeight = rows * m_cascadeSize;
+    for ( int i = 0; i < m_numCascades; i++ )
+    {
+        m_cascades[i].m_viewportX = (i % ShadowMapColumns) * m_cascadeSize;
+        m_cascades[i].m_viewportY = (i / ShadowMapColumns) * m_cascadeSize;
+        m_cascades[i].m_totalDraws = 0;
+    }
+
+    LOG_DEBUG("PhysicsStage: shadow quality %d, %d cascades of %dx%d",
+              quality, m_numCascades, m_cascadeSize, m_cascadeSize);
+
     m_shadowMapping = CreateDepthTextureAndFBO(&m_shadowMapFBO,
                                                &m_shadowMapTexture,
                                                &m_shadowMapDepthRenderBuffer,
-                                               ShadowMapSize, ShadowMapSize,
+                                               m_shadowMapWidth,
+                                               m_shadowMapHeight,
                                                false);
     
     // Go back to using the default frame buffer
@@ -1235,23 +3526,141 @@ bool PhysicsStage::SetupShadowMapping()
             glGetUniformLocation(m_shadowMapTransparentProgram, "mvp_matrix");
     m_shadowMapTransparentTextureLoc =
             glGetUniformLocation(m_shadowMapTransparentProgram, "texture");
+    glUseProgram(m_shadowMapTransparentProgram);
+    glUniform1i(m_shadowMapTransparentTextureLoc, 0);
 
-    // Setup light's projection matrix to match the shadow map dimensions
-    float lightProjection[16];
-    MatrixPerspectiveProjection(lightProjection, 8.5,
-                                (float)(ShadowMapSize)/(float)ShadowMapSize,
-                                760.0f, 870.0f);//TODO adjust z-range more?
+    // Setup light orientation (view) matrix; the sun is far enough to be
+    // treated as a directional light, so each cascade only adds its own
+    // orthographic projection
+    MatrixSetLookat(m_lightViewMatrix, SunWorldPosition, LightTarget);
 
-    const float lightTarget[3] = { -60, 0, 0 };
+    return true;
+}
 
-    // Setup light orientation (view) matrix
-    float lookat[16];
-    MatrixSetLookat(lookat, SunWorldPosition, lightTarget);
+bool PhysicsStage::SetupSunQueries()
+{
+    if ( !OcclusionQueriesSupported() )
+    {
+        return false;
+    }
+
+    // Quads for the sun samples, centered around the origin
+    std::vector<float> vertices;
+    float halfGrid = (SunSampleGridSize - 1) * 0.5;
+    float halfSize = SunSampleSize * 0.5;
+    for ( int y = 0; y < SunSampleGridSize; y++ )
+    {
+        for ( int x = 0; x < SunSampleGridSize; x++ )
+        {
+            float left = ((x - halfGrid) * SunSampleSpacing) - halfSize;
+            float bottom = ((y - halfGrid) * SunSampleSpacing) - halfSize;
+            float right = left + SunSampleSize;
+            float top = bottom + SunSampleSize;
+            const float quad[18] = {
+                left, bottom, 0.0,   right, bottom, 0.0,   right, top, 0.0,
+                left, bottom, 0.0,   right, top, 0.0,   left, top, 0.0
+            };
+            vertices.insert(vertices.end(), quad, quad + 18);
+        }
+    }
 
-    // Setup light matrix (view * projection)
-    MatrixMultiply(lookat, lightProjection, m_lightMatrix);
+    glGenBuffers(1, &m_sunSampleVertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_sunSampleVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float),
+                 &vertices[0], GL_STATIC_DRAW);
 
-    return true;
+    m_sunQueries.resize(SunQueryLatency * NumSunSamples);
+    GenQueries(m_sunQueries.size(), &m_sunQueries[0]);
+    m_oldestSunQuerySet = 0;
+    m_numPendingSunQuerySets = 0;
+
+    return (glGetError() == GL_NO_ERROR);
+}
+
+void PhysicsStage::TeardownSunQueries()
+{
+    if ( !m_sunQueries.empty() )
+    {
+        DeleteQueries(m_sunQueries.size(), &m_sunQueries[0]);
+        m_sunQueries.clear();
+    }
+    m_numPendingSunQuerySets = 0;
+
+    glDeleteBuffers(1, &m_sunSampleVertexBuffer);
+    m_sunSampleVertexBuffer = 0;
+}
+
+bool PhysicsStage::SetupInstancing()
+{
+    if ( !InstancingSupported() )
+    {
+        return false;
+    }
+
+    if ( !LoadShaderFromBundle("PhysicsStageDefaultInstanced",
+                               &m_defaultInstancedProgram) )
+    {
+        return false;
+    }
+    m_defaultInstancedVpLoc =
+            glGetUniformLocation(m_defaultInstancedProgram, "vp_matrix");
+    m_defaultInstancedTextureLoc =
+            glGetUniformLocation(m_defaultInstancedProgram, "texture");
+    m_defaultInstancedLightPosLoc =
+            glGetUniformLocation(m_defaultInstancedProgram, "light_pos");
+    m_defaultInstancedShadowTextureLoc =
+            glGetUniformLocation(m_defaultInstancedProgram, "shadow_texture");
+    m_defaultInstancedShadowMatrixLoc =
+            glGetUniformLocation(m_defaultInstancedProgram, "shadow_matrix");
+    GetCascadeUniformLocations(m_defaultInstancedProgram,
+                               m_defaultInstancedCascadeLocs);
+    m_defaultInstancedModelMatrixLoc =
+            glGetAttribLocation(m_defaultInstancedProgram, "in_modelMatrix");
+    if ( m_defaultInstancedModelMatrixLoc < 0 )
+    {
+        return false;
+    }
+
+    // Lighting is done in world space, so these never change
+    glUseProgram(m_defaultInstancedProgram);
+    glUniform1i(m_defaultInstancedTextureLoc, 0);
+    glUniform1i(m_defaultInstancedShadowTextureLoc, 1);
+    glUniform3fv(m_defaultInstancedLightPosLoc, 1, SunWorldPosition);
+
+    if ( m_shadowMapping )
+    {
+        if ( !LoadShaderFromBundle("ShadowMapInstanced",
+                                   &m_shadowMapInstancedProgram) )
+        {
+            return false;
+        }
+        m_shadowMapInstancedVpLoc =
+                glGetUniformLocation(m_shadowMapInstancedProgram, "vp_matrix");
+        m_shadowMapInstancedModelMatrixLoc =
+                glGetAttribLocation(m_shadowMapInstancedProgram,
+                                    "in_modelMatrix");
+        if ( m_shadowMapInstancedModelMatrixLoc < 0 )
+        {
+            return false;
+        }
+    }
+
+    // Room for the visible pillars of each shadow cascade and the camera
+    m_pillarInstances = InstanceBuffer::Create((MaxShadowCascades + 1) *
+                                               MaxPillars());
+
+    return (m_pillarInstances != NULL);
+}
+
+void PhysicsStage::TeardownInstancing()
+{
+    delete m_pillarInstances;
+    m_pillarInstances = NULL;
+
+    UnloadShader(m_defaultInstancedProgram);
+    m_defaultInstancedProgram = 0;
+    UnloadShader(m_shadowMapInstancedProgram);
+    m_shadowMapInstancedProgram = 0;
 }
 
 bool PhysicsStage::ViewportResized(int viewportWidth, int viewportHeight)
@@ -1286,10 +3695,20 @@ bool PhysicsStage::SetupImpl()
 //    m_cameraTarget[1] = 0.0;
 //    m_cameraTarget[2] = 0.0;
 
+    m_totalCameraCulled = 0;
+    m_totalLightCulled = 0;
+    m_totalTerrainIndices = 0;
+    m_totalDrawItems = 0;
+    m_totalStateChanges = 0;
+    m_totalRedundantStateChanges = 0;
+    m_totalObjectUniformUpdates = 0;
+
     // Initialize shadow mapping
     if ( !SetupShadowMapping() )
     {
         LOG_DEBUG("Shadow mapping disabled.");
+        m_shadowMapping = false;
+        m_numCascades = 0;
     }
 
     if ( !Load2DTextureFromBundle("white_marble.jpg", &m_pillarTexture,
@@ -1391,6 +3810,7 @@ bool PhysicsStage::SetupImpl()
             glGetUniformLocation(m_defaultProgram, "shadow_texture");
     m_defaultShadowMatrixLoc =
             glGetUniformLocation(m_defaultProgram, "shadow_matrix");
+    GetCascadeUniformLocations(m_defaultProgram, m_defaultCascadeLocs);
     m_skyboxMvpLoc = glGetUniformLocation(m_skyboxProgram, "mvp_matrix");
     m_skyboxTextureLoc = glGetUniformLocation(m_skyboxProgram, "skybox");
     m_terrainMvpLoc = glGetUniformLocation(m_terrainProgram, "mvp_matrix");
@@ -1401,6 +3821,7 @@ bool PhysicsStage::SetupImpl()
                                                      "shadow_texture");
     m_terrainShadowMatrixLoc = glGetUniformLocation(m_terrainProgram,
                                                      "shadow_matrix");
+    GetCascadeUniformLocations(m_terrainProgram, m_terrainCascadeLocs);
     m_vehicleMvpLoc = glGetUniformLocation(m_vehicleProgram, "mvp_matrix");
     m_vehicleTextureLoc = glGetUniformLocation(m_vehicleProgram, "texture");
     m_vehicleNormalmapLoc = glGetUniformLocation(m_vehicleProgram, "normalMap");
@@ -1410,23 +3831,44 @@ bool PhysicsStage::SetupImpl()
             glGetUniformLocation(m_vehicleProgram, "shadow_texture");
     m_vehicleShadowMatrixLoc =
             glGetUniformLocation(m_vehicleProgram, "shadow_matrix");
+    GetCascadeUniformLocations(m_vehicleProgram, m_vehicleCascadeLocs);
     m_vehicleShininessLoc = glGetUniformLocation(m_vehicleProgram, "shininess");
     m_vehicleSpecularColorLoc =
             glGetUniformLocation(m_vehicleProgram, "specularColor");
 
-    // Create objects
-    m_statics = PhysicsStageStatics::Create();
-    m_pillar = Pillar::Create();
-    m_skybox = Skybox::Create(15.0);
-    m_vehicle = Vehicle::Create();
+    // The sampler texture units never change; set them once
+    glUseProgram(m_defaultProgram);
+    glUniform1i(m_defaultTextureLoc, 0);
+    glUniform1i(m_defaultShadowTextureLoc, 1);
+    glUseProgram(m_skyboxProgram);
+    glUniform1i(m_skyboxTextureLoc, 0);
+    glUseProgram(m_terrainProgram);
+    glUniform1i(m_terrainTextureLoc, 0);
+    glUniform1i(m_terrainTexture2Loc, 1);
+    glUniform1i(m_terrainShadowTextureLoc, 2);
+    glUseProgram(m_vehicleProgram);
+    glUniform1i(m_vehicleTextureLoc, 0);
+    glUniform1i(m_vehicleNormalmapLoc, 1);
+    glUniform1i(m_vehicleShadowTextureLoc, 2);
 
-    if ( (m_statics == NULL) || (m_pillar == NULL) || (m_skybox == NULL) ||
-         (m_vehicle == NULL) )
+    m_skybox = Skybox::Create(15.0);
+    if ( m_skybox == NULL )
     {
         LOG_DEBUG("PhysicsStage::Setup(): Object initialization failed!");
         return false;
     }
 
+    // Put the world kept from the previous run back into its initial
+    // state, or build it if there is none
+    if ( (m_dynamicsWorld != NULL) && !RestartPhysics() )
+    {
+        TeardownPhysics();
+    }
+    if ( (m_dynamicsWorld == NULL) && !SetupPhysics() )
+    {
+        return false;
+    }
+
     int glError = glGetError();
     if ( glError != GL_NO_ERROR )
     {
@@ -1434,12 +3876,82 @@ bool PhysicsStage::SetupImpl()
         return false;
     }
 
-    // Set up the physics
-    SetupPhysicsEngine();
+    // Draw the pillars with one instanced draw call per pass if possible
+    if ( !SetupInstancing() )
+    {
+        LOG_DEBUG("Instanced rendering disabled.");
+        TeardownInstancing();
+    }
+
+    // Measure the sun visibility asynchronously if possible
+    if ( !SetupSunQueries() )
+    {
+        LOG_DEBUG("Sun occlusion queries disabled.");
+        TeardownSunQueries();
+    }
+
+    // Setup animations
+    SetupAnimations();
+
+    // Only profile the steps taken while the stage runs
+    ResetPhysicsProfile();
+
+    // Sample the awake pillars from the first frame on
+    m_activitySamples.clear();
+    m_activityStartTime = 0.0;
+    m_activityIntervalStart = 0.0;
+    m_activityIntervalFrames = 0;
+    m_activityIntervalBodies = 0.0;
+    m_totalActiveBodies = 0.0;
+
+    // Step the physics on its own thread if requested
+    if ( m_threadedPhysics && !StartPhysicsThread() )
+    {
+        LOG_DEBUG("Threaded physics disabled.");
+        m_threadedPhysics = false;
+    }
+
+    // Make sure we have blending turned on
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBlendColor(1.0, 1.0, 1.0, LensFlareAlpha);
+
+    // Set LEQUAL depth func to be able to draw the walkway on top of terrain
+    glDepthFunc(GL_LEQUAL);
+
+    return true;
+}
+
+bool PhysicsStage::SetupPhysics()
+{
+    // Bullet allocates from the stage's own arena from here on
+    m_allocator = PhysicsAllocator::Create(PhysicsArenaChunkSize);
+    if ( m_allocator == NULL )
+    {
+        LOG_DEBUG("PhysicsStage::Setup(): Allocator initialization failed!");
+        return false;
+    }
+    m_allocator->Install();
+
+    // Create objects; the bodies point to their renderable objects, so
+    // these are kept with the world
+    m_statics = PhysicsStageStatics::Create();
+    m_pillar = Pillar::Create();
+    m_vehicle = Vehicle::Create();
+
+    if ( (m_statics == NULL) || (m_pillar == NULL) || (m_vehicle == NULL) )
+    {
+        LOG_DEBUG("PhysicsStage::Setup(): Object initialization failed!");
+        return false;
+    }
 
-    // Create all static bodies & collision shapes
+    // Create all static bodies & collision shapes; the broadphase may be
+    // fitted to them
     m_statics->CreateObjects(m_terrains, m_wallCorners, m_wallSegments, 
                              m_trees);
+
+    // Set up the physics
+    SetupPhysicsEngine();
     AddBodies(m_terrains);
     AddBodies(m_wallCorners);
     AddBodies(m_wallSegments);
@@ -1450,27 +3962,40 @@ bool PhysicsStage::SetupImpl()
     // Create the vehicle
     CreateVehicle();
 
-    // Setup animations
-    SetupAnimations();
+    // The static bodies are all in; move them into the fixed tree
+    if ( m_tunedBroadphase != NULL )
+    {
+        m_tunedBroadphase->FreezeStaticProxies();
+    }
 
-    // Make sure we have blending turned on
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glBlendColor(1.0, 1.0, 1.0, 0.3);
+    // Set up the scene query workload if requested
+    SetupSceneQueries();
 
-    // Set LEQUAL depth func to be able to draw the walkway on top of terrain
-    glDepthFunc(GL_LEQUAL);
+    // Keep the state of the bodies for restarting the physics or checking
+    // the replay, if requested
+    if ( m_restartable || (m_replayCheckSteps > 0) )
+    {
+        TakeInitialSnapshot();
+    }
+    if ( (m_replayCheckSteps > 0) && (m_initialSnapshot != NULL) )
+    {
+        CheckReplay();
+    }
+    if ( !m_restartable )
+    {
+        delete m_initialSnapshot;
+        m_initialSnapshot = NULL;
+    }
 
     return true;
 }
 
-void PhysicsStage::AddBodies(std::list<ObjectInstance*>& objects)
+void PhysicsStage::AddBodies(SceneInstanceStore& objects)
 {
-    for ( std::list<ObjectInstance*>::iterator iter = objects.begin();
-         iter != objects.end(); iter++ )
+    for ( int i = 0; i < objects.Count(); i++ )
     {
-        btRigidBody* body = (*iter)->GetBody();
-        if ( body != NULL ) 
+        btRigidBody* body = objects.GetBody(i);
+        if ( body != NULL )
         {
             m_dynamicsWorld->addRigidBody(body);
         }
@@ -1483,34 +4008,34 @@ void PhysicsStage::DestroyBodies(std::vector<btRigidBody*>& bodies)
     {
         btRigidBody* body = bodies[i];
         m_dynamicsWorld->removeRigidBody(body);
-        delete body->getMotionState();
+        m_allocator->Delete(body->getMotionState());
         delete body;
     }
     bodies.clear();
 }
 
-void PhysicsStage::DestroyObjects(std::list<ObjectInstance*>& objects)
+void PhysicsStage::DestroyObjects(SceneInstanceStore& objects)
 {
-    for (std::list<ObjectInstance*>::iterator iter = objects.begin();
-         iter != objects.end(); iter++)
+    for ( int i = 0; i < objects.Count(); i++ )
     {
-        btRigidBody* body = (*iter)->GetBody();
-        if ( body != NULL ) 
+        btRigidBody* body = objects.GetBody(i);
+        if ( body != NULL )
         {
             m_dynamicsWorld->removeRigidBody(body);
             delete body->getMotionState();
             delete body;
         }
-        delete (*iter);
-        iter = objects.erase(iter);
     }
-    objects.clear();
+    objects.Clear();
 }
 
 void PhysicsStage::TeardownImpl()
 {
     LOG_DEBUG("PhysicsStage::Teardown()");
 
+    // The physics thread must be stopped before the world is destroyed
+    StopPhysicsThread();
+
     // Restore default depth func
     glDepthFunc(GL_LESS);
 
@@ -1533,19 +4058,58 @@ void PhysicsStage::TeardownImpl()
     UnloadShader(m_shadowMapTransparentProgram);
     UnloadShader(m_vehicleProgram);
 
+    TeardownInstancing();
+    TeardownSunQueries();
+
     glDeleteFramebuffers(1, &m_shadowMapFBO);
     glDeleteTextures(1, &m_shadowMapTexture);
     glDeleteRenderbuffers(1, &m_shadowMapDepthRenderBuffer);
 
     m_lensFlares.clear();
-    m_sunVisible = false;
+    m_sunOnScreen = false;
+    m_sunVisibility = 0.0;
+    m_sunVisibilityTarget = 0.0;
     delete m_lastSunVisibilityTestTime;
     m_lastSunVisibilityTestTime = NULL;
 
     m_lastStepTime.tv_sec = 0;
     m_lastStepTime.tv_usec = 0;
 
+    m_pillarTransforms.clear();
+    m_pillarUniforms.clear();
+    m_stressResults.clear();
+    m_wallCornerUniforms.clear();
+    m_wallSegmentUniforms.clear();
+    m_treeUniforms.clear();
+    m_walkwayUniforms.m_valid = false;
+
+    while ( !m_animations.empty() )
+    {
+        delete m_animations.front();
+        m_animations.pop_front();
+    }
+
+    delete m_skybox;
+    m_skybox = NULL;
+
+    // Keep the world of a restartable stage for the next run; it is put
+    // back into its initial state instead of being rebuilt. The stress
+    // levels change the bodies, so their world is not kept
+    if ( (m_initialSnapshot == NULL) || (m_numStressLevels > 0) )
+    {
+        TeardownPhysics();
+    }
+    
+    LOG_DEBUG("PhysicsStage::Teardown() done.");
+}
+
+void PhysicsStage::TeardownPhysics()
+{
+    delete m_initialSnapshot;
+    m_initialSnapshot = NULL;
+
     DestroyBodies(m_pillarBodies);
+    m_stressLevel = -1;
     DestroyObjects(m_terrains);
     DestroyObjects(m_wallCorners);
     DestroyObjects(m_wallSegments);
@@ -1553,12 +4117,31 @@ void PhysicsStage::TeardownImpl()
 
     if ( m_dynamicsWorld != NULL )
     {
+        m_dynamicsWorld->removeAction(m_raycastVehicle);
         m_dynamicsWorld->removeRigidBody(m_vehicleBody);
     }
 
+    delete m_raycastVehicle;
+    m_raycastVehicle = NULL;
+
+    delete m_sceneQueries;
+    m_sceneQueries = NULL;
+    delete m_querySphere;
+    m_querySphere = NULL;
+
+    // The query buffers and the tunnelling check centers have their
+    // memory in the arena freed below
+    m_queryFrom.clear();
+    m_queryTo.clear();
+    m_queryResults.Clear();
+    m_tunnellingCenters.clear();
+
+    delete m_vehicleRaycaster;
+    m_vehicleRaycaster = NULL;
+
     if ( m_vehicleBody != NULL )
     {
-        delete m_vehicleBody->getMotionState();
+        m_allocator->Delete(m_vehicleBody->getMotionState());
         delete m_vehicleBody;
         m_vehicleBody = NULL;
     }
@@ -1569,42 +4152,38 @@ void PhysicsStage::TeardownImpl()
     delete m_vehicleShape;
     m_vehicleShape = NULL;
 
-    while ( !m_animations.empty() )
-    {
-        delete m_animations.front();
-        m_animations.pop_front();
-    }
-
-    // All remaining animations were already deleted above
-    m_wheelRotationAnimation = NULL;
-
     delete m_statics;
     m_statics = NULL;
 
     delete m_pillar;
     m_pillar = NULL;
 
-    delete m_skybox;
-    m_skybox = NULL;
-
     delete m_vehicle;
     m_vehicle = NULL;
 
     delete m_dynamicsWorld;
     m_dynamicsWorld = NULL;
+    m_parallelWorld = NULL;
 
-    delete m_solver;
-    m_solver = NULL;
+    for ( unsigned int i = 0; i < m_solvers.size(); i++ )
+    {
+        delete m_solvers[i];
+    }
+    m_solvers.clear();
 
     delete m_dispatcher;
     m_dispatcher = NULL;
+    m_parallelDispatcher = NULL;
 
     delete m_collisionConfiguration;
     m_collisionConfiguration = NULL;
 
     delete m_broadphase;
     m_broadphase = NULL;
-    
-    LOG_DEBUG("PhysicsStage::Teardown() done.");
+    m_tunedBroadphase = NULL;
+
+    // Bullet has freed everything by now; release the arena
+    delete m_allocator;
+    m_allocator = NULL;
 }
 
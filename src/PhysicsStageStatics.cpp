@@ -1,12 +1,16 @@
+#include <new>
+
 #include "CommonFunctions.h"
 #include "PhysicsStageStatics.h"
 #include "WallSegment_data.h"
 #include "WallCorner_data.h"
 #include "PillarsTerrain_data.h"
+#include "PillarsTerrain_bvh.h"
 #include "Tree_data.h"
 #include "ObjectMotionState.h"
-#include "ObjectInstance.h"
+#include "SceneInstanceStore.h"
 #include "MatrixOperations.h"
+#include "ChunkedTerrain.h"
 
 // Y coordinate of the "floor"
 //static const GLfloat FloorY = 0.0;
@@ -14,17 +18,69 @@
 static const unsigned int NumTreeLeavesPolygons = 236;
 static const unsigned int NumTreeTrunkPolygons = 261;
 
+/**
+ * Fills in the object header of the serialized terrain BVH the way
+ * btQuantizedBvh::serialize() does. The layout of the header depends on
+ * the platform, so only its values are generated offline.
+ */
+class TerrainBvhHeader : public btQuantizedBvh
+{
+public:
+    TerrainBvhHeader()
+    {
+        m_bvhAabbMin.setValue(PillarsTerrainBvhAabbMin[0],
+                              PillarsTerrainBvhAabbMin[1],
+                              PillarsTerrainBvhAabbMin[2]);
+        m_bvhAabbMax.setValue(PillarsTerrainBvhAabbMax[0],
+                              PillarsTerrainBvhAabbMax[1],
+                              PillarsTerrainBvhAabbMax[2]);
+        m_bvhQuantization.setValue(PillarsTerrainBvhQuantization[0],
+                                   PillarsTerrainBvhQuantization[1],
+                                   PillarsTerrainBvhQuantization[2]);
+        m_useQuantization = true;
+        m_curNodeIndex = PillarsTerrainBvhNumNodes;
+        m_subtreeHeaderCount = PillarsTerrainBvhNumSubtrees;
+        m_traversalMode = (btTraversalMode)PillarsTerrainBvhTraversalMode;
+    }
+};
+
+// Takes the offline built terrain BVH into use in place; returns NULL if
+// the data does not match this platform's layout of the serialized BVH
+static btOptimizedBvh* LoadTerrainBvh()
+{
+    // The nodes and the subtree headers must follow the object header
+    // exactly as btQuantizedBvh::serialize() lays them out
+    PillarsTerrainBvhData& data = PillarsTerrain_bvh;
+    unsigned char* header = data.m_header;
+    unsigned char* nodes = reinterpret_cast<unsigned char*>(data.m_nodes);
+    unsigned char* subtrees =
+            reinterpret_cast<unsigned char*>(data.m_subtrees);
+    if ( (nodes != header + sizeof(btQuantizedBvh)) ||
+         (subtrees != nodes + sizeof(data.m_nodes)) ||
+         (sizeof(PillarsTerrainBvhSubtree) != sizeof(btBvhSubtreeInfo)) )
+    {
+        return NULL;
+    }
+
+    new (header) TerrainBvhHeader();
+
+    // btOptimizedBvh adds no data to btQuantizedBvh; Bullet's own demos
+    // load it the same way
+    return static_cast<btOptimizedBvh*>(
+            btQuantizedBvh::deSerializeInPlace(header, sizeof(data), false));
+}
+
 PhysicsStageStatics::PhysicsStageStatics()
     : m_wallSegmentVertexBuffer(0),
       m_wallCornerVertexBuffer(0),
-      m_terrainVertexBuffer(0),   
-      m_terrainIndexBuffer(0),
       m_treeVertexBuffer(0),
       m_treeLeavesIndexBuffer(0),
       m_treeTrunkIndexBuffer(0),
       m_walkwayVertexBuffer(0),
       m_walkwayIndexBuffer(0),
-      m_floorShape(NULL),
+      m_terrain(NULL),
+      m_terrainMesh(NULL),
+      m_terrainShape(NULL),
       m_wallSegmentShape(NULL),
       m_wallCornerShape(NULL)
 {
@@ -35,15 +91,15 @@ PhysicsStageStatics::~PhysicsStageStatics()
     // Release all OpenGL resources
     glDeleteBuffers(1, &m_wallSegmentVertexBuffer);
     glDeleteBuffers(1, &m_wallCornerVertexBuffer);
-    glDeleteBuffers(1, &m_terrainVertexBuffer);
-    glDeleteBuffers(1, &m_terrainIndexBuffer);
     glDeleteBuffers(1, &m_treeVertexBuffer);
     glDeleteBuffers(1, &m_treeLeavesIndexBuffer);
     glDeleteBuffers(1, &m_treeTrunkIndexBuffer);
     glDeleteBuffers(1, &m_walkwayVertexBuffer);
     glDeleteBuffers(1, &m_walkwayIndexBuffer);
+    delete m_terrain;
 
-    delete m_floorShape;
+    delete m_terrainShape;
+    delete m_terrainMesh;
     delete m_wallSegmentShape;
     delete m_wallCornerShape;
 }
@@ -87,16 +143,15 @@ bool PhysicsStageStatics::Setup()
     glBufferData(GL_ARRAY_BUFFER, sizeof(WallCorner_vertices),
                  WallCorner_vertices, GL_STATIC_DRAW);
 
-    // Create terrain vertex/index buffers
-    glGenBuffers(1, &m_terrainVertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_terrainVertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(PillarsTerrain_vertices),
-                 PillarsTerrain_vertices, GL_STATIC_DRAW);
-    
-    glGenBuffers(1, &m_terrainIndexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_terrainIndexBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(PillarsTerrain_indices),
-                 PillarsTerrain_indices, GL_STATIC_DRAW);
+    // Split the terrain into chunks with detail levels
+    m_terrain = ChunkedTerrain::Create(PillarsTerrain_vertices,
+                                       PillarsTerrainNumVertices,
+                                       PillarsTerrain_indices,
+                                       PillarsTerrainNumIndices);
+    if ( m_terrain == NULL )
+    {
+        return false;
+    }
     
     // Create tree vertex/index buffers
     glGenBuffers(1, &m_treeVertexBuffer);
@@ -203,13 +258,10 @@ void PhysicsStageStatics::RenderWalkway()
                    GL_UNSIGNED_SHORT, NULL);
 }
 
-void PhysicsStageStatics::RenderTerrain() 
+int PhysicsStageStatics::RenderTerrain(const float* frustumPlanes,
+                                       const float* eyePosition)
 {
-    glBindBuffer(GL_ARRAY_BUFFER, m_terrainVertexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_terrainIndexBuffer);
-    SetVertexAttribsPointers();
-    glDrawElements(GL_TRIANGLES, PillarsTerrainNumIndices, 
-                   GL_UNSIGNED_SHORT, NULL);
+    return m_terrain->Render(frustumPlanes, eyePosition);
 }
 
 void PhysicsStageStatics::PrepareRenderWallSegment()
@@ -236,10 +288,51 @@ void PhysicsStageStatics::RenderWallCorner()
     glDrawArrays(GL_TRIANGLES, 0, WallCornerNumVertices);
 }
 
+void PhysicsStageStatics::CreateTerrainShape()
+{
+    // Collide against the render mesh as is
+    btIndexedMesh mesh;
+    mesh.m_numTriangles = PillarsTerrainNumPolygons;
+    mesh.m_triangleIndexBase =
+            reinterpret_cast<const unsigned char*>(PillarsTerrain_indices);
+    mesh.m_triangleIndexStride = 3 * sizeof(GLushort);
+    mesh.m_numVertices = PillarsTerrainNumVertices;
+    mesh.m_vertexBase =
+            reinterpret_cast<const unsigned char*>(PillarsTerrain_vertices);
+    mesh.m_vertexStride = sizeof(VertexAttribs);
+    mesh.m_vertexType = PHY_FLOAT;
+
+    m_terrainMesh = new btTriangleIndexVertexArray();
+    m_terrainMesh->addIndexedMesh(mesh, PHY_SHORT);
+
+    // The bounds are known too; saves a pass over the triangles
+    m_terrainMesh->setPremadeAabb(btVector3(PillarsTerrainAabbMin[0],
+                                            PillarsTerrainAabbMin[1],
+                                            PillarsTerrainAabbMin[2]),
+                                  btVector3(PillarsTerrainAabbMax[0],
+                                            PillarsTerrainAabbMax[1],
+                                            PillarsTerrainAabbMax[2]));
+
+    btOptimizedBvh* bvh = LoadTerrainBvh();
+    if ( bvh != NULL )
+    {
+        m_terrainShape = new btBvhTriangleMeshShape(m_terrainMesh, true,
+                                                    false);
+        m_terrainShape->setOptimizedBvh(bvh);
+    }
+    else
+    {
+        LOG_DEBUG("PhysicsStageStatics: terrain BVH data does not match, "
+                  "building it");
+        m_terrainShape = new btBvhTriangleMeshShape(m_terrainMesh, true,
+                                                    true);
+    }
+}
+
 void PhysicsStageStatics::AddStaticBody(const btVector3& translation,
                                         const btQuaternion& rotation,
                                         btCollisionShape* shape,
-                                        std::list<ObjectInstance*>& objects)
+                                        SceneInstanceStore& objects)
 {
     ObjectMotionState* motionState =
             new ObjectMotionState(btTransform(rotation, translation),
@@ -249,31 +342,44 @@ void PhysicsStageStatics::AddStaticBody(const btVector3& translation,
     // Body construction info: mass = 0, inertia = 0 vector for static shape
     // Objects with mass = 0 are static (immovable)
     btRigidBody::btRigidBodyConstructionInfo bodyCI(0, motionState, shape);
-    objects.push_back(new ObjectInstance(new btRigidBody(bodyCI)));
+    objects.Add(new btRigidBody(bodyCI));
+}
+
+btVector3 PhysicsStageStatics::GetWallSegmentExtents()
+{
+    return btVector3(WallSegmentHalfWidth, WallSegmentHalfHeight,
+                     WallSegmentHalfDepth);
+}
+
+btVector3 PhysicsStageStatics::GetWallCornerExtents()
+{
+    return btVector3(WallCornerHalfWidth, WallCornerHalfHeight,
+                     WallCornerHalfDepth);
+}
+
+btVector3 PhysicsStageStatics::GetTreeExtents()
+{
+    return btVector3(TreeHalfWidth, TreeHalfHeight, TreeHalfDepth);
 }
 
 void PhysicsStageStatics::AddWallSegment(float x, float y, float z,
                                          const btQuaternion& rotation,
-                                         std::list<ObjectInstance*>& objects)
+                                         SceneInstanceStore& objects)
 {
     if ( m_wallSegmentShape == NULL )
     {
-        m_wallSegmentShape = new btBoxShape(btVector3(WallSegmentHalfWidth,
-                                                      WallSegmentHalfHeight,
-                                                      WallSegmentHalfDepth));
+        m_wallSegmentShape = new btBoxShape(GetWallSegmentExtents());
     }
 
     AddStaticBody(btVector3(x, y, z), rotation, m_wallSegmentShape, objects);
 }
 
 void PhysicsStageStatics::AddWallCorner(float x, float y, float z,
-                                        std::list<ObjectInstance*>& wallCorners)
+                                        SceneInstanceStore& wallCorners)
 {
     if ( m_wallCornerShape == NULL )
     {
-        m_wallCornerShape = new btBoxShape(btVector3(WallCornerHalfWidth,
-                                                     WallCornerHalfHeight,
-                                                     WallCornerHalfDepth));
+        m_wallCornerShape = new btBoxShape(GetWallCornerExtents());
     }
 
     AddStaticBody(btVector3(x, y, z), btQuaternion(0, 0, 0),
@@ -281,7 +387,7 @@ void PhysicsStageStatics::AddWallCorner(float x, float y, float z,
 }
 
 void PhysicsStageStatics::AddTree(float x, float y, float z, float yRotAngle,
-                                  std::list<ObjectInstance*>& trees)
+                                  SceneInstanceStore& trees)
 {
     float yRotation[16];
     MatrixCreateRotation(yRotation, yRotAngle, 0.0, 1.0, 0.0);
@@ -289,23 +395,23 @@ void PhysicsStageStatics::AddTree(float x, float y, float z, float yRotAngle,
     MatrixCreateTranslation(translation, x, y, z);
     float transform[16];
     MatrixMultiply(yRotation, translation, transform);
-    trees.push_back(new ObjectInstance(transform));
+    trees.Add(transform);
 }
 
-void PhysicsStageStatics::CreateObjects(std::list<ObjectInstance*>& terrains, 
-                                        std::list<ObjectInstance*>& wallCorners,
-                                        std::list<ObjectInstance*>& wallSegments,
-                                        std::list<ObjectInstance*>& trees)
+void PhysicsStageStatics::CreateObjects(SceneInstanceStore& terrains,
+                                        SceneInstanceStore& wallCorners,
+                                        SceneInstanceStore& wallSegments,
+                                        SceneInstanceStore& trees)
 {
-    // Create floor static body
-    if ( m_floorShape == NULL )
+    // Create the terrain static body
+    if ( m_terrainShape == NULL )
     {
-        m_floorShape = new btStaticPlaneShape(btVector3(0, 1, 0), 0);
+        CreateTerrainShape();
     }
 
     // Create the collision object for ground
     AddStaticBody(btVector3(0, 0, 0), btQuaternion(0, 0, 0),
-                  m_floorShape, terrains);
+                  m_terrainShape, terrains);
     
     // Create the wall corners
     AddWallCorner(-88, WallCornerHalfHeight, -48, wallCorners);
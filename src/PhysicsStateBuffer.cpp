@@ -0,0 +1,57 @@
+#include "PhysicsStateBuffer.h"
+
+// Set in the shared index when it refers to a state the reader has not
+// taken yet
+static const int NewStateFlag = 0x4;
+static const int StateIndexMask = 0x3;
+
+// Atomically replaces the value of target and returns the previous value.
+// Acts as a full memory barrier.
+static int AtomicExchange(volatile int* target, int value)
+{
+    int previous = *target;
+    int actual = 0;
+    while ( (actual = __sync_val_compare_and_swap(target, previous,
+                                                  value)) != previous )
+    {
+        previous = actual;
+    }
+
+    return previous;
+}
+
+PhysicsStateBuffer::PhysicsStateBuffer()
+{
+    Reset();
+}
+
+PhysicsStateBuffer::~PhysicsStateBuffer()
+{
+}
+
+void PhysicsStateBuffer::Publish()
+{
+    // The barrier makes the state's contents visible before its index
+    m_writeIndex = AtomicExchange(&m_sharedIndex,
+                                  m_writeIndex | NewStateFlag) &
+            StateIndexMask;
+}
+
+bool PhysicsStateBuffer::Acquire()
+{
+    if ( (m_sharedIndex & NewStateFlag) == 0 )
+    {
+        return false;
+    }
+
+    m_readIndex = AtomicExchange(&m_sharedIndex, m_readIndex) &
+            StateIndexMask;
+    return true;
+}
+
+void PhysicsStateBuffer::Reset()
+{
+    m_writeIndex = 0;
+    m_sharedIndex = 1;
+    m_readIndex = 2;
+}
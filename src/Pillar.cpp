@@ -1,6 +1,7 @@
 #include "Pillar.h"
 #include "Pillar_data.h"
 #include "CommonFunctions.h"
+#include "GLExtensions.h"
 
 Pillar::Pillar()
     : m_vertexBuffer(0),
@@ -68,3 +69,9 @@ void Pillar::Render()
                    PillarIndicesDatatype, NULL);
 }
 
+
+void Pillar::RenderInstanced(int numInstances)
+{
+    DrawElementsInstanced(GL_TRIANGLES, PillarNumPolygons * 3,
+                          PillarIndicesDatatype, NULL, numInstances);
+}
@@ -0,0 +1,46 @@
+#include "PooledCollisionDispatcher.h"
+#include "LinearMath/btPoolAllocator.h"
+
+PooledCollisionDispatcher::PooledCollisionDispatcher(
+        btCollisionConfiguration* collisionConfiguration)
+    : btCollisionDispatcher(collisionConfiguration),
+      m_numManifoldPoolOverflows(0),
+      m_numAlgorithmPoolOverflows(0)
+{
+}
+
+PooledCollisionDispatcher::~PooledCollisionDispatcher()
+{
+}
+
+btPersistentManifold* PooledCollisionDispatcher::getNewManifold(void* b0,
+                                                                void* b1)
+{
+    // btCollisionDispatcher falls back to the heap when the pool is empty
+    if ( m_persistentManifoldPoolAllocator->getFreeCount() == 0 )
+    {
+        CountManifoldPoolOverflow();
+    }
+
+    return btCollisionDispatcher::getNewManifold(b0, b1);
+}
+
+void* PooledCollisionDispatcher::allocateCollisionAlgorithm(int size)
+{
+    if ( m_collisionAlgorithmPoolAllocator->getFreeCount() == 0 )
+    {
+        CountAlgorithmPoolOverflow();
+    }
+
+    return btCollisionDispatcher::allocateCollisionAlgorithm(size);
+}
+
+void PooledCollisionDispatcher::CountManifoldPoolOverflow()
+{
+    __sync_fetch_and_add(&m_numManifoldPoolOverflows, 1);
+}
+
+void PooledCollisionDispatcher::CountAlgorithmPoolOverflow()
+{
+    __sync_fetch_and_add(&m_numAlgorithmPoolOverflows, 1);
+}
@@ -0,0 +1,255 @@
+#include <LinearMath/btAabbUtil2.h>
+
+#include "RaycastVehicle.h"
+
+// Collects the objects overlapping a box
+class CandidateCallback : public btBroadphaseAabbCallback
+{
+public:
+    CandidateCallback(const btCollisionObject* exclude,
+                      btAlignedObjectArray<btCollisionObject*>& candidates,
+                      btAlignedObjectArray<btVector3>& aabbMin,
+                      btAlignedObjectArray<btVector3>& aabbMax)
+        : m_exclude(exclude), m_candidates(candidates),
+          m_aabbMin(aabbMin), m_aabbMax(aabbMax) {}
+
+    virtual bool process(const btBroadphaseProxy* proxy)
+    {
+        // The same filtering as the rays of btDefaultVehicleRaycaster
+        btCollisionObject* object =
+                static_cast<btCollisionObject*>(proxy->m_clientObject);
+        if ( (object != m_exclude) &&
+             ((proxy->m_collisionFilterMask &
+               btBroadphaseProxy::DefaultFilter) != 0) )
+        {
+            m_candidates.push_back(object);
+            m_aabbMin.push_back(proxy->m_aabbMin);
+            m_aabbMax.push_back(proxy->m_aabbMax);
+        }
+        return true;
+    }
+
+private:
+    const btCollisionObject* m_exclude;
+    btAlignedObjectArray<btCollisionObject*>& m_candidates;
+    btAlignedObjectArray<btVector3>& m_aabbMin;
+    btAlignedObjectArray<btVector3>& m_aabbMax;
+};
+
+BatchedVehicleRaycaster::BatchedVehicleRaycaster(btCollisionWorld* world)
+    : m_world(world),
+      m_numQueries(0),
+      m_numRays(0),
+      m_numShapeTests(0)
+{
+}
+
+BatchedVehicleRaycaster::~BatchedVehicleRaycaster()
+{
+}
+
+void BatchedVehicleRaycaster::FindCandidates(const btVector3* rayFrom,
+                                             const btVector3* rayTo,
+                                             int numRays,
+                                             const btCollisionObject* exclude)
+{
+    m_candidates.resize(0);
+    m_candidateAabbMin.resize(0);
+    m_candidateAabbMax.resize(0);
+    if ( numRays == 0 )
+    {
+        return;
+    }
+
+    btVector3 aabbMin = rayFrom[0];
+    btVector3 aabbMax = rayFrom[0];
+    for ( int i = 0; i < numRays; i++ )
+    {
+        aabbMin.setMin(rayFrom[i]);
+        aabbMin.setMin(rayTo[i]);
+        aabbMax.setMax(rayFrom[i]);
+        aabbMax.setMax(rayTo[i]);
+    }
+
+    CandidateCallback callback(exclude, m_candidates, m_candidateAabbMin,
+                               m_candidateAabbMax);
+    m_world->getBroadphase()->aabbTest(aabbMin, aabbMax, callback);
+    m_numQueries++;
+}
+
+void BatchedVehicleRaycaster::ResetCounters()
+{
+    m_numQueries = 0;
+    m_numRays = 0;
+    m_numShapeTests = 0;
+}
+
+void* BatchedVehicleRaycaster::castRay(const btVector3& from,
+                                       const btVector3& to,
+                                       btVehicleRaycasterResult& result)
+{
+    m_numRays++;
+
+    btTransform rayFromTransform;
+    rayFromTransform.setIdentity();
+    rayFromTransform.setOrigin(from);
+    btTransform rayToTransform;
+    rayToTransform.setIdentity();
+    rayToTransform.setOrigin(to);
+
+    btCollisionWorld::ClosestRayResultCallback rayCallback(from, to);
+    for ( int i = 0; i < m_candidates.size(); i++ )
+    {
+        // Only test the shapes whose boxes the ray crosses, as the
+        // broadphase would
+        btScalar param = 1.0;
+        btVector3 normal;
+        if ( !btRayAabb(from, to, m_candidateAabbMin[i], m_candidateAabbMax[i],
+                        param, normal) )
+        {
+            continue;
+        }
+
+        btCollisionObject* object = m_candidates[i];
+        btCollisionWorld::rayTestSingle(rayFromTransform, rayToTransform,
+                                        object, object->getCollisionShape(),
+                                        object->getWorldTransform(),
+                                        rayCallback);
+        m_numShapeTests++;
+    }
+
+    // The same result as btDefaultVehicleRaycaster gives
+    if ( rayCallback.hasHit() )
+    {
+        btRigidBody* body = btRigidBody::upcast(rayCallback.m_collisionObject);
+        if ( (body != NULL) && body->hasContactResponse() )
+        {
+            result.m_hitPointInWorld = rayCallback.m_hitPointWorld;
+            result.m_hitNormalInWorld = rayCallback.m_hitNormalWorld;
+            result.m_hitNormalInWorld.normalize();
+            result.m_distFraction = rayCallback.m_closestHitFraction;
+            return body;
+        }
+    }
+
+    return NULL;
+}
+
+RaycastVehicle::RaycastVehicle(const btVehicleTuning& tuning,
+                               btRigidBody* chassis,
+                               BatchedVehicleRaycaster& raycaster)
+    : btRaycastVehicle(tuning, chassis, &raycaster),
+      m_raycaster(raycaster),
+      m_driveSpeed(0.0),
+      m_driveAcceleration(0.0)
+{
+}
+
+RaycastVehicle::~RaycastVehicle()
+{
+}
+
+void RaycastVehicle::Drive(btScalar speed, btScalar acceleration)
+{
+    m_driveSpeed = speed;
+    m_driveAcceleration = acceleration;
+    for ( int i = 0; i < getNumWheels(); i++ )
+    {
+        setBrake(0.0, i);
+    }
+}
+
+void RaycastVehicle::Coast()
+{
+    Drive(0.0, 0.0);
+}
+
+void RaycastVehicle::Brake(btScalar force)
+{
+    Coast();
+    for ( int i = 0; i < getNumWheels(); i++ )
+    {
+        setBrake(force, i);
+    }
+}
+
+void RaycastVehicle::Reset(btScalar brakeForce)
+{
+    resetSuspension();
+    for ( int i = 0; i < getNumWheels(); i++ )
+    {
+        btWheelInfo& wheel = m_wheelInfo[i];
+        wheel.m_rotation = 0.0;
+        wheel.m_deltaRotation = 0.0;
+        wheel.m_engineForce = 0.0;
+        wheel.m_skidInfo = 1.0;
+    }
+    Brake(brakeForce);
+}
+
+void RaycastVehicle::updateVehicle(btScalar step)
+{
+    // The rays btRaycastVehicle::rayCast() casts for the wheels: from the
+    // hard point down through the suspension rest length and the radius
+    int numWheels = getNumWheels();
+    m_rayFrom.resize(numWheels);
+    m_rayTo.resize(numWheels);
+    for ( int i = 0; i < numWheels; i++ )
+    {
+        btWheelInfo& wheel = m_wheelInfo[i];
+        updateWheelTransformsWS(wheel, false);
+        btScalar rayLength = wheel.getSuspensionRestLength() +
+                wheel.m_wheelsRadius;
+        m_rayFrom[i] = wheel.m_raycastInfo.m_hardPointWS;
+        m_rayTo[i] = m_rayFrom[i] +
+                (wheel.m_raycastInfo.m_wheelDirectionWS * rayLength);
+    }
+
+    if ( numWheels > 0 )
+    {
+        m_raycaster.FindCandidates(&m_rayFrom[0], &m_rayTo[0], numWheels,
+                                   getRigidBody());
+    }
+
+    ApplyDriveForce(step);
+    btRaycastVehicle::updateVehicle(step);
+}
+
+void RaycastVehicle::ApplyDriveForce(btScalar step)
+{
+    const btTransform& chassisTransform = getChassisWorldTransform();
+    btVector3 forward = -chassisTransform.getBasis().getColumn(2);
+    btScalar speed = forward.dot(getRigidBody()->getLinearVelocity());
+
+    // Close the gap to the set speed within this step if the acceleration
+    // allows; no reverse
+    btScalar acceleration = 0.0;
+    if ( (m_driveAcceleration > 0.0) && (step > 0.0) )
+    {
+        acceleration = btMax(btScalar(0.0),
+                             btMin((m_driveSpeed - speed) / step,
+                                   m_driveAcceleration));
+    }
+
+    int numDriven = 0;
+    for ( int i = 0; i < getNumWheels(); i++ )
+    {
+        if ( !m_wheelInfo[i].m_bIsFrontWheel )
+        {
+            numDriven++;
+        }
+    }
+    if ( numDriven == 0 )
+    {
+        return;
+    }
+
+    // The force of a wheel pushes the chassis along the negative forward
+    // axis of the vehicle coordinate system
+    btScalar force = -acceleration /
+            (getRigidBody()->getInvMass() * numDriven);
+    for ( int i = 0; i < getNumWheels(); i++ )
+    {
+        applyEngineForce(m_wheelInfo[i].m_bIsFrontWheel ? 0.0 : force, i);
+    }
+}
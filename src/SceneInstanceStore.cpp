@@ -0,0 +1,52 @@
+#include "SceneInstanceStore.h"
+#include "ObjectMotionState.h"
+#include "MatrixOperations.h"
+#include "MatrixKernels.h"
+
+SceneInstanceStore::SceneInstanceStore()
+{
+}
+
+SceneInstanceStore::~SceneInstanceStore()
+{
+    // Bodies are not owned
+    Clear();
+}
+
+int SceneInstanceStore::Add(btRigidBody* rigidBody, int type)
+{
+    ObjectMotionState* motionState =
+            static_cast<ObjectMotionState*>(rigidBody->getMotionState());
+    int index = Add(motionState->GetObjectTransform(), type);
+    m_bodies[index] = rigidBody;
+
+    return index;
+}
+
+int SceneInstanceStore::Add(const float* transform, int type)
+{
+    int index = m_types.size();
+
+    m_transforms.resize((index + 1) * 16);
+    CopyMatrix(transform, &m_transforms[index * 16]);
+    m_types.push_back(type);
+    m_bodies.push_back(NULL);
+
+    return index;
+}
+
+void SceneInstanceStore::Clear()
+{
+    m_transforms.clear();
+    m_types.clear();
+    m_bodies.clear();
+}
+
+void SceneInstanceStore::MultiplyTransforms(const float* matrix,
+                                            float* out) const
+{
+    if ( !Empty() )
+    {
+        MatrixMultiplyBatch(Transforms(), matrix, out, Count());
+    }
+}
@@ -0,0 +1,525 @@
+#include <LinearMath/btAabbUtil2.h>
+
+#include "SceneQueryBatch.h"
+#include "CommonFunctions.h"
+
+// Initial size of the tree walk stacks; the walk holds at most one node
+// more than the depth of the tree
+static const int InitialStackSize = 128;
+
+struct WorkerThreadData
+{
+    SceneQueryBatch* m_batch;
+    int m_thread;
+};
+
+/**
+ * Tests the objects of broadphase proxies against one query and keeps the
+ * closest hit; the hit limits how far the broadphase needs to be walked.
+ */
+class ProxyTester
+{
+public:
+    virtual ~ProxyTester() {}
+
+    /** Tests the object of the proxy, if it passes the filter. */
+    virtual void Process(btBroadphaseProxy* proxy) = 0;
+
+    /** Returns the fraction of the closest hit so far; 1.0 if none. */
+    virtual btScalar ClosestFraction() const = 0;
+};
+
+// Tests a ray against the objects
+class RayTester : public ProxyTester
+{
+public:
+    RayTester(const btVector3& from, const btVector3& to)
+        : m_callback(from, to)
+    {
+        m_from.setIdentity();
+        m_from.setOrigin(from);
+        m_to.setIdentity();
+        m_to.setOrigin(to);
+    }
+
+    virtual void Process(btBroadphaseProxy* proxy)
+    {
+        if ( m_callback.needsCollision(proxy) )
+        {
+            btCollisionObject* object =
+                    static_cast<btCollisionObject*>(proxy->m_clientObject);
+            TestShape(object, object->getCollisionShape(),
+                      object->getWorldTransform());
+        }
+    }
+
+    virtual btScalar ClosestFraction() const
+    {
+        return m_callback.m_closestHitFraction;
+    }
+
+    btCollisionWorld::ClosestRayResultCallback m_callback;
+
+private:
+    void TestShape(btCollisionObject* object, const btCollisionShape* shape,
+                   const btTransform& transform)
+    {
+        if ( shape->isCompound() )
+        {
+            // The children are tested as shapes of the object itself,
+            // without swapping in the child shape as rayTestSingle() does
+            const btCompoundShape* compound =
+                    static_cast<const btCompoundShape*>(shape);
+            for ( int i = 0; i < compound->getNumChildShapes(); i++ )
+            {
+                TestShape(object, compound->getChildShape(i),
+                          transform * compound->getChildTransform(i));
+            }
+            return;
+        }
+
+        btCollisionWorld::rayTestSingle(m_from, m_to, object, shape,
+                                        transform, m_callback);
+    }
+
+private:
+    btTransform m_from;
+    btTransform m_to;
+};
+
+// Tests a convex shape swept along a line against the objects
+class SweepTester : public ProxyTester
+{
+public:
+    SweepTester(const btConvexShape* shape, const btVector3& from,
+                const btVector3& to)
+        : m_callback(from, to), m_shape(shape)
+    {
+        m_from.setIdentity();
+        m_from.setOrigin(from);
+        m_to.setIdentity();
+        m_to.setOrigin(to);
+    }
+
+    virtual void Process(btBroadphaseProxy* proxy)
+    {
+        if ( m_callback.needsCollision(proxy) )
+        {
+            btCollisionObject* object =
+                    static_cast<btCollisionObject*>(proxy->m_clientObject);
+            TestShape(object, object->getCollisionShape(),
+                      object->getWorldTransform());
+        }
+    }
+
+    virtual btScalar ClosestFraction() const
+    {
+        return m_callback.m_closestHitFraction;
+    }
+
+    btCollisionWorld::ClosestConvexResultCallback m_callback;
+
+private:
+    void TestShape(btCollisionObject* object, const btCollisionShape* shape,
+                   const btTransform& transform)
+    {
+        if ( shape->isCompound() )
+        {
+            // As in RayTester
+            const btCompoundShape* compound =
+                    static_cast<const btCompoundShape*>(shape);
+            for ( int i = 0; i < compound->getNumChildShapes(); i++ )
+            {
+                TestShape(object, compound->getChildShape(i),
+                          transform * compound->getChildTransform(i));
+            }
+            return;
+        }
+
+        btCollisionWorld::objectQuerySingle(m_shape, m_from, m_to, object,
+                                            shape, transform, m_callback,
+                                            0.0);
+    }
+
+private:
+    const btConvexShape* m_shape;
+    btTransform m_from;
+    btTransform m_to;
+};
+
+// Collects the proxies overlapping a box
+class CandidateCallback : public btBroadphaseAabbCallback
+{
+public:
+    CandidateCallback(btAlignedObjectArray<btBroadphaseProxy*>& candidates)
+        : m_candidates(candidates) {}
+
+    virtual bool process(const btBroadphaseProxy* proxy)
+    {
+        m_candidates.push_back(const_cast<btBroadphaseProxy*>(proxy));
+        return true;
+    }
+
+private:
+    btAlignedObjectArray<btBroadphaseProxy*>& m_candidates;
+};
+
+SceneQueryBatch::SceneQueryBatch(btCollisionWorld* world,
+                                 btDbvtBroadphase* dbvt, int numThreads)
+    : m_world(world),
+      m_dbvt(dbvt),
+      m_numThreads(numThreads),
+      m_shape(NULL),
+      m_from(NULL),
+      m_to(NULL),
+      m_results(NULL),
+      m_numQueries(0),
+      m_generation(0),
+      m_numBusyThreads(0),
+      m_threadsAlive(false)
+{
+    for ( int i = 0; i < MaxSceneQueryThreads; i++ )
+    {
+        m_numHits[i] = 0;
+    }
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_startCondition, NULL);
+    pthread_cond_init(&m_doneCondition, NULL);
+}
+
+SceneQueryBatch::~SceneQueryBatch()
+{
+    // Terminate the worker threads
+    pthread_mutex_lock(&m_mutex);
+    m_threadsAlive = false;
+    pthread_cond_broadcast(&m_startCondition);
+    pthread_mutex_unlock(&m_mutex);
+    for ( unsigned int i = 0; i < m_threads.size(); i++ )
+    {
+        pthread_join(m_threads[i], NULL);
+    }
+    m_threads.clear();
+
+    pthread_cond_destroy(&m_doneCondition);
+    pthread_cond_destroy(&m_startCondition);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+SceneQueryBatch* SceneQueryBatch::Create(btCollisionWorld* world,
+                                         btDbvtBroadphase* dbvt,
+                                         int numThreads)
+{
+    SceneQueryBatch* self = new SceneQueryBatch(world, dbvt, numThreads);
+    if ( !self->Setup() )
+    {
+        delete self;
+        return NULL;
+    }
+
+    return self;
+}
+
+bool SceneQueryBatch::Setup()
+{
+    if ( (m_numThreads < 1) || (m_numThreads > MaxSceneQueryThreads) )
+    {
+        LOG_DEBUG("SceneQueryBatch: invalid thread count %d", m_numThreads);
+        return false;
+    }
+
+    for ( int i = 0; i < m_numThreads; i++ )
+    {
+        m_stacks[i].reserve(InitialStackSize);
+    }
+
+    // Create the worker threads; the calling thread is the first
+    m_threadsAlive = true;
+    for ( int i = 1; i < m_numThreads; i++ )
+    {
+        WorkerThreadData* data = new WorkerThreadData();
+        data->m_batch = this;
+        data->m_thread = i;
+
+        pthread_t thread;
+        if ( pthread_create(&thread, NULL,
+                            &SceneQueryBatch::WorkerThreadMethod,
+                            data) != 0 )
+        {
+            LOG_DEBUG("SceneQueryBatch: thread creation failed!");
+            delete data;
+            return false;
+        }
+        m_threads.push_back(thread);
+    }
+
+    return true;
+}
+
+void SceneQueryBatch::CastRays(const btVector3* from, const btVector3* to,
+                               int numRays, SceneQueryResults& results)
+{
+    m_shape = NULL;
+    m_from = from;
+    m_to = to;
+    m_results = &results;
+    RunQueries(numRays);
+}
+
+void SceneQueryBatch::SweepShape(const btConvexShape* shape,
+                                 const btVector3* from, const btVector3* to,
+                                 int numSweeps, SceneQueryResults& results)
+{
+    m_shape = shape;
+    m_from = from;
+    m_to = to;
+    m_results = &results;
+    RunQueries(numSweeps);
+}
+
+void SceneQueryBatch::RunQueries(int numQueries)
+{
+    m_results->Resize(numQueries);
+    m_numQueries = numQueries;
+
+    // Not worth waking up the threads for less than one query each
+    int numThreads = (numQueries >= m_numThreads) ? m_numThreads : 1;
+    if ( numThreads > 1 )
+    {
+        // Wake up the worker threads
+        pthread_mutex_lock(&m_mutex);
+        m_numBusyThreads = m_numThreads - 1;
+        m_generation++;
+        pthread_cond_broadcast(&m_startCondition);
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    ProcessQueries(0, numThreads);
+
+    if ( numThreads > 1 )
+    {
+        // Wait for the worker threads
+        pthread_mutex_lock(&m_mutex);
+        while ( m_numBusyThreads > 0 )
+        {
+            pthread_cond_wait(&m_doneCondition, &m_mutex);
+        }
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    m_results->m_numHits = 0;
+    for ( int i = 0; i < numThreads; i++ )
+    {
+        m_results->m_numHits += m_numHits[i];
+    }
+
+    m_shape = NULL;
+    m_from = NULL;
+    m_to = NULL;
+    m_results = NULL;
+}
+
+void SceneQueryBatch::ProcessQueries(int thread, int numThreads)
+{
+    // Each thread takes an equal run of the queries
+    int first = (m_numQueries * thread) / numThreads;
+    int last = (m_numQueries * (thread + 1)) / numThreads;
+    SceneQueryResults& results = *m_results;
+    int numHits = 0;
+
+    // The bounds of the swept shape around its origin
+    btVector3 shapeMin(0.0, 0.0, 0.0);
+    btVector3 shapeMax(0.0, 0.0, 0.0);
+    if ( m_shape != NULL )
+    {
+        btTransform identity;
+        identity.setIdentity();
+        m_shape->getAabb(identity, shapeMin, shapeMax);
+    }
+
+    for ( int i = first; i < last; i++ )
+    {
+        const btVector3& from = m_from[i];
+        const btVector3& to = m_to[i];
+        const btCollisionObject* object = NULL;
+        if ( m_shape == NULL )
+        {
+            RayTester tester(from, to);
+            WalkBroadphase(thread, from, to, shapeMin, shapeMax, tester);
+            btCollisionWorld::ClosestRayResultCallback& hit = tester.m_callback;
+            object = hit.m_collisionObject;
+            results.m_hitFraction[i] = hit.m_closestHitFraction;
+            if ( object != NULL )
+            {
+                results.m_hitPoint[i] = hit.m_hitPointWorld;
+                results.m_hitNormal[i] = hit.m_hitNormalWorld;
+            }
+        }
+        else
+        {
+            SweepTester tester(m_shape, from, to);
+            WalkBroadphase(thread, from, to, shapeMin, shapeMax, tester);
+            btCollisionWorld::ClosestConvexResultCallback& hit =
+                    tester.m_callback;
+            object = hit.m_hitCollisionObject;
+            results.m_hitFraction[i] = hit.m_closestHitFraction;
+            if ( object != NULL )
+            {
+                results.m_hitPoint[i] = hit.m_hitPointWorld;
+                results.m_hitNormal[i] = hit.m_hitNormalWorld;
+            }
+        }
+
+        results.m_hitObject[i] = object;
+        if ( object != NULL )
+        {
+            numHits++;
+        }
+    }
+
+    m_numHits[thread] = numHits;
+}
+
+void SceneQueryBatch::WalkBroadphase(int thread, const btVector3& from,
+                                     const btVector3& to,
+                                     const btVector3& shapeMin,
+                                     const btVector3& shapeMax,
+                                     ProxyTester& tester)
+{
+    btVector3 direction = to - from;
+    btScalar length = direction.length();
+    if ( (m_dbvt != NULL) && (length > SIMD_EPSILON) )
+    {
+        // The ray in the form btDbvtBroadphase::rayTest() walks the trees
+        // with; the distances along it are in world units
+        direction /= length;
+        btVector3 directionInverse;
+        unsigned int signs[3];
+        for ( int i = 0; i < 3; i++ )
+        {
+            directionInverse[i] = (direction[i] == 0.0) ?
+                    btScalar(BT_LARGE_FLOAT) : (1.0 / direction[i]);
+            signs[i] = (directionInverse[i] < 0.0);
+        }
+
+        for ( int i = 0; i < btDbvtBroadphase::STAGECOUNT; i++ )
+        {
+            WalkTree(thread, m_dbvt->m_sets[i].m_root, from,
+                     directionInverse, signs, length, shapeMin, shapeMax,
+                     tester);
+        }
+        return;
+    }
+
+    // Look up the objects within the bounds of the query and test the
+    // ones whose bounds it crosses
+    btVector3 aabbMin = from;
+    aabbMin.setMin(to);
+    btVector3 aabbMax = from;
+    aabbMax.setMax(to);
+    btAlignedObjectArray<btBroadphaseProxy*>& candidates =
+            m_candidates[thread];
+    candidates.resize(0);
+    CandidateCallback callback(candidates);
+    m_world->getBroadphase()->aabbTest(aabbMin + shapeMin, aabbMax + shapeMax,
+                                       callback);
+
+    for ( int i = 0; i < candidates.size(); i++ )
+    {
+        btBroadphaseProxy* proxy = candidates[i];
+        btScalar param = tester.ClosestFraction();
+        btVector3 normal;
+        if ( btRayAabb(from, to, proxy->m_aabbMin - shapeMax,
+                       proxy->m_aabbMax - shapeMin, param, normal) )
+        {
+            tester.Process(proxy);
+        }
+    }
+}
+
+void SceneQueryBatch::WalkTree(int thread, const btDbvtNode* root,
+                               const btVector3& from,
+                               const btVector3& directionInverse,
+                               const unsigned int* signs, btScalar length,
+                               const btVector3& shapeMin,
+                               const btVector3& shapeMax,
+                               ProxyTester& tester)
+{
+    if ( root == NULL )
+    {
+        return;
+    }
+
+    // As btDbvt::rayTestInternal(), but with the thread's own stack, and
+    // only up to the closest hit so far
+    btAlignedObjectArray<const btDbvtNode*>& stack = m_stacks[thread];
+    stack.resize(0);
+    stack.push_back(root);
+    while ( stack.size() > 0 )
+    {
+        const btDbvtNode* node = stack[stack.size() - 1];
+        stack.pop_back();
+
+        btVector3 bounds[2];
+        bounds[0] = node->volume.Mins() - shapeMax;
+        bounds[1] = node->volume.Maxs() - shapeMin;
+        btScalar distance = 1.0;
+        if ( !btRayAabb2(from, directionInverse, signs, bounds, distance,
+                         0.0, length * tester.ClosestFraction()) )
+        {
+            continue;
+        }
+
+        if ( node->isinternal() )
+        {
+            stack.push_back(node->childs[0]);
+            stack.push_back(node->childs[1]);
+        }
+        else
+        {
+            tester.Process(static_cast<btBroadphaseProxy*>(node->data));
+        }
+    }
+}
+
+void SceneQueryBatch::WorkerThreadLoop(int thread)
+{
+    int generation = 0;
+
+    while ( true )
+    {
+        // Wait for the next batch
+        pthread_mutex_lock(&m_mutex);
+        while ( m_threadsAlive && (m_generation == generation) )
+        {
+            pthread_cond_wait(&m_startCondition, &m_mutex);
+        }
+        generation = m_generation;
+        bool alive = m_threadsAlive;
+        pthread_mutex_unlock(&m_mutex);
+
+        if ( !alive )
+        {
+            return;
+        }
+
+        ProcessQueries(thread, m_numThreads);
+
+        // Signal the thread running the batch
+        pthread_mutex_lock(&m_mutex);
+        m_numBusyThreads--;
+        if ( m_numBusyThreads == 0 )
+        {
+            pthread_cond_signal(&m_doneCondition);
+        }
+        pthread_mutex_unlock(&m_mutex);
+    }
+}
+
+void* SceneQueryBatch::WorkerThreadMethod(void* data)
+{
+    WorkerThreadData* threadData = static_cast<WorkerThreadData*>(data);
+    threadData->m_batch->WorkerThreadLoop(threadData->m_thread);
+    delete threadData;
+
+    return NULL;
+}
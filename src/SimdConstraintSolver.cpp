@@ -0,0 +1,747 @@
+#include <sys/time.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "SimdConstraintSolver.h"
+#include "CommonFunctions.h"
+#include "MatrixKernels.h"
+
+#if !defined(BT_USE_DOUBLE_PRECISION) && \
+    (defined(__SSE2__) || defined(_M_X64))
+#define SIMD_ROWS_SSE
+#include <emmintrin.h>
+#endif
+
+#if !defined(BT_USE_DOUBLE_PRECISION) && \
+    (defined(__ARM_NEON__) || defined(__ARM_NEON))
+#define SIMD_ROWS_NEON
+#include <arm_neon.h>
+#endif
+
+// Returns the current time in seconds
+static double CurrentTime()
+{
+    timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + (now.tv_usec * 0.000001);
+}
+
+// Applies the limits of a row to its accumulated impulse and returns the
+// change of the impulse, as btSequentialImpulseConstraintSolver does
+static inline btScalar ClampImpulse(const btSolverConstraint& c,
+                                    btScalar deltaImpulse,
+                                    btSimdScalar& appliedImpulse,
+                                    bool clampUpper)
+{
+    const btScalar sum = btScalar(appliedImpulse) + deltaImpulse;
+    if ( sum < c.m_lowerLimit )
+    {
+        deltaImpulse = c.m_lowerLimit - btScalar(appliedImpulse);
+        appliedImpulse = c.m_lowerLimit;
+    }
+    else if ( clampUpper && (sum > c.m_upperLimit) )
+    {
+        deltaImpulse = c.m_upperLimit - btScalar(appliedImpulse);
+        appliedImpulse = c.m_upperLimit;
+    }
+    else
+    {
+        appliedImpulse = sum;
+    }
+
+    return deltaImpulse;
+}
+
+// Returns the impulse change of a row from the relative velocities along
+// the row at the two bodies
+static inline btScalar RowImpulse(const btSolverConstraint& c, btScalar rhs,
+                                  btSimdScalar& appliedImpulse,
+                                  btScalar deltaVel1Dotn,
+                                  btScalar deltaVel2Dotn, bool clampUpper)
+{
+    btScalar deltaImpulse = rhs - btScalar(appliedImpulse) * c.m_cfm;
+    deltaImpulse -= deltaVel1Dotn * c.m_jacDiagABInv;
+    deltaImpulse -= deltaVel2Dotn * c.m_jacDiagABInv;
+
+    return ClampImpulse(c, deltaImpulse, appliedImpulse, clampUpper);
+}
+
+#ifdef SIMD_ROWS_SSE
+// Returns the dot products a0.b0 and a1.b1 of the xyz components, each
+// summed in the order btVector3::dot uses
+static inline void DotPairSse(__m128 a0, __m128 b0, __m128 a1, __m128 b1,
+                              float& dot0, float& dot1)
+{
+    __m128 product0 = _mm_mul_ps(a0, b0);
+    __m128 product1 = _mm_mul_ps(a1, b1);
+
+    // (x0 x1 y0 y1) + (y0 y1 ..) + (z0 z1 ..)
+    __m128 low = _mm_unpacklo_ps(product0, product1);
+    __m128 high = _mm_unpackhi_ps(product0, product1);
+    __m128 sum = _mm_add_ps(low, _mm_movehl_ps(low, low));
+    sum = _mm_add_ps(sum, high);
+
+    dot0 = _mm_cvtss_f32(sum);
+    dot1 = _mm_cvtss_f32(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+}
+
+static void SolveRowSse(btRigidBody& body1, btRigidBody& body2,
+                        const btSolverConstraint& c,
+                        btVector3& linearVelocity1,
+                        btVector3& angularVelocity1,
+                        btVector3& linearVelocity2,
+                        btVector3& angularVelocity2,
+                        btScalar rhs, btSimdScalar& appliedImpulse,
+                        bool clampUpper)
+{
+    __m128 normal = _mm_loadu_ps(c.m_contactNormal.m_floats);
+    __m128 linear1 = _mm_loadu_ps(linearVelocity1.m_floats);
+    __m128 angular1 = _mm_loadu_ps(angularVelocity1.m_floats);
+    __m128 linear2 = _mm_loadu_ps(linearVelocity2.m_floats);
+    __m128 angular2 = _mm_loadu_ps(angularVelocity2.m_floats);
+
+    float normalDot1 = 0.0f;
+    float crossDot1 = 0.0f;
+    float normalDot2 = 0.0f;
+    float crossDot2 = 0.0f;
+    DotPairSse(normal, linear1,
+               _mm_loadu_ps(c.m_relpos1CrossNormal.m_floats), angular1,
+               normalDot1, crossDot1);
+    DotPairSse(normal, linear2,
+               _mm_loadu_ps(c.m_relpos2CrossNormal.m_floats), angular2,
+               normalDot2, crossDot2);
+
+    btScalar deltaImpulse = RowImpulse(c, rhs, appliedImpulse,
+                                       normalDot1 + crossDot1,
+                                       -normalDot2 + crossDot2, clampUpper);
+    __m128 impulse = _mm_set1_ps(deltaImpulse);
+
+    // Static bodies are shared between the islands; never write them
+    if ( body1.getInvMass() != btScalar(0) )
+    {
+        __m128 linearComponent =
+                _mm_mul_ps(normal,
+                           _mm_loadu_ps(body1.internalGetInvMass().m_floats));
+        __m128 angularImpulse =
+                _mm_mul_ps(impulse, _mm_loadu_ps(
+                               body1.internalGetAngularFactor().m_floats));
+        _mm_storeu_ps(linearVelocity1.m_floats,
+                      _mm_add_ps(linear1,
+                                 _mm_mul_ps(linearComponent, impulse)));
+        _mm_storeu_ps(angularVelocity1.m_floats,
+                      _mm_add_ps(angular1,
+                                 _mm_mul_ps(_mm_loadu_ps(
+                                     c.m_angularComponentA.m_floats),
+                                            angularImpulse)));
+    }
+    if ( body2.getInvMass() != btScalar(0) )
+    {
+        __m128 negatedNormal = _mm_xor_ps(normal, _mm_set1_ps(-0.0f));
+        __m128 linearComponent =
+                _mm_mul_ps(negatedNormal,
+                           _mm_loadu_ps(body2.internalGetInvMass().m_floats));
+        __m128 angularImpulse =
+                _mm_mul_ps(impulse, _mm_loadu_ps(
+                               body2.internalGetAngularFactor().m_floats));
+        _mm_storeu_ps(linearVelocity2.m_floats,
+                      _mm_add_ps(linear2,
+                                 _mm_mul_ps(linearComponent, impulse)));
+        _mm_storeu_ps(angularVelocity2.m_floats,
+                      _mm_add_ps(angular2,
+                                 _mm_mul_ps(_mm_loadu_ps(
+                                     c.m_angularComponentB.m_floats),
+                                            angularImpulse)));
+    }
+}
+#endif // SIMD_ROWS_SSE
+
+#ifdef SIMD_ROWS_NEON
+// Returns the dot products a0.b0 and a1.b1 of the xyz components, each
+// summed in the order btVector3::dot uses
+static inline void DotPairNeon(float32x4_t a0, float32x4_t b0,
+                               float32x4_t a1, float32x4_t b1,
+                               float& dot0, float& dot1)
+{
+    float32x4_t product0 = vmulq_f32(a0, b0);
+    float32x4_t product1 = vmulq_f32(a1, b1);
+
+    // (x0 + y0, x1 + y1) + (z0, z1)
+    float32x2_t sum = vpadd_f32(vget_low_f32(product0),
+                                vget_low_f32(product1));
+    sum = vadd_f32(sum, vuzp_f32(vget_high_f32(product0),
+                                 vget_high_f32(product1)).val[0]);
+
+    dot0 = vget_lane_f32(sum, 0);
+    dot1 = vget_lane_f32(sum, 1);
+}
+
+static void SolveRowNeon(btRigidBody& body1, btRigidBody& body2,
+                         const btSolverConstraint& c,
+                         btVector3& linearVelocity1,
+                         btVector3& angularVelocity1,
+                         btVector3& linearVelocity2,
+                         btVector3& angularVelocity2,
+                         btScalar rhs, btSimdScalar& appliedImpulse,
+                         bool clampUpper)
+{
+    float32x4_t normal = vld1q_f32(c.m_contactNormal.m_floats);
+    float32x4_t linear1 = vld1q_f32(linearVelocity1.m_floats);
+    float32x4_t angular1 = vld1q_f32(angularVelocity1.m_floats);
+    float32x4_t linear2 = vld1q_f32(linearVelocity2.m_floats);
+    float32x4_t angular2 = vld1q_f32(angularVelocity2.m_floats);
+
+    float normalDot1 = 0.0f;
+    float crossDot1 = 0.0f;
+    float normalDot2 = 0.0f;
+    float crossDot2 = 0.0f;
+    DotPairNeon(normal, linear1,
+                vld1q_f32(c.m_relpos1CrossNormal.m_floats), angular1,
+                normalDot1, crossDot1);
+    DotPairNeon(normal, linear2,
+                vld1q_f32(c.m_relpos2CrossNormal.m_floats), angular2,
+                normalDot2, crossDot2);
+
+    btScalar deltaImpulse = RowImpulse(c, rhs, appliedImpulse,
+                                       normalDot1 + crossDot1,
+                                       -normalDot2 + crossDot2, clampUpper);
+    float32x4_t impulse = vdupq_n_f32(deltaImpulse);
+
+    // Separate multiplies and adds rather than fused ones, as in the
+    // generic rows. Static bodies are shared between the islands; never
+    // write them
+    if ( body1.getInvMass() != btScalar(0) )
+    {
+        float32x4_t linearComponent =
+                vmulq_f32(normal, vld1q_f32(body1.internalGetInvMass().m_floats));
+        float32x4_t angularImpulse =
+                vmulq_f32(impulse,
+                          vld1q_f32(body1.internalGetAngularFactor().m_floats));
+        vst1q_f32(linearVelocity1.m_floats,
+                  vaddq_f32(linear1, vmulq_f32(linearComponent, impulse)));
+        vst1q_f32(angularVelocity1.m_floats,
+                  vaddq_f32(angular1,
+                            vmulq_f32(vld1q_f32(c.m_angularComponentA.m_floats),
+                                      angularImpulse)));
+    }
+    if ( body2.getInvMass() != btScalar(0) )
+    {
+        float32x4_t linearComponent =
+                vmulq_f32(vnegq_f32(normal),
+                          vld1q_f32(body2.internalGetInvMass().m_floats));
+        float32x4_t angularImpulse =
+                vmulq_f32(impulse,
+                          vld1q_f32(body2.internalGetAngularFactor().m_floats));
+        vst1q_f32(linearVelocity2.m_floats,
+                  vaddq_f32(linear2, vmulq_f32(linearComponent, impulse)));
+        vst1q_f32(angularVelocity2.m_floats,
+                  vaddq_f32(angular2,
+                            vmulq_f32(vld1q_f32(c.m_angularComponentB.m_floats),
+                                      angularImpulse)));
+    }
+}
+#endif // SIMD_ROWS_NEON
+
+// Returns the row kernel of the given implementation; NULL for the
+// generic rows or if not available
+static SimdConstraintSolver::SolveRowFunction RowFunction(RowKernels kernels)
+{
+    switch ( kernels )
+    {
+#ifdef SIMD_ROWS_SSE
+        case RowKernelsSse:
+            return &SolveRowSse;
+#endif
+#ifdef SIMD_ROWS_NEON
+        case RowKernelsNeon:
+            return &SolveRowNeon;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+// Returns a pseudo random number in [min, max); the benchmark uses the
+// same rows on every run
+static btScalar RandomScalar(unsigned int& seed, btScalar min, btScalar max)
+{
+    seed = (1664525 * seed) + 1013904223;
+    return min + ((max - min) * (seed >> 8) / 16777216.0f);
+}
+
+static btVector3 RandomVector(unsigned int& seed, btScalar min, btScalar max)
+{
+    btScalar x = RandomScalar(seed, min, max);
+    btScalar y = RandomScalar(seed, min, max);
+    btScalar z = RandomScalar(seed, min, max);
+    return btVector3(x, y, z);
+}
+
+// Sets the solver velocities of the bodies and the accumulated impulses of
+// the rows to their initial values
+static void ResetBenchmarkState(std::vector<btRigidBody*>& bodies,
+                                btConstraintArray& rows,
+                                const btAlignedObjectArray<btVector3>&
+                                velocities)
+{
+    for ( unsigned int i = 0; i < bodies.size(); i++ )
+    {
+        btRigidBody* body = bodies[i];
+        body->internalGetDeltaLinearVelocity() = velocities[(i * 4) + 0];
+        body->internalGetDeltaAngularVelocity() = velocities[(i * 4) + 1];
+        body->internalGetPushVelocity() = velocities[(i * 4) + 2];
+        body->internalGetTurnVelocity() = velocities[(i * 4) + 3];
+    }
+    for ( int i = 0; i < rows.size(); i++ )
+    {
+        rows[i].m_appliedImpulse = 0.0f;
+        rows[i].m_appliedPushImpulse = 0.0f;
+    }
+}
+
+// Collects the solver velocities of the bodies and the accumulated
+// impulses of the rows
+static void GetBenchmarkState(std::vector<btRigidBody*>& bodies,
+                              btConstraintArray& rows,
+                              std::vector<btScalar>& state)
+{
+    state.clear();
+    for ( unsigned int i = 0; i < bodies.size(); i++ )
+    {
+        btRigidBody* body = bodies[i];
+        const btVector3* velocities[4] = {
+            &body->internalGetDeltaLinearVelocity(),
+            &body->internalGetDeltaAngularVelocity(),
+            &body->internalGetPushVelocity(),
+            &body->internalGetTurnVelocity()
+        };
+        for ( int j = 0; j < 4; j++ )
+        {
+            state.push_back(velocities[j]->x());
+            state.push_back(velocities[j]->y());
+            state.push_back(velocities[j]->z());
+        }
+    }
+    for ( int i = 0; i < rows.size(); i++ )
+    {
+        state.push_back(rows[i].m_appliedImpulse);
+        state.push_back(rows[i].m_appliedPushImpulse);
+    }
+}
+
+SimdConstraintSolver::SimdConstraintSolver()
+    : m_rowKernels(RowKernelsGeneric),
+      m_solveRow(NULL)
+{
+    SetRowKernels(RowKernelsAuto);
+}
+
+SimdConstraintSolver::~SimdConstraintSolver()
+{
+}
+
+bool SimdConstraintSolver::SetRowKernels(RowKernels kernels)
+{
+    if ( kernels == RowKernelsAuto )
+    {
+        if ( RowKernelsAvailable(RowKernelsNeon) )
+        {
+            kernels = RowKernelsNeon;
+        }
+        else if ( RowKernelsAvailable(RowKernelsSse) )
+        {
+            kernels = RowKernelsSse;
+        }
+        else
+        {
+            kernels = RowKernelsGeneric;
+        }
+    }
+
+    if ( !RowKernelsAvailable(kernels) )
+    {
+        return false;
+    }
+
+    m_rowKernels = kernels;
+    m_solveRow = RowFunction(kernels);
+
+    return true;
+}
+
+bool SimdConstraintSolver::RowKernelsAvailable(RowKernels kernels)
+{
+    switch ( kernels )
+    {
+        case RowKernelsAuto:
+        case RowKernelsGeneric:
+            return true;
+        case RowKernelsNeon:
+            // Compiled in for ARMv7, which does not guarantee a NEON unit
+            return (RowFunction(kernels) != NULL) && NEONPresent();
+        default:
+            return (RowFunction(kernels) != NULL);
+    }
+}
+
+const char* SimdConstraintSolver::RowKernelsName(RowKernels kernels)
+{
+    switch ( kernels )
+    {
+        case RowKernelsAuto:
+            return "auto";
+        case RowKernelsGeneric:
+            return "generic";
+        case RowKernelsSse:
+            return "SSE2";
+        case RowKernelsNeon:
+            return "NEON";
+        default:
+            return "unknown";
+    }
+}
+
+bool SimdConstraintSolver::UseRowKernels(
+        const btContactSolverInfo& infoGlobal) const
+{
+    return (m_solveRow != NULL) &&
+            ((infoGlobal.m_solverMode & SOLVER_SIMD) != 0) &&
+            ((infoGlobal.m_solverMode & SOLVER_RANDMIZE_ORDER) == 0);
+}
+
+void SimdConstraintSolver::ResolveRow(const btSolverConstraint& c)
+{
+    btRigidBody& body1 = *c.m_solverBodyA;
+    btRigidBody& body2 = *c.m_solverBodyB;
+    m_solveRow(body1, body2, c,
+               body1.internalGetDeltaLinearVelocity(),
+               body1.internalGetDeltaAngularVelocity(),
+               body2.internalGetDeltaLinearVelocity(),
+               body2.internalGetDeltaAngularVelocity(),
+               c.m_rhs, c.m_appliedImpulse, true);
+}
+
+void SimdConstraintSolver::ResolveRowLowerLimit(const btSolverConstraint& c)
+{
+    btRigidBody& body1 = *c.m_solverBodyA;
+    btRigidBody& body2 = *c.m_solverBodyB;
+    m_solveRow(body1, body2, c,
+               body1.internalGetDeltaLinearVelocity(),
+               body1.internalGetDeltaAngularVelocity(),
+               body2.internalGetDeltaLinearVelocity(),
+               body2.internalGetDeltaAngularVelocity(),
+               c.m_rhs, c.m_appliedImpulse, false);
+}
+
+void SimdConstraintSolver::ResolveSplitPenetration(const btSolverConstraint& c)
+{
+    if ( c.m_rhsPenetration == btScalar(0) )
+    {
+        return;
+    }
+
+    btRigidBody& body1 = *c.m_solverBodyA;
+    btRigidBody& body2 = *c.m_solverBodyB;
+    m_solveRow(body1, body2, c,
+               body1.internalGetPushVelocity(),
+               body1.internalGetTurnVelocity(),
+               body2.internalGetPushVelocity(),
+               body2.internalGetTurnVelocity(),
+               c.m_rhsPenetration, c.m_appliedPushImpulse, false);
+}
+
+void SimdConstraintSolver::SolveIteration(
+        int iteration, btTypedConstraint** constraints, int numConstraints,
+        const btContactSolverInfo& infoGlobal)
+{
+    // Joint rows
+    for ( int j = 0; j < m_tmpSolverNonContactConstraintPool.size(); j++ )
+    {
+        const btSolverConstraint& constraint =
+                m_tmpSolverNonContactConstraintPool[
+                    m_orderNonContactConstraintPool[j]];
+        if ( iteration < constraint.m_overrideNumSolverIterations )
+        {
+            ResolveRow(constraint);
+        }
+    }
+
+    // Contacts are not solved beyond the normal number of iterations
+    if ( iteration >= infoGlobal.m_numIterations )
+    {
+        return;
+    }
+
+    for ( int j = 0; j < numConstraints; j++ )
+    {
+        constraints[j]->solveConstraintObsolete(
+                constraints[j]->getRigidBodyA(),
+                constraints[j]->getRigidBodyB(), infoGlobal.m_timeStep);
+    }
+
+    // Contact rows
+    int numContacts = m_tmpSolverContactConstraintPool.size();
+    for ( int j = 0; j < numContacts; j++ )
+    {
+        ResolveRowLowerLimit(
+                m_tmpSolverContactConstraintPool[m_orderTmpConstraintPool[j]]);
+    }
+
+    // Friction rows, limited by the impulse of their contact
+    int numFrictions = m_tmpSolverContactFrictionConstraintPool.size();
+    for ( int j = 0; j < numFrictions; j++ )
+    {
+        btSolverConstraint& friction =
+                m_tmpSolverContactFrictionConstraintPool[
+                    m_orderFrictionConstraintPool[j]];
+        btScalar totalImpulse =
+                m_tmpSolverContactConstraintPool[friction.m_frictionIndex].
+                m_appliedImpulse;
+        if ( totalImpulse > btScalar(0) )
+        {
+            friction.m_lowerLimit = -(friction.m_friction * totalImpulse);
+            friction.m_upperLimit = friction.m_friction * totalImpulse;
+            ResolveRow(friction);
+        }
+    }
+}
+
+void SimdConstraintSolver::solveGroupCacheFriendlySplitImpulseIterations(
+        btCollisionObject** bodies, int numBodies,
+        btPersistentManifold** manifoldPtr, int numManifolds,
+        btTypedConstraint** constraints, int numConstraints,
+        const btContactSolverInfo& infoGlobal, btIDebugDraw* debugDrawer,
+        btStackAlloc* stackAlloc)
+{
+    if ( !UseRowKernels(infoGlobal) )
+    {
+        btSequentialImpulseConstraintSolver::
+                solveGroupCacheFriendlySplitImpulseIterations(
+                    bodies, numBodies, manifoldPtr, numManifolds,
+                    constraints, numConstraints, infoGlobal, debugDrawer,
+                    stackAlloc);
+        return;
+    }
+
+    if ( !infoGlobal.m_splitImpulse )
+    {
+        return;
+    }
+
+    int numContacts = m_tmpSolverContactConstraintPool.size();
+    for ( int iteration = 0; iteration < infoGlobal.m_numIterations;
+          iteration++ )
+    {
+        for ( int j = 0; j < numContacts; j++ )
+        {
+            ResolveSplitPenetration(
+                    m_tmpSolverContactConstraintPool[
+                        m_orderTmpConstraintPool[j]]);
+        }
+    }
+}
+
+btScalar SimdConstraintSolver::solveGroupCacheFriendlyIterations(
+        btCollisionObject** bodies, int numBodies,
+        btPersistentManifold** manifoldPtr, int numManifolds,
+        btTypedConstraint** constraints, int numConstraints,
+        const btContactSolverInfo& infoGlobal, btIDebugDraw* debugDrawer,
+        btStackAlloc* stackAlloc)
+{
+    if ( !UseRowKernels(infoGlobal) )
+    {
+        return btSequentialImpulseConstraintSolver::
+                solveGroupCacheFriendlyIterations(
+                    bodies, numBodies, manifoldPtr, numManifolds,
+                    constraints, numConstraints, infoGlobal, debugDrawer,
+                    stackAlloc);
+    }
+
+    BT_PROFILE("solveGroupCacheFriendlyIterations");
+
+    // Penetration recovery first, for contacts only
+    solveGroupCacheFriendlySplitImpulseIterations(bodies, numBodies,
+                                                  manifoldPtr, numManifolds,
+                                                  constraints, numConstraints,
+                                                  infoGlobal, debugDrawer,
+                                                  stackAlloc);
+
+    int maxIterations = std::max(m_maxOverrideNumSolverIterations,
+                                 infoGlobal.m_numIterations);
+    for ( int iteration = 0; iteration < maxIterations; iteration++ )
+    {
+        SolveIteration(iteration, constraints, numConstraints, infoGlobal);
+    }
+
+    return 0.0f;
+}
+
+void SimdConstraintSolver::SolveBenchmarkRows(btConstraintArray& rows,
+                                              int numPasses)
+{
+    // Every third row of each kind; the generic ones are Bullet's own
+    for ( int pass = 0; pass < numPasses; pass++ )
+    {
+        for ( int i = 0; i < rows.size(); i++ )
+        {
+            btSolverConstraint& row = rows[i];
+            btRigidBody& body1 = *row.m_solverBodyA;
+            btRigidBody& body2 = *row.m_solverBodyB;
+            switch ( i % 3 )
+            {
+                case 0:
+                    if ( m_solveRow != NULL )
+                    {
+                        ResolveRow(row);
+                    }
+                    else
+                    {
+                        resolveSingleConstraintRowGeneric(body1, body2, row);
+                    }
+                    break;
+                case 1:
+                    if ( m_solveRow != NULL )
+                    {
+                        ResolveRowLowerLimit(row);
+                    }
+                    else
+                    {
+                        resolveSingleConstraintRowLowerLimit(body1, body2,
+                                                             row);
+                    }
+                    break;
+                default:
+                    if ( m_solveRow != NULL )
+                    {
+                        ResolveSplitPenetration(row);
+                    }
+                    else
+                    {
+                        resolveSplitPenetrationImpulseCacheFriendly(body1,
+                                                                    body2,
+                                                                    row);
+                    }
+                    break;
+            }
+        }
+    }
+}
+
+bool SimdConstraintSolver::BenchmarkRowKernels(int numRows, int numPasses)
+{
+    unsigned int seed = 1;
+
+    // Bodies of varying mass and angular factor; the first is static
+    btSphereShape shape(0.5f);
+    int numBodies = std::max(numRows / 4, 2);
+    std::vector<btRigidBody*> bodies;
+    btAlignedObjectArray<btVector3> velocities;
+    for ( int i = 0; i < numBodies; i++ )
+    {
+        btScalar mass = (i == 0) ? 0.0f : RandomScalar(seed, 1.0f, 10.0f);
+        btVector3 inertia(0, 0, 0);
+        if ( mass > 0.0f )
+        {
+            shape.calculateLocalInertia(mass, inertia);
+        }
+        btRigidBody::btRigidBodyConstructionInfo info(mass, NULL, &shape,
+                                                      inertia);
+        btRigidBody* body = new btRigidBody(info);
+        body->setAngularFactor(RandomVector(seed, 0.5f, 1.0f));
+        bodies.push_back(body);
+
+        for ( int j = 0; j < 4; j++ )
+        {
+            velocities.push_back(RandomVector(seed, -1.0f, 1.0f));
+        }
+    }
+
+    // Random rows between two different bodies
+    btConstraintArray rows;
+    rows.resize(numRows);
+    for ( int i = 0; i < numRows; i++ )
+    {
+        btSolverConstraint& row = rows[i];
+        int body1 = (int)RandomScalar(seed, 0, numBodies);
+        int body2 = (body1 + 1 + (int)RandomScalar(seed, 0, numBodies - 1)) %
+                numBodies;
+        row.m_solverBodyA = bodies[body1];
+        row.m_solverBodyB = bodies[body2];
+        row.m_contactNormal = RandomVector(seed, -1.0f, 1.0f).normalized();
+        row.m_relpos1CrossNormal = RandomVector(seed, -1.0f, 1.0f);
+        row.m_relpos2CrossNormal = RandomVector(seed, -1.0f, 1.0f);
+        row.m_angularComponentA = RandomVector(seed, -0.5f, 0.5f);
+        row.m_angularComponentB = RandomVector(seed, -0.5f, 0.5f);
+        row.m_jacDiagABInv = RandomScalar(seed, 0.1f, 1.0f);
+        row.m_rhs = RandomScalar(seed, -1.0f, 1.0f);
+        row.m_rhsPenetration = RandomScalar(seed, -0.2f, 0.2f);
+        row.m_cfm = RandomScalar(seed, 0.0f, 0.01f);
+        row.m_lowerLimit = RandomScalar(seed, -1.0f, 0.0f);
+        row.m_upperLimit = RandomScalar(seed, 0.0f, 1.0f);
+        row.m_friction = 0.5f;
+    }
+
+    // The generic rows as the reference
+    SimdConstraintSolver solver;
+    solver.SetRowKernels(RowKernelsGeneric);
+    ResetBenchmarkState(bodies, rows, velocities);
+    double startTime = CurrentTime();
+    solver.SolveBenchmarkRows(rows, numPasses);
+    double genericTime = CurrentTime() - startTime;
+    std::vector<btScalar> reference;
+    GetBenchmarkState(bodies, rows, reference);
+
+    double numSolved = (double)numRows * numPasses;
+    LOG_DEBUG("SimdConstraintSolver: %s rows: %.2f ns per row",
+              RowKernelsName(RowKernelsGeneric),
+              genericTime * 1000000000.0 / numSolved);
+
+    bool identical = true;
+    const RowKernels simdKernels[] = { RowKernelsSse, RowKernelsNeon };
+    for ( unsigned int i = 0;
+          i < sizeof(simdKernels) / sizeof(simdKernels[0]); i++ )
+    {
+        if ( !solver.SetRowKernels(simdKernels[i]) )
+        {
+            continue;
+        }
+
+        ResetBenchmarkState(bodies, rows, velocities);
+        startTime = CurrentTime();
+        solver.SolveBenchmarkRows(rows, numPasses);
+        double time = CurrentTime() - startTime;
+        std::vector<btScalar> state;
+        GetBenchmarkState(bodies, rows, state);
+
+        btScalar maxDeviation = 0.0f;
+        int numDifferent = 0;
+        for ( unsigned int j = 0; j < state.size(); j++ )
+        {
+            if ( state[j] != reference[j] )
+            {
+                maxDeviation = std::max(maxDeviation,
+                                        (btScalar)fabs(state[j] -
+                                                       reference[j]));
+                numDifferent++;
+            }
+        }
+
+        LOG_DEBUG("SimdConstraintSolver: %s rows: %.2f ns per row "
+                  "(%.2fx), %d of %d values differ, max deviation %g",
+                  RowKernelsName(simdKernels[i]),
+                  time * 1000000000.0 / numSolved,
+                  (time > 0.0) ? (genericTime / time) : 0.0,
+                  numDifferent, (int)state.size(), maxDeviation);
+        if ( numDifferent > 0 )
+        {
+            identical = false;
+        }
+    }
+
+    for ( unsigned int i = 0; i < bodies.size(); i++ )
+    {
+        delete bodies[i];
+    }
+
+    return identical;
+}
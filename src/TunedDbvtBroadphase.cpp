@@ -0,0 +1,84 @@
+#include "TunedDbvtBroadphase.h"
+
+// Unlinks a proxy from the list of its stage; the same as the stage list
+// handling of btDbvtBroadphase
+static void ListRemove(btDbvtProxy* proxy, btDbvtProxy*& list)
+{
+    if ( proxy->links[0] != NULL )
+    {
+        proxy->links[0]->links[1] = proxy->links[1];
+    }
+    else
+    {
+        list = proxy->links[1];
+    }
+
+    if ( proxy->links[1] != NULL )
+    {
+        proxy->links[1]->links[0] = proxy->links[0];
+    }
+}
+
+static void ListAppend(btDbvtProxy* proxy, btDbvtProxy*& list)
+{
+    proxy->links[0] = NULL;
+    proxy->links[1] = list;
+    if ( list != NULL )
+    {
+        list->links[0] = proxy;
+    }
+    list = proxy;
+}
+
+TunedDbvtBroadphase::TunedDbvtBroadphase(const DbvtBroadphaseTuning& tuning)
+{
+    m_deferedcollide = tuning.m_deferredCollide;
+    m_dupdates = tuning.m_dynamicOptimizePercent;
+    m_fupdates = tuning.m_fixedOptimizePercent;
+    m_cupdates = tuning.m_cleanupPercent;
+    m_prediction = tuning.m_velocityPrediction;
+}
+
+TunedDbvtBroadphase::~TunedDbvtBroadphase()
+{
+}
+
+int TunedDbvtBroadphase::FreezeStaticProxies()
+{
+    int numFrozen = 0;
+    for ( int stage = 0; stage < STAGECOUNT; stage++ )
+    {
+        btDbvtProxy* proxy = m_stageRoots[stage];
+        while ( proxy != NULL )
+        {
+            btDbvtProxy* next = proxy->links[1];
+            const btCollisionObject* object =
+                    static_cast<btCollisionObject*>(proxy->m_clientObject);
+            if ( (object != NULL) && object->isStaticObject() )
+            {
+                // The pairs of the proxy stay as they are; only the tree
+                // it is looked up from changes
+                ListRemove(proxy, m_stageRoots[stage]);
+                ListAppend(proxy, m_stageRoots[STAGECOUNT]);
+                m_sets[DYNAMIC_SET].remove(proxy->leaf);
+                ATTRIBUTE_ALIGNED16(btDbvtVolume) volume =
+                        btDbvtVolume::FromMM(proxy->m_aabbMin,
+                                             proxy->m_aabbMax);
+                proxy->leaf = m_sets[FIXED_SET].insert(volume, proxy);
+                proxy->stage = STAGECOUNT;
+                numFrozen++;
+            }
+            proxy = next;
+        }
+    }
+
+    if ( numFrozen > 0 )
+    {
+        // Rebuild the tree in one go instead of leaving it to be balanced
+        // incrementally over the following steps; the leaves are kept
+        m_sets[FIXED_SET].optimizeTopDown();
+        m_fixedleft = 0;
+    }
+
+    return numFrozen;
+}
@@ -4,8 +4,10 @@
 #include "Buggy_body_data.h"
 #include "Buggy_front_wheel_data.h"
 #include "Buggy_rear_wheel_data.h"
+#include "Buggy_hulls.h"
 #include "CommonFunctions.h"
 #include "MatrixOperations.h"
+#include "MatrixKernels.h"
 
 Vehicle::Vehicle()
     : m_bodyVertexBuffer(0),
@@ -29,6 +31,50 @@ const float RearWheelXOffs = Buggy_bodyHalfWidth + 0.2;
 const float RearWheelYOffs = -0.25 * Buggy_bodyHalfHeight;
 const float RearWheelZOffs = 0.75 * Buggy_bodyHalfDepth;
 
+VehicleShape::VehicleShape(btScalar wheelLift)
+    : btCompoundShape(false)
+{
+    btTransform transform;
+    transform.setIdentity();
+    AddHull(Buggy_bodyHullVertices, Buggy_bodyHullNumVertices, transform);
+
+    // The wheels as they are drawn, lifted; the left side ones are turned
+    // around
+    btVector3 lift(0.0, wheelLift, 0.0);
+    transform.setOrigin(Vehicle::GetWheelPosition(FrontRightWheel) + lift);
+    AddHull(Buggy_front_wheelHullVertices, Buggy_front_wheelHullNumVertices,
+            transform);
+    transform.setOrigin(Vehicle::GetWheelPosition(RearRightWheel) + lift);
+    AddHull(Buggy_rear_wheelHullVertices, Buggy_rear_wheelHullNumVertices,
+            transform);
+
+    transform.setRotation(btQuaternion(btVector3(0.0, 1.0, 0.0), M_PI));
+    transform.setOrigin(Vehicle::GetWheelPosition(FrontLeftWheel) + lift);
+    AddHull(Buggy_front_wheelHullVertices, Buggy_front_wheelHullNumVertices,
+            transform);
+    transform.setOrigin(Vehicle::GetWheelPosition(RearLeftWheel) + lift);
+    AddHull(Buggy_rear_wheelHullVertices, Buggy_rear_wheelHullNumVertices,
+            transform);
+}
+
+VehicleShape::~VehicleShape()
+{
+    for ( int i = 0; i < getNumChildShapes(); i++ )
+    {
+        delete getChildShape(i);
+    }
+}
+
+void VehicleShape::AddHull(const float* vertices, int numVertices,
+                           const btTransform& transform)
+{
+    // The hulls were shrunk by the margin they are given here
+    btConvexHullShape* hull =
+            new btConvexHullShape(vertices, numVertices, 3 * sizeof(float));
+    hull->setMargin(Buggy_hullMargin);
+    addChildShape(transform, hull);
+}
+
 btVector3 Vehicle::GetExtents()
 {
     // Return the outer extents of the vehicle body / wheels
@@ -38,6 +84,34 @@ btVector3 Vehicle::GetExtents()
                      Buggy_bodyHalfDepth);
 }
 
+btVector3 Vehicle::GetWheelPosition(VehicleWheel wheel)
+{
+    switch ( wheel )
+    {
+        case FrontRightWheel:
+            return btVector3(FrontWheelXOffs, FrontWheelYOffs, FrontWheelZOffs);
+        case FrontLeftWheel:
+            return btVector3(-FrontWheelXOffs, FrontWheelYOffs,
+                             FrontWheelZOffs);
+        case RearRightWheel:
+            return btVector3(RearWheelXOffs, RearWheelYOffs, RearWheelZOffs);
+        default:
+            return btVector3(-RearWheelXOffs, RearWheelYOffs, RearWheelZOffs);
+    }
+}
+
+float Vehicle::GetWheelRadius(VehicleWheel wheel)
+{
+    if ( (wheel == FrontRightWheel) || (wheel == FrontLeftWheel) )
+    {
+        return Buggy_front_wheelHalfHeight;
+    }
+    else
+    {
+        return Buggy_rear_wheelHalfHeight;
+    }
+}
+
 void Vehicle::SetupTransforms()
 {
     MatrixCreateRotation(m_yRotation, M_PI, 0.0, 1.0, 0.0);
@@ -52,25 +126,27 @@ void Vehicle::SetupTransforms()
                             -RearWheelXOffs, RearWheelYOffs, RearWheelZOffs);
 }
 
-void Vehicle::UpdateWheelTransforms(float rotation)
+void Vehicle::UpdateWheelTransforms(float frontRotation, float rearRotation)
 {
-    float xRotation[16];
-    MatrixCreateRotation(xRotation, rotation, 1.0, 0.0, 0.0);
+    float frontXRotation[16];
+    float rearXRotation[16];
+    MatrixCreateRotation(frontXRotation, frontRotation, 1.0, 0.0, 0.0);
+    MatrixCreateRotation(rearXRotation, rearRotation, 1.0, 0.0, 0.0);
 
     // Left side wheels transform order: yrotate, xrotate, translate
-    MatrixMultiply(m_yRotation, xRotation, m_frontLeftWheelTransform);
-    MatrixMultiply(m_frontLeftWheelTransform, m_frontLeftWheelTranslation,
-                   m_frontLeftWheelTransform);
-
-    MatrixMultiply(m_yRotation, xRotation, m_rearLeftWheelTransform);
-    MatrixMultiply(m_rearLeftWheelTransform, m_rearLeftWheelTranslation,
-                   m_rearLeftWheelTransform);
+    float leftRotation[16];
+    MatrixMultiplyKernel(m_yRotation, frontXRotation, leftRotation);
+    MatrixMultiplyKernel(leftRotation, m_frontLeftWheelTranslation,
+                         m_frontLeftWheelTransform);
+    MatrixMultiplyKernel(m_yRotation, rearXRotation, leftRotation);
+    MatrixMultiplyKernel(leftRotation, m_rearLeftWheelTranslation,
+                         m_rearLeftWheelTransform);
 
     // Right side wheels transform order: xrotate, translate
-    MatrixMultiply(xRotation, m_frontRightWheelTranslation,
-                   m_frontRightWheelTransform);
-    MatrixMultiply(xRotation, m_rearRightWheelTranslation,
-                   m_rearRightWheelTransform);
+    MatrixMultiplyKernel(frontXRotation, m_frontRightWheelTranslation,
+                         m_frontRightWheelTransform);
+    MatrixMultiplyKernel(rearXRotation, m_rearRightWheelTranslation,
+                         m_rearRightWheelTransform);
 }
 
 bool Vehicle::Setup()
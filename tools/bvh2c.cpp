@@ -0,0 +1,167 @@
+// Offline generator of include/PillarsTerrain_bvh.h; builds the quantized
+// BVH of the physics stage terrain and writes it out as C source so that
+// the application can take it into use in place instead of building it at
+// load time.
+//
+// Build and run from the repository root:
+//
+//   g++ -O2 -IBulletPhysics_2.80 -Iinclude tools/bvh2c.cpp \
+//       <Bullet collision and linear math sources or library> -o bvh2c
+//   ./bvh2c > include/PillarsTerrain_bvh.h
+//
+// The output must be regenerated whenever PillarsTerrain_data.h changes.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <btBulletDynamicsCommon.h>
+
+// Just enough of OpenGLAPI.h for the terrain data
+typedef unsigned short GLushort;
+#define GL_UNSIGNED_SHORT 0x1403
+struct VertexAttribs
+{
+    float x, y, z;
+    float u, v;
+    float nx, ny, nz;
+};
+
+#include "PillarsTerrain_data.h"
+
+/**
+ * Gives access to the fields btQuantizedBvh::serialize() writes into the
+ * object header of the serialized data.
+ */
+class SerializedBvh : public btQuantizedBvh
+{
+public:
+    void Write(FILE* out, const btVector3& localAabbMin,
+               const btVector3& localAabbMax) const;
+};
+
+static void WriteVector(FILE* out, const char* name, const btVector3& v)
+{
+    fprintf(out, "static const float %s[3] = { %.9g, %.9g, %.9g };\n",
+            name, v.getX(), v.getY(), v.getZ());
+}
+
+void SerializedBvh::Write(FILE* out, const btVector3& localAabbMin,
+                          const btVector3& localAabbMax) const
+{
+    // The nodes and the subtree headers follow the object in the buffer
+    const btQuantizedBvhNode* nodes =
+            reinterpret_cast<const btQuantizedBvhNode*>(this + 1);
+    const btBvhSubtreeInfo* subtrees =
+            reinterpret_cast<const btBvhSubtreeInfo*>(nodes + m_curNodeIndex);
+
+    fprintf(out, "//\n");
+    fprintf(out, "// Exported by bvh2c from PillarsTerrain_data.h; "
+            "do not edit\n");
+    fprintf(out, "//\n\n");
+    fprintf(out, "#ifndef __PILLARSTERRAIN_BVH_H__\n");
+    fprintf(out, "#define __PILLARSTERRAIN_BVH_H__\n\n");
+
+    fprintf(out, "// Numeric constants\n");
+    fprintf(out, "static const int PillarsTerrainBvhNumNodes = %d;\n",
+            m_curNodeIndex);
+    fprintf(out, "static const int PillarsTerrainBvhNumSubtrees = %d;\n",
+            m_subtreeHeaderCount);
+    fprintf(out, "static const int PillarsTerrainBvhTraversalMode = %d;\n\n",
+            (int)m_traversalMode);
+
+    fprintf(out, "// Local AABB of the triangle mesh shape\n");
+    WriteVector(out, "PillarsTerrainAabbMin", localAabbMin);
+    WriteVector(out, "PillarsTerrainAabbMax", localAabbMax);
+    fprintf(out, "\n// Quantization of the BVH\n");
+    WriteVector(out, "PillarsTerrainBvhAabbMin", m_bvhAabbMin);
+    WriteVector(out, "PillarsTerrainBvhAabbMax", m_bvhAabbMax);
+    WriteVector(out, "PillarsTerrainBvhQuantization", m_bvhQuantization);
+
+    fprintf(out, "\n// Same layout as btBvhSubtreeInfo, which cannot be "
+            "initialized statically\n");
+    fprintf(out, "struct PillarsTerrainBvhSubtree\n{\n");
+    fprintf(out, "    unsigned short m_quantizedAabbMin[3];\n");
+    fprintf(out, "    unsigned short m_quantizedAabbMax[3];\n");
+    fprintf(out, "    int m_rootNodeIndex;\n");
+    fprintf(out, "    int m_subtreeSize;\n");
+    fprintf(out, "    int m_padding[3];\n");
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "// Serialized BVH as btQuantizedBvh::deSerializeInPlace() "
+            "expects it: the\n");
+    fprintf(out, "// object header, filled in at runtime since its layout "
+            "depends on the\n");
+    fprintf(out, "// platform, followed by the nodes and the subtree "
+            "headers\n");
+    fprintf(out, "ATTRIBUTE_ALIGNED16(struct) PillarsTerrainBvhData\n{\n");
+    fprintf(out, "    unsigned char m_header[sizeof(btQuantizedBvh)];\n");
+    fprintf(out, "    btQuantizedBvhNode "
+            "m_nodes[PillarsTerrainBvhNumNodes];\n");
+    fprintf(out, "    PillarsTerrainBvhSubtree "
+            "m_subtrees[PillarsTerrainBvhNumSubtrees];\n");
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static PillarsTerrainBvhData PillarsTerrain_bvh = {\n");
+    fprintf(out, "    { 0 },\n");
+    fprintf(out, "    {\n");
+    for ( int i = 0; i < m_curNodeIndex; i++ )
+    {
+        const btQuantizedBvhNode& node = nodes[i];
+        fprintf(out, "    {{%u, %u, %u}, {%u, %u, %u}, %d},\n",
+                node.m_quantizedAabbMin[0], node.m_quantizedAabbMin[1],
+                node.m_quantizedAabbMin[2], node.m_quantizedAabbMax[0],
+                node.m_quantizedAabbMax[1], node.m_quantizedAabbMax[2],
+                node.m_escapeIndexOrTriangleIndex);
+    }
+    fprintf(out, "    },\n");
+    fprintf(out, "    {\n");
+    for ( int i = 0; i < m_subtreeHeaderCount; i++ )
+    {
+        const btBvhSubtreeInfo& subtree = subtrees[i];
+        fprintf(out, "    {{%u, %u, %u}, {%u, %u, %u}, %d, %d, {0, 0, 0}},\n",
+                subtree.m_quantizedAabbMin[0], subtree.m_quantizedAabbMin[1],
+                subtree.m_quantizedAabbMin[2], subtree.m_quantizedAabbMax[0],
+                subtree.m_quantizedAabbMax[1], subtree.m_quantizedAabbMax[2],
+                subtree.m_rootNodeIndex, subtree.m_subtreeSize);
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "#endif\n");
+}
+
+int main()
+{
+    // The same mesh PhysicsStageStatics creates the terrain shape from
+    btIndexedMesh mesh;
+    mesh.m_numTriangles = PillarsTerrainNumPolygons;
+    mesh.m_triangleIndexBase =
+            reinterpret_cast<const unsigned char*>(PillarsTerrain_indices);
+    mesh.m_triangleIndexStride = 3 * sizeof(GLushort);
+    mesh.m_numVertices = PillarsTerrainNumVertices;
+    mesh.m_vertexBase =
+            reinterpret_cast<const unsigned char*>(PillarsTerrain_vertices);
+    mesh.m_vertexStride = sizeof(VertexAttribs);
+    mesh.m_vertexType = PHY_FLOAT;
+
+    btTriangleIndexVertexArray meshInterface;
+    meshInterface.addIndexedMesh(mesh, PHY_SHORT);
+
+    btBvhTriangleMeshShape shape(&meshInterface, true, true);
+    btOptimizedBvh* bvh = shape.getOptimizedBvh();
+
+    unsigned int bufferSize = bvh->calculateSerializeBufferSize();
+    void* buffer = btAlignedAlloc(bufferSize, 16);
+    if ( !bvh->serialize(buffer, bufferSize, false) )
+    {
+        fprintf(stderr, "BVH serialization failed!\n");
+        return EXIT_FAILURE;
+    }
+
+    static_cast<SerializedBvh*>(static_cast<btQuantizedBvh*>(buffer))->Write(
+            stdout, shape.getLocalAabbMin(), shape.getLocalAabbMax());
+
+    btAlignedFree(buffer);
+
+    return EXIT_SUCCESS;
+}
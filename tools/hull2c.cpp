@@ -0,0 +1,116 @@
+// Offline generator of include/Buggy_hulls.h; builds simplified convex
+// hulls of the buggy body and wheels for the vehicle's collision shape and
+// writes them out as C source so that no hulls are computed at load time.
+//
+// Build and run from the repository root:
+//
+//   g++ -O2 -IBulletPhysics_2.80 -Iinclude tools/hull2c.cpp \
+//       <Bullet collision and linear math sources or library> -o hull2c
+//   ./hull2c > include/Buggy_hulls.h
+//
+// The output must be regenerated whenever the Buggy_*_data.h files change.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <btBulletDynamicsCommon.h>
+#include <BulletCollision/CollisionShapes/btShapeHull.h>
+#include <LinearMath/btConvexHullComputer.h>
+
+// Just enough of OpenGLAPI.h for the buggy data
+typedef unsigned short GLushort;
+#define GL_UNSIGNED_SHORT 0x1403
+struct VertexAttribs
+{
+    float x, y, z;
+    float u, v;
+    float nx, ny, nz;
+};
+
+#include "Buggy_body_data.h"
+#include "Buggy_front_wheel_data.h"
+#include "Buggy_rear_wheel_data.h"
+
+// Most vertices in a hull; btShapeHull samples the support points of the
+// mesh in 42 directions, so that is what it can give at most
+static const int MaxHullVertices = 42;
+
+// Collision margin of the hull shapes; the hulls are shrunk by it so that
+// the shapes with their margins fit the meshes
+static const float HullMargin = 0.04;
+
+// Writes the simplified hull of a mesh; returns false on failure
+static bool WriteHull(FILE* out, const char* name,
+                      const VertexAttribs* vertices, int numVertices)
+{
+    // The exact hull of the mesh, shrunk by the margin
+    btConvexHullComputer hull;
+    btScalar shift = hull.compute(&vertices[0].x, sizeof(VertexAttribs),
+                                  numVertices, HullMargin, 0.0);
+    if ( (shift < 0.0) || (hull.vertices.size() == 0) )
+    {
+        fprintf(stderr, "%s: btConvexHullComputer failed!\n", name);
+        return false;
+    }
+
+    // Simplified to its support points in the sample directions; without
+    // a margin they are vertices of the hull
+    btConvexHullShape hullShape(&hull.vertices[0].getX(),
+                                hull.vertices.size(), sizeof(btVector3));
+    hullShape.setMargin(0.0);
+    btShapeHull shapeHull(&hullShape);
+    if ( !shapeHull.buildHull(0.0) )
+    {
+        fprintf(stderr, "%s: btShapeHull failed!\n", name);
+        return false;
+    }
+    if ( shapeHull.numVertices() > MaxHullVertices )
+    {
+        fprintf(stderr, "%s: %d hull vertices, at most %d allowed!\n",
+                name, shapeHull.numVertices(), MaxHullVertices);
+        return false;
+    }
+    fprintf(stderr, "%s: %d mesh vertices, %d on the hull, %d kept\n",
+            name, numVertices, hull.vertices.size(),
+            shapeHull.numVertices());
+
+    fprintf(out, "static const int %sHullNumVertices = %d;\n",
+            name, shapeHull.numVertices());
+    fprintf(out, "static const float %sHullVertices[] = {\n", name);
+    for ( int i = 0; i < shapeHull.numVertices(); i++ )
+    {
+        const btVector3& v = shapeHull.getVertexPointer()[i];
+        fprintf(out, "    %.9g, %.9g, %.9g,\n", v.getX(), v.getY(), v.getZ());
+    }
+    fprintf(out, "};\n\n");
+
+    return true;
+}
+
+int main()
+{
+    FILE* out = stdout;
+    fprintf(out, "//\n");
+    fprintf(out, "// Exported by hull2c from the Buggy_*_data.h files; "
+            "do not edit\n");
+    fprintf(out, "//\n\n");
+    fprintf(out, "#ifndef __BUGGY_HULLS_H__\n");
+    fprintf(out, "#define __BUGGY_HULLS_H__\n\n");
+    fprintf(out, "// Collision margin the hulls are shrunk by\n");
+    fprintf(out, "static const float Buggy_hullMargin = %g;\n\n", HullMargin);
+    fprintf(out, "// Convex hull vertices { x, y, z } of each mesh\n");
+
+    if ( !WriteHull(out, "Buggy_body", Buggy_body_vertices,
+                    Buggy_bodyNumVertices) ||
+         !WriteHull(out, "Buggy_front_wheel", Buggy_front_wheel_vertices,
+                    Buggy_front_wheelNumVertices) ||
+         !WriteHull(out, "Buggy_rear_wheel", Buggy_rear_wheel_vertices,
+                    Buggy_rear_wheelNumVertices) )
+    {
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "#endif\n");
+
+    return EXIT_SUCCESS;
+}